@@ -0,0 +1,453 @@
+#include "AssetLoader.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <objbase.h>
+#endif
+
+namespace
+{
+	using namespace std::chrono;
+
+	double MillisecondsSince(steady_clock::time_point start)
+	{
+		return duration<double, std::milli>(steady_clock::now() - start).count();
+	}
+
+	// A GPU that finishes the copies of a frame framesInFlight frames after they were recorded.
+	class FakeUploader : public AssetUploader
+	{
+	public:
+		explicit FakeUploader(uint64_t framesInFlight) : m_frame(0), m_framesInFlight(framesInFlight) {}
+
+		void NextFrame() { ++m_frame; }
+		uint64_t Submit() override { return m_frame; }
+		uint64_t GetCompletedFence() override { return m_frame > m_framesInFlight ? m_frame - m_framesInFlight : 0; }
+
+	private:
+		uint64_t m_frame;
+		uint64_t m_framesInFlight;
+	};
+}
+
+AssetLoader::AssetLoader(uint32_t threads) :
+	m_start(steady_clock::now()),
+	m_nextQueued(0),
+	m_decoding(0),
+	m_stop(false)
+{
+	for (uint32_t t = 0; t < std::max(1u, threads); ++t)
+	{
+		m_threads.emplace_back(&AssetLoader::Run, this);
+	}
+}
+
+AssetLoader::~AssetLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_all();
+	for (std::thread& thread : m_threads)
+	{
+		thread.join();
+	}
+}
+
+uint32_t AssetLoader::Add(const std::string& name, const DecodeFunction& decode, const StageFunction& stage, const ResidentFunction& resident)
+{
+	uint32_t index;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		Asset asset = {};
+		asset.name = name;
+		asset.decode = decode;
+		asset.stage = stage;
+		asset.resident = resident;
+		asset.state = AssetState::QUEUED;
+		asset.queuedMs = MillisecondsSince(m_start);
+		index = (uint32_t)m_assets.size();
+		m_assets.push_back(std::move(asset));
+	}
+	m_wake.notify_one();
+	return index;
+}
+
+void AssetLoader::Update(AssetUploader& uploader, uint32_t maxStages)
+{
+	// Resident first, so that nothing staged this frame is taken for done before its fence.
+	const uint64_t completed = uploader.GetCompletedFence();
+	std::vector<uint32_t> resident, staging;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t i = 0; i < m_staged.size();)
+		{
+			if (m_assets[m_staged[i]].fence <= completed)
+			{
+				resident.push_back(m_staged[i]);
+				m_staged.erase(m_staged.begin() + i);
+			}
+			else
+			{
+				++i;
+			}
+		}
+		size_t count = std::min((size_t)maxStages, m_decodedOrder.size());
+		staging.assign(m_decodedOrder.begin(), m_decodedOrder.begin() + count);
+	}
+
+	for (uint32_t index : resident)
+	{
+		ResidentFunction residentFunction;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			residentFunction = m_assets[index].resident;
+		}
+		if (residentFunction)
+		{
+			residentFunction();
+		}
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_assets[index].state = AssetState::RESIDENT;
+		m_assets[index].residentMs = MillisecondsSince(m_start);
+	}
+
+	if (staging.empty())
+	{
+		return;
+	}
+	std::vector<size_t> bytes(staging.size(), 0);
+	std::vector<double> stagedMs, costMs;
+	std::vector<bool> done;
+	for (size_t i = 0; i < staging.size(); ++i)
+	{
+		StageFunction stage;
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			stage = m_assets[staging[i]].stage;
+		}
+		auto start = steady_clock::now();
+		done.push_back(stage ? stage(bytes[i]) : true);
+		costMs.push_back(MillisecondsSince(start));
+		stagedMs.push_back(MillisecondsSince(m_start));
+	}
+	const uint64_t fence = uploader.Submit();
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (size_t i = 0; i < staging.size(); ++i)
+	{
+		Asset& asset = m_assets[staging[i]];
+		asset.bytesStaged += bytes[i];
+		asset.stageCostMs += costMs[i];
+		++asset.stageFrames;
+		if (!done[i])
+		{
+			continue;
+		}
+		asset.state = AssetState::STAGED;
+		asset.fence = fence;
+		asset.stagedMs = stagedMs[i];
+		m_staged.push_back(staging[i]);
+		m_decodedOrder.erase(std::find(m_decodedOrder.begin(), m_decodedOrder.end(), staging[i]));
+	}
+}
+
+void AssetLoader::WaitForDecodes()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_idle.wait(lock, [this] { return m_nextQueued == m_assets.size() && m_decoding == 0; });
+}
+
+AssetState AssetLoader::GetState(uint32_t asset) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_assets[asset].state;
+}
+
+bool AssetLoader::IsComplete() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (const Asset& asset : m_assets)
+	{
+		if (asset.state != AssetState::RESIDENT && asset.state != AssetState::FAILED)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+AssetLoader::Progress AssetLoader::GetProgress() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	Progress progress = {};
+	uint32_t steps = 0;
+	for (const Asset& asset : m_assets)
+	{
+		switch (asset.state)
+		{
+		case AssetState::FAILED: ++progress.failed; ++progress.decoded; steps += 3; break;
+		case AssetState::RESIDENT: ++progress.resident; ++progress.decoded; steps += 3; break;
+		case AssetState::STAGED: ++progress.decoded; steps += 2; break;
+		case AssetState::DECODED: ++progress.decoded; steps += 1; break;
+		default: break;
+		}
+		progress.bytesStaged += asset.bytesStaged;
+	}
+	progress.assets = (uint32_t)m_assets.size();
+	progress.fraction = m_assets.empty() ? 1.0f : steps / (3.0f * m_assets.size());
+	return progress;
+}
+
+bool AssetLoader::GetFailure(std::string& message) const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (const Asset& asset : m_assets)
+	{
+		if (asset.state == AssetState::FAILED)
+		{
+			message = asset.name + ": " + asset.error;
+			return true;
+		}
+	}
+	return false;
+}
+
+double AssetLoader::GetElapsedMs() const
+{
+	return MillisecondsSince(m_start);
+}
+
+std::string AssetLoader::Report() const
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::string report;
+	char line[512];
+	double decodeMs = 0.0, stageMs = 0.0, firstQueuedMs = 0.0, lastDoneMs = 0.0;
+	for (size_t i = 0; i < m_assets.size(); ++i)
+	{
+		const Asset& asset = m_assets[i];
+		const double decodedMs = asset.decodedMs - asset.decodeStartMs;
+		firstQueuedMs = i == 0 ? asset.queuedMs : std::min(firstQueuedMs, asset.queuedMs);
+		if (asset.state == AssetState::FAILED)
+		{
+			snprintf(line, sizeof(line), "  %s: failed after %.1f ms of decoding: %s\n", asset.name.c_str(), decodedMs, asset.error.c_str());
+			decodeMs += decodedMs;
+			lastDoneMs = std::max(lastDoneMs, asset.decodedMs);
+		}
+		else if (asset.state == AssetState::RESIDENT)
+		{
+			snprintf(line, sizeof(line), "  %s: waited %.1f ms, decoded in %.1f ms, staged %.1f MB in %.1f ms over %u frames by %.1f ms, resident at %.1f ms\n",
+				asset.name.c_str(), asset.decodeStartMs - asset.queuedMs, decodedMs, asset.bytesStaged / (1024.0 * 1024.0), asset.stageCostMs,
+				asset.stageFrames, asset.stagedMs, asset.residentMs);
+			decodeMs += decodedMs;
+			stageMs += asset.stageCostMs;
+			lastDoneMs = std::max(lastDoneMs, asset.residentMs);
+		}
+		else
+		{
+			snprintf(line, sizeof(line), "  %s: still loading\n", asset.name.c_str());
+		}
+		report += line;
+	}
+
+	// Loaded one after the other, startup would have taken the decodes and stages end to end.
+	const double wallMs = lastDoneMs - firstQueuedMs;
+	snprintf(line, sizeof(line), "Asset loader: %zu assets on %zu threads in %.1f ms; %.1f ms of decoding and %.1f ms of staging, %.1fx overlapped\n",
+		m_assets.size(), m_threads.size(), wallMs, decodeMs, stageMs, wallMs > 0.0 ? (decodeMs + stageMs) / wallMs : 0.0);
+	return line + report;
+}
+
+void AssetLoader::Run()
+{
+#ifdef _WIN32
+	// Decoders use WIC, which needs COM on every thread that calls it.
+	const bool com = SUCCEEDED(CoInitializeEx(nullptr, COINIT_MULTITHREADED));
+#endif
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;)
+	{
+		m_wake.wait(lock, [this] { return m_stop || m_nextQueued < m_assets.size(); });
+		if (m_stop)
+		{
+			break;
+		}
+
+		const size_t index = m_nextQueued++;
+		DecodeFunction decode = m_assets[index].decode;
+		m_assets[index].state = AssetState::DECODING;
+		m_assets[index].decodeStartMs = MillisecondsSince(m_start);
+		++m_decoding;
+
+		lock.unlock();
+		std::string error;
+		try
+		{
+			decode();
+		}
+		catch (const std::exception& exception)
+		{
+			error = exception.what();
+			error = error.empty() ? "unknown error" : error;
+		}
+		catch (...)
+		{
+			error = "unknown error";
+		}
+		lock.lock();
+
+		Asset& asset = m_assets[index];
+		asset.decodedMs = MillisecondsSince(m_start);
+		asset.error = error;
+		asset.state = error.empty() ? AssetState::DECODED : AssetState::FAILED;
+		if (error.empty())
+		{
+			m_decodedOrder.push_back((uint32_t)index);
+		}
+		--m_decoding;
+		m_idle.notify_all();
+	}
+	lock.unlock();
+#ifdef _WIN32
+	if (com)
+	{
+		CoUninitialize();
+	}
+#endif
+}
+
+bool AssetLoader::Validate()
+{
+	// Four assets on four threads that take their time, one of which fails, through a GPU three
+	// frames behind that takes one asset a frame. Each decode fills its own buffer, each stage
+	// copies that into the staging buffer, asset 3 in two halves over two frames, and each
+	// resident call checks what arrived.
+	const uint32_t count = 4;
+	const int decodeMs[count] = { 120, 40, 80, 60 };
+	const uint64_t framesInFlight = 3;
+	std::vector<std::vector<uint8_t>> decoded(count);
+	std::vector<uint8_t> staging;
+	std::vector<uint32_t> stageOrder;
+	std::vector<size_t> stageOffsets(count, 0);
+	std::atomic<int> decoding(0);
+	std::atomic<int> mostDecoding(0);
+	bool stagedWhileDecoding = false;
+	bool residentEarly = false;
+	bool stagedApart = false;
+	bool wrongBytes = false;
+	FakeUploader uploader(framesInFlight);
+	std::vector<uint64_t> stagedFrames(count, 0);
+	std::vector<uint32_t> stageCalls(count, 0);
+	uint64_t frame = 0;
+
+	auto start = steady_clock::now();
+	{
+		AssetLoader loader(count);
+		for (uint32_t a = 0; a < count; ++a)
+		{
+			loader.Add("asset " + std::to_string(a),
+				[&, a]()
+				{
+					int now = ++decoding;
+					int most = mostDecoding;
+					while (now > most && !mostDecoding.compare_exchange_weak(most, now))
+					{
+					}
+					std::this_thread::sleep_for(milliseconds(decodeMs[a]));
+					--decoding;
+					if (a == 2)
+					{
+						throw std::runtime_error("unreadable");
+					}
+					decoded[a].assign(1000 + a * 100, (uint8_t)(a + 1));
+				},
+				[&, a](size_t& bytes)
+				{
+					stagedWhileDecoding = stagedWhileDecoding || decoding > 0;
+					const size_t half = decoded[a].size() / 2;
+					const size_t begin = a == 3 && stageCalls[a] == 1 ? half : 0;
+					const size_t end = a == 3 && stageCalls[a] == 0 ? half : decoded[a].size();
+					if (stageCalls[a]++ == 0)
+					{
+						stageOffsets[a] = staging.size();
+					}
+					else
+					{
+						stagedApart = stagedApart || stagedFrames[a] + 1 != frame;
+					}
+					stagedFrames[a] = frame;
+					staging.insert(staging.end(), decoded[a].begin() + begin, decoded[a].begin() + end);
+					bytes += end - begin;
+					if (end != decoded[a].size())
+					{
+						return false;
+					}
+					stageOrder.push_back(a);
+					return true;
+				},
+				[&, a]()
+				{
+					residentEarly = residentEarly || frame < stagedFrames[a] + framesInFlight;
+					wrongBytes = wrongBytes || decoded[a].empty() ||
+						!std::equal(decoded[a].begin(), decoded[a].end(), staging.begin() + stageOffsets[a]);
+				});
+		}
+
+		float lastFraction = 0.0f;
+		while (!loader.IsComplete())
+		{
+			if (duration<double>(steady_clock::now() - start).count() > 10.0)
+			{
+				return false;
+			}
+			++frame;
+			uploader.NextFrame();
+			const size_t stagedBefore = stageOrder.size();
+			loader.Update(uploader, 1);
+			AssetLoader::Progress progress = loader.GetProgress();
+			if (stageOrder.size() > stagedBefore + 1 || progress.fraction < lastFraction || progress.fraction > 1.0f)
+			{
+				return false;
+			}
+			lastFraction = progress.fraction;
+			std::this_thread::sleep_for(milliseconds(2));
+		}
+
+		std::string failure;
+		AssetLoader::Progress progress = loader.GetProgress();
+		if (!loader.GetFailure(failure) || failure != "asset 2: unreadable" || loader.GetState(2) != AssetState::FAILED ||
+			progress.assets != count || progress.resident != count - 1 || progress.failed != 1 || progress.fraction != 1.0f ||
+			progress.bytesStaged != 1000 + 1100 + 1300 || loader.Report().empty())
+		{
+			return false;
+		}
+	}
+	const double elapsedMs = MillisecondsSince(start);
+
+	// In parallel and shortest first, well before the decodes end to end would have taken.
+	const std::vector<uint32_t> finishOrder = { 1, 3, 0 };
+	if (stageOrder != finishOrder || stageCalls[0] != 1 || stageCalls[1] != 1 || stageCalls[2] != 0 || stageCalls[3] != 2 || stagedApart ||
+		!stagedWhileDecoding || residentEarly || wrongBytes || mostDecoding < 2 ||
+		elapsedMs > 0.8 * (decodeMs[0] + decodeMs[1] + decodeMs[2] + decodeMs[3]))
+	{
+		return false;
+	}
+
+	// Destroyed right away, a single thread finishes the decode it started and drops the rest.
+	std::atomic<int> decodes(0);
+	{
+		AssetLoader loader(1);
+		for (int a = 0; a < 5; ++a)
+		{
+			loader.Add("dropped", [&decodes]() { ++decodes; std::this_thread::sleep_for(milliseconds(20)); }, nullptr, nullptr);
+		}
+	}
+	return decodes <= 2;
+}
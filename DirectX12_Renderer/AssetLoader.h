@@ -0,0 +1,133 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+enum class AssetState
+{
+	QUEUED,
+	DECODING,
+	DECODED,	// waiting for the render thread to stage it
+	STAGED,		// copies recorded, not yet known to have run on the GPU
+	RESIDENT,
+	FAILED,
+};
+
+// Where the render thread's copies go: the renderer's frames, or a fake one in Validate.
+class AssetUploader
+{
+public:
+	virtual ~AssetUploader() {}
+
+	// Fence value at which everything recorded so far will have run on the GPU.
+	virtual uint64_t Submit() = 0;
+
+	// Highest fence value the GPU has passed.
+	virtual uint64_t GetCompletedFence() = 0;
+};
+
+// Loads assets in the background: every asset is decoded on one of a few worker threads, all
+// at once, and staged on the render thread as soon as its decode is done, while the others are
+// still decoding. Staging may take several frames, when the staging memory is bounded. Assets
+// become resident once the fence their last copies were recorded under has passed. Decode
+// functions may throw; the asset then fails and the others carry on.
+// CPU only; Scene stages into the command list of each frame through a FrameUploader.
+class AssetLoader
+{
+public:
+	typedef std::function<void()> DecodeFunction;		// on a worker thread
+	typedef std::function<bool(size_t& bytes)> StageFunction;	// on the render thread, adds the bytes staged; false to go on next frame
+	typedef std::function<void()> ResidentFunction;		// on the render thread, to free the staging memory
+
+	struct Progress
+	{
+		uint32_t assets;
+		uint32_t decoded;	// decoded or further along, failures included
+		uint32_t resident;
+		uint32_t failed;
+		uint64_t bytesStaged;
+		float fraction;		// 0..1, a third each for decoding, staging and becoming resident
+	};
+
+	// Decodes on up to threads workers, each of which may still spread its work over all cores.
+	explicit AssetLoader(uint32_t threads);
+
+	// Drops the assets not yet decoding and waits for the ones that are.
+	~AssetLoader();
+
+	AssetLoader(const AssetLoader&) = delete;
+	AssetLoader& operator=(const AssetLoader&) = delete;
+
+	// Queues an asset and returns its index; decodes start in the order they were added.
+	uint32_t Add(const std::string& name, const DecodeFunction& decode, const StageFunction& stage, const ResidentFunction& resident);
+
+	// Once a frame on the render thread: makes the staged assets whose copies have run resident,
+	// then stages up to maxStages decoded ones, in the order their decodes finished. An asset
+	// that is not staged completely goes on first next frame.
+	void Update(AssetUploader& uploader, uint32_t maxStages);
+
+	// Blocks until nothing is queued or decoding, for tests and benchmarks.
+	void WaitForDecodes();
+
+	AssetState GetState(uint32_t asset) const;
+	bool IsResident(uint32_t asset) const { return GetState(asset) == AssetState::RESIDENT; }
+	bool IsComplete() const;	// every asset resident or failed
+	Progress GetProgress() const;
+
+	// The name and error of the first asset that failed; false if none did.
+	bool GetFailure(std::string& message) const;
+
+	// Milliseconds since the loader was created.
+	double GetElapsedMs() const;
+
+	// When each asset was queued, decoded, staged and became resident, and how much the decodes
+	// overlapped, as lines for the debug output.
+	std::string Report() const;
+
+	// True if assets decode in parallel and are staged while others still decode, in the order
+	// they finished, at most maxStages a frame and over as many frames as they ask for, become
+	// resident only once their last fence has passed, a failing decode leaves the others
+	// loading, and the destructor drops queued assets.
+	static bool Validate();
+
+private:
+	struct Asset
+	{
+		std::string name;
+		DecodeFunction decode;
+		StageFunction stage;
+		ResidentFunction resident;
+		AssetState state;
+		std::string error;
+		uint64_t fence;
+		size_t bytesStaged;
+		uint32_t stageFrames;
+		double queuedMs;	// times since the loader was created
+		double decodeStartMs;
+		double decodedMs;
+		double stagedMs;
+		double stageCostMs;	// spent staging on the render thread
+		double residentMs;
+	};
+
+	void Run();
+
+	std::chrono::steady_clock::time_point m_start;
+	mutable std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_idle;
+	std::vector<Asset> m_assets;
+	size_t m_nextQueued;				// assets are taken for decoding in order
+	uint32_t m_decoding;
+	std::vector<uint32_t> m_decodedOrder;	// decoded and not yet staged completely, oldest first
+	std::vector<uint32_t> m_staged;
+	bool m_stop;
+	std::vector<std::thread> m_threads;
+};
@@ -0,0 +1,1015 @@
+#include "BlockCompressor.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+#include <fstream>
+#include <limits>
+
+namespace
+{
+	// The 16 texels of a block channel by channel, on the 0..255 scale of 8-bit codes whatever the
+	// precision of the source.
+	struct Block
+	{
+		float channel[4][16];
+	};
+
+	// Colors a block's indices choose from, channels counted from the first one encoded.
+	struct Palette
+	{
+		float color[16][4];
+		uint32_t count;
+	};
+
+	// Weights of the second endpoint that each index interpolates with.
+	const float BC1_WEIGHTS[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+	const float BC4_WEIGHTS[8] = { 0.0f, 1.0f, 1.0f / 7.0f, 2.0f / 7.0f, 3.0f / 7.0f, 4.0f / 7.0f, 5.0f / 7.0f, 6.0f / 7.0f };
+	const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+	// Little endian, with the DX10 extension that BC7 needs; see DDS_HEADER and DDS_HEADER_DXT10.
+	struct DdsHeader
+	{
+		uint32_t magic;
+		uint32_t size;
+		uint32_t flags;
+		uint32_t height;
+		uint32_t width;
+		uint32_t linearSize;
+		uint32_t depth;
+		uint32_t mipCount;
+		uint32_t reserved[11];
+		uint32_t formatSize;
+		uint32_t formatFlags;
+		uint32_t fourCC;
+		uint32_t formatBits[5];
+		uint32_t caps[4];
+		uint32_t reserved2;
+		uint32_t dxgiFormat;
+		uint32_t dimension;
+		uint32_t miscFlags;
+		uint32_t arraySize;
+		uint32_t miscFlags2;
+	};
+
+	float HorizontalSum(__m128 v)
+	{
+		const __m128 pairs = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+		return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(2, 3, 0, 1))));
+	}
+
+	float HorizontalMin(__m128 v)
+	{
+		const __m128 pairs = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+		return _mm_cvtss_f32(_mm_min_ss(pairs, _mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(2, 3, 0, 1))));
+	}
+
+	float HorizontalMax(__m128 v)
+	{
+		const __m128 pairs = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+		return _mm_cvtss_f32(_mm_max_ss(pairs, _mm_shuffle_ps(pairs, pairs, _MM_SHUFFLE(2, 3, 0, 1))));
+	}
+
+	float Clamp255(float value)
+	{
+		return std::min(std::max(value, 0.0f), 255.0f);
+	}
+
+	void SourceTexel(const uint8_t* texels, size_t rowPitch, MipFormat source, uint32_t x, uint32_t y, float rgba[4])
+	{
+		const uint8_t* row = texels + y * rowPitch;
+		switch (source)
+		{
+		case MipFormat::R8_UNORM:
+			rgba[0] = row[x];
+			break;
+		case MipFormat::R16_UNORM:
+			rgba[0] = reinterpret_cast<const uint16_t*>(row)[x] / 257.0f;
+			break;
+		case MipFormat::R32_FLOAT:
+			rgba[0] = Clamp255(reinterpret_cast<const float*>(row)[x] * 255.0f);
+			break;
+		default:
+			for (uint32_t c = 0; c < 4; ++c)
+			{
+				rgba[c] = row[x * 4 + c];
+			}
+			return;
+		}
+		rgba[1] = rgba[2] = rgba[0];
+		rgba[3] = 255.0f;
+	}
+
+	void LoadBlock(const uint8_t* texels, size_t rowPitch, uint32_t width, uint32_t height, MipFormat source, uint32_t bx, uint32_t by, Block& block)
+	{
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			float rgba[4];
+			SourceTexel(texels, rowPitch, source, std::min(bx * 4 + (i & 3), width - 1), std::min(by * 4 + (i >> 2), height - 1), rgba);
+			for (uint32_t c = 0; c < 4; ++c)
+			{
+				block.channel[c][i] = rgba[c];
+			}
+		}
+	}
+
+	bool IsConstant(const Block& block, uint32_t first, uint32_t channels)
+	{
+		for (uint32_t c = first; c < first + channels; ++c)
+		{
+			for (uint32_t i = 1; i < 16; ++i)
+			{
+				if (block.channel[c][i] != block.channel[c][0])
+				{
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	// Ends of the segment through the texels along their principal axis, found by power iteration
+	// on their covariance, four texels per register.
+	void PrincipalEndpoints(const Block& block, uint32_t first, uint32_t channels, float low[4], float high[4])
+	{
+		__m128 centered[4][4];
+		float mean[4];
+		for (uint32_t c = 0; c < channels; ++c)
+		{
+			const float* texels = block.channel[first + c];
+			const __m128 sum = _mm_add_ps(_mm_add_ps(_mm_loadu_ps(texels), _mm_loadu_ps(texels + 4)),
+				_mm_add_ps(_mm_loadu_ps(texels + 8), _mm_loadu_ps(texels + 12)));
+			mean[c] = HorizontalSum(sum) / 16.0f;
+			for (uint32_t g = 0; g < 4; ++g)
+			{
+				centered[c][g] = _mm_sub_ps(_mm_loadu_ps(texels + g * 4), _mm_set1_ps(mean[c]));
+			}
+		}
+
+		float covariance[4][4];
+		uint32_t widest = 0;
+		for (uint32_t i = 0; i < channels; ++i)
+		{
+			for (uint32_t j = i; j < channels; ++j)
+			{
+				__m128 sum = _mm_setzero_ps();
+				for (uint32_t g = 0; g < 4; ++g)
+				{
+					sum = _mm_add_ps(sum, _mm_mul_ps(centered[i][g], centered[j][g]));
+				}
+				covariance[i][j] = covariance[j][i] = HorizontalSum(sum);
+			}
+			widest = covariance[i][i] > covariance[widest][widest] ? i : widest;
+		}
+
+		float axis[4] = {};
+		axis[widest] = 1.0f;
+		for (int iteration = 0; iteration < 8; ++iteration)
+		{
+			float next[4] = {};
+			float length = 0.0f;
+			for (uint32_t i = 0; i < channels; ++i)
+			{
+				for (uint32_t j = 0; j < channels; ++j)
+				{
+					next[i] += covariance[i][j] * axis[j];
+				}
+				length += next[i] * next[i];
+			}
+			if (length < 1e-12f)
+			{
+				break;
+			}
+			length = sqrtf(length);
+			for (uint32_t i = 0; i < channels; ++i)
+			{
+				axis[i] = next[i] / length;
+			}
+		}
+
+		__m128 lowest = _mm_set1_ps(FLT_MAX);
+		__m128 highest = _mm_set1_ps(-FLT_MAX);
+		for (uint32_t g = 0; g < 4; ++g)
+		{
+			__m128 t = _mm_setzero_ps();
+			for (uint32_t c = 0; c < channels; ++c)
+			{
+				t = _mm_add_ps(t, _mm_mul_ps(centered[c][g], _mm_set1_ps(axis[c])));
+			}
+			lowest = _mm_min_ps(lowest, t);
+			highest = _mm_max_ps(highest, t);
+		}
+		const float tLow = HorizontalMin(lowest);
+		const float tHigh = HorizontalMax(highest);
+		for (uint32_t c = 0; c < channels; ++c)
+		{
+			low[c] = Clamp255(mean[c] + axis[c] * tLow);
+			high[c] = Clamp255(mean[c] + axis[c] * tHigh);
+		}
+	}
+
+	// The closest palette color of every texel, four texels per register. Returns the summed
+	// squared error.
+	float SelectIndices(const Block& block, uint32_t first, uint32_t channels, const Palette& palette, uint8_t indices[16])
+	{
+		float error = 0.0f;
+		for (uint32_t g = 0; g < 16; g += 4)
+		{
+			__m128 texel[4];
+			for (uint32_t c = 0; c < channels; ++c)
+			{
+				texel[c] = _mm_loadu_ps(block.channel[first + c] + g);
+			}
+			__m128 best = _mm_set1_ps(FLT_MAX);
+			__m128 bestIndex = _mm_setzero_ps();
+			for (uint32_t k = 0; k < palette.count; ++k)
+			{
+				__m128 distance = _mm_setzero_ps();
+				for (uint32_t c = 0; c < channels; ++c)
+				{
+					const __m128 difference = _mm_sub_ps(texel[c], _mm_set1_ps(palette.color[k][c]));
+					distance = _mm_add_ps(distance, _mm_mul_ps(difference, difference));
+				}
+				const __m128 closer = _mm_cmplt_ps(distance, best);
+				best = _mm_min_ps(distance, best);
+				bestIndex = _mm_or_ps(_mm_and_ps(closer, _mm_set1_ps((float)k)), _mm_andnot_ps(closer, bestIndex));
+			}
+			error += HorizontalSum(best);
+			int32_t closest[4];
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(closest), _mm_cvtps_epi32(bestIndex));
+			for (uint32_t i = 0; i < 4; ++i)
+			{
+				indices[g + i] = (uint8_t)closest[i];
+			}
+		}
+		return error;
+	}
+
+	// Least squares endpoints for the indices chosen, weights[index] being how much of end1 an index
+	// takes. False if every texel takes the same weight, which leaves them undetermined.
+	bool FitEndpoints(const Block& block, uint32_t first, uint32_t channels, const uint8_t indices[16], const float* weights, float end0[4], float end1[4])
+	{
+		double aa = 0.0, ab = 0.0, bb = 0.0;
+		double ax[4] = {}, bx[4] = {};
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			const double b = weights[indices[i]];
+			const double a = 1.0 - b;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (uint32_t c = 0; c < channels; ++c)
+			{
+				ax[c] += a * block.channel[first + c][i];
+				bx[c] += b * block.channel[first + c][i];
+			}
+		}
+		const double determinant = aa * bb - ab * ab;
+		if (determinant < 1e-6)
+		{
+			return false;
+		}
+		for (uint32_t c = 0; c < channels; ++c)
+		{
+			end0[c] = Clamp255((float)((ax[c] * bb - bx[c] * ab) / determinant));
+			end1[c] = Clamp255((float)((bx[c] * aa - ax[c] * ab) / determinant));
+		}
+		return true;
+	}
+
+	struct BitWriter
+	{
+		uint8_t* out;
+		uint32_t bit;
+
+		void Write(uint32_t value, uint32_t bits)
+		{
+			for (uint32_t b = 0; b < bits; ++b, ++bit)
+			{
+				out[bit >> 3] |= (uint8_t)(((value >> b) & 1) << (bit & 7));
+			}
+		}
+	};
+
+	struct BitReader
+	{
+		const uint8_t* in;
+		uint32_t bit;
+
+		uint32_t Read(uint32_t bits)
+		{
+			uint32_t value = 0;
+			for (uint32_t b = 0; b < bits; ++b, ++bit)
+			{
+				value |= (uint32_t)((in[bit >> 3] >> (bit & 7)) & 1) << b;
+			}
+			return value;
+		}
+	};
+
+	float Expand5(uint32_t value)
+	{
+		return (float)((value << 3) | (value >> 2));
+	}
+
+	float Expand6(uint32_t value)
+	{
+		return (float)((value << 2) | (value >> 4));
+	}
+
+	uint16_t Pack565(const float color[4])
+	{
+		const uint32_t r = (uint32_t)(color[0] * 31.0f / 255.0f + 0.5f);
+		const uint32_t g = (uint32_t)(color[1] * 63.0f / 255.0f + 0.5f);
+		const uint32_t b = (uint32_t)(color[2] * 31.0f / 255.0f + 0.5f);
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	void Unpack565(uint16_t packed, float color[4])
+	{
+		color[0] = Expand5(packed >> 11);
+		color[1] = Expand6((packed >> 5) & 63);
+		color[2] = Expand5(packed & 31);
+	}
+
+	// Endpoints of 5 and 6 bits whose color 2/3 of the way from the second to the first comes
+	// closest to each 8-bit value, for blocks of a single color.
+	struct SingleColorTables
+	{
+		uint8_t ends5[256][2];
+		uint8_t ends6[256][2];
+
+		SingleColorTables()
+		{
+			Build(31, Expand5, ends5);
+			Build(63, Expand6, ends6);
+		}
+
+		static void Build(uint32_t top, float (*expand)(uint32_t), uint8_t ends[256][2])
+		{
+			for (int value = 0; value < 256; ++value)
+			{
+				float best = FLT_MAX;
+				for (uint32_t a = 0; a <= top; ++a)
+				{
+					for (uint32_t b = 0; b <= top; ++b)
+					{
+						const float error = fabsf((2.0f * expand(a) + expand(b)) / 3.0f - value);
+						if (error < best)
+						{
+							best = error;
+							ends[value][0] = (uint8_t)a;
+							ends[value][1] = (uint8_t)b;
+						}
+					}
+				}
+			}
+		}
+	};
+
+	const SingleColorTables& SingleColors()
+	{
+		static const SingleColorTables tables;
+		return tables;
+	}
+
+	void EncodeBC1(const Block& block, uint8_t* out)
+	{
+		uint16_t color0 = 0, color1 = 0;
+		uint32_t indexBits = 0;
+		if (IsConstant(block, 0, 3))
+		{
+			const SingleColorTables& tables = SingleColors();
+			const int r = (int)(block.channel[0][0] + 0.5f);
+			const int g = (int)(block.channel[1][0] + 0.5f);
+			const int b = (int)(block.channel[2][0] + 0.5f);
+			color0 = (uint16_t)((tables.ends5[r][0] << 11) | (tables.ends6[g][0] << 5) | tables.ends5[b][0]);
+			color1 = (uint16_t)((tables.ends5[r][1] << 11) | (tables.ends6[g][1] << 5) | tables.ends5[b][1]);
+			// Index 2 of the four color mode, or 3 once the endpoints are swapped into it. Equal
+			// endpoints select the three color mode, whose index 2 is their average.
+			indexBits = 0xAAAAAAAAu;
+			if (color0 < color1)
+			{
+				std::swap(color0, color1);
+				indexBits = 0xFFFFFFFFu;
+			}
+		}
+		else
+		{
+			float end0[4], end1[4];
+			PrincipalEndpoints(block, 0, 3, end1, end0);
+			float bestError = FLT_MAX;
+			for (int pass = 0; pass < 3; ++pass)
+			{
+				// Four color mode needs the first endpoint greater.
+				uint16_t packed0 = Pack565(end0);
+				uint16_t packed1 = Pack565(end1);
+				if (packed0 < packed1)
+				{
+					std::swap(packed0, packed1);
+				}
+				Palette palette;
+				Unpack565(packed0, palette.color[0]);
+				Unpack565(packed1, palette.color[1]);
+				for (uint32_t c = 0; c < 3; ++c)
+				{
+					palette.color[2][c] = (2.0f * palette.color[0][c] + palette.color[1][c]) / 3.0f;
+					palette.color[3][c] = (palette.color[0][c] + 2.0f * palette.color[1][c]) / 3.0f;
+				}
+				palette.count = packed0 == packed1 ? 1 : 4;
+
+				uint8_t indices[16];
+				const float error = SelectIndices(block, 0, 3, palette, indices);
+				if (error < bestError)
+				{
+					bestError = error;
+					color0 = packed0;
+					color1 = packed1;
+					indexBits = 0;
+					for (uint32_t i = 0; i < 16; ++i)
+					{
+						indexBits |= (uint32_t)indices[i] << (2 * i);
+					}
+				}
+				if (palette.count == 1 || !FitEndpoints(block, 0, 3, indices, BC1_WEIGHTS, end0, end1))
+				{
+					break;
+				}
+			}
+		}
+		memcpy(out, &color0, 2);
+		memcpy(out + 2, &color1, 2);
+		memcpy(out + 4, &indexBits, 4);
+	}
+
+	// The eight value mode, whose first endpoint is the greater; equal endpoints leave one value.
+	void EncodeBC4(const Block& block, uint32_t channel, uint8_t* out)
+	{
+		float end0[4], end1[4];
+		PrincipalEndpoints(block, channel, 1, end1, end0);
+		float bestError = FLT_MAX;
+		int best0 = 0, best1 = 0;
+		uint64_t bestBits = 0;
+		for (int pass = 0; pass < 3; ++pass)
+		{
+			// Outward first so that the palette covers every texel.
+			int red0 = pass == 0 ? (int)ceilf(end0[0]) : (int)(end0[0] + 0.5f);
+			int red1 = pass == 0 ? (int)floorf(end1[0]) : (int)(end1[0] + 0.5f);
+			if (red0 < red1)
+			{
+				std::swap(red0, red1);
+			}
+			Palette palette;
+			palette.color[0][0] = (float)red0;
+			palette.color[1][0] = (float)red1;
+			for (uint32_t k = 2; k < 8; ++k)
+			{
+				palette.color[k][0] = ((8 - k) * red0 + (k - 1) * red1) / 7.0f;
+			}
+			palette.count = red0 == red1 ? 1 : 8;
+
+			uint8_t indices[16];
+			const float error = SelectIndices(block, channel, 1, palette, indices);
+			if (error < bestError)
+			{
+				bestError = error;
+				best0 = red0;
+				best1 = red1;
+				bestBits = 0;
+				for (uint32_t i = 0; i < 16; ++i)
+				{
+					bestBits |= (uint64_t)indices[i] << (3 * i);
+				}
+			}
+			if (palette.count == 1 || !FitEndpoints(block, channel, 1, indices, BC4_WEIGHTS, end0, end1))
+			{
+				break;
+			}
+		}
+		out[0] = (uint8_t)best0;
+		out[1] = (uint8_t)best1;
+		for (uint32_t i = 0; i < 6; ++i)
+		{
+			out[2 + i] = (uint8_t)(bestBits >> (8 * i));
+		}
+	}
+
+	// A mode 6 endpoint channel of 7 bits under the endpoint's low bit.
+	uint32_t QuantizeBC7(float value, uint32_t bit)
+	{
+		return (uint32_t)std::min(std::max((int)floorf((value - bit) / 2.0f + 0.5f), 0), 127);
+	}
+
+	// The low bit an endpoint quantizes closest with on its own.
+	uint32_t NearestLowBit(const float end[4])
+	{
+		float error[2] = {};
+		for (uint32_t bit = 0; bit < 2; ++bit)
+		{
+			for (uint32_t c = 0; c < 4; ++c)
+			{
+				const float difference = (float)(QuantizeBC7(end[c], bit) << 1 | bit) - end[c];
+				error[bit] += difference * difference;
+			}
+		}
+		return error[1] < error[0] ? 1 : 0;
+	}
+
+	// Mode 6: one subset of RGBA endpoints with 7 bits per channel and a shared low bit per
+	// endpoint, and 4-bit indices. Refinement passes take the low bits each endpoint rounds best
+	// with; the last pass tries all four pairs.
+	void EncodeBC7(const Block& block, uint8_t* out)
+	{
+		static const float weights[16] = { 0.0f, 4 / 64.0f, 9 / 64.0f, 13 / 64.0f, 17 / 64.0f, 21 / 64.0f, 26 / 64.0f, 30 / 64.0f,
+			34 / 64.0f, 38 / 64.0f, 43 / 64.0f, 47 / 64.0f, 51 / 64.0f, 55 / 64.0f, 60 / 64.0f, 1.0f };
+
+		float end0[4], end1[4];
+		PrincipalEndpoints(block, 0, 4, end0, end1);
+		float bestError = FLT_MAX;
+		uint32_t bestEnds[2][4] = {};
+		uint32_t bestBits[2] = {};
+		uint8_t bestIndices[16] = {};
+		for (int pass = 0; pass < 3; ++pass)
+		{
+			float passError = FLT_MAX;
+			uint8_t passIndices[16];
+			const bool last = pass == 2;
+			const uint32_t nearest = NearestLowBit(end0) | NearestLowBit(end1) << 1;
+			for (uint32_t pair = 0; pair < (last ? 4u : 1u); ++pair)
+			{
+				const uint32_t bits = last ? pair : nearest;
+				const uint32_t bit[2] = { bits & 1, bits >> 1 };
+				uint32_t ends[2][4];
+				Palette palette;
+				palette.count = 16;
+				for (uint32_t c = 0; c < 4; ++c)
+				{
+					ends[0][c] = QuantizeBC7(end0[c], bit[0]);
+					ends[1][c] = QuantizeBC7(end1[c], bit[1]);
+					const int value0 = (int)(ends[0][c] << 1 | bit[0]);
+					const int value1 = (int)(ends[1][c] << 1 | bit[1]);
+					for (uint32_t k = 0; k < 16; ++k)
+					{
+						palette.color[k][c] = (float)(((64 - BC7_WEIGHTS[k]) * value0 + BC7_WEIGHTS[k] * value1 + 32) >> 6);
+					}
+				}
+
+				uint8_t indices[16];
+				const float error = SelectIndices(block, 0, 4, palette, indices);
+				if (error < passError)
+				{
+					passError = error;
+					memcpy(passIndices, indices, 16);
+				}
+				if (error < bestError)
+				{
+					bestError = error;
+					memcpy(bestEnds, ends, sizeof(ends));
+					bestBits[0] = bit[0];
+					bestBits[1] = bit[1];
+					memcpy(bestIndices, indices, 16);
+				}
+			}
+			if (bestError == 0.0f || !FitEndpoints(block, 0, 4, passIndices, weights, end0, end1))
+			{
+				break;
+			}
+		}
+
+		// The first texel's index is stored without its high bit, which swapping the endpoints clears.
+		if (bestIndices[0] >= 8)
+		{
+			for (uint32_t c = 0; c < 4; ++c)
+			{
+				std::swap(bestEnds[0][c], bestEnds[1][c]);
+			}
+			std::swap(bestBits[0], bestBits[1]);
+			for (uint32_t i = 0; i < 16; ++i)
+			{
+				bestIndices[i] = (uint8_t)(15 - bestIndices[i]);
+			}
+		}
+
+		memset(out, 0, 16);
+		BitWriter writer = { out, 0 };
+		writer.Write(1 << 6, 7);
+		for (uint32_t c = 0; c < 4; ++c)
+		{
+			writer.Write(bestEnds[0][c], 7);
+			writer.Write(bestEnds[1][c], 7);
+		}
+		writer.Write(bestBits[0], 1);
+		writer.Write(bestBits[1], 1);
+		writer.Write(bestIndices[0], 3);
+		for (uint32_t i = 1; i < 16; ++i)
+		{
+			writer.Write(bestIndices[i], 4);
+		}
+	}
+
+	void DecodeBC1(const uint8_t* in, float texels[16][4])
+	{
+		uint16_t color0, color1;
+		uint32_t indexBits;
+		memcpy(&color0, in, 2);
+		memcpy(&color1, in + 2, 2);
+		memcpy(&indexBits, in + 4, 4);
+		float palette[4][4];
+		Unpack565(color0, palette[0]);
+		Unpack565(color1, palette[1]);
+		for (uint32_t c = 0; c < 3; ++c)
+		{
+			if (color0 > color1)
+			{
+				palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+				palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+			}
+			else
+			{
+				palette[2][c] = (palette[0][c] + palette[1][c]) / 2.0f;
+				palette[3][c] = 0.0f;
+			}
+		}
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			for (uint32_t c = 0; c < 3; ++c)
+			{
+				texels[i][c] = palette[(indexBits >> (2 * i)) & 3][c] / 255.0f;
+			}
+		}
+	}
+
+	void DecodeBC4(const uint8_t* in, float texels[16][4], uint32_t channel)
+	{
+		const int red0 = in[0];
+		const int red1 = in[1];
+		float palette[8] = { (float)red0, (float)red1 };
+		for (int k = 2; k < 8; ++k)
+		{
+			palette[k] = red0 > red1 ? ((8 - k) * red0 + (k - 1) * red1) / 7.0f : ((6 - k) * red0 + (k - 1) * red1) / 5.0f;
+		}
+		if (red0 <= red1)
+		{
+			palette[6] = 0.0f;
+			palette[7] = 255.0f;
+		}
+		uint64_t indexBits = 0;
+		for (uint32_t i = 0; i < 6; ++i)
+		{
+			indexBits |= (uint64_t)in[2 + i] << (8 * i);
+		}
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			texels[i][channel] = palette[(indexBits >> (3 * i)) & 7] / 255.0f;
+		}
+	}
+
+	void DecodeBC7(const uint8_t* in, float texels[16][4])
+	{
+		BitReader reader = { in, 0 };
+		if (reader.Read(7) != 1 << 6)
+		{
+			memset(texels, 0, sizeof(float) * 16 * 4);
+			return;
+		}
+		uint32_t ends[2][4];
+		for (uint32_t c = 0; c < 4; ++c)
+		{
+			ends[0][c] = reader.Read(7);
+			ends[1][c] = reader.Read(7);
+		}
+		const uint32_t bit0 = reader.Read(1);
+		const uint32_t bit1 = reader.Read(1);
+		for (uint32_t i = 0; i < 16; ++i)
+		{
+			const int weight = BC7_WEIGHTS[reader.Read(i == 0 ? 3 : 4)];
+			for (uint32_t c = 0; c < 4; ++c)
+			{
+				const int value0 = (int)(ends[0][c] << 1 | bit0);
+				const int value1 = (int)(ends[1][c] << 1 | bit1);
+				texels[i][c] = (((64 - weight) * value0 + weight * value1 + 32) >> 6) / 255.0f;
+			}
+		}
+	}
+
+	void DecodeBlock(const uint8_t* in, BlockFormat format, float texels[16][4])
+	{
+		switch (format)
+		{
+		case BlockFormat::BC1: DecodeBC1(in, texels); break;
+		case BlockFormat::BC4: DecodeBC4(in, texels, 0); break;
+		case BlockFormat::BC5: DecodeBC4(in, texels, 0); DecodeBC4(in + 8, texels, 1); break;
+		case BlockFormat::BC7: DecodeBC7(in, texels); break;
+		}
+	}
+
+	// Maps that validation encodes: smooth shading with a slowly changing tint, as the terrain
+	// maps have, and hashed noise in every channel.
+	std::vector<uint8_t> TestMap(uint32_t width, uint32_t height, MipFormat format, bool noise)
+	{
+		const size_t texelBytes = MipChain::TexelBytes(format);
+		std::vector<uint8_t> texels((size_t)width * height * texelBytes);
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				const size_t i = (size_t)y * width + x;
+				for (uint32_t c = 0; c < MipChain::Channels(format); ++c)
+				{
+					double value = noise ? (((i * 4 + c) * 2654435761u) >> 8 & 0xFFFF) / 65535.0 :
+						0.5 + 0.35 * sin(x * 0.09) * cos(y * 0.07) + 0.05 * c * sin(x * 0.05 + y * 0.03);
+					uint8_t* texel = &texels[i * texelBytes];
+					switch (format)
+					{
+					case MipFormat::R16_UNORM:
+						reinterpret_cast<uint16_t*>(texel)[0] = (uint16_t)(value * 65535.0 + 0.5);
+						break;
+					case MipFormat::R32_FLOAT:
+						reinterpret_cast<float*>(texel)[0] = (float)value;
+						break;
+					default:
+						texel[c] = (uint8_t)(value * 255.0 + 0.5);
+						break;
+					}
+				}
+			}
+		}
+		return texels;
+	}
+}
+
+size_t BlockCompressor::BlockBytes(BlockFormat format)
+{
+	return format == BlockFormat::BC1 || format == BlockFormat::BC4 ? 8 : 16;
+}
+
+uint32_t BlockCompressor::Channels(BlockFormat format)
+{
+	switch (format)
+	{
+	case BlockFormat::BC1: return 3;
+	case BlockFormat::BC4: return 1;
+	case BlockFormat::BC5: return 2;
+	default: return 4;
+	}
+}
+
+uint32_t BlockCompressor::DxgiFormat(BlockFormat format)
+{
+	switch (format)
+	{
+	case BlockFormat::BC1: return 71;	// DXGI_FORMAT_BC1_UNORM
+	case BlockFormat::BC4: return 80;	// DXGI_FORMAT_BC4_UNORM
+	case BlockFormat::BC5: return 83;	// DXGI_FORMAT_BC5_UNORM
+	default: return 98;					// DXGI_FORMAT_BC7_UNORM
+	}
+}
+
+void BlockCompressor::Encode(const void* texels, size_t rowPitch, uint32_t width, uint32_t height, MipFormat source, BlockFormat format,
+	std::vector<uint8_t>& blocks)
+{
+	const uint32_t across = BlocksAcross(width);
+	const uint32_t down = BlocksAcross(height);
+	const size_t blockBytes = BlockBytes(format);
+	blocks.assign((size_t)across * down * blockBytes, 0);
+	ParallelFor(down, [&](uint32_t begin, uint32_t end)
+	{
+		Block block;
+		for (uint32_t by = begin; by < end; ++by)
+		{
+			for (uint32_t bx = 0; bx < across; ++bx)
+			{
+				LoadBlock(static_cast<const uint8_t*>(texels), rowPitch, width, height, source, bx, by, block);
+				uint8_t* out = &blocks[((size_t)by * across + bx) * blockBytes];
+				switch (format)
+				{
+				case BlockFormat::BC1: EncodeBC1(block, out); break;
+				case BlockFormat::BC4: EncodeBC4(block, 0, out); break;
+				case BlockFormat::BC5: EncodeBC4(block, 0, out); EncodeBC4(block, 1, out + 8); break;
+				case BlockFormat::BC7: EncodeBC7(block, out); break;
+				}
+			}
+		}
+	});
+}
+
+void BlockCompressor::Decode(const uint8_t* blocks, uint32_t width, uint32_t height, BlockFormat format, std::vector<float>& texels)
+{
+	const uint32_t across = BlocksAcross(width);
+	const uint32_t channels = Channels(format);
+	const size_t blockBytes = BlockBytes(format);
+	texels.resize((size_t)width * height * channels);
+	for (uint32_t by = 0; by < BlocksAcross(height); ++by)
+	{
+		for (uint32_t bx = 0; bx < across; ++bx)
+		{
+			float decoded[16][4];
+			DecodeBlock(blocks + ((size_t)by * across + bx) * blockBytes, format, decoded);
+			for (uint32_t i = 0; i < 16; ++i)
+			{
+				const uint32_t x = bx * 4 + (i & 3);
+				const uint32_t y = by * 4 + (i >> 2);
+				if (x < width && y < height)
+				{
+					std::copy(decoded[i], decoded[i] + channels, &texels[((size_t)y * width + x) * channels]);
+				}
+			}
+		}
+	}
+}
+
+double BlockCompressor::Psnr(const void* texels, size_t rowPitch, uint32_t width, uint32_t height, MipFormat source, BlockFormat format,
+	const std::vector<uint8_t>& blocks)
+{
+	std::vector<float> decoded;
+	Decode(blocks.data(), width, height, format, decoded);
+	const uint32_t channels = Channels(format);
+	double squared = 0.0;
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			float rgba[4];
+			SourceTexel(static_cast<const uint8_t*>(texels), rowPitch, source, x, y, rgba);
+			for (uint32_t c = 0; c < channels; ++c)
+			{
+				const double difference = decoded[((size_t)y * width + x) * channels + c] * 255.0 - rgba[c];
+				squared += difference * difference;
+			}
+		}
+	}
+	const double mse = squared / ((double)width * height * channels);
+	return mse == 0.0 ? std::numeric_limits<double>::infinity() : 10.0 * log10(255.0 * 255.0 / mse);
+}
+
+bool BlockCompressor::WriteDds(const std::string& path, BlockFormat format, uint32_t width, uint32_t height,
+	const std::vector<std::vector<uint8_t>>& levels)
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file || levels.empty())
+	{
+		return false;
+	}
+
+	DdsHeader header = {};
+	header.magic = 0x20534444;					// "DDS "
+	header.size = 124;
+	header.flags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000;	// caps, height, width, pixel format, mip count, linear size
+	header.height = height;
+	header.width = width;
+	header.linearSize = (uint32_t)levels[0].size();
+	header.mipCount = (uint32_t)levels.size();
+	header.formatSize = 32;
+	header.formatFlags = 0x4;					// fourCC
+	header.fourCC = 0x30315844;					// "DX10"
+	header.caps[0] = 0x1000 | (levels.size() > 1 ? 0x400008 : 0);	// texture, mip maps and complex
+	header.dxgiFormat = DxgiFormat(format);
+	header.dimension = 3;						// D3D10_RESOURCE_DIMENSION_TEXTURE2D
+	header.arraySize = 1;
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	for (const std::vector<uint8_t>& level : levels)
+	{
+		file.write(reinterpret_cast<const char*>(level.data()), (std::streamsize)level.size());
+	}
+	return (bool)file;
+}
+
+bool BlockCompressor::Validate()
+{
+	// Blocks laid out by hand from the format specifications, indices 0, 1, 2, 3... from the first texel.
+	float decoded[16][4];
+	const uint8_t bc1[8] = { 0x00, 0xF8, 0x1F, 0x00, 0xE4, 0x00, 0x00, 0x00 };	// red, blue
+	DecodeBC1(bc1, decoded);
+	const float bc1Expected[4][3] = { { 255, 0, 0 }, { 0, 0, 255 }, { 170, 0, 85 }, { 85, 0, 170 } };
+	for (uint32_t i = 0; i < 4; ++i)
+	{
+		for (uint32_t c = 0; c < 3; ++c)
+		{
+			if (fabsf(decoded[i][c] * 255.0f - bc1Expected[i][c]) > 1e-3f)
+			{
+				return false;
+			}
+		}
+	}
+
+	const uint8_t bc4[2][8] = { { 200, 100, 0x88, 0xC6, 0xFA }, { 100, 200, 0x88, 0xC6, 0xFA } };
+	const float bc4Expected[2][8] = { { 200, 100, 1300 / 7.0f, 1200 / 7.0f, 1100 / 7.0f, 1000 / 7.0f, 900 / 7.0f, 800 / 7.0f },
+		{ 100, 200, 120, 140, 160, 180, 0, 255 } };
+	for (uint32_t block = 0; block < 2; ++block)
+	{
+		DecodeBC4(bc4[block], decoded, 0);
+		for (uint32_t i = 0; i < 8; ++i)
+		{
+			if (fabsf(decoded[i][0] * 255.0f - bc4Expected[block][i]) > 1e-3f)
+			{
+				return false;
+			}
+		}
+	}
+
+	// Mode 6 from RGBA (255, 0, 127, 254) to (0, 255, 128, 1): 7-bit ends and their low bits.
+	uint8_t bc7[16] = {};
+	BitWriter writer = { bc7, 0 };
+	writer.Write(1 << 6, 7);
+	const uint32_t ends[2][4] = { { 127, 0, 63, 127 }, { 0, 127, 64, 0 } };
+	for (uint32_t c = 0; c < 4; ++c)
+	{
+		writer.Write(ends[0][c], 7);
+		writer.Write(ends[1][c], 7);
+	}
+	writer.Write(1, 1);
+	writer.Write(0, 1);
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		writer.Write(i == 0 ? 0 : 15 - i, i == 0 ? 3 : 4);
+	}
+	DecodeBC7(bc7, decoded);
+	const int bc7End0[4] = { 255, 1, 127, 255 };
+	const int bc7End1[4] = { 0, 254, 128, 0 };
+	for (uint32_t i = 0; i < 16; ++i)
+	{
+		const int weight = BC7_WEIGHTS[i == 0 ? 0 : 15 - i];
+		for (uint32_t c = 0; c < 4; ++c)
+		{
+			if (decoded[i][c] * 255.0f != (float)(((64 - weight) * bc7End0[c] + weight * bc7End1[c] + 32) >> 6))
+			{
+				return false;
+			}
+		}
+	}
+
+	// Constant maps: exact in BC4 at every 8-bit value, but for float rounding; within a step in BC7, whose endpoints
+	// share their low bit across channels, and within the 565 steps in BC1.
+	std::vector<uint8_t> constant(16 * 16 * 4);
+	std::vector<uint8_t> blocks;
+	for (int value = 0; value < 256; value += 15)
+	{
+		for (size_t i = 0; i < constant.size(); ++i)
+		{
+			constant[i] = (uint8_t)(i % 4 == 3 ? 255 - value : (value + 77 * (i % 4)) & 255);
+		}
+		BlockCompressor::Encode(constant.data(), 16 * 4, 16, 16, MipFormat::R8G8B8A8_UNORM, BlockFormat::BC7, blocks);
+		if (Psnr(constant.data(), 16 * 4, 16, 16, MipFormat::R8G8B8A8_UNORM, BlockFormat::BC7, blocks) < 48.0)
+		{
+			return false;
+		}
+		BlockCompressor::Encode(constant.data(), 16 * 4, 16, 16, MipFormat::R8G8B8A8_UNORM, BlockFormat::BC5, blocks);
+		if (Psnr(constant.data(), 16 * 4, 16, 16, MipFormat::R8G8B8A8_UNORM, BlockFormat::BC5, blocks) < 100.0)
+		{
+			return false;
+		}
+		BlockCompressor::Encode(constant.data(), 16 * 4, 16, 16, MipFormat::R8G8B8A8_UNORM, BlockFormat::BC1, blocks);
+		if (Psnr(constant.data(), 16 * 4, 16, 16, MipFormat::R8G8B8A8_UNORM, BlockFormat::BC1, blocks) < 48.0)
+		{
+			return false;
+		}
+	}
+
+	// Smooth maps come within a step or so of 8-bit precision, BC7 well above BC1; noise, which no
+	// block fits, still lands near the error of a gray block. Sizes that are not a whole number of
+	// blocks encode the texels they have.
+	struct Case
+	{
+		MipFormat source;
+		BlockFormat format;
+		bool noise;
+		double minimum;
+	};
+	const Case cases[] = {
+		{ MipFormat::R8G8B8A8_UNORM, BlockFormat::BC1, false, 38.0 },
+		{ MipFormat::R8G8B8A8_UNORM, BlockFormat::BC7, false, 46.0 },
+		{ MipFormat::R8G8B8A8_UNORM, BlockFormat::BC5, false, 46.0 },
+		{ MipFormat::R16_UNORM, BlockFormat::BC4, false, 46.0 },
+		{ MipFormat::R32_FLOAT, BlockFormat::BC4, false, 46.0 },
+		{ MipFormat::R8_UNORM, BlockFormat::BC4, false, 46.0 },
+		{ MipFormat::R8G8B8A8_UNORM, BlockFormat::BC1, true, 11.0 },
+		{ MipFormat::R8G8B8A8_UNORM, BlockFormat::BC7, true, 11.0 } };
+	const uint32_t sizes[3][2] = { { 64, 64 }, { 30, 18 }, { 3, 7 } };
+	for (const uint32_t* size : sizes)
+	{
+		double psnr[8];
+		for (uint32_t c = 0; c < 8; ++c)
+		{
+			const Case& test = cases[c];
+			const std::vector<uint8_t> texels = TestMap(size[0], size[1], test.source, test.noise);
+			const size_t rowPitch = size[0] * MipChain::TexelBytes(test.source);
+			BlockCompressor::Encode(texels.data(), rowPitch, size[0], size[1], test.source, test.format, blocks);
+			if (blocks.size() != (size_t)BlocksAcross(size[0]) * BlocksAcross(size[1]) * BlockBytes(test.format))
+			{
+				return false;
+			}
+			psnr[c] = Psnr(texels.data(), rowPitch, size[0], size[1], test.source, test.format, blocks);
+			if (psnr[c] < test.minimum)
+			{
+				return false;
+			}
+		}
+		if (psnr[1] < psnr[0] + 3.0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "MipChain.h"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Block compressed formats of 4x4 texels, as D3D12 samples them.
+enum class BlockFormat
+{
+	BC1,	// RGB in 8 bytes, for colors without alpha
+	BC4,	// one channel in 8 bytes, for heights
+	BC5,	// two channels in 16 bytes, for normals in red and green
+	BC7,	// RGBA in 16 bytes, for colors; written in mode 6 only
+};
+
+// Encodes maps into D3D12 block compressed formats on the CPU, at bake time or load time.
+// Blocks are fitted along the principal axis of their texels and refined by least squares,
+// with SSE2 for the axis and index searches and rows of blocks spread over all cores. Sources
+// are MipFormats: the color formats take RGBA8 as stored, single-channel sources encode as gray;
+// BC4 takes the red channel and BC5 red and green, R16 and float sources at full precision.
+// Blocks past the right and bottom edges repeat the edge texels.
+class BlockCompressor
+{
+public:
+	static size_t BlockBytes(BlockFormat format);
+	static uint32_t Channels(BlockFormat format);
+	static uint32_t BlocksAcross(uint32_t texels) { return (texels + 3) / 4; }
+	static uint32_t DxgiFormat(BlockFormat format);	// the DXGI_FORMAT value of the UNORM format
+
+	// Rows of BlocksAcross(width) blocks of a width x height map whose rows are rowPitch bytes apart.
+	static void Encode(const void* texels, size_t rowPitch, uint32_t width, uint32_t height, MipFormat source, BlockFormat format,
+		std::vector<uint8_t>& blocks);
+
+	// Channels(format) floats of 0..1 per texel, as the sampler returns them. BC7 blocks in other
+	// modes than 6 decode as zero.
+	static void Decode(const uint8_t* blocks, uint32_t width, uint32_t height, BlockFormat format, std::vector<float>& texels);
+
+	// Peak signal to noise ratio in dB of the encoded blocks against their source, over the channels
+	// the format stores and at the 8-bit peak of 255; infinite if they match exactly.
+	static double Psnr(const void* texels, size_t rowPitch, uint32_t width, uint32_t height, MipFormat source, BlockFormat format,
+		const std::vector<uint8_t>& blocks);
+
+	// A DDS file of a 2D texture with the DX10 header, levels from the top down.
+	static bool WriteDds(const std::string& path, BlockFormat format, uint32_t width, uint32_t height,
+		const std::vector<std::vector<uint8_t>>& levels);
+
+	// True if hand-built blocks of every format decode as the specification lays them out, constant
+	// maps encode exactly where the format can, smooth and noisy maps reach a minimum PSNR with BC7
+	// above BC1, and maps that are not a whole number of blocks encode.
+	static bool Validate();
+};
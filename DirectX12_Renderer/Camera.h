@@ -14,6 +14,8 @@ public:
 
 	XMFLOAT4 GetEyePosition() { return m_pos; }
 
+	void SetEyePosition(XMFLOAT4 position) { m_pos = position; }
+
 	XMFLOAT4 Translate(XMFLOAT3 move);
 
 	void Pitch(float theta);
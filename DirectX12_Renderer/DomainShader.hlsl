@@ -1,4 +1,10 @@
 Texture2D<float4> displacementmap : register(t0);
+#ifdef VIRTUAL_TEXTURE
+Texture2D<uint4> heightPages : register(t2);
+#endif
+#ifdef NORMAL_MAP
+Texture2D<float2> normalmap : register(t4);	// NormalMap, BC5 or RGBA8: x and y of the tangent space normal
+#endif
 SamplerState dmsampler : register(s0);
 
 struct LightData {
@@ -19,6 +25,16 @@ cbuffer ConstantBuffer : register(b0)
 	LightData light;
 	int height;
 	int width;
+	float heightOffset;	// displacement texel to 0..1 height, Heightmap::Range
+	float heightScale;
+	float3 meshOrigin;
+	float meshScale;
+	float planetRadius;
+	int patchGridSize;
+	uint virtualHeightWidth;	// level 0 size of the streamed maps
+	uint virtualHeightHeight;
+	uint virtualColorWidth;
+	uint virtualColorHeight;
 }
 
 struct DS_OUTPUT
@@ -44,6 +60,35 @@ struct HS_CONSTANT_DATA_OUTPUT
 
 #define NUM_CONTROL_POINTS 3
 
+#ifdef VIRTUAL_TEXTURE
+static const float VT_TILE_SIZE = 128.0f;	// TilePyramid::TILE_SIZE
+static const float VT_BORDER = 1.0f;		// TilePyramid::BORDER
+
+// Physical cache coordinates of a virtual texture coordinate, inside the finest resident tile
+// over it as VirtualPageTable::WriteIndirection records it. u wraps and v clamps like the tile borders.
+float2 VirtualToPhysical(Texture2D<uint4> pages, float2 virtualSize, float2 physicalSize, float2 uv)
+{
+	float2 texel = min(float2(frac(uv.x), saturate(uv.y)) * virtualSize, virtualSize - 0.5f);
+	uint4 page = pages.Load(int3(texel / VT_TILE_SIZE, 0));
+	float2 local = fmod(texel / (float)(1u << page.z), VT_TILE_SIZE);
+	return (page.xy * (VT_TILE_SIZE + 2.0f * VT_BORDER) + VT_BORDER + local) / physicalSize;
+}
+#endif
+
+// The displacement map is R8, R16 or R32F as the file stores it, or RGBA8 with the height in red,
+// with a box filtered mip chain. Streamed heights are stored as 0..1 already and pick their level
+// through the page table instead.
+float SampleHeight(float2 uv, float lod)
+{
+#ifdef VIRTUAL_TEXTURE
+	float2 physicalSize;
+	displacementmap.GetDimensions(physicalSize.x, physicalSize.y);
+	return displacementmap.SampleLevel(dmsampler, VirtualToPhysical(heightPages, float2(virtualHeightWidth, virtualHeightHeight), physicalSize, uv), 0).r;
+#else
+	return (displacementmap.SampleLevel(dmsampler, uv, lod).r - heightOffset) * heightScale;
+#endif
+}
+
 [domain("tri")]
 DS_OUTPUT DS(
 	HS_CONSTANT_DATA_OUTPUT input,
@@ -66,7 +111,18 @@ DS_OUTPUT DS(
 	output.tex.x = theta / (2.0f * 3.14159265359f);
 	output.tex.y = phi / 3.14159265359f;
 
-	float hei = scale * displacementmap.SampleLevel(dmsampler, output.tex.xy, 0).r;
+#ifdef VIRTUAL_TEXTURE
+	float lod = 0.0f;
+	float2 tapStep = 0.3f / float2(virtualHeightWidth, virtualHeightHeight);
+#else
+	// The mip whose texels are as far apart as the vertices the patch is tessellated into, 9 per
+	// edge; a texel spans pi r / height along a meridian. The normal taps widen with it.
+	float edge = max(length(patch[1].pos - patch[0].pos), max(length(patch[2].pos - patch[1].pos), length(patch[0].pos - patch[2].pos)));
+	float lod = max(log2(edge / 9.0f * height / (3.14159265359f * length(patch[0].pos))), 0.0f);
+	float2 tapStep = 0.3f * exp2(lod) / float2(width, height);
+#endif
+
+	float hei = scale * SampleHeight(output.tex.xy, lod);
 
 	output.pos.xyz += output.norm * hei;
 
@@ -84,29 +140,36 @@ DS_OUTPUT DS(
 	//float y = -2 * (y1.z - y2.z);
 	//float z = 4;
 
-	float2 b = output.tex.xy + float2(0.0f, -0.3f / height);
-	float2 c = output.tex.xy + float2(0.3f / width, -0.3f / height);
-	float2 d = output.tex.xy + float2(0.3f / width, 0.0f);
-	float2 e = output.tex.xy + float2(0.3f / width, 0.3f / height);
-	float2 f = output.tex.xy + float2(0.0f, 0.3f / height);
-	float2 g = output.tex.xy + float2(-0.3f / width, 0.3f / height);
-	float2 h = output.tex.xy + float2(-0.3f / width, 0.0f);
-	float2 i = output.tex.xy + float2(-0.3f / width, -0.3f / height);
-
-	float zb = displacementmap.SampleLevel(dmsampler, b, 0) * scale;
-	float zc = displacementmap.SampleLevel(dmsampler, c, 0) * scale;
-	float zd = displacementmap.SampleLevel(dmsampler, d, 0) * scale;
-	float ze = displacementmap.SampleLevel(dmsampler, e, 0) * scale;
-	float zf = displacementmap.SampleLevel(dmsampler, f, 0) * scale;
-	float zg = displacementmap.SampleLevel(dmsampler, g, 0) * scale;
-	float zh = displacementmap.SampleLevel(dmsampler, h, 0) * scale;
-	float zi = displacementmap.SampleLevel(dmsampler, i, 0) * scale;
+#ifdef NORMAL_MAP
+	// Generated from the heights at load time with the slopes of the sphere they are wrapped on,
+	// filtered down the mips like the heights; z is rebuilt from x and y.
+	float2 slope = normalmap.SampleLevel(dmsampler, output.tex.xy, lod) * 2.0f - 1.0f;
+	float3 normal = float3(slope, sqrt(saturate(1.0f - dot(slope, slope))));
+#else
+	float2 b = output.tex.xy + float2(0.0f, -tapStep.y);
+	float2 c = output.tex.xy + float2(tapStep.x, -tapStep.y);
+	float2 d = output.tex.xy + float2(tapStep.x, 0.0f);
+	float2 e = output.tex.xy + float2(tapStep.x, tapStep.y);
+	float2 f = output.tex.xy + float2(0.0f, tapStep.y);
+	float2 g = output.tex.xy + float2(-tapStep.x, tapStep.y);
+	float2 h = output.tex.xy + float2(-tapStep.x, 0.0f);
+	float2 i = output.tex.xy + float2(-tapStep.x, -tapStep.y);
+
+	float zb = SampleHeight(b, lod) * scale;
+	float zc = SampleHeight(c, lod) * scale;
+	float zd = SampleHeight(d, lod) * scale;
+	float ze = SampleHeight(e, lod) * scale;
+	float zf = SampleHeight(f, lod) * scale;
+	float zg = SampleHeight(g, lod) * scale;
+	float zh = SampleHeight(h, lod) * scale;
+	float zi = SampleHeight(i, lod) * scale;
 
 	float x = zg + 2 * zh + zi - zc - 2 * zd - ze;
 	float y = 2 * zb + zc + zi - ze - 2 * zf - zg;
 	float z = 8.0f;
 
 	float3 normal = normalize(float3(x, y, z));
+#endif
 
 	float3 N = normalize(patch[0].norm.xyz * domain.x + patch[1].norm.xyz * domain.y + patch[2].norm.xyz * domain.z);
 	float3 T = normalize(patch[0].tan.xyz * domain.x + patch[1].tan.xyz * domain.y + patch[2].tan.xyz * domain.z);
@@ -0,0 +1,305 @@
+#include "GeometryCache.h"
+#include "GeometryGenerator.h"
+#include "MeshOptimizer.h"
+#include "VertexPacking.h"
+#include <chrono>
+
+using namespace std::chrono;
+
+namespace
+{
+	void ReleaseResource(ID3D12Resource*& resource)
+	{
+		if (resource)
+		{
+			resource->Release();
+			resource = nullptr;
+		}
+	}
+}
+
+GeometryCache::GeometryCache()
+{
+}
+
+GeometryCache::~GeometryCache()
+{
+	for (std::unique_ptr<SharedGeometry>& geometry : m_geometry)
+	{
+		if (geometry)
+		{
+			ReleaseBuffers(*geometry);
+		}
+	}
+}
+
+uint32_t GeometryCache::GetSlot(const SharedGeometry* geometry) const
+{
+	for (size_t i = 0; i < m_geometry.size(); ++i)
+	{
+		if (m_geometry[i] && m_geometry[i].get() == geometry)
+		{
+			return (uint32_t)i;
+		}
+	}
+	return MeshRegistry::NONE;
+}
+
+const SharedGeometry* GeometryCache::Acquire(const MeshCache::Key& key)
+{
+	const uint32_t slot = m_registry.Acquire(key);
+	return slot != MeshRegistry::NONE ? m_geometry[slot].get() : nullptr;
+}
+
+const SharedGeometry* GeometryCache::Load(Graphics* renderer, const std::wstring& path, const MeshCache::Key& key, bool meshlets)
+{
+	if (const SharedGeometry* geometry = Acquire(key))
+	{
+		return geometry;
+	}
+
+	auto start = steady_clock::now();
+
+	MeshCache cache;
+	if (!cache.Open(path, key))
+	{
+		return nullptr;
+	}
+
+	// Uploaded straight from the mapped file.
+	MeshBlob mesh = cache.GetMesh();
+	const SharedGeometry* geometry = Add(renderer, key, mesh, false);
+
+	double elapsedMs = duration<double, std::milli>(steady_clock::now() - start).count();
+
+	char report[256];
+	sprintf_s(report, "%s: loaded %zu vertices, %zu triangles in %zu chunks from the mesh cache in %.2f ms\n",
+		key.generator, mesh.vertexCount, mesh.indexCount / 3, mesh.chunkCount, elapsedMs);
+	OutputDebugStringA(report);
+
+	// Outside the timing above, which is the cost of the cache hit.
+	if (meshlets)
+	{
+		BuildMeshlets(key, mesh, *m_geometry[GetSlot(geometry)]);
+	}
+	return geometry;
+}
+
+const SharedGeometry* GeometryCache::Add(Graphics* renderer, const MeshCache::Key& key, const MeshBlob& mesh, bool meshlets)
+{
+	if (const SharedGeometry* geometry = Acquire(key))
+	{
+		return geometry;
+	}
+
+	std::unique_ptr<SharedGeometry> added(new SharedGeometry());
+	SharedGeometry& geometry = *added;
+	geometry.vertexBuffer = nullptr;
+	geometry.vertexBufferUpload = nullptr;
+	geometry.indexBuffer = nullptr;
+	geometry.indexBufferUpload = nullptr;
+	geometry.vertexBufferView = {};
+	geometry.indexBufferView = {};
+	geometry.chunks.assign(mesh.chunks, mesh.chunks + mesh.chunkCount);
+	geometry.meshOrigin = mesh.meshOrigin;
+	geometry.meshScale = mesh.meshScale;
+	geometry.bytes = mesh.VertexBytes() + mesh.IndexBytes();
+	Upload(renderer, mesh, geometry);
+
+	if (meshlets)
+	{
+		BuildMeshlets(key, mesh, geometry);
+	}
+
+	const uint32_t slot = m_registry.Add(key, geometry.bytes);
+	if (slot == m_geometry.size())
+	{
+		m_geometry.emplace_back();
+	}
+	m_geometry[slot] = std::move(added);
+	return &geometry;
+}
+
+const SharedGeometry* GeometryCache::AcquireGeosphere(Graphics* renderer, UINT numSubdivisions, UINT chunkVertices, bool packed, bool meshlets)
+{
+	const UINT stride = packed ? sizeof(PackedVertex) : sizeof(Vertex);
+	const MeshCache::Key key = { "Geosphere", 1.0f, numSubdivisions, chunkVertices, stride, 0 };
+
+	wchar_t cachePath[64];
+	swprintf_s(cachePath, L"Geosphere_%016llx.meshcache", (unsigned long long)MeshCache::HashKey(key));
+	if (const SharedGeometry* geometry = Load(renderer, cachePath, key, meshlets))
+	{
+		return geometry;
+	}
+
+	auto start = steady_clock::now();
+
+	GeometryGenerator::MeshData mesh;
+	GeometryGenerator::CreateGeosphere(1.0f, numSubdivisions, mesh);
+
+	double elapsedMs = duration<double, std::milli>(steady_clock::now() - start).count();
+
+	// Split into 16-bit chunks, each reordered for the post-transform cache and vertex fetch.
+	std::vector<XMFLOAT3> positions(mesh.Vertices.size());
+	for (size_t i = 0; i < mesh.Vertices.size(); ++i)
+	{
+		positions[i] = mesh.Vertices[i].Position;
+	}
+
+	MeshOptimizer::CacheStatistics before = MeshOptimizer::AnalyzeVertexCache(mesh.Indices32, mesh.Vertices.size());
+	start = steady_clock::now();
+	MeshChunker::ChunkedMesh chunked;
+	MeshChunker::Build(positions, mesh.Indices32, chunkVertices, chunked);
+	double optimizeMs = duration<double, std::milli>(steady_clock::now() - start).count();
+	MeshOptimizer::CacheStatistics after = MeshOptimizer::AnalyzeVertexCache(MeshChunker::ExpandIndices(chunked), chunked.VertexRemap.size());
+
+	std::vector<Vertex> vertices = MeshChunker::GatherVertices(mesh.Vertices, chunked);
+
+	char report[256];
+	sprintf_s(report, "Geosphere: %u subdivisions, %zu vertices, %zu triangles, %zu bytes, %.2f ms, ACMR %.3f -> %.3f, ATVR %.3f -> %.3f (%.2f ms)\n",
+		numSubdivisions, mesh.Vertices.size(), mesh.Indices32.size() / 3, mesh.VertexBytes() + mesh.IndexBytes(), elapsedMs,
+		before.acmr, after.acmr, before.atvr, after.atvr, optimizeMs);
+	OutputDebugStringA(report);
+	sprintf_s(report, "Geosphere: %zu chunks, %zu vertices with chunk borders, index buffer %zu -> %zu bytes\n",
+		chunked.Chunks.size(), vertices.size(), mesh.IndexBytes(), chunked.IndexBytes());
+	OutputDebugStringA(report);
+
+	XMFLOAT3 meshOrigin(0.0f, 0.0f, 0.0f);
+	float meshScale = 1.0f;
+	std::vector<PackedVertex> packedVertices;
+	if (packed)
+	{
+		VertexPacking::PackingReport packing;
+		VertexPacking::PackVertices(vertices, packedVertices, meshOrigin, meshScale, &packing);
+
+		sprintf_s(report, "Geosphere packed vertices: %zu -> %zu bytes (%.2fx), max error position %.6f, normal %.4f deg, tangent %.4f deg\n",
+			packing.sourceBytes, packing.packedBytes, (double)packing.sourceBytes / packing.packedBytes,
+			packing.maxPositionError, packing.maxNormalErrorDegrees, packing.maxTangentErrorDegrees);
+		OutputDebugStringA(report);
+	}
+
+	const void* vertexPointer = packed ? (const void*)&packedVertices[0] : (const void*)&vertices[0];
+
+	MeshBlob blob = MeshCache::MakeBlob(vertexPointer, stride, vertices.size(), chunked);
+	blob.meshOrigin = meshOrigin;
+	blob.meshScale = meshScale;
+	Store(cachePath, key, blob);
+
+	return Add(renderer, key, blob, meshlets);
+}
+
+void GeometryCache::Release(const SharedGeometry*& geometry)
+{
+	const uint32_t slot = GetSlot(geometry);
+	if (slot != MeshRegistry::NONE && m_registry.Release(slot))
+	{
+		ReleaseBuffers(*m_geometry[slot]);
+		m_geometry[slot].reset();
+	}
+	geometry = nullptr;
+}
+
+void GeometryCache::ReleaseUploadBuffers()
+{
+	for (std::unique_ptr<SharedGeometry>& geometry : m_geometry)
+	{
+		if (geometry)
+		{
+			ReleaseResource(geometry->indexBufferUpload);
+			ReleaseResource(geometry->vertexBufferUpload);
+		}
+	}
+}
+
+void GeometryCache::Report() const
+{
+	Statistics statistics = GetStatistics();
+
+	char report[256];
+	sprintf_s(report, "Geometry cache: %zu meshes, %zu references, %zu bytes of vertex and index buffers, %zu bytes saved by sharing\n",
+		statistics.meshes, statistics.references, statistics.bytes, statistics.bytesShared);
+	OutputDebugStringA(report);
+	const std::vector<std::unique_ptr<MeshRegistry::Entry>>& entries = m_registry.GetEntries();
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		const MeshRegistry::Entry& entry = *entries[i];
+		if (entry.references == 0)
+		{
+			continue;
+		}
+		sprintf_s(report, "Geometry cache:   %s, radius %g, %u subdivisions, %u byte vertices: %u references, %zu bytes, %zu meshlets\n",
+			entry.generator.c_str(), entry.key.radius, entry.key.subdivisions, entry.key.vertexStride,
+			entry.references, entry.bytes, m_geometry[i]->meshlets.Meshlets.size());
+		OutputDebugStringA(report);
+	}
+}
+
+void GeometryCache::Store(const std::wstring& path, const MeshCache::Key& key, const MeshBlob& mesh)
+{
+	if (!MeshCache::Write(path, key, mesh))
+	{
+		OutputDebugStringA("GeometryCache: could not write the mesh cache\n");
+	}
+}
+
+void GeometryCache::Upload(Graphics* renderer, const MeshBlob& mesh, SharedGeometry& geometry)
+{
+	int bufferSize = (int)mesh.VertexBytes();
+
+	renderer->CreateCommittedBuffer(geometry.vertexBuffer, geometry.vertexBufferUpload, &CD3DX12_RESOURCE_DESC::Buffer(bufferSize));
+
+	D3D12_SUBRESOURCE_DATA vertexData = {};
+	vertexData.pData = mesh.vertices;
+	vertexData.RowPitch = bufferSize;
+	vertexData.SlicePitch = bufferSize;
+
+	UpdateSubresources(renderer->GetCommandList(), geometry.vertexBuffer, geometry.vertexBufferUpload, 0, 0, 1, &vertexData);
+	renderer->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(geometry.vertexBuffer, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER));
+
+	geometry.vertexBufferView.BufferLocation = geometry.vertexBuffer->GetGPUVirtualAddress();
+	geometry.vertexBufferView.StrideInBytes = mesh.vertexStride;
+	geometry.vertexBufferView.SizeInBytes = bufferSize;
+
+	// Index buffer sizes must be a multiple of 4.
+	bufferSize = (int)((mesh.IndexBytes() + 3) & ~3);
+
+	renderer->CreateCommittedBuffer(geometry.indexBuffer, geometry.indexBufferUpload, &CD3DX12_RESOURCE_DESC::Buffer(bufferSize));
+
+	D3D12_SUBRESOURCE_DATA indexData = {};
+	indexData.pData = mesh.indices;
+	indexData.RowPitch = mesh.IndexBytes();
+	indexData.SlicePitch = mesh.IndexBytes();
+
+	UpdateSubresources(renderer->GetCommandList(), geometry.indexBuffer, geometry.indexBufferUpload, 0, 0, 1, &indexData);
+	renderer->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(geometry.indexBuffer, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_INDEX_BUFFER));
+
+	geometry.indexBufferView.BufferLocation = geometry.indexBuffer->GetGPUVirtualAddress();
+	geometry.indexBufferView.Format = DXGI_FORMAT_R16_UINT;
+	geometry.indexBufferView.SizeInBytes = bufferSize;
+}
+
+void GeometryCache::BuildMeshlets(const MeshCache::Key& key, const MeshBlob& mesh, SharedGeometry& geometry)
+{
+	std::vector<XMFLOAT3> positions;
+	std::vector<uint32_t> indices;
+	MeshletBuilder::GetGeometry(mesh, positions, indices);
+
+	auto start = steady_clock::now();
+	MeshletBuilder::Build(positions, indices, geometry.meshlets);
+	double buildMs = duration<double, std::milli>(steady_clock::now() - start).count();
+
+	const MeshletBuilder::MeshletMesh& built = geometry.meshlets;
+	char report[256];
+	sprintf_s(report, "%s: %zu meshlets, %.1f vertices and %.1f triangles on average, %zu bytes, built in %.1f ms\n",
+		key.generator, built.Meshlets.size(), (double)built.VertexIndices.size() / built.Meshlets.size(),
+		(double)built.Triangles.size() / built.Meshlets.size(), built.Bytes(), buildMs);
+	OutputDebugStringA(report);
+}
+
+void GeometryCache::ReleaseBuffers(SharedGeometry& geometry)
+{
+	ReleaseResource(geometry.indexBufferUpload);
+	ReleaseResource(geometry.indexBuffer);
+	ReleaseResource(geometry.vertexBufferUpload);
+	ReleaseResource(geometry.vertexBuffer);
+}
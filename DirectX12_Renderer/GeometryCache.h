@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Renderer.h"
+#include "MeshletBuilder.h"
+#include "MeshRegistry.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace graphics;
+
+// Vertex and index buffers of one mesh, shared by everything that draws it. Shaders place a
+// vertex at meshOrigin + meshScale * position, times the scale of whoever draws it.
+struct SharedGeometry
+{
+	ID3D12Resource* vertexBuffer;
+	ID3D12Resource* vertexBufferUpload;
+	ID3D12Resource* indexBuffer;
+	ID3D12Resource* indexBufferUpload;
+	D3D12_VERTEX_BUFFER_VIEW vertexBufferView;
+	D3D12_INDEX_BUFFER_VIEW indexBufferView;
+	std::vector<MeshChunk> chunks;
+	XMFLOAT3 meshOrigin;	// PackedVertex dequantization, 0 and 1 for float vertices
+	float meshScale;
+	MeshletBuilder::MeshletMesh meshlets;	// empty unless asked for when the mesh was added
+	size_t bytes;	// vertex and index buffer
+};
+
+// GPU meshes keyed by the parameters they were generated from, MeshCache::Key. Everyone asking
+// for the same key gets the same buffers and holds a reference until Release; the buffers are
+// freed with the last one. The keys and references are kept by MeshRegistry. Meshes that only differ by a uniform scale should be generated once
+// at unit size and scaled in the shader.
+class GeometryCache
+{
+public:
+	typedef MeshRegistry::Statistics Statistics;
+
+	GeometryCache();
+	~GeometryCache();
+
+	// Adds a reference to the mesh for key; nullptr if there is none.
+	const SharedGeometry* Acquire(const MeshCache::Key& key);
+
+	// Acquire, or else map the mesh from the MeshCache file at path and add it. nullptr if the file
+	// is missing or holds another key.
+	const SharedGeometry* Load(Graphics* renderer, const std::wstring& path, const MeshCache::Key& key, bool meshlets);
+
+	// Acquire, or else upload mesh as the mesh for key with one reference. meshlets builds
+	// MeshletBuilder meshlets for it.
+	const SharedGeometry* Add(Graphics* renderer, const MeshCache::Key& key, const MeshBlob& mesh, bool meshlets);
+
+	// Unit radius geosphere with outward normals, from memory, the MeshCache file or generated,
+	// chunked for 16-bit indices, as float Vertex or PackedVertex.
+	const SharedGeometry* AcquireGeosphere(Graphics* renderer, UINT numSubdivisions, UINT chunkVertices, bool packed, bool meshlets);
+
+	// Drops a reference and sets geometry to nullptr. The last one frees the buffers at once,
+	// so only release what no command list in flight still draws.
+	void Release(const SharedGeometry*& geometry);
+
+	// Once the command list that uploaded the meshes has run.
+	void ReleaseUploadBuffers();
+
+	Statistics GetStatistics() const { return m_registry.GetStatistics(); }
+
+	// Statistics and every mesh with its references to the debug output.
+	void Report() const;
+
+	// Writes a MeshCache file for key; a failed write only costs the next startup a rebuild.
+	static void Store(const std::wstring& path, const MeshCache::Key& key, const MeshBlob& mesh);
+
+private:
+	GeometryCache(const GeometryCache&) = delete;
+	GeometryCache& operator=(const GeometryCache&) = delete;
+
+	// The registry slot of geometry, MeshRegistry::NONE if it is not held here.
+	uint32_t GetSlot(const SharedGeometry* geometry) const;
+	static void Upload(Graphics* renderer, const MeshBlob& mesh, SharedGeometry& geometry);
+	static void BuildMeshlets(const MeshCache::Key& key, const MeshBlob& mesh, SharedGeometry& geometry);
+	static void ReleaseBuffers(SharedGeometry& geometry);
+
+	MeshRegistry m_registry;
+	std::vector<std::unique_ptr<SharedGeometry>> m_geometry;	// by registry slot, empty for a free one
+};
@@ -0,0 +1,304 @@
+#include "GeometryGenerator.h"
+#include <cmath>
+
+namespace
+{
+	const uint64_t EMPTY_EDGE = ~0ull;
+
+	const float ICOSAHEDRON_X = 0.525731f;
+	const float ICOSAHEDRON_Z = 0.850651f;
+
+	const XMFLOAT3 ICOSAHEDRON_VERTICES[12] =
+	{
+		XMFLOAT3(-ICOSAHEDRON_X, 0.0f, ICOSAHEDRON_Z),  XMFLOAT3(ICOSAHEDRON_X, 0.0f, ICOSAHEDRON_Z),
+		XMFLOAT3(-ICOSAHEDRON_X, 0.0f, -ICOSAHEDRON_Z), XMFLOAT3(ICOSAHEDRON_X, 0.0f, -ICOSAHEDRON_Z),
+		XMFLOAT3(0.0f, ICOSAHEDRON_Z, ICOSAHEDRON_X),   XMFLOAT3(0.0f, ICOSAHEDRON_Z, -ICOSAHEDRON_X),
+		XMFLOAT3(0.0f, -ICOSAHEDRON_Z, ICOSAHEDRON_X),  XMFLOAT3(0.0f, -ICOSAHEDRON_Z, -ICOSAHEDRON_X),
+		XMFLOAT3(ICOSAHEDRON_Z, ICOSAHEDRON_X, 0.0f),   XMFLOAT3(-ICOSAHEDRON_Z, ICOSAHEDRON_X, 0.0f),
+		XMFLOAT3(ICOSAHEDRON_Z, -ICOSAHEDRON_X, 0.0f),  XMFLOAT3(-ICOSAHEDRON_Z, -ICOSAHEDRON_X, 0.0f)
+	};
+
+	const uint32_t ICOSAHEDRON_INDICES[60] =
+	{
+		1,4,0,  4,9,0,  4,5,9,  8,5,4,  1,8,4,
+		1,10,8, 10,3,8, 8,3,5,  3,2,5,  3,7,2,
+		3,10,7, 10,6,7, 6,11,7, 6,0,11, 6,1,0,
+		10,1,6, 11,0,9, 2,11,9, 5,2,9,  11,2,7
+	};
+
+	XMFLOAT3 Midpoint(const XMFLOAT3& p0, const XMFLOAT3& p1)
+	{
+		return XMFLOAT3(0.5f * (p0.x + p1.x), 0.5f * (p0.y + p1.y), 0.5f * (p0.z + p1.z));
+	}
+
+	// Open addressing map from an undirected edge (v0, v1) to the index of its midpoint vertex.
+	// Sized once per subdivision pass from the known edge count, so it never rehashes.
+	class MidpointCache
+	{
+	public:
+		void Reset(uint64_t edgeCount)
+		{
+			size_t capacity = 16;
+			while (capacity < edgeCount * 2)
+			{
+				capacity <<= 1;
+			}
+			m_mask = capacity - 1;
+			m_keys.assign(capacity, EMPTY_EDGE);
+			m_values.resize(capacity);
+		}
+
+		// Returns true and fills index if the edge is already split, otherwise reserves
+		// the slot for index and returns false.
+		bool FindOrInsert(uint32_t v0, uint32_t v1, uint32_t& index)
+		{
+			const uint64_t key = v0 < v1 ? ((uint64_t)v0 << 32) | v1 : ((uint64_t)v1 << 32) | v0;
+			size_t slot = (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & m_mask;
+
+			while (m_keys[slot] != EMPTY_EDGE)
+			{
+				if (m_keys[slot] == key)
+				{
+					index = m_values[slot];
+					return true;
+				}
+				slot = (slot + 1) & m_mask;
+			}
+
+			m_keys[slot] = key;
+			m_values[slot] = index;
+			return false;
+		}
+
+	private:
+		std::vector<uint64_t> m_keys;
+		std::vector<uint32_t> m_values;
+		size_t m_mask = 0;
+	};
+}
+
+uint64_t GeometryGenerator::GeosphereVertexCount(uint32_t numSubdivisions)
+{
+	return 10ull * (1ull << (2 * numSubdivisions)) + 2;
+}
+
+uint64_t GeometryGenerator::GeosphereTriangleCount(uint32_t numSubdivisions)
+{
+	return 20ull * (1ull << (2 * numSubdivisions));
+}
+
+void GeometryGenerator::CreateGeosphere(float radius, uint32_t numSubdivisions, MeshData& meshData)
+{
+	meshData.Vertices.clear();
+	meshData.Indices32.clear();
+
+	// Every vertex of the final mesh is appended exactly once, so reserve it all up front.
+	meshData.Vertices.reserve((size_t)GeosphereVertexCount(numSubdivisions));
+	meshData.Vertices.resize(12);
+	meshData.Indices32.assign(ICOSAHEDRON_INDICES, ICOSAHEDRON_INDICES + 60);
+
+	for (uint32_t i = 0; i < 12; ++i)
+	{
+		meshData.Vertices[i].Position = ICOSAHEDRON_VERTICES[i];
+	}
+
+	for (uint32_t i = 0; i < numSubdivisions; ++i)
+	{
+		Subdivide(meshData);
+	}
+
+	ProjectToSphere(radius, meshData);
+}
+
+void GeometryGenerator::CreateGeosphereExpanded(float radius, uint32_t numSubdivisions, MeshData& meshData)
+{
+	meshData.Vertices.resize(12);
+	meshData.Indices32.assign(ICOSAHEDRON_INDICES, ICOSAHEDRON_INDICES + 60);
+	for (uint32_t i = 0; i < 12; ++i)
+	{
+		meshData.Vertices[i].Position = ICOSAHEDRON_VERTICES[i];
+	}
+
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	for (uint32_t pass = 0; pass < numSubdivisions; ++pass)
+	{
+		vertices.swap(meshData.Vertices);
+		indices.swap(meshData.Indices32);
+
+		// The corners and the midpoints m0, m1 and m2 of Subdivide, split into the same four triangles.
+		const size_t numTris = indices.size() / 3;
+		const uint32_t corners[12] = { 0, 3, 5,  3, 4, 5,  5, 4, 2,  3, 1, 4 };
+		meshData.Vertices.resize(numTris * 6);
+		meshData.Indices32.resize(numTris * 12);
+		for (size_t i = 0; i < numTris; ++i)
+		{
+			Vertex* v = &meshData.Vertices[i * 6];
+			v[0] = vertices[indices[i * 3 + 0]];
+			v[1] = vertices[indices[i * 3 + 1]];
+			v[2] = vertices[indices[i * 3 + 2]];
+			v[3].Position = Midpoint(v[0].Position, v[1].Position);
+			v[4].Position = Midpoint(v[1].Position, v[2].Position);
+			v[5].Position = Midpoint(v[0].Position, v[2].Position);
+			for (uint32_t c = 0; c < 12; ++c)
+			{
+				meshData.Indices32[i * 12 + c] = (uint32_t)(i * 6) + corners[c];
+			}
+		}
+	}
+
+	ProjectToSphere(radius, meshData);
+}
+
+void GeometryGenerator::ProjectToSphere(float radius, MeshData& meshData)
+{
+	for (size_t i = 0; i < meshData.Vertices.size(); ++i)
+	{
+		Vertex& v = meshData.Vertices[i];
+
+		// Project onto unit sphere.
+		float invLength = 1.0f / sqrtf(v.Position.x * v.Position.x + v.Position.y * v.Position.y + v.Position.z * v.Position.z);
+		v.Normal = XMFLOAT3(v.Position.x * invLength, v.Position.y * invLength, v.Position.z * invLength);
+
+		// Project onto sphere.
+		v.Position = XMFLOAT3(radius * v.Normal.x, radius * v.Normal.y, radius * v.Normal.z);
+
+		// Derive texture coordinates from spherical coordinates, theta in [0, 2*PI).
+		float theta = atan2f(v.Normal.z, v.Normal.x);
+		if (theta < 0.0f)
+		{
+			theta += XM_2PI;
+		}
+		float phi = acosf(fmaxf(-1.0f, fminf(1.0f, v.Normal.y)));
+
+		v.TexC.x = theta / XM_2PI;
+		v.TexC.y = phi / XM_PI;
+
+		// Partial derivative of P with respect to theta, normalized. At the poles the
+		// derivative vanishes, so fall back to +X like the analytic limit along theta = 0.
+		float tx = -sinf(phi) * sinf(theta);
+		float tz = +sinf(phi) * cosf(theta);
+		float tLength = sqrtf(tx * tx + tz * tz);
+		v.TangentU = tLength > 0.0f ? XMFLOAT3(tx / tLength, 0.0f, tz / tLength) : XMFLOAT3(1.0f, 0.0f, 0.0f);
+	}
+}
+
+void GeometryGenerator::Subdivide(MeshData& meshData)
+{
+	/*
+	       v1
+	       *
+	      / \
+	     /   \
+	  m0*-----*m1
+	   / \   / \
+	  /   \ /   \
+	 *-----*-----*
+	 v0    m2     v2
+	*/
+
+	std::vector<Vertex>& vertices = meshData.Vertices;
+	const std::vector<uint32_t> indices = std::move(meshData.Indices32);
+
+	const size_t numTris = indices.size() / 3;
+
+	// Euler characteristic of a sphere: V - E + F = 2.
+	MidpointCache cache;
+	cache.Reset(vertices.size() + numTris - 2);
+
+	std::vector<uint32_t>& newIndices = meshData.Indices32;
+	newIndices.resize(numTris * 12);
+
+	auto midpoint = [&](uint32_t a, uint32_t b)
+	{
+		uint32_t index = (uint32_t)vertices.size();
+		if (!cache.FindOrInsert(a, b, index))
+		{
+			// For subdivision, we just care about the position component. The other
+			// vertex components are derived once the sphere is complete.
+			Vertex m;
+			m.Position = Midpoint(vertices[a].Position, vertices[b].Position);
+			vertices.push_back(m);
+		}
+		return index;
+	};
+
+	for (size_t i = 0; i < numTris; ++i)
+	{
+		uint32_t v0 = indices[i * 3 + 0];
+		uint32_t v1 = indices[i * 3 + 1];
+		uint32_t v2 = indices[i * 3 + 2];
+
+		uint32_t m0 = midpoint(v0, v1);
+		uint32_t m1 = midpoint(v1, v2);
+		uint32_t m2 = midpoint(v0, v2);
+
+		uint32_t* tri = &newIndices[i * 12];
+
+		tri[0] = v0; tri[1] = m0; tri[2] = m2;
+		tri[3] = m0; tri[4] = m1; tri[5] = m2;
+		tri[6] = m2; tri[7] = m1; tri[8] = v2;
+		tri[9] = m0; tri[10] = v1; tri[11] = m1;
+	}
+}
+
+bool GeometryGenerator::Validate()
+{
+	MeshData welded;
+	MeshData expanded;
+	float firstWinding = 0.0f;
+	for (uint32_t n = 0; n <= 5; ++n)
+	{
+		CreateGeosphere(2.0f, n, welded);
+		CreateGeosphereExpanded(2.0f, n, expanded);
+		if (welded.Vertices.size() != GeosphereVertexCount(n) || welded.Indices32.size() != 3 * GeosphereTriangleCount(n) ||
+			expanded.Indices32.size() != welded.Indices32.size())
+		{
+			return false;
+		}
+		for (const Vertex& v : welded.Vertices)
+		{
+			float length = sqrtf(v.Position.x * v.Position.x + v.Position.y * v.Position.y + v.Position.z * v.Position.z);
+			if (fabsf(length - 2.0f) > 1e-5f)
+			{
+				return false;
+			}
+		}
+
+		// Corner for corner at the positions of the expanded triangles, so wound the same way,
+		// and every triangle turning the same way seen from outside.
+		for (size_t i = 0; i < welded.Indices32.size(); i += 3)
+		{
+			XMFLOAT3 corners[3];
+			for (size_t c = 0; c < 3; ++c)
+			{
+				if (welded.Indices32[i + c] >= welded.Vertices.size())
+				{
+					return false;
+				}
+				const XMFLOAT3& p = welded.Vertices[welded.Indices32[i + c]].Position;
+				const XMFLOAT3& q = expanded.Vertices[expanded.Indices32[i + c]].Position;
+				if (p.x != q.x || p.y != q.y || p.z != q.z)
+				{
+					return false;
+				}
+				corners[c] = p;
+			}
+
+			const XMFLOAT3 e0(corners[1].x - corners[0].x, corners[1].y - corners[0].y, corners[1].z - corners[0].z);
+			const XMFLOAT3 e1(corners[2].x - corners[0].x, corners[2].y - corners[0].y, corners[2].z - corners[0].z);
+			const XMFLOAT3 normal(e0.y * e1.z - e0.z * e1.y, e0.z * e1.x - e0.x * e1.z, e0.x * e1.y - e0.y * e1.x);
+			const float winding = normal.x * (corners[0].x + corners[1].x + corners[2].x) +
+				normal.y * (corners[0].y + corners[1].y + corners[2].y) + normal.z * (corners[0].z + corners[1].z + corners[2].z);
+			if (firstWinding == 0.0f)
+			{
+				firstWinding = winding;
+			}
+			if (winding * firstWinding <= 0.0f)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace DirectX;
+
+struct Vertex
+{
+	Vertex() {}
+	Vertex(
+		float px, float py, float pz,
+		float nx, float ny, float nz,
+		float tx, float ty, float tz,
+		float u, float v) :
+		Position(px, py, pz),
+		Normal(nx, ny, nz),
+		TangentU(tx, ty, tz),
+		TexC(u, v) {}
+
+	XMFLOAT3 Position;
+	XMFLOAT3 Normal;
+	XMFLOAT3 TangentU;
+	XMFLOAT2 TexC;
+};
+
+// CPU-only mesh generation. Nothing here touches the device, so meshes can be built
+// and measured on a machine without a GPU.
+class GeometryGenerator
+{
+public:
+	struct MeshData
+	{
+		std::vector<Vertex> Vertices;
+		std::vector<uint32_t> Indices32;
+
+		size_t VertexBytes() const { return Vertices.size() * sizeof(Vertex); }
+		size_t IndexBytes() const { return Indices32.size() * sizeof(uint32_t); }
+	};
+
+	// Icosahedron subdivided numSubdivisions times and projected onto a sphere.
+	// Vertices are shared between neighbouring triangles through an edge midpoint cache.
+	static void CreateGeosphere(float radius, uint32_t numSubdivisions, MeshData& meshData);
+
+	// The same triangles the way Terrain and Sky used to build them: every pass gives each
+	// triangle six vertices of its own. For Validate and the benchmark.
+	static void CreateGeosphereExpanded(float radius, uint32_t numSubdivisions, MeshData& meshData);
+
+	// Closed form element counts of a subdivided icosahedron (V = 10 * 4^n + 2, F = 20 * 4^n).
+	static uint64_t GeosphereVertexCount(uint32_t numSubdivisions);
+	static uint64_t GeosphereTriangleCount(uint32_t numSubdivisions);
+
+	// True if geospheres up to 5 subdivisions have the closed form counts, lie on their sphere,
+	// and draw the triangles of the expanded geospheres corner for corner, all wound alike.
+	static bool Validate();
+
+private:
+	static void Subdivide(MeshData& meshData);
+	static void ProjectToSphere(float radius, MeshData& meshData);
+};
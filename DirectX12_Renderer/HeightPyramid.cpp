@@ -0,0 +1,367 @@
+#include "HeightPyramid.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <emmintrin.h>
+
+namespace
+{
+	const char PYRAMID_MAGIC[4] = { 'H', 'P', 'Y', 'R' };
+	const uint32_t PYRAMID_VERSION = 1;
+
+	struct PyramidHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t width;
+		uint32_t height;
+		uint32_t levels;
+		uint32_t padding;
+		uint64_t hash;
+	};
+
+	// The cache path as the fstreams open it: MSVC's take wide paths, other libraries' narrow ones,
+	// and the paths are ASCII there.
+#ifdef _WIN32
+	const std::wstring& FilePath(const std::wstring& path)
+	{
+		return path;
+	}
+#else
+	std::string FilePath(const std::wstring& path)
+	{
+		return std::string(path.begin(), path.end());
+	}
+#endif
+
+	int Wrap(int value, int size)
+	{
+		int wrapped = value % size;
+		return wrapped < 0 ? wrapped + size : wrapped;
+	}
+
+	// Splits the inclusive range lo..hi, at most size long, into ranges inside [0, size).
+	int WrapRange(int lo, int hi, int size, int (&ranges)[2][2])
+	{
+		if (hi - lo + 1 >= size)
+		{
+			ranges[0][0] = 0;
+			ranges[0][1] = size - 1;
+			return 1;
+		}
+
+		int start = Wrap(lo, size);
+		int end = start + (hi - lo);
+		ranges[0][0] = start;
+		ranges[0][1] = std::min(end, size - 1);
+		if (end < size)
+		{
+			return 1;
+		}
+		ranges[1][0] = 0;
+		ranges[1][1] = end - size;
+		return 2;
+	}
+}
+
+HeightPyramid::HeightPyramid() :
+	m_width(0),
+	m_height(0),
+	m_hash(0),
+	m_levels()
+{
+}
+
+uint64_t HeightPyramid::Hash(const std::vector<uint16_t>& heights)
+{
+	// Four heights per step; this runs on every startup.
+	uint64_t hash = 14695981039346656037ull;
+	size_t i = 0;
+	for (; i + 4 <= heights.size(); i += 4)
+	{
+		uint64_t word = heights[i] | ((uint64_t)heights[i + 1] << 16) | ((uint64_t)heights[i + 2] << 32) | ((uint64_t)heights[i + 3] << 48);
+		hash = (hash ^ word) * 1099511628211ull;
+	}
+	for (; i < heights.size(); ++i)
+	{
+		hash = (hash ^ heights[i]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+void HeightPyramid::InitLevels(std::vector<uint16_t> heights, uint32_t width, uint32_t height)
+{
+	m_width = width;
+	m_height = height;
+	m_levels.clear();
+
+	Level base;
+	base.width = width;
+	base.height = height;
+	base.minimum = std::move(heights);
+	m_levels.push_back(std::move(base));
+
+	while (m_levels.back().width > 1 || m_levels.back().height > 1)
+	{
+		Level level;
+		level.width = (m_levels.back().width + 1) / 2;
+		level.height = (m_levels.back().height + 1) / 2;
+		level.minimum.resize((size_t)level.width * level.height);
+		level.maximum.resize((size_t)level.width * level.height);
+		m_levels.push_back(std::move(level));
+	}
+}
+
+void HeightPyramid::Build(std::vector<uint16_t> heights, uint32_t width, uint32_t height)
+{
+	m_hash = Hash(heights);
+	InitLevels(std::move(heights), width, height);
+	for (uint32_t level = 1; level < m_levels.size(); ++level)
+	{
+		BuildLevel(level);
+	}
+}
+
+void HeightPyramid::BuildLevel(uint32_t level)
+{
+	const Level& source = m_levels[level - 1];
+	Level& target = m_levels[level];
+
+	ParallelFor(target.height, [&source, &target](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t y = begin; y < end; ++y)
+		{
+			size_t row0 = (size_t)(2 * y) * source.width;
+			size_t row1 = (size_t)std::min(2 * y + 1, source.height - 1) * source.width;
+			ReduceRows(source.Min() + row0, source.Min() + row1, source.width, false, &target.minimum[(size_t)y * target.width]);
+			ReduceRows(source.Max() + row0, source.Max() + row1, source.width, true, &target.maximum[(size_t)y * target.width]);
+		}
+	});
+}
+
+void HeightPyramid::ReduceRows(const uint16_t* row0, const uint16_t* row1, uint32_t width, bool maximum, uint16_t* out)
+{
+	// SSE2 only has signed 16-bit min and max; flipping the top bit maps unsigned order onto it.
+	const __m128i bias = _mm_set1_epi16((short)0x8000);
+
+	uint32_t i = 0;
+	for (; i + 16 <= width; i += 16)
+	{
+		__m128i halves[2];
+		for (int h = 0; h < 2; ++h)
+		{
+			__m128i a = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row0 + i + 8 * h)), bias);
+			__m128i b = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(row1 + i + 8 * h)), bias);
+			__m128i v = maximum ? _mm_max_epi16(a, b) : _mm_min_epi16(a, b);
+
+			// Odd texels onto the even ones, then sign extend the 32-bit lanes for the pack.
+			__m128i odd = _mm_srli_epi32(v, 16);
+			v = maximum ? _mm_max_epi16(v, odd) : _mm_min_epi16(v, odd);
+			halves[h] = _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+		}
+		__m128i packed = _mm_xor_si128(_mm_packs_epi32(halves[0], halves[1]), bias);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i / 2), packed);
+	}
+
+	const uint32_t outWidth = (width + 1) / 2;
+	for (uint32_t x = i / 2; x < outWidth; ++x)
+	{
+		uint32_t a = 2 * x;
+		uint32_t b = std::min(2 * x + 1, width - 1);
+		if (maximum)
+		{
+			out[x] = std::max(std::max(row0[a], row0[b]), std::max(row1[a], row1[b]));
+		}
+		else
+		{
+			out[x] = std::min(std::min(row0[a], row0[b]), std::min(row1[a], row1[b]));
+		}
+	}
+}
+
+bool HeightPyramid::LoadOrBuild(const std::wstring& cachePath, std::vector<uint16_t> heights, uint32_t width, uint32_t height)
+{
+	m_hash = Hash(heights);
+	InitLevels(std::move(heights), width, height);
+	if (ReadLevels(cachePath))
+	{
+		return true;
+	}
+
+	for (uint32_t level = 1; level < m_levels.size(); ++level)
+	{
+		BuildLevel(level);
+	}
+	Save(cachePath);
+	return false;
+}
+
+bool HeightPyramid::ReadLevels(const std::wstring& path)
+{
+	std::ifstream file(FilePath(path), std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+
+	PyramidHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+		!std::equal(PYRAMID_MAGIC, PYRAMID_MAGIC + 4, header.magic) || header.version != PYRAMID_VERSION ||
+		header.width != m_width || header.height != m_height || header.levels != m_levels.size() || header.hash != m_hash)
+	{
+		return false;
+	}
+
+	for (uint32_t level = 1; level < m_levels.size(); ++level)
+	{
+		Level& l = m_levels[level];
+		std::streamsize bytes = (std::streamsize)(l.minimum.size() * sizeof(uint16_t));
+		if (!file.read(reinterpret_cast<char*>(l.minimum.data()), bytes) ||
+			!file.read(reinterpret_cast<char*>(l.maximum.data()), bytes))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool HeightPyramid::Save(const std::wstring& path) const
+{
+	std::ofstream file(FilePath(path), std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		return false;
+	}
+
+	PyramidHeader header = {};
+	std::copy(PYRAMID_MAGIC, PYRAMID_MAGIC + 4, header.magic);
+	header.version = PYRAMID_VERSION;
+	header.width = m_width;
+	header.height = m_height;
+	header.levels = (uint32_t)m_levels.size();
+	header.hash = m_hash;
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	for (uint32_t level = 1; level < m_levels.size(); ++level)
+	{
+		const Level& l = m_levels[level];
+		std::streamsize bytes = (std::streamsize)(l.minimum.size() * sizeof(uint16_t));
+		file.write(reinterpret_cast<const char*>(l.minimum.data()), bytes);
+		file.write(reinterpret_cast<const char*>(l.maximum.data()), bytes);
+	}
+	return (bool)file;
+}
+
+void HeightPyramid::QueryTexels(int x0, int x1, int y0, int y1, uint16_t& minHeight, uint16_t& maxHeight) const
+{
+	int xRanges[2][2];
+	int yRanges[2][2];
+	int xCount = WrapRange(x0, x1, (int)m_width, xRanges);
+	int yCount = WrapRange(y0, y1, (int)m_height, yRanges);
+
+	// The coarsest level that still reads no more than a few texels per side.
+	int span = std::max(std::min(x1 - x0 + 1, (int)m_width), std::min(y1 - y0 + 1, (int)m_height));
+	uint32_t level = 0;
+	while (level + 1 < m_levels.size() && (span >> (level + 1)) >= 4)
+	{
+		++level;
+	}
+	const Level& l = m_levels[level];
+
+	minHeight = 0xFFFF;
+	maxHeight = 0;
+	for (int j = 0; j < yCount; ++j)
+	{
+		for (int i = 0; i < xCount; ++i)
+		{
+			for (int y = yRanges[j][0] >> level; y <= yRanges[j][1] >> level; ++y)
+			{
+				const uint16_t* minRow = l.Min() + (size_t)y * l.width;
+				const uint16_t* maxRow = l.Max() + (size_t)y * l.width;
+				for (int x = xRanges[i][0] >> level; x <= xRanges[i][1] >> level; ++x)
+				{
+					minHeight = std::min(minHeight, minRow[x]);
+					maxHeight = std::max(maxHeight, maxRow[x]);
+				}
+			}
+		}
+	}
+}
+
+void HeightPyramid::Query(float thetaMin, float thetaMax, float phiMin, float phiMax, uint16_t& minHeight, uint16_t& maxHeight) const
+{
+	// Texel centers sit at half integers, so a bilinear sample at t reads floor(t - 0.5) and the next one.
+	int x0 = (int)floorf(thetaMin / 6.28318531f * m_width - 0.5f);
+	int x1 = (int)floorf(thetaMax / 6.28318531f * m_width - 0.5f) + 1;
+	int y0 = (int)floorf(phiMin / 3.14159265f * m_height - 0.5f);
+	int y1 = (int)floorf(phiMax / 3.14159265f * m_height - 0.5f) + 1;
+	QueryTexels(x0, x1, y0, y1, minHeight, maxHeight);
+}
+
+bool HeightPyramid::Validate(uint32_t queries) const
+{
+	for (uint32_t level = 1; level < m_levels.size(); ++level)
+	{
+		const Level& source = m_levels[level - 1];
+		const Level& target = m_levels[level];
+		for (uint32_t y = 0; y < target.height; ++y)
+		{
+			for (uint32_t x = 0; x < target.width; ++x)
+			{
+				uint16_t lowest = 0xFFFF;
+				uint16_t highest = 0;
+				for (uint32_t sy = 2 * y; sy <= std::min(2 * y + 1, source.height - 1); ++sy)
+				{
+					for (uint32_t sx = 2 * x; sx <= std::min(2 * x + 1, source.width - 1); ++sx)
+					{
+						lowest = std::min(lowest, source.Min()[(size_t)sy * source.width + sx]);
+						highest = std::max(highest, source.Max()[(size_t)sy * source.width + sx]);
+					}
+				}
+				size_t index = (size_t)y * target.width + x;
+				if (target.minimum[index] != lowest || target.maximum[index] != highest)
+				{
+					return false;
+				}
+			}
+		}
+	}
+
+	// Rectangles of every size, including ones that wrap around the edges.
+	uint32_t seed = 12345;
+	auto random = [&seed](int range)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (int)((seed >> 8) % (uint32_t)range);
+	};
+	const std::vector<uint16_t>& heights = GetHeights();
+	for (uint32_t q = 0; q < queries; ++q)
+	{
+		int size = 1 << random(10);
+		int x0 = random(m_width + 2 * size) - size;
+		int y0 = random(m_height + 2 * size) - size;
+		int x1 = x0 + random(size);
+		int y1 = y0 + random(size);
+
+		uint16_t lowest = 0xFFFF;
+		uint16_t highest = 0;
+		for (int y = y0; y <= y1; ++y)
+		{
+			for (int x = x0; x <= x1; ++x)
+			{
+				uint16_t h = heights[(size_t)Wrap(y, m_height) * m_width + Wrap(x, m_width)];
+				lowest = std::min(lowest, h);
+				highest = std::max(highest, h);
+			}
+		}
+
+		uint16_t minHeight, maxHeight;
+		QueryTexels(x0, x1, y0, y1, minHeight, maxHeight);
+		if (minHeight > lowest || maxHeight < highest)
+		{
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Min/max mip pyramid over a 16-bit heightmap. Level 0 is the heightmap itself, texel (x, y)
+// of level k holds the lowest and the highest height of the 2^k x 2^k texels it covers.
+// Queries wrap in both directions, like the WRAP sampler of the terrain shaders. CPU only.
+class HeightPyramid
+{
+public:
+	HeightPyramid();
+
+	// Takes the heights, row major, and builds the levels on all cores.
+	void Build(std::vector<uint16_t> heights, uint32_t width, uint32_t height);
+
+	// Takes the heights and reads the levels from a cache file when it was written for the same
+	// heights, otherwise builds them and rewrites the cache. True if the cache was used.
+	bool LoadOrBuild(const std::wstring& cachePath, std::vector<uint16_t> heights, uint32_t width, uint32_t height);
+	bool Save(const std::wstring& path) const;
+
+	bool IsEmpty() const { return m_levels.empty(); }
+	uint32_t GetWidth() const { return m_width; }
+	uint32_t GetHeight() const { return m_height; }
+	uint32_t GetLevelCount() const { return (uint32_t)m_levels.size(); }
+	uint64_t GetHash() const { return m_hash; }
+	const std::vector<uint16_t>& GetHeights() const { return m_levels[0].minimum; }
+
+	// Range over the texels x0..x1, y0..y1 inclusive. Coordinates may lie outside the map and wrap.
+	void QueryTexels(int x0, int x1, int y0, int y1, uint16_t& minHeight, uint16_t& maxHeight) const;
+
+	// Range over every texel a bilinear sample of the angular rectangle can touch, with the
+	// theta = atan2(z, x), phi = acos(y) mapping of DomainShader. thetaMax may exceed pi.
+	void Query(float thetaMin, float thetaMax, float phiMin, float phiMax, uint16_t& minHeight, uint16_t& maxHeight) const;
+
+	// True if every level matches the one below it and random queries contain the range of a
+	// texel by texel scan.
+	bool Validate(uint32_t queries) const;
+
+	// FNV-1a over the heights, four at a time; identifies the source of a saved pyramid.
+	static uint64_t Hash(const std::vector<uint16_t>& heights);
+
+private:
+	struct Level
+	{
+		uint32_t width;
+		uint32_t height;
+		std::vector<uint16_t> minimum;	// level 0 keeps the heights here only
+		std::vector<uint16_t> maximum;
+
+		const uint16_t* Min() const { return minimum.data(); }
+		const uint16_t* Max() const { return maximum.empty() ? minimum.data() : maximum.data(); }
+	};
+
+	void InitLevels(std::vector<uint16_t> heights, uint32_t width, uint32_t height);
+	bool ReadLevels(const std::wstring& path);
+	void BuildLevel(uint32_t level);
+
+	// Halves two rows of a level into one row of the next, SSE2 for the bulk.
+	static void ReduceRows(const uint16_t* row0, const uint16_t* row1, uint32_t width, bool maximum, uint16_t* out);
+
+	uint32_t m_width;
+	uint32_t m_height;
+	uint64_t m_hash;
+	std::vector<Level> m_levels;
+};
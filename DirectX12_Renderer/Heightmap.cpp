@@ -0,0 +1,188 @@
+#include "Heightmap.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	const uint8_t* Row(const void* texels, size_t rowPitch, uint32_t y)
+	{
+		return static_cast<const uint8_t*>(texels) + y * rowPitch;
+	}
+
+	// Lowest and highest finite float of the first channels; NaNs from nodata texels are left out.
+	void FloatRange(const void* texels, size_t rowPitch, uint32_t width, uint32_t height, float& lowest, float& highest)
+	{
+		lowest = INFINITY;
+		highest = -INFINITY;
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			const uint8_t* row = Row(texels, rowPitch, y);
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				float value;
+				memcpy(&value, row + x * sizeof(float), sizeof(float));
+				if (std::isfinite(value))
+				{
+					lowest = std::min(lowest, value);
+					highest = std::max(highest, value);
+				}
+			}
+		}
+		if (lowest > highest)
+		{
+			lowest = highest = 0.0f;
+		}
+	}
+}
+
+size_t Heightmap::TexelBytes(HeightmapFormat format)
+{
+	switch (format)
+	{
+	case HeightmapFormat::R8_UNORM: return 1;
+	case HeightmapFormat::R16_UNORM: return 2;
+	default: return 4;
+	}
+}
+
+void Heightmap::Decode(const void* texels, size_t rowPitch, uint32_t width, uint32_t height, HeightmapFormat format,
+	std::vector<uint16_t>& heights, Range& range)
+{
+	heights.resize((size_t)width * height);
+	range.offset = 0.0f;
+	range.scale = 1.0f;
+
+	float lowest = 0.0f;
+	float toHeight = 0.0f;
+	if (format == HeightmapFormat::R32_FLOAT)
+	{
+		float highest;
+		FloatRange(texels, rowPitch, width, height, lowest, highest);
+		if (highest > lowest)
+		{
+			range.offset = lowest;
+			range.scale = 1.0f / (highest - lowest);
+			toHeight = 65535.0f / (highest - lowest);
+		}
+	}
+
+	uint16_t* out = &heights[0];
+	ParallelFor(height, [=](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t y = begin; y < end; ++y)
+		{
+			const uint8_t* row = Row(texels, rowPitch, y);
+			uint16_t* dst = out + (size_t)y * width;
+			switch (format)
+			{
+			case HeightmapFormat::R16_UNORM:
+				memcpy(dst, row, width * sizeof(uint16_t));
+				break;
+			case HeightmapFormat::R8_UNORM:
+				for (uint32_t x = 0; x < width; ++x)
+				{
+					dst[x] = (uint16_t)(row[x] * 257);
+				}
+				break;
+			case HeightmapFormat::R8G8B8A8_UNORM:
+				for (uint32_t x = 0; x < width; ++x)
+				{
+					dst[x] = (uint16_t)(row[x * 4] * 257);
+				}
+				break;
+			case HeightmapFormat::R32_FLOAT:
+				for (uint32_t x = 0; x < width; ++x)
+				{
+					float value;
+					memcpy(&value, row + x * sizeof(float), sizeof(float));
+					float scaled = std::isfinite(value) ? (value - lowest) * toHeight + 0.5f : 0.0f;
+					dst[x] = (uint16_t)std::min(std::max(scaled, 0.0f), 65535.0f);
+				}
+				break;
+			}
+		}
+	});
+}
+
+bool Heightmap::Validate()
+{
+	std::vector<uint16_t> heights;
+	Range range;
+
+	// Every 16-bit value once, 256 per row, with 24 bytes of padding after each row.
+	const uint32_t width = 256;
+	const size_t pitch16 = width * sizeof(uint16_t) + 24;
+	std::vector<uint8_t> texels(pitch16 * 256, 0xCD);
+	for (uint32_t y = 0; y < 256; ++y)
+	{
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			uint16_t value = (uint16_t)(y * width + x);
+			memcpy(&texels[y * pitch16 + x * sizeof(uint16_t)], &value, sizeof(value));
+		}
+	}
+	Decode(&texels[0], pitch16, width, 256, HeightmapFormat::R16_UNORM, heights, range);
+	for (uint32_t i = 0; i < 65536; ++i)
+	{
+		if (heights[i] != i)
+		{
+			return false;
+		}
+	}
+	if (range.offset != 0.0f || range.scale != 1.0f)
+	{
+		return false;
+	}
+
+	// Every 8-bit value once, alone and as the red channel of RGBA8 with the other channels noisy.
+	std::vector<uint8_t> gray(width + 8, 0xCD);
+	std::vector<uint8_t> rgba(width * 4);
+	for (uint32_t x = 0; x < width; ++x)
+	{
+		gray[x] = (uint8_t)x;
+		rgba[x * 4 + 0] = (uint8_t)x;
+		rgba[x * 4 + 1] = (uint8_t)(x * 7);
+		rgba[x * 4 + 2] = (uint8_t)(x * 13);
+		rgba[x * 4 + 3] = 0xFF;
+	}
+	std::vector<uint16_t> fromRgba;
+	Decode(&gray[0], gray.size(), width, 1, HeightmapFormat::R8_UNORM, heights, range);
+	Decode(&rgba[0], rgba.size(), width, 1, HeightmapFormat::R8G8B8A8_UNORM, fromRgba, range);
+	for (uint32_t x = 0; x < width; ++x)
+	{
+		if (heights[x] != x * 257 || fromRgba[x] != x * 257)
+		{
+			return false;
+		}
+	}
+
+	// Float elevations in meters, below and above zero, with a NaN hole. The range maps them
+	// back to within half a step of 0..65535.
+	const uint32_t floatCount = 1000;
+	std::vector<float> elevations(floatCount);
+	for (uint32_t x = 0; x < floatCount; ++x)
+	{
+		elevations[x] = -9000.0f + 19000.0f * ((float)x / (floatCount - 1)) * ((float)x / (floatCount - 1));
+	}
+	elevations[500] = NAN;
+	Decode(&elevations[0], floatCount * sizeof(float), floatCount, 1, HeightmapFormat::R32_FLOAT, heights, range);
+	if (heights[0] != 0 || heights[floatCount - 1] != 65535 || heights[500] != 0)
+	{
+		return false;
+	}
+	for (uint32_t x = 1; x < floatCount; ++x)
+	{
+		if (x == 500 || x == 501)
+		{
+			continue;
+		}
+		float expected = (elevations[x] - range.offset) * range.scale * 65535.0f;
+		if (heights[x] < heights[x - 1] || fabsf(heights[x] - expected) > 0.5f + expected * 1e-6f)
+		{
+			return false;
+		}
+	}
+	return true;
+}
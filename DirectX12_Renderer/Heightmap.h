@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Texel formats a heightmap is uploaded in, as WIC decodes the file. Only the first channel is a height.
+enum class HeightmapFormat
+{
+	R8_UNORM,
+	R16_UNORM,
+	R32_FLOAT,
+	R8G8B8A8_UNORM,	// fallback for files WIC has no single-channel format for
+};
+
+// Turns the decoded heightmap texels into the 0..65535 heights HeightPyramid and TerrainDisplacement
+// work on, and tells the shaders how to map a sampled texel into the same 0..1 range. CPU only.
+class Heightmap
+{
+public:
+	// Sampled texel to 0..1 height: (texel - offset) * scale. UNORM formats are already 0..1;
+	// float heightmaps keep their own units and are stretched over their min..max.
+	struct Range
+	{
+		float offset;
+		float scale;
+	};
+
+	static size_t TexelBytes(HeightmapFormat format);
+
+	// Reads the first channel of width x height texels, rows rowPitch bytes apart. UNORM16 is
+	// copied bit for bit, UNORM8 is widened by 257 so 255 stays the top, floats are rounded
+	// onto 0..65535 of their range.
+	static void Decode(const void* texels, size_t rowPitch, uint32_t width, uint32_t height, HeightmapFormat format,
+		std::vector<uint16_t>& heights, Range& range);
+
+	// True if every 16-bit value decodes bit exact through a padded row pitch, 8-bit and RGBA8
+	// texels decode to their widened value, and float texels keep their order and hit both ends.
+	static bool Validate();
+};
@@ -0,0 +1,353 @@
+#include "HorizonMap.h"
+#include "Parallel.h"
+#include "TerrainHeightField.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+
+namespace
+{
+	const float PI = 3.14159265358979f;
+	const uint32_t MIN_RUN_LEVEL = 3;	// runs of fewer than 8 steps are cheaper sampled than bounded
+	const uint32_t MAX_RUN_LEVEL = 6;	// runs of up to 64 steps bounded by one pyramid query
+
+	uint32_t Random(uint32_t& seed, uint32_t range)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	}
+
+	// The steps every ray takes, up to the farthest any of them can see: from the lowest height,
+	// the highest one sinks below the horizontal that far round the sphere.
+	struct Steps
+	{
+		float step;		// radians of arc, a texel of the heights along a meridian
+		float peak;		// radius of the highest height
+		std::vector<float> sines;	// sin(k step)
+		std::vector<float> chords;	// 1 - cos(k step), apart from the 1 for precision
+	};
+
+	Steps MakeSteps(const HeightPyramid& heights, float radius, float heightScale)
+	{
+		uint16_t lowest, highest;
+		heights.QueryTexels(0, (int)heights.GetWidth() - 1, 0, (int)heights.GetHeight() - 1, lowest, highest);
+
+		Steps steps;
+		steps.step = PI / heights.GetHeight();
+		steps.peak = radius + highest * heightScale;
+		const double reach = acos((double)(radius + lowest * heightScale) / steps.peak);
+		const uint32_t count = (uint32_t)(reach / steps.step) + 2;
+		steps.sines.resize(count);
+		steps.chords.resize(count);
+		for (uint32_t k = 0; k < count; ++k)
+		{
+			const double half = sin(0.5 * k * steps.step);
+			steps.sines[k] = (float)sin((double)k * steps.step);
+			steps.chords[k] = (float)(2.0 * half * half);
+		}
+		return steps;
+	}
+
+	// Sine of the elevation of a point rise above the surface at radius r0, k steps round the
+	// sphere from it; 0 for anything below the horizontal. Grows with rise.
+	float Elevation(const Steps& steps, float r0, float rise, uint32_t k)
+	{
+		const float r1 = r0 + rise;
+		const float up = rise - r1 * steps.chords[k];
+		if (up <= 0.0f)
+		{
+			return 0.0f;
+		}
+		const float along = r1 * steps.sines[k];
+		return up / sqrtf(up * up + along * along);
+	}
+
+	struct Ray
+	{
+		float origin[3];	// unit vector to the surface point
+		float direction[3];	// unit tangent along the azimuth
+		float h0;			// height of the surface point, 0..65535
+		float r0;			// and its radius
+	};
+
+	// theta = atan2(z, x) and phi = acos(y) of the point angle round the sphere along the ray.
+	void Position(const Ray& ray, float cosine, float sine, float& theta, float& phi)
+	{
+		const float x = ray.origin[0] * cosine + ray.direction[0] * sine;
+		const float y = ray.origin[1] * cosine + ray.direction[1] * sine;
+		const float z = ray.origin[2] * cosine + ray.direction[2] * sine;
+		theta = atan2f(z, x);
+		phi = acosf(std::max(-1.0f, std::min(y, 1.0f)));
+	}
+
+	// Highest height a bilinear sample at steps first..last can read: the pyramid's maximum over
+	// the cap round their middle that holds them all, widened past float rounding.
+	uint16_t Bound(const HeightPyramid& heights, const Steps& steps, const Ray& ray, uint32_t first, uint32_t last)
+	{
+		const float middle = 0.5f * (first + last) * steps.step;
+		const float reach = 0.5f * (last - first) * steps.step * 1.001f + 1e-6f;
+		float theta, phi;
+		Position(ray, cosf(middle), sinf(middle), theta, phi);
+
+		// A cap across a pole takes in every longitude.
+		float thetaMin = -PI;
+		float thetaMax = PI;
+		if (phi - reach > 0.0f && phi + reach < PI)
+		{
+			const float halfWidth = asinf(std::min(sinf(reach) / sinf(phi), 1.0f));
+			thetaMin = theta - halfWidth;
+			thetaMax = theta + halfWidth;
+		}
+		uint16_t lowest, highest;
+		heights.Query(thetaMin, thetaMax, std::max(phi - reach, 0.0f), std::min(phi + reach, PI), lowest, highest);
+		return highest;
+	}
+
+	// Sine of the horizon along the ray. Accelerated, a run of steps is bounded before it is
+	// sampled, and skipped if even its bound stays below the horizon so far; runs double while
+	// they are skipped and halve when they are not, down to a short run that is sampled.
+	float March(const HeightPyramid& heights, const Steps& steps, float heightScale, const Ray& ray, bool accelerated, HorizonMap::Stats& stats)
+	{
+		const float threshold = 1.0f - ray.r0 / steps.peak;
+		const uint32_t last = (uint32_t)std::min<size_t>(
+			std::lower_bound(steps.chords.begin() + 1, steps.chords.end(), threshold) - steps.chords.begin() - 1, steps.chords.size() - 1);
+		++stats.rays;
+		stats.bruteForceSteps += last;
+
+		float best = 0.0f;
+		uint32_t run = MIN_RUN_LEVEL;
+		uint32_t sampled = last;	// steps up to here are sampled without bounding
+		if (accelerated)
+		{
+			sampled = std::min(1u << MIN_RUN_LEVEL, last);
+		}
+		for (uint32_t k = 1; k <= last;)
+		{
+			if (k > sampled)
+			{
+				// Even the peak would be under the horizon from here on.
+				if (Elevation(steps, ray.r0, steps.peak - ray.r0, k) <= best)
+				{
+					break;
+				}
+				const uint32_t end = std::min(k + (1u << run) - 1, last);
+				++stats.bounds;
+				if (Elevation(steps, ray.r0, (Bound(heights, steps, ray, k, end) - ray.h0) * heightScale, k) <= best)
+				{
+					k = end + 1;
+					run = std::min(run + 1, MAX_RUN_LEVEL);
+				}
+				else if (run > MIN_RUN_LEVEL)
+				{
+					--run;
+				}
+				else
+				{
+					sampled = end;
+				}
+				continue;
+			}
+
+			float theta, phi;
+			Position(ray, 1.0f - steps.chords[k], steps.sines[k], theta, phi);
+			const float h = TerrainHeightField::Sample(heights, theta / (2.0f * PI), phi / PI);
+			best = std::max(best, Elevation(steps, ray.r0, (h - ray.h0) * heightScale, k));
+			++stats.steps;
+			++k;
+		}
+		return best;
+	}
+
+	void Run(const HeightPyramid& heights, float radius, float heightScale, uint32_t level, uint8_t* texels, bool accelerated,
+		HorizonMap::Stats* stats)
+	{
+		const uint32_t width = std::max(heights.GetWidth() >> level, 1u);
+		const uint32_t height = std::max(heights.GetHeight() >> level, 1u);
+		const size_t slice = (size_t)width * height * 4;
+		const Steps steps = MakeSteps(heights, radius, heightScale);
+
+		std::atomic<uint64_t> rays(0), marched(0), bounds(0), bruteForce(0);
+		ParallelFor(height, [&](uint32_t begin, uint32_t end)
+		{
+			HorizonMap::Stats local = {};
+			for (uint32_t y = begin; y < end; ++y)
+			{
+				const float v = (y + 0.5f) / height;
+				const float sinPhi = sinf(v * PI);
+				const float cosPhi = cosf(v * PI);
+				for (uint32_t x = 0; x < width; ++x)
+				{
+					const float u = (x + 0.5f) / width;
+					const float sinTheta = sinf(u * 2.0f * PI);
+					const float cosTheta = cosf(u * 2.0f * PI);
+
+					// The shaders' tangent frame: east along u, south along v.
+					const float east[3] = { -sinTheta, 0.0f, cosTheta };
+					const float south[3] = { cosPhi * cosTheta, -sinPhi, cosPhi * sinTheta };
+					Ray ray;
+					ray.origin[0] = sinPhi * cosTheta;
+					ray.origin[1] = cosPhi;
+					ray.origin[2] = sinPhi * sinTheta;
+					ray.h0 = TerrainHeightField::Sample(heights, u, v);
+					ray.r0 = radius + ray.h0 * heightScale;
+
+					uint8_t* texel = texels + ((size_t)y * width + x) * 4;
+					for (uint32_t a = 0; a < HorizonMap::AZIMUTHS; ++a)
+					{
+						const float azimuth = a * 2.0f * PI / HorizonMap::AZIMUTHS;
+						const float along = cosf(azimuth);
+						const float across = sinf(azimuth);
+						for (int i = 0; i < 3; ++i)
+						{
+							ray.direction[i] = east[i] * along + south[i] * across;
+						}
+						const float sine = March(heights, steps, heightScale, ray, accelerated, local);
+						texel[(a / 4) * slice + a % 4] = (uint8_t)(sine * 255.0f + 0.5f);
+					}
+				}
+			}
+			rays += local.rays;
+			marched += local.steps;
+			bounds += local.bounds;
+			bruteForce += local.bruteForceSteps;
+		});
+
+		if (stats)
+		{
+			stats->rays = rays;
+			stats->steps = marched;
+			stats->bounds = bounds;
+			stats->bruteForceSteps = bruteForce;
+		}
+	}
+}
+
+void HorizonMap::Generate(const HeightPyramid& heights, float radius, float heightScale, uint32_t level, uint8_t* texels, Stats* stats)
+{
+	Run(heights, radius, heightScale, level, texels, true, stats);
+}
+
+void HorizonMap::GenerateBruteForce(const HeightPyramid& heights, float radius, float heightScale, uint32_t level, uint8_t* texels)
+{
+	Run(heights, radius, heightScale, level, texels, false, nullptr);
+}
+
+size_t HorizonMap::Size(uint32_t width, uint32_t height, uint32_t level)
+{
+	return (size_t)std::max(width >> level, 1u) * std::max(height >> level, 1u) * AZIMUTHS;
+}
+
+bool HorizonMap::Validate()
+{
+	const float radius = 20.0f;
+	const float heightScale = 4.0f / 65535.0f;
+	const uint32_t width = 64;
+	const uint32_t height = 32;
+	const size_t count = (size_t)width * height;
+	const size_t slice = count * 4;
+	std::vector<uint16_t> heights(count);
+	std::vector<uint8_t> texels(Size(width, height, 0));
+	std::vector<uint8_t> bruteForce(Size(width, height, 0));
+	HeightPyramid pyramid;
+
+	// Flat terrain curves away under every horizon.
+	std::fill(heights.begin(), heights.end(), (uint16_t)30000);
+	pyramid.Build(heights, width, height);
+	Generate(pyramid, radius, heightScale, 0, texels.data(), nullptr);
+	if (std::any_of(texels.begin(), texels.end(), [](uint8_t sine) { return sine != 0; }))
+	{
+		return false;
+	}
+
+	// A wall along row 20 of flat ground at 0. Due south the meridian steps onto its crest, which
+	// the peak's reach puts at most 5 rows away; north, east and west there is open sky.
+	const uint32_t wall = 20;
+	std::fill(heights.begin(), heights.end(), (uint16_t)0);
+	std::fill(heights.begin() + (size_t)wall * width, heights.begin() + (size_t)(wall + 1) * width, (uint16_t)65535);
+	pyramid.Build(heights, width, height);
+	Generate(pyramid, radius, heightScale, 0, texels.data(), nullptr);
+	for (uint32_t y = wall - 5; y < wall; ++y)
+	{
+		const double d = (wall - y) * (double)PI / height;
+		const double r1 = radius + 65535 * heightScale;
+		const double up = r1 * cos(d) - radius;
+		const double expected = up / sqrt(up * up + r1 * sin(d) * r1 * sin(d)) * 255.0;
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			const uint8_t* texel = &texels[((size_t)y * width + x) * 4];
+			if (fabs(texel[2] - expected) > 1.0 || texel[0] != 0 || texel[slice] != 0 || texel[slice + 2] != 0)
+			{
+				return false;
+			}
+		}
+	}
+
+	// Rolling noisy terrain, on grids over a map fine enough for rays of a few dozen steps.
+	// Skipping by the pyramid must leave every horizon as the brute force march finds it, and
+	// must sample less.
+	const uint32_t fineWidth = 256;
+	const uint32_t fineHeight = 128;
+	std::vector<uint16_t> fine((size_t)fineWidth * fineHeight);
+	uint32_t seed = 11;
+	for (uint32_t y = 0; y < fineHeight; ++y)
+	{
+		for (uint32_t x = 0; x < fineWidth; ++x)
+		{
+			const float hills = sinf(x * 0.1f) * cosf(y * 0.14f) + 0.5f * sinf((x + 2 * y) * 0.23f);
+			fine[(size_t)y * fineWidth + x] = (uint16_t)(30000.0f + 15000.0f * hills + Random(seed, 8000));
+		}
+	}
+	pyramid.Build(fine, fineWidth, fineHeight);
+	for (uint32_t level = 1; level < 3; ++level)
+	{
+		std::vector<uint8_t> accelerated(Size(fineWidth, fineHeight, level));
+		std::vector<uint8_t> marched(accelerated.size());
+		Stats stats;
+		Generate(pyramid, radius, heightScale, level, accelerated.data(), &stats);
+		GenerateBruteForce(pyramid, radius, heightScale, level, marched.data());
+		if (accelerated != marched || stats.steps >= stats.bruteForceSteps ||
+			std::none_of(accelerated.begin(), accelerated.end(), [](uint8_t sine) { return sine > 64; }))
+		{
+			return false;
+		}
+	}
+
+	// Turning the map round in u turns the horizons with it, across the seam too.
+	for (size_t i = 0; i < count; ++i)
+	{
+		heights[i] = (uint16_t)(30000 + Random(seed, 30000));
+	}
+	pyramid.Build(heights, width, height);
+	Generate(pyramid, radius, heightScale, 0, texels.data(), nullptr);
+	const uint32_t turn = 8;
+	std::vector<uint16_t> turned(count);
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			turned[(size_t)y * width + (x + turn) % width] = heights[(size_t)y * width + x];
+		}
+	}
+	pyramid.Build(turned, width, height);
+	Generate(pyramid, radius, heightScale, 0, bruteForce.data(), nullptr);
+	for (uint32_t s = 0; s < 2; ++s)
+	{
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				for (uint32_t c = 0; c < 4; ++c)
+				{
+					if (abs((int)texels[s * slice + ((size_t)y * width + x) * 4 + c] -
+						(int)bruteForce[s * slice + ((size_t)y * width + (x + turn) % width) * 4 + c]) > 1)
+					{
+						return false;
+					}
+				}
+			}
+		}
+	}
+	return true;
+}
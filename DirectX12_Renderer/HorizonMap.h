@@ -0,0 +1,44 @@
+#pragma once
+
+#include "HeightPyramid.h"
+#include <cstddef>
+#include <cstdint>
+
+// Horizon map of a heightmap wrapped on a sphere, for PixelShaderTes to shadow the terrain by
+// itself and darken its ambient light without a shadow map, which would tessellate the terrain
+// a second time. For each texel of a grid over the heights and each of AZIMUTHS directions round
+// it, it holds the sine of the angle above the local horizontal at which the terrain hides the
+// sky. A ray follows the great circle one texel of the heights at a time, bilinearly like
+// DomainShader, until the curvature hides even the highest peak; runs of steps whose maximum in
+// the HeightPyramid cannot raise the horizon are skipped whole. Rows in parallel. CPU only.
+class HorizonMap
+{
+public:
+	static const uint32_t AZIMUTHS = 8;	// east first, then every 45 degrees towards south
+
+	// Work of a Generate; marching every step takes bruteForceSteps.
+	struct Stats
+	{
+		uint64_t rays;
+		uint64_t steps;			// heights sampled
+		uint64_t bounds;		// runs bounded by the pyramid
+		uint64_t bruteForceSteps;
+	};
+
+	// Horizons at the texel centers of level of the heights, (width >> level) x (height >> level),
+	// on a sphere of radius, heightScale world units per height step. texels receives two slices
+	// of RGBA8 in tightly packed rows, azimuths 0-3 then 4-7, the sines mapped onto 0..255. stats
+	// may be null.
+	static void Generate(const HeightPyramid& heights, float radius, float heightScale, uint32_t level, uint8_t* texels, Stats* stats);
+
+	// Same as Generate, sampling every step of every ray.
+	static void GenerateBruteForce(const HeightPyramid& heights, float radius, float heightScale, uint32_t level, uint8_t* texels);
+
+	// Bytes Generate writes for level of a width x height map.
+	static size_t Size(uint32_t width, uint32_t height, uint32_t level);
+
+	// True if flat terrain has an open sky, the horizon of a wall is where geometry puts it, turning
+	// the map turns the horizons with it, and skipping by the pyramid changes no horizon of the
+	// brute force march while sampling fewer steps.
+	static bool Validate();
+};
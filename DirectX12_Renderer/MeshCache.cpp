@@ -0,0 +1,378 @@
+#include "MeshCache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	const char CACHE_MAGIC[4] = { 'M', 'E', 'S', 'H' };
+	const uint64_t BLOB_ALIGNMENT = 64;
+
+	struct MeshCacheHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint64_t keyHash;
+
+		// The key, for reading the file by hand; Open only compares keyHash and generator.
+		char generator[32];
+		float radius;
+		uint32_t subdivisions;
+		uint32_t chunkVertices;
+		uint32_t vertexStride;
+		uint64_t sourceHash;
+
+		float meshOrigin[3];
+		float meshScale;
+
+		uint32_t chunkSize;		// sizeof(MeshChunk) when written
+		uint32_t chunkCount;
+		uint64_t vertexCount;
+		uint64_t indexCount;
+		uint64_t chunkOffset;
+		uint64_t vertexOffset;
+		uint64_t indexOffset;
+		uint64_t fileSize;
+	};
+
+#ifdef _WIN32
+	const std::wstring& FilePath(const std::wstring& path)
+	{
+		return path;
+	}
+
+	void RemoveFile(const std::wstring& path)
+	{
+		DeleteFileW(path.c_str());
+	}
+
+	std::wstring TempPath(const wchar_t* name)
+	{
+		wchar_t directory[MAX_PATH + 1];
+		return GetTempPathW(MAX_PATH + 1, directory) != 0 ? directory + std::wstring(name) : std::wstring(name);
+	}
+#else
+	// Cache paths are ASCII off Windows.
+	std::string FilePath(const std::wstring& path)
+	{
+		return std::string(path.begin(), path.end());
+	}
+
+	void RemoveFile(const std::wstring& path)
+	{
+		std::remove(FilePath(path).c_str());
+	}
+
+	std::wstring TempPath(const wchar_t* name)
+	{
+		const char* variable = getenv("TMPDIR");
+		const std::string directory = variable && *variable ? variable : "/tmp";
+		return std::wstring(directory.begin(), directory.end()) + L"/" + name;
+	}
+#endif
+
+	uint64_t Align(uint64_t offset)
+	{
+		return (offset + BLOB_ALIGNMENT - 1) & ~(BLOB_ALIGNMENT - 1);
+	}
+
+	void Fnv(uint64_t& hash, const void* data, size_t size)
+	{
+		const uint8_t* bytes = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash = (hash ^ bytes[i]) * 1099511628211ull;
+		}
+	}
+
+	// Header and blob offsets for a mesh, as Write lays them out.
+	MeshCacheHeader MakeHeader(const MeshCache::Key& key, const MeshBlob& mesh)
+	{
+		MeshCacheHeader header = {};
+		std::copy(CACHE_MAGIC, CACHE_MAGIC + 4, header.magic);
+		header.version = MeshCache::VERSION;
+		header.keyHash = MeshCache::HashKey(key);
+		strncpy(header.generator, key.generator, sizeof(header.generator) - 1);
+		header.radius = key.radius;
+		header.subdivisions = key.subdivisions;
+		header.chunkVertices = key.chunkVertices;
+		header.vertexStride = key.vertexStride;
+		header.sourceHash = key.sourceHash;
+		header.meshOrigin[0] = mesh.meshOrigin.x;
+		header.meshOrigin[1] = mesh.meshOrigin.y;
+		header.meshOrigin[2] = mesh.meshOrigin.z;
+		header.meshScale = mesh.meshScale;
+		header.chunkSize = sizeof(MeshChunk);
+		header.chunkCount = (uint32_t)mesh.chunkCount;
+		header.vertexCount = mesh.vertexCount;
+		header.indexCount = mesh.indexCount;
+		header.chunkOffset = Align(sizeof(MeshCacheHeader));
+		header.vertexOffset = Align(header.chunkOffset + mesh.chunkCount * sizeof(MeshChunk));
+		header.indexOffset = Align(header.vertexOffset + mesh.VertexBytes());
+		header.fileSize = header.indexOffset + mesh.IndexBytes();
+		return header;
+	}
+}
+
+MeshCache::MeshCache() :
+	m_view(nullptr),
+	m_size(0),
+#ifdef _WIN32
+	m_file(INVALID_HANDLE_VALUE),
+	m_mapping(nullptr)
+#else
+	m_file(-1)
+#endif
+{
+}
+
+MeshCache::~MeshCache()
+{
+	Close();
+}
+
+uint64_t MeshCache::HashKey(const Key& key)
+{
+	uint64_t hash = 14695981039346656037ull;
+	const uint32_t version = VERSION;
+	const uint32_t chunkSize = sizeof(MeshChunk);
+	Fnv(hash, &version, sizeof(version));
+	Fnv(hash, &chunkSize, sizeof(chunkSize));
+	Fnv(hash, key.generator, strlen(key.generator));
+	Fnv(hash, &key.radius, sizeof(key.radius));
+	Fnv(hash, &key.subdivisions, sizeof(key.subdivisions));
+	Fnv(hash, &key.chunkVertices, sizeof(key.chunkVertices));
+	Fnv(hash, &key.vertexStride, sizeof(key.vertexStride));
+	Fnv(hash, &key.sourceHash, sizeof(key.sourceHash));
+	return hash;
+}
+
+bool MeshCache::Open(const std::wstring& path, const Key& key)
+{
+	Close();
+
+#ifdef _WIN32
+	m_file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER size;
+	if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size) || size.QuadPart < (LONGLONG)sizeof(MeshCacheHeader))
+	{
+		Close();
+		return false;
+	}
+	m_size = (uint64_t)size.QuadPart;
+	m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	m_view = m_mapping ? static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+#else
+	m_file = open(FilePath(path).c_str(), O_RDONLY);
+	struct stat status;
+	if (m_file < 0 || fstat(m_file, &status) != 0 || status.st_size < (off_t)sizeof(MeshCacheHeader))
+	{
+		Close();
+		return false;
+	}
+	m_size = (uint64_t)status.st_size;
+	void* view = mmap(nullptr, (size_t)m_size, PROT_READ, MAP_SHARED, m_file, 0);
+	m_view = view != MAP_FAILED ? static_cast<const uint8_t*>(view) : nullptr;
+#endif
+	if (!m_view)
+	{
+		Close();
+		return false;
+	}
+
+	const MeshCacheHeader& header = *reinterpret_cast<const MeshCacheHeader*>(m_view);
+	bool valid = std::equal(CACHE_MAGIC, CACHE_MAGIC + 4, header.magic) &&
+		header.version == VERSION &&
+		header.keyHash == HashKey(key) &&
+		strncmp(header.generator, key.generator, sizeof(header.generator)) == 0 &&
+		header.chunkSize == sizeof(MeshChunk) &&
+		header.fileSize == m_size &&
+		header.chunkOffset + (uint64_t)header.chunkCount * sizeof(MeshChunk) <= header.vertexOffset &&
+		header.vertexOffset + header.vertexCount * header.vertexStride <= header.indexOffset &&
+		header.indexOffset + header.indexCount * sizeof(uint16_t) <= m_size;
+	if (!valid)
+	{
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void MeshCache::Close()
+{
+#ifdef _WIN32
+	if (m_view)
+	{
+		UnmapViewOfFile(m_view);
+	}
+	if (m_mapping)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+	if (m_file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (m_view)
+	{
+		munmap(const_cast<uint8_t*>(m_view), (size_t)m_size);
+	}
+	if (m_file >= 0)
+	{
+		close(m_file);
+		m_file = -1;
+	}
+#endif
+	m_view = nullptr;
+	m_size = 0;
+}
+
+MeshBlob MeshCache::GetMesh() const
+{
+	const MeshCacheHeader& header = *reinterpret_cast<const MeshCacheHeader*>(m_view);
+
+	MeshBlob mesh;
+	mesh.vertices = m_view + header.vertexOffset;
+	mesh.vertexStride = header.vertexStride;
+	mesh.vertexCount = (size_t)header.vertexCount;
+	mesh.indices = reinterpret_cast<const uint16_t*>(m_view + header.indexOffset);
+	mesh.indexCount = (size_t)header.indexCount;
+	mesh.chunks = reinterpret_cast<const MeshChunk*>(m_view + header.chunkOffset);
+	mesh.chunkCount = header.chunkCount;
+	mesh.meshOrigin = XMFLOAT3(header.meshOrigin[0], header.meshOrigin[1], header.meshOrigin[2]);
+	mesh.meshScale = header.meshScale;
+	return mesh;
+}
+
+bool MeshCache::Write(const std::wstring& path, const Key& key, const MeshBlob& mesh)
+{
+	std::ofstream file(FilePath(path), std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		return false;
+	}
+
+	const MeshCacheHeader header = MakeHeader(key, mesh);
+	const char padding[BLOB_ALIGNMENT] = {};
+	auto pad = [&file, &padding](uint64_t offset)
+	{
+		file.write(padding, (std::streamsize)(offset - (uint64_t)file.tellp()));
+	};
+
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	pad(header.chunkOffset);
+	file.write(reinterpret_cast<const char*>(mesh.chunks), (std::streamsize)(mesh.chunkCount * sizeof(MeshChunk)));
+	pad(header.vertexOffset);
+	file.write(static_cast<const char*>(mesh.vertices), (std::streamsize)mesh.VertexBytes());
+	pad(header.indexOffset);
+	file.write(reinterpret_cast<const char*>(mesh.indices), (std::streamsize)mesh.IndexBytes());
+	return (bool)file;
+}
+
+MeshBlob MeshCache::MakeBlob(const void* vertices, uint32_t vertexStride, size_t vertexCount, const MeshChunker::ChunkedMesh& chunked)
+{
+	MeshBlob mesh;
+	mesh.vertices = vertices;
+	mesh.vertexStride = vertexStride;
+	mesh.vertexCount = vertexCount;
+	mesh.indices = chunked.Indices16.data();
+	mesh.indexCount = chunked.Indices16.size();
+	mesh.chunks = chunked.Chunks.data();
+	mesh.chunkCount = chunked.Chunks.size();
+	mesh.meshOrigin = XMFLOAT3(0.0f, 0.0f, 0.0f);
+	mesh.meshScale = 1.0f;
+	return mesh;
+}
+
+bool MeshCache::Validate()
+{
+	// A grid in a dozen chunks, with an origin and scale so every header field has to round trip.
+	const uint32_t size = 16;
+	std::vector<XMFLOAT3> positions;
+	std::vector<uint32_t> indices;
+	for (uint32_t y = 0; y <= size; ++y)
+	{
+		for (uint32_t x = 0; x <= size; ++x)
+		{
+			positions.push_back(XMFLOAT3((float)x, (float)(x * y % 7), (float)y));
+			if (x < size && y < size)
+			{
+				const uint32_t v = y * (size + 1) + x;
+				const uint32_t quad[6] = { v, v + size + 1, v + 1, v + 1, v + size + 1, v + size + 2 };
+				indices.insert(indices.end(), quad, quad + 6);
+			}
+		}
+	}
+	MeshChunker::ChunkedMesh chunked;
+	MeshChunker::Build(positions, indices, 64, chunked);
+	const std::vector<XMFLOAT3> vertices = MeshChunker::GatherVertices(positions, chunked);
+	MeshBlob mesh = MakeBlob(vertices.data(), sizeof(XMFLOAT3), vertices.size(), chunked);
+	mesh.meshOrigin = XMFLOAT3(1.0f, 2.0f, 3.0f);
+	mesh.meshScale = 4.0f;
+	const Key key = { "Validate", 1.0f, 2, 64, sizeof(XMFLOAT3), 5 };
+
+	const std::wstring path = TempPath(L"MeshCacheValidate.meshcache");
+	const std::wstring truncatedPath = path + L".truncated";
+	bool valid = Write(path, key, mesh);
+	if (valid)
+	{
+		MeshCache cache;
+		valid = cache.Open(path, key);
+		if (valid)
+		{
+			MeshBlob cached = cache.GetMesh();
+			valid = cached.vertexCount == mesh.vertexCount && cached.vertexStride == mesh.vertexStride &&
+				cached.indexCount == mesh.indexCount && cached.chunkCount == mesh.chunkCount &&
+				cached.meshScale == mesh.meshScale && memcmp(&cached.meshOrigin, &mesh.meshOrigin, sizeof(XMFLOAT3)) == 0 &&
+				memcmp(cached.vertices, mesh.vertices, mesh.VertexBytes()) == 0 &&
+				memcmp(cached.indices, mesh.indices, mesh.IndexBytes()) == 0 &&
+				memcmp(cached.chunks, mesh.chunks, mesh.chunkCount * sizeof(MeshChunk)) == 0;
+		}
+	}
+
+	Key changed[6] = { key, key, key, key, key, key };
+	changed[0].generator = "";
+	changed[1].radius = key.radius * 2.0f + 1.0f;
+	changed[2].subdivisions = key.subdivisions + 1;
+	changed[3].chunkVertices = key.chunkVertices + 1;
+	changed[4].vertexStride = key.vertexStride + 4;
+	changed[5].sourceHash = key.sourceHash + 1;
+	for (const Key& other : changed)
+	{
+		MeshCache cache;
+		valid = valid && !cache.Open(path, other);
+	}
+
+	// A write cut short, e.g. by a crash, must not be picked up.
+	if (valid)
+	{
+		std::ifstream source(FilePath(path), std::ios::binary);
+		std::vector<char> bytes((std::istreambuf_iterator<char>(source)), std::istreambuf_iterator<char>());
+		std::ofstream truncated(FilePath(truncatedPath), std::ios::binary | std::ios::trunc);
+		truncated.write(bytes.data(), (std::streamsize)(bytes.size() - 1));
+	}
+	if (valid)
+	{
+		MeshCache cache;
+		valid = !cache.Open(truncatedPath, key);
+	}
+	RemoveFile(truncatedPath);
+	RemoveFile(path);
+	return valid;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "MeshChunker.h"
+#include <DirectXMath.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+using namespace DirectX;
+
+// Upload-ready chunked mesh: vertices in chunked order, 16-bit indices relative to each
+// chunk's baseVertex. Only points at the data, which belongs to a ChunkedMesh or a MeshCache.
+struct MeshBlob
+{
+	const void* vertices;
+	uint32_t vertexStride;
+	size_t vertexCount;
+	const uint16_t* indices;
+	size_t indexCount;
+	const MeshChunk* chunks;
+	size_t chunkCount;
+	XMFLOAT3 meshOrigin;	// PackedVertex dequantization, 0 and 1 for float vertices
+	float meshScale;
+
+	size_t VertexBytes() const { return vertexCount * vertexStride; }
+	size_t IndexBytes() const { return indexCount * sizeof(uint16_t); }
+};
+
+// Generated meshes saved as one file: a header with the generator parameters and their hash,
+// then the chunk, vertex and index blobs, each 64-byte aligned. Open maps the file read-only
+// (MapViewOfFile on Windows, mmap elsewhere) and GetMesh points straight into the mapping, so a
+// cache hit does no per-vertex work.
+class MeshCache
+{
+public:
+	static const uint32_t VERSION = 1;
+
+	// Everything the cached mesh was generated from; any difference misses the cache.
+	struct Key
+	{
+		const char* generator;	// at most 31 characters
+		float radius;
+		uint32_t subdivisions;
+		uint32_t chunkVertices;
+		uint32_t vertexStride;
+		uint64_t sourceHash;	// of other inputs, e.g. HeightPyramid::GetHash for displaced meshes
+	};
+
+	MeshCache();
+	~MeshCache();
+
+	// False if the file is missing, truncated or written for another key.
+	bool Open(const std::wstring& path, const Key& key);
+	void Close();
+
+	bool IsOpen() const { return m_view != nullptr; }
+	MeshBlob GetMesh() const;
+
+	static bool Write(const std::wstring& path, const Key& key, const MeshBlob& mesh);
+
+	static MeshBlob MakeBlob(const void* vertices, uint32_t vertexStride, size_t vertexCount, const MeshChunker::ChunkedMesh& chunked);
+
+	static uint64_t HashKey(const Key& key);
+
+	// True if a small chunked grid written to the temp directory reads back exactly, and a change
+	// to any single key field or a copy of the file missing its last byte makes Open fail.
+	static bool Validate();
+
+private:
+	MeshCache(const MeshCache&) = delete;
+	MeshCache& operator=(const MeshCache&) = delete;
+
+	const uint8_t* m_view;
+	uint64_t m_size;
+#ifdef _WIN32
+	void* m_file;
+	void* m_mapping;
+#else
+	int m_file;
+#endif
+};
@@ -0,0 +1,252 @@
+#include "MeshChunker.h"
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	// Spreads the low 10 bits of v so that there are two zero bits between each of them.
+	uint32_t Part1By2(uint32_t v)
+	{
+		v &= 0x000003ff;
+		v = (v ^ (v << 16)) & 0xff0000ff;
+		v = (v ^ (v << 8)) & 0x0300f00f;
+		v = (v ^ (v << 4)) & 0x030c30c3;
+		v = (v ^ (v << 2)) & 0x09249249;
+		return v;
+	}
+
+	uint32_t Morton3(float x, float y, float z)
+	{
+		uint32_t ix = (uint32_t)std::min(std::max(x * 1024.0f, 0.0f), 1023.0f);
+		uint32_t iy = (uint32_t)std::min(std::max(y * 1024.0f, 0.0f), 1023.0f);
+		uint32_t iz = (uint32_t)std::min(std::max(z * 1024.0f, 0.0f), 1023.0f);
+		return (Part1By2(iz) << 2) | (Part1By2(iy) << 1) | Part1By2(ix);
+	}
+
+	struct Triangle
+	{
+		uint32_t v[3];
+
+		// Rotated so the smallest index comes first, which keeps the winding.
+		static Triangle Canonical(uint32_t a, uint32_t b, uint32_t c)
+		{
+			Triangle t;
+			if (a <= b && a <= c)
+			{
+				t.v[0] = a; t.v[1] = b; t.v[2] = c;
+			}
+			else if (b <= a && b <= c)
+			{
+				t.v[0] = b; t.v[1] = c; t.v[2] = a;
+			}
+			else
+			{
+				t.v[0] = c; t.v[1] = a; t.v[2] = b;
+			}
+			return t;
+		}
+
+		bool operator<(const Triangle& o) const
+		{
+			return std::lexicographical_compare(v, v + 3, o.v, o.v + 3);
+		}
+
+		bool operator==(const Triangle& o) const
+		{
+			return v[0] == o.v[0] && v[1] == o.v[1] && v[2] == o.v[2];
+		}
+	};
+}
+
+void MeshChunker::Build(const std::vector<XMFLOAT3>& positions, const std::vector<uint32_t>& indices,
+	uint32_t maxVertices, ChunkedMesh& chunked)
+{
+	chunked.Chunks.clear();
+	chunked.Indices16.clear();
+	chunked.VertexRemap.clear();
+
+	const size_t triCount = indices.size() / 3;
+	if (triCount == 0)
+	{
+		return;
+	}
+
+	maxVertices = std::max(3u, std::min(maxVertices, (uint32_t)MAX_CHUNK_VERTICES));
+
+	XMFLOAT3 minimum = positions[indices[0]];
+	XMFLOAT3 maximum = minimum;
+	for (const XMFLOAT3& p : positions)
+	{
+		minimum = XMFLOAT3(std::min(minimum.x, p.x), std::min(minimum.y, p.y), std::min(minimum.z, p.z));
+		maximum = XMFLOAT3(std::max(maximum.x, p.x), std::max(maximum.y, p.y), std::max(maximum.z, p.z));
+	}
+	XMFLOAT3 invExtent(
+		maximum.x > minimum.x ? 1.0f / (maximum.x - minimum.x) : 0.0f,
+		maximum.y > minimum.y ? 1.0f / (maximum.y - minimum.y) : 0.0f,
+		maximum.z > minimum.z ? 1.0f / (maximum.z - minimum.z) : 0.0f);
+
+	// (morton code, triangle) pairs, sorted so neighbouring triangles end up next to each other.
+	std::vector<uint64_t> order(triCount);
+	for (size_t t = 0; t < triCount; ++t)
+	{
+		const XMFLOAT3& a = positions[indices[t * 3 + 0]];
+		const XMFLOAT3& b = positions[indices[t * 3 + 1]];
+		const XMFLOAT3& c = positions[indices[t * 3 + 2]];
+		float x = ((a.x + b.x + c.x) / 3.0f - minimum.x) * invExtent.x;
+		float y = ((a.y + b.y + c.y) / 3.0f - minimum.y) * invExtent.y;
+		float z = ((a.z + b.z + c.z) / 3.0f - minimum.z) * invExtent.z;
+		order[t] = ((uint64_t)Morton3(x, y, z) << 32) | (uint64_t)t;
+	}
+	std::sort(order.begin(), order.end());
+
+	chunked.Indices16.reserve(indices.size());
+
+	// localIndex[v] is only valid while chunkOf[v] is the chunk being built.
+	std::vector<uint32_t> chunkOf(positions.size(), ~0u);
+	std::vector<uint32_t> localIndex(positions.size());
+	std::vector<uint32_t> localToSource;
+	std::vector<uint32_t> local;
+
+	size_t cursor = 0;
+	while (cursor < triCount)
+	{
+		const uint32_t chunkId = (uint32_t)chunked.Chunks.size();
+		localToSource.clear();
+		local.clear();
+
+		for (; cursor < triCount; ++cursor)
+		{
+			const uint32_t* tri = &indices[(size_t)(order[cursor] & 0xffffffff) * 3];
+
+			uint32_t added = 0;
+			for (int k = 0; k < 3; ++k)
+			{
+				bool repeated = (k > 0 && tri[k] == tri[0]) || (k > 1 && tri[k] == tri[1]);
+				added += chunkOf[tri[k]] != chunkId && !repeated ? 1 : 0;
+			}
+			if (localToSource.size() + added > maxVertices)
+			{
+				break;
+			}
+
+			for (int k = 0; k < 3; ++k)
+			{
+				uint32_t v = tri[k];
+				if (chunkOf[v] != chunkId)
+				{
+					chunkOf[v] = chunkId;
+					localIndex[v] = (uint32_t)localToSource.size();
+					localToSource.push_back(v);
+				}
+				local.push_back(localIndex[v]);
+			}
+		}
+
+		// Morton order is good for locality but poor for the post-transform cache.
+		MeshOptimizer::OptimizeVertexCache(local, localToSource.size());
+		std::vector<uint32_t> remap = MeshOptimizer::OptimizeVertexFetchRemap(local, localToSource.size());
+
+		MeshChunk chunk;
+		chunk.indexStart = (uint32_t)chunked.Indices16.size();
+		chunk.indexCount = (uint32_t)local.size();
+		chunk.baseVertex = (int32_t)chunked.VertexRemap.size();
+		chunk.vertexCount = (uint32_t)localToSource.size();
+
+		chunked.VertexRemap.resize(chunked.VertexRemap.size() + localToSource.size());
+		for (size_t i = 0; i < localToSource.size(); ++i)
+		{
+			chunked.VertexRemap[chunk.baseVertex + remap[i]] = localToSource[i];
+		}
+		for (uint32_t index : local)
+		{
+			chunked.Indices16.push_back((uint16_t)index);
+		}
+
+		// Bounding sphere around the box center; loose but cheap.
+		XMFLOAT3 chunkMin = positions[localToSource[0]];
+		XMFLOAT3 chunkMax = chunkMin;
+		for (uint32_t v : localToSource)
+		{
+			const XMFLOAT3& p = positions[v];
+			chunkMin = XMFLOAT3(std::min(chunkMin.x, p.x), std::min(chunkMin.y, p.y), std::min(chunkMin.z, p.z));
+			chunkMax = XMFLOAT3(std::max(chunkMax.x, p.x), std::max(chunkMax.y, p.y), std::max(chunkMax.z, p.z));
+		}
+		chunk.center = XMFLOAT3(0.5f * (chunkMin.x + chunkMax.x), 0.5f * (chunkMin.y + chunkMax.y), 0.5f * (chunkMin.z + chunkMax.z));
+
+		float radiusSq = 0.0f;
+		for (uint32_t v : localToSource)
+		{
+			const XMFLOAT3& p = positions[v];
+			float dx = p.x - chunk.center.x;
+			float dy = p.y - chunk.center.y;
+			float dz = p.z - chunk.center.z;
+			radiusSq = std::max(radiusSq, dx * dx + dy * dy + dz * dz);
+		}
+		chunk.radius = sqrtf(radiusSq);
+
+		chunked.Chunks.push_back(chunk);
+	}
+}
+
+std::vector<uint32_t> MeshChunker::ExpandIndices(const ChunkedMesh& chunked)
+{
+	std::vector<uint32_t> expanded(chunked.Indices16.size());
+	for (const MeshChunk& chunk : chunked.Chunks)
+	{
+		for (uint32_t i = 0; i < chunk.indexCount; ++i)
+		{
+			expanded[chunk.indexStart + i] = chunk.baseVertex + chunked.Indices16[chunk.indexStart + i];
+		}
+	}
+	return expanded;
+}
+
+bool MeshChunker::Validate(const ChunkedMesh& chunked, const std::vector<uint32_t>& indices, size_t vertexCount)
+{
+	size_t chunkedIndexCount = 0;
+	for (const MeshChunk& chunk : chunked.Chunks)
+	{
+		if (chunk.vertexCount > MAX_CHUNK_VERTICES ||
+			chunk.indexStart != chunkedIndexCount ||
+			(size_t)chunk.baseVertex + chunk.vertexCount > chunked.VertexRemap.size())
+		{
+			return false;
+		}
+		for (uint32_t i = 0; i < chunk.indexCount; ++i)
+		{
+			if (chunked.Indices16[chunk.indexStart + i] >= chunk.vertexCount)
+			{
+				return false;
+			}
+		}
+		chunkedIndexCount += chunk.indexCount;
+	}
+	if (chunkedIndexCount != chunked.Indices16.size() || chunkedIndexCount != indices.size())
+	{
+		return false;
+	}
+	for (uint32_t v : chunked.VertexRemap)
+	{
+		if (v >= vertexCount)
+		{
+			return false;
+		}
+	}
+
+	std::vector<uint32_t> expanded = ExpandIndices(chunked);
+
+	std::vector<Triangle> source(indices.size() / 3);
+	std::vector<Triangle> rebuilt(indices.size() / 3);
+	for (size_t t = 0; t < source.size(); ++t)
+	{
+		source[t] = Triangle::Canonical(indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2]);
+		rebuilt[t] = Triangle::Canonical(
+			chunked.VertexRemap[expanded[t * 3]],
+			chunked.VertexRemap[expanded[t * 3 + 1]],
+			chunked.VertexRemap[expanded[t * 3 + 2]]);
+	}
+	std::sort(source.begin(), source.end());
+	std::sort(rebuilt.begin(), rebuilt.end());
+	return source == rebuilt;
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace DirectX;
+
+// One DrawIndexedInstanced worth of a chunked mesh.
+struct MeshChunk
+{
+	uint32_t indexStart;	// StartIndexLocation
+	uint32_t indexCount;
+	int32_t baseVertex;		// BaseVertexLocation, 16-bit indices are relative to it
+	uint32_t vertexCount;
+	XMFLOAT3 center;		// bounding sphere of the chunk
+	float radius;
+};
+
+// Splits an indexed triangle list into spatially coherent chunks of at most maxVertices
+// vertices so every chunk can be drawn with 16-bit indices. CPU only.
+class MeshChunker
+{
+public:
+	static const uint32_t MAX_CHUNK_VERTICES = 65535;	// keeps 0xFFFF free as the strip cut value
+
+	struct ChunkedMesh
+	{
+		std::vector<MeshChunk> Chunks;
+		std::vector<uint16_t> Indices16;
+		std::vector<uint32_t> VertexRemap;	// chunked vertex -> source vertex, vertices on chunk borders repeat
+
+		size_t IndexBytes() const { return Indices16.size() * sizeof(uint16_t); }
+	};
+
+	// Triangles are ordered along a Morton curve through their centroids and cut greedily
+	// into chunks, then every chunk is reordered for the vertex cache and vertex fetch.
+	static void Build(const std::vector<XMFLOAT3>& positions, const std::vector<uint32_t>& indices,
+		uint32_t maxVertices, ChunkedMesh& chunked);
+
+	// Source vertices in chunked order.
+	template<typename T>
+	static std::vector<T> GatherVertices(const std::vector<T>& vertices, const ChunkedMesh& chunked)
+	{
+		std::vector<T> gathered(chunked.VertexRemap.size());
+		for (size_t i = 0; i < gathered.size(); ++i)
+		{
+			gathered[i] = vertices[chunked.VertexRemap[i]];
+		}
+		return gathered;
+	}
+
+	// 32-bit indices into the gathered vertices (baseVertex + local index), in draw order.
+	static std::vector<uint32_t> ExpandIndices(const ChunkedMesh& chunked);
+
+	// True if the chunks draw exactly the source triangles, each once and with the same winding.
+	static bool Validate(const ChunkedMesh& chunked, const std::vector<uint32_t>& indices, size_t vertexCount);
+};
@@ -0,0 +1,324 @@
+#include "MeshOptimizer.h"
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace
+{
+	// Tuning from Tom Forsyth, "Linear-Speed Vertex Cache Optimisation".
+	const int CACHE_SIZE = 32;
+	const float CACHE_DECAY_POWER = 1.5f;
+	const float LAST_TRI_SCORE = 0.75f;
+	const float VALENCE_BOOST_SCALE = 2.0f;
+	const float VALENCE_BOOST_POWER = 0.5f;
+	const uint32_t VALENCE_TABLE_SIZE = 32;
+
+	struct ScoreTable
+	{
+		float cache[CACHE_SIZE];
+		float valence[VALENCE_TABLE_SIZE];
+
+		ScoreTable()
+		{
+			for (int i = 0; i < CACHE_SIZE; ++i)
+			{
+				// The three vertices of the last triangle get a fixed score so that strips are
+				// not favoured over fans.
+				cache[i] = i < 3 ? LAST_TRI_SCORE : powf(1.0f - (float)(i - 3) / (CACHE_SIZE - 3), CACHE_DECAY_POWER);
+			}
+			for (uint32_t i = 0; i < VALENCE_TABLE_SIZE; ++i)
+			{
+				valence[i] = i == 0 ? 0.0f : VALENCE_BOOST_SCALE * powf((float)i, -VALENCE_BOOST_POWER);
+			}
+		}
+
+		float VertexScore(int cachePosition, uint32_t remainingTris) const
+		{
+			if (remainingTris == 0)
+			{
+				return -1.0f;
+			}
+
+			float score = cachePosition >= 0 ? cache[cachePosition] : 0.0f;
+			score += remainingTris < VALENCE_TABLE_SIZE ? valence[remainingTris] : VALENCE_BOOST_SCALE * powf((float)remainingTris, -VALENCE_BOOST_POWER);
+			return score;
+		}
+	};
+
+	// Triangles rotated to start at their smallest index, which keeps the winding, and sorted.
+	std::vector<std::array<uint32_t, 3>> SortedTriangles(const std::vector<uint32_t>& indices)
+	{
+		std::vector<std::array<uint32_t, 3>> triangles(indices.size() / 3);
+		for (size_t t = 0; t < triangles.size(); ++t)
+		{
+			const uint32_t* tri = &indices[t * 3];
+			const size_t first = tri[0] <= tri[1] && tri[0] <= tri[2] ? 0 : tri[1] <= tri[2] ? 1 : 2;
+			triangles[t] = { tri[first], tri[(first + 1) % 3], tri[(first + 2) % 3] };
+		}
+		std::sort(triangles.begin(), triangles.end());
+		return triangles;
+	}
+}
+
+void MeshOptimizer::OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+	static const ScoreTable scores;
+
+	const size_t triCount = indices.size() / 3;
+	if (triCount == 0)
+	{
+		return;
+	}
+
+	// Vertex -> triangle adjacency, stored as one flat array with per-vertex offsets.
+	std::vector<uint32_t> remaining(vertexCount, 0);
+	for (size_t i = 0; i < triCount * 3; ++i)
+	{
+		++remaining[indices[i]];
+	}
+
+	std::vector<uint32_t> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		offsets[v + 1] = offsets[v] + remaining[v];
+	}
+
+	std::vector<uint32_t> adjacency(triCount * 3);
+	{
+		std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+		for (size_t i = 0; i < triCount * 3; ++i)
+		{
+			adjacency[cursor[indices[i]]++] = (uint32_t)(i / 3);
+		}
+	}
+
+	std::vector<int> cachePosition(vertexCount, -1);
+	std::vector<float> vertexScore(vertexCount);
+	for (size_t v = 0; v < vertexCount; ++v)
+	{
+		vertexScore[v] = scores.VertexScore(-1, remaining[v]);
+	}
+
+	std::vector<float> triScore(triCount);
+	std::vector<bool> emitted(triCount, false);
+
+	size_t bestTri = 0;
+	float bestScore = -1.0f;
+	for (size_t t = 0; t < triCount; ++t)
+	{
+		const uint32_t* tri = &indices[t * 3];
+		triScore[t] = vertexScore[tri[0]] + vertexScore[tri[1]] + vertexScore[tri[2]];
+		if (triScore[t] > bestScore)
+		{
+			bestScore = triScore[t];
+			bestTri = t;
+		}
+	}
+
+	std::vector<uint32_t> output;
+	output.reserve(triCount * 3);
+
+	uint32_t cache[CACHE_SIZE + 3];
+	uint32_t cacheCount = 0;
+	size_t scanCursor = 0;
+
+	for (size_t emittedCount = 0; emittedCount < triCount; ++emittedCount)
+	{
+		if (bestScore < 0.0f)
+		{
+			// Dead end: nothing in the cache has triangles left, continue in input order.
+			while (emitted[scanCursor])
+			{
+				++scanCursor;
+			}
+			bestTri = scanCursor;
+		}
+
+		const uint32_t* tri = &indices[bestTri * 3];
+		output.push_back(tri[0]);
+		output.push_back(tri[1]);
+		output.push_back(tri[2]);
+		emitted[bestTri] = true;
+
+		uint32_t newCache[CACHE_SIZE + 3];
+		uint32_t newCount = 0;
+
+		for (int k = 0; k < 3; ++k)
+		{
+			uint32_t v = tri[k];
+
+			// Remove the triangle from the vertex adjacency list.
+			uint32_t* list = &adjacency[offsets[v]];
+			for (uint32_t j = 0; j < remaining[v]; ++j)
+			{
+				if (list[j] == bestTri)
+				{
+					list[j] = list[remaining[v] - 1];
+					break;
+				}
+			}
+			--remaining[v];
+
+			bool duplicate = false;
+			for (uint32_t j = 0; j < newCount; ++j)
+			{
+				duplicate |= newCache[j] == v;
+			}
+			if (!duplicate)
+			{
+				newCache[newCount++] = v;
+			}
+		}
+
+		for (uint32_t i = 0; i < cacheCount; ++i)
+		{
+			uint32_t v = cache[i];
+			if (v != tri[0] && v != tri[1] && v != tri[2])
+			{
+				newCache[newCount++] = v;
+			}
+		}
+
+		for (uint32_t i = 0; i < newCount; ++i)
+		{
+			uint32_t v = newCache[i];
+			cachePosition[v] = i < CACHE_SIZE ? (int)i : -1;
+			vertexScore[v] = scores.VertexScore(cachePosition[v], remaining[v]);
+		}
+
+		// Only triangles touching the cache (or just evicted from it) change score.
+		bestScore = -1.0f;
+		for (uint32_t i = 0; i < newCount; ++i)
+		{
+			uint32_t v = newCache[i];
+			const uint32_t* list = &adjacency[offsets[v]];
+			for (uint32_t j = 0; j < remaining[v]; ++j)
+			{
+				uint32_t t = list[j];
+				const uint32_t* other = &indices[t * 3];
+				triScore[t] = vertexScore[other[0]] + vertexScore[other[1]] + vertexScore[other[2]];
+				if (triScore[t] > bestScore)
+				{
+					bestScore = triScore[t];
+					bestTri = t;
+				}
+			}
+		}
+
+		cacheCount = newCount < CACHE_SIZE ? newCount : CACHE_SIZE;
+		for (uint32_t i = 0; i < cacheCount; ++i)
+		{
+			cache[i] = newCache[i];
+		}
+	}
+
+	indices.swap(output);
+}
+
+std::vector<uint32_t> MeshOptimizer::OptimizeVertexFetchRemap(std::vector<uint32_t>& indices, size_t vertexCount)
+{
+	std::vector<uint32_t> remap(vertexCount, ~0u);
+	uint32_t next = 0;
+
+	for (size_t i = 0; i < indices.size(); ++i)
+	{
+		uint32_t& index = indices[i];
+		if (remap[index] == ~0u)
+		{
+			remap[index] = next++;
+		}
+		index = remap[index];
+	}
+
+	return remap;
+}
+
+MeshOptimizer::CacheStatistics MeshOptimizer::AnalyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize)
+{
+	CacheStatistics stats = {};
+
+	// A vertex is in a FIFO cache of cacheSize entries if fewer than cacheSize misses
+	// happened since it was last loaded.
+	std::vector<uint32_t> loadedAt(vertexCount, 0);
+	uint32_t misses = 0;
+	uint32_t uniqueVertices = 0;
+
+	for (size_t i = 0; i < indices.size(); ++i)
+	{
+		uint32_t v = indices[i];
+		if (loadedAt[v] == 0)
+		{
+			++uniqueVertices;
+		}
+		if (loadedAt[v] == 0 || misses + 1 - loadedAt[v] > cacheSize)
+		{
+			++misses;
+			loadedAt[v] = misses;
+		}
+	}
+
+	stats.vertexTransforms = misses;
+	stats.acmr = indices.empty() ? 0.0f : (float)misses / (float)(indices.size() / 3);
+	stats.atvr = uniqueVertices == 0 ? 0.0f : (float)misses / (float)uniqueVertices;
+	return stats;
+}
+
+bool MeshOptimizer::Validate()
+{
+	// A 48 x 48 quad grid drawn row by row, and the same triangles shuffled.
+	const uint32_t size = 48;
+	std::vector<uint32_t> rows;
+	for (uint32_t y = 0; y < size; ++y)
+	{
+		for (uint32_t x = 0; x < size; ++x)
+		{
+			const uint32_t v = y * (size + 1) + x;
+			const uint32_t quad[6] = { v, v + 1, v + size + 1, v + 1, v + size + 2, v + size + 1 };
+			rows.insert(rows.end(), quad, quad + 6);
+		}
+	}
+	std::vector<uint32_t> shuffled = rows;
+	uint32_t seed = 1;
+	for (size_t t = shuffled.size() / 3 - 1; t > 0; --t)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		const size_t other = (seed >> 8) % (t + 1);
+		std::swap_ranges(&shuffled[t * 3], &shuffled[t * 3] + 3, &shuffled[other * 3]);
+	}
+
+	const size_t vertexCount = (size + 1) * (size + 1);
+	for (const std::vector<uint32_t>* source : { &rows, &shuffled })
+	{
+		std::vector<uint32_t> indices = *source;
+		OptimizeVertexCache(indices, vertexCount);
+		const CacheStatistics before = AnalyzeVertexCache(*source, vertexCount);
+		const CacheStatistics after = AnalyzeVertexCache(indices, vertexCount);
+		if (after.acmr >= before.acmr || SortedTriangles(indices) != SortedTriangles(*source))
+		{
+			return false;
+		}
+
+		// Vertices are their own source numbers, so each corner must still name its vertex.
+		std::vector<uint32_t> vertices(vertexCount);
+		for (uint32_t v = 0; v < vertexCount; ++v)
+		{
+			vertices[v] = v;
+		}
+		std::vector<uint32_t> fetched = indices;
+		OptimizeVertexFetch(vertices, fetched);
+		uint32_t next = 0;
+		for (size_t i = 0; i < fetched.size(); ++i)
+		{
+			if (fetched[i] > next || vertices[fetched[i]] != indices[i])
+			{
+				return false;
+			}
+			next = std::max(next, fetched[i] + 1);
+		}
+		if (vertices.size() != vertexCount || AnalyzeVertexCache(fetched, vertexCount).vertexTransforms != after.vertexTransforms)
+		{
+			return false;
+		}
+	}
+	return true;
+}
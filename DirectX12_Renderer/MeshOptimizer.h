@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Index and vertex reordering for indexed triangle lists (and 3 control point patch lists,
+// which go through the same post-transform cache). CPU only.
+class MeshOptimizer
+{
+public:
+	struct CacheStatistics
+	{
+		uint32_t vertexTransforms;	// cache misses, i.e. vertex shader invocations.
+		float acmr;					// average cache miss ratio: transforms per triangle.
+		float atvr;					// average transform to vertex ratio: 1.0 is optimal.
+	};
+
+	// Reorders triangles for the post-transform vertex cache (Forsyth's linear-speed algorithm).
+	static void OptimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount);
+
+	// Renumbers vertices in order of first use and rewrites indices accordingly.
+	// Returns the old -> new vertex remap table; unreferenced vertices map to ~0u.
+	static std::vector<uint32_t> OptimizeVertexFetchRemap(std::vector<uint32_t>& indices, size_t vertexCount);
+
+	template<typename T>
+	static void OptimizeVertexFetch(std::vector<T>& vertices, std::vector<uint32_t>& indices)
+	{
+		std::vector<uint32_t> remap = OptimizeVertexFetchRemap(indices, vertices.size());
+
+		std::vector<T> reordered(vertices.size());
+		size_t used = 0;
+		for (size_t i = 0; i < vertices.size(); ++i)
+		{
+			if (remap[i] != ~0u)
+			{
+				reordered[remap[i]] = vertices[i];
+				++used;
+			}
+		}
+		reordered.resize(used);
+		vertices.swap(reordered);
+	}
+
+	// Cache reordering followed by fetch reordering.
+	template<typename T>
+	static void Optimize(std::vector<T>& vertices, std::vector<uint32_t>& indices)
+	{
+		OptimizeVertexCache(indices, vertices.size());
+		OptimizeVertexFetch(vertices, indices);
+	}
+
+	// Simulates a FIFO post-transform cache of cacheSize entries.
+	static CacheStatistics AnalyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, uint32_t cacheSize = 16);
+
+	// True if reordering a grid in rows and in random order lowers the ACMR and keeps every
+	// triangle with its winding, and fetch reordering renumbers the vertices in order of first
+	// use without changing what the triangles draw.
+	static bool Validate();
+};
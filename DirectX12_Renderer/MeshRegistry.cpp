@@ -0,0 +1,143 @@
+#include "MeshRegistry.h"
+#include <cstring>
+
+MeshRegistry::MeshRegistry()
+{
+}
+
+uint32_t MeshRegistry::Acquire(const MeshCache::Key& key)
+{
+	const uint64_t hash = MeshCache::HashKey(key);
+	for (size_t i = 0; i < m_entries.size(); ++i)
+	{
+		Entry& entry = *m_entries[i];
+		if (entry.references > 0 && entry.hash == hash && KeysEqual(entry.key, key))
+		{
+			++entry.references;
+			return (uint32_t)i;
+		}
+	}
+	return NONE;
+}
+
+uint32_t MeshRegistry::Add(const MeshCache::Key& key, size_t bytes)
+{
+	size_t slot = 0;
+	while (slot < m_entries.size() && m_entries[slot]->references > 0)
+	{
+		++slot;
+	}
+	if (slot == m_entries.size())
+	{
+		m_entries.emplace_back(new Entry());
+	}
+
+	Entry& entry = *m_entries[slot];
+	entry.generator = key.generator;
+	entry.key = key;
+	entry.key.generator = entry.generator.c_str();
+	entry.hash = MeshCache::HashKey(key);
+	entry.references = 1;
+	entry.bytes = bytes;
+	return (uint32_t)slot;
+}
+
+bool MeshRegistry::Release(uint32_t slot)
+{
+	Entry& entry = *m_entries[slot];
+	if (entry.references == 0 || --entry.references > 0)
+	{
+		return false;
+	}
+	entry.generator.clear();
+	entry.key.generator = entry.generator.c_str();
+	entry.bytes = 0;
+	return true;
+}
+
+MeshRegistry::Statistics MeshRegistry::GetStatistics() const
+{
+	Statistics statistics = {};
+	for (const std::unique_ptr<Entry>& entry : m_entries)
+	{
+		if (entry->references > 0)
+		{
+			++statistics.meshes;
+			statistics.references += entry->references;
+			statistics.bytes += entry->bytes;
+			statistics.bytesShared += entry->bytes * (entry->references - 1);
+		}
+	}
+	return statistics;
+}
+
+bool MeshRegistry::KeysEqual(const MeshCache::Key& a, const MeshCache::Key& b)
+{
+	return strcmp(a.generator, b.generator) == 0 && a.radius == b.radius && a.subdivisions == b.subdivisions &&
+		a.chunkVertices == b.chunkVertices && a.vertexStride == b.vertexStride && a.sourceHash == b.sourceHash;
+}
+
+bool MeshRegistry::Validate()
+{
+	// Equal keys in different storage hash and compare alike.
+	char generatorA[] = "Validate";
+	char generatorB[] = "Validate";
+	const MeshCache::Key key = { generatorA, 1.0f, 3, 2048, 44, 7 };
+	MeshCache::Key copy = key;
+	copy.generator = generatorB;
+	if (MeshCache::HashKey(key) != MeshCache::HashKey(copy) || !KeysEqual(key, copy))
+	{
+		return false;
+	}
+
+	MeshCache::Key changed[6] = { key, key, key, key, key, key };
+	changed[0].generator = "Validate2";
+	changed[1].radius = 2.0f;
+	changed[2].subdivisions = 4;
+	changed[3].chunkVertices = 4096;
+	changed[4].vertexStride = 12;
+	changed[5].sourceHash = 8;
+	for (const MeshCache::Key& other : changed)
+	{
+		if (MeshCache::HashKey(other) == MeshCache::HashKey(key) || KeysEqual(other, key))
+		{
+			return false;
+		}
+	}
+
+	// The generator is copied, so the caller's string may go.
+	const size_t bytes = 1000;
+	MeshRegistry registry;
+	if (registry.Acquire(key) != NONE)
+	{
+		return false;
+	}
+	const uint32_t first = registry.Add(key, bytes);
+	const uint32_t other = registry.Add(changed[2], bytes);
+	generatorA[0] = 'X';
+	const uint32_t second = registry.Acquire(copy);
+	const uint32_t third = registry.Acquire(copy);
+	Statistics statistics = registry.GetStatistics();
+	if (first == NONE || second != first || third != first || other == first ||
+		statistics.meshes != 2 || statistics.references != 4 ||
+		statistics.bytes != 2 * bytes || statistics.bytesShared != 2 * bytes)
+	{
+		return false;
+	}
+
+	// The mesh stays until its last reference goes, and its slot is then reused.
+	if (registry.Release(first) || registry.Release(second) || registry.Acquire(copy) != first ||
+		registry.Release(third) || !registry.Release(first) || registry.Acquire(copy) != NONE ||
+		registry.GetStatistics().meshes != 1 || registry.Add(copy, bytes) != first)
+	{
+		return false;
+	}
+
+	registry.Release(first);
+	if (!registry.Release(other))
+	{
+		return false;
+	}
+	statistics = registry.GetStatistics();
+	return statistics.meshes == 0 && statistics.references == 0 && statistics.bytes == 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "MeshCache.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Which meshes are held, by the MeshCache::Key they were generated from, and how many references
+// each has: the bookkeeping of GeometryCache without its GPU buffers. A mesh is known by the slot
+// it was added in, which stays its own until the last reference is released and is then reused.
+class MeshRegistry
+{
+public:
+	static const uint32_t NONE = 0xFFFFFFFF;
+
+	struct Statistics
+	{
+		size_t meshes;
+		size_t references;
+		size_t bytes;			// on the GPU
+		size_t bytesShared;		// that separate copies for every reference would have added
+	};
+
+	// references is 0 for a free slot.
+	struct Entry
+	{
+		std::string generator;
+		MeshCache::Key key;		// generator points at the string above
+		uint64_t hash;
+		uint32_t references;
+		size_t bytes;
+	};
+
+	MeshRegistry();
+
+	// Adds a reference to the mesh for key and returns its slot; NONE if there is none.
+	uint32_t Acquire(const MeshCache::Key& key);
+
+	// Adds key, which Acquire did not find, as a mesh of bytes with one reference. Returns its slot.
+	uint32_t Add(const MeshCache::Key& key, size_t bytes);
+
+	// Drops a reference to the mesh in slot; true if it was the last and the slot is now free.
+	bool Release(uint32_t slot);
+
+	// Every slot, free or not.
+	const std::vector<std::unique_ptr<Entry>>& GetEntries() const { return m_entries; }
+	Statistics GetStatistics() const;
+
+	static bool KeysEqual(const MeshCache::Key& a, const MeshCache::Key& b);
+
+	// True if equal keys hash alike whatever their generator string lives in, any single field
+	// changes the hash, and acquiring and releasing shares and frees meshes as it should.
+	static bool Validate();
+
+private:
+	MeshRegistry(const MeshRegistry&) = delete;
+	MeshRegistry& operator=(const MeshRegistry&) = delete;
+
+	std::vector<std::unique_ptr<Entry>> m_entries;	// not moved when the vector grows, so key.generator stays valid
+};
@@ -0,0 +1,478 @@
+#include "MeshletBuilder.h"
+#include "VertexPacking.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace
+{
+	const uint8_t NOT_IN_MESHLET = 0xff;
+	const float NORMAL_WEIGHT = 1.0f;		// score of a neighbour with a normal at right angles to the meshlet
+	const float DISTANCE_WEIGHT = 0.1f;		// score per average edge length from the meshlet centroid
+	const float CONE_SLACK = 1e-3f;			// added to the cone cutoff against rounding
+
+	struct Triangle
+	{
+		uint32_t v[3];
+
+		// Rotated so the smallest index comes first, which keeps the winding.
+		static Triangle Canonical(uint32_t a, uint32_t b, uint32_t c)
+		{
+			Triangle t;
+			if (a <= b && a <= c)
+			{
+				t.v[0] = a; t.v[1] = b; t.v[2] = c;
+			}
+			else if (b <= a && b <= c)
+			{
+				t.v[0] = b; t.v[1] = c; t.v[2] = a;
+			}
+			else
+			{
+				t.v[0] = c; t.v[1] = a; t.v[2] = b;
+			}
+			return t;
+		}
+
+		bool operator<(const Triangle& o) const
+		{
+			return std::lexicographical_compare(v, v + 3, o.v, o.v + 3);
+		}
+
+		bool operator==(const Triangle& o) const
+		{
+			return v[0] == o.v[0] && v[1] == o.v[1] && v[2] == o.v[2];
+		}
+	};
+
+	XMFLOAT3 Subtract(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		return XMFLOAT3(a.x - b.x, a.y - b.y, a.z - b.z);
+	}
+
+	float Dot(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	float Length(const XMFLOAT3& a)
+	{
+		return sqrtf(Dot(a, a));
+	}
+
+	// Zero for a zero vector.
+	XMFLOAT3 Normalize(const XMFLOAT3& a)
+	{
+		float length = Length(a);
+		return length > 0.0f ? XMFLOAT3(a.x / length, a.y / length, a.z / length) : XMFLOAT3(0.0f, 0.0f, 0.0f);
+	}
+
+	// Unit normal of the front face, which D3D draws clockwise: it points toward the eye.
+	XMFLOAT3 TriangleNormal(const XMFLOAT3& a, const XMFLOAT3& b, const XMFLOAT3& c)
+	{
+		XMFLOAT3 e0 = Subtract(b, a);
+		XMFLOAT3 e1 = Subtract(c, a);
+		return Normalize(XMFLOAT3(e0.y * e1.z - e0.z * e1.y, e0.z * e1.x - e0.x * e1.z, e0.x * e1.y - e0.y * e1.x));
+	}
+
+	uint32_t PackTriangle(uint8_t a, uint8_t b, uint8_t c)
+	{
+		return (uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16);
+	}
+
+	uint32_t LocalIndex(uint32_t packed, int corner)
+	{
+		return (packed >> (corner * 8)) & 0xff;
+	}
+
+	// Sphere around the box of the vertices, and the narrowest cone around the average normal.
+	MeshletBounds ComputeBounds(const std::vector<XMFLOAT3>& positions, const uint32_t* vertices, uint32_t vertexCount,
+		const XMFLOAT3* normals, const uint32_t* triangles, uint32_t triangleCount)
+	{
+		MeshletBounds bounds = {};
+
+		XMFLOAT3 minimum = positions[vertices[0]];
+		XMFLOAT3 maximum = minimum;
+		for (uint32_t i = 1; i < vertexCount; ++i)
+		{
+			const XMFLOAT3& p = positions[vertices[i]];
+			minimum = XMFLOAT3(std::min(minimum.x, p.x), std::min(minimum.y, p.y), std::min(minimum.z, p.z));
+			maximum = XMFLOAT3(std::max(maximum.x, p.x), std::max(maximum.y, p.y), std::max(maximum.z, p.z));
+		}
+		bounds.center = XMFLOAT3((minimum.x + maximum.x) * 0.5f, (minimum.y + maximum.y) * 0.5f, (minimum.z + maximum.z) * 0.5f);
+		for (uint32_t i = 0; i < vertexCount; ++i)
+		{
+			bounds.radius = std::max(bounds.radius, Length(Subtract(positions[vertices[i]], bounds.center)));
+		}
+
+		XMFLOAT3 sum(0.0f, 0.0f, 0.0f);
+		for (uint32_t t = 0; t < triangleCount; ++t)
+		{
+			const XMFLOAT3& n = normals[triangles[t]];
+			sum = XMFLOAT3(sum.x + n.x, sum.y + n.y, sum.z + n.z);
+		}
+		bounds.coneAxis = Normalize(sum);
+
+		// Degenerate triangles have no facing and do not widen the cone.
+		float minimumDot = 1.0f;
+		for (uint32_t t = 0; t < triangleCount; ++t)
+		{
+			const XMFLOAT3& n = normals[triangles[t]];
+			if (Dot(n, n) > 0.0f)
+			{
+				minimumDot = std::min(minimumDot, Dot(n, bounds.coneAxis));
+			}
+		}
+		bounds.coneCutoff = minimumDot <= 0.0f ? 1.0f : std::min(1.0f, sqrtf(1.0f - minimumDot * minimumDot) + CONE_SLACK);
+		return bounds;
+	}
+}
+
+void MeshletBuilder::Build(const std::vector<XMFLOAT3>& positions, const std::vector<uint32_t>& indices, MeshletMesh& meshlets)
+{
+	meshlets.Meshlets.clear();
+	meshlets.Bounds.clear();
+	meshlets.VertexIndices.clear();
+	meshlets.Triangles.clear();
+
+	const uint32_t triCount = (uint32_t)(indices.size() / 3);
+	const uint32_t vertexCount = (uint32_t)positions.size();
+	if (triCount == 0)
+	{
+		return;
+	}
+
+	std::vector<XMFLOAT3> normals(triCount);
+	std::vector<XMFLOAT3> centroids(triCount);
+	double edgeSum = 0.0;
+	for (uint32_t t = 0; t < triCount; ++t)
+	{
+		const XMFLOAT3& a = positions[indices[t * 3]];
+		const XMFLOAT3& b = positions[indices[t * 3 + 1]];
+		const XMFLOAT3& c = positions[indices[t * 3 + 2]];
+		normals[t] = TriangleNormal(a, b, c);
+		centroids[t] = XMFLOAT3((a.x + b.x + c.x) / 3.0f, (a.y + b.y + c.y) / 3.0f, (a.z + b.z + c.z) / 3.0f);
+		edgeSum += Length(Subtract(b, a)) + Length(Subtract(c, b)) + Length(Subtract(a, c));
+	}
+	const float edgeLength = std::max((float)(edgeSum / (3.0 * triCount)), std::numeric_limits<float>::min());
+
+	// Triangles around every vertex.
+	std::vector<uint32_t> adjacencyStart(vertexCount + 1, 0);
+	for (uint32_t index : indices)
+	{
+		++adjacencyStart[index + 1];
+	}
+	for (uint32_t v = 0; v < vertexCount; ++v)
+	{
+		adjacencyStart[v + 1] += adjacencyStart[v];
+	}
+	std::vector<uint32_t> adjacency(indices.size());
+	std::vector<uint32_t> fill(adjacencyStart.begin(), adjacencyStart.end() - 1);
+	for (uint32_t i = 0; i < (uint32_t)indices.size(); ++i)
+	{
+		adjacency[fill[indices[i]]++] = i / 3;
+	}
+
+	std::vector<uint8_t> emitted(triCount, 0);
+	std::vector<uint8_t> localIndex(vertexCount, NOT_IN_MESHLET);
+	std::vector<uint32_t> vertices;
+	std::vector<uint32_t> triangles;
+	std::vector<uint32_t> candidates;
+	vertices.reserve(MAX_VERTICES);
+	triangles.reserve(MAX_TRIANGLES);
+
+	XMFLOAT3 normalSum;
+	XMFLOAT3 centroidSum;
+
+	auto addTriangle = [&](uint32_t t)
+	{
+		emitted[t] = 1;
+		triangles.push_back(t);
+		for (int corner = 0; corner < 3; ++corner)
+		{
+			uint32_t v = indices[t * 3 + corner];
+			if (localIndex[v] != NOT_IN_MESHLET)
+			{
+				continue;
+			}
+			localIndex[v] = (uint8_t)vertices.size();
+			vertices.push_back(v);
+			for (uint32_t a = adjacencyStart[v]; a < adjacencyStart[v + 1]; ++a)
+			{
+				if (!emitted[adjacency[a]])
+				{
+					candidates.push_back(adjacency[a]);
+				}
+			}
+		}
+		normalSum = XMFLOAT3(normalSum.x + normals[t].x, normalSum.y + normals[t].y, normalSum.z + normals[t].z);
+		centroidSum = XMFLOAT3(centroidSum.x + centroids[t].x, centroidSum.y + centroids[t].y, centroidSum.z + centroids[t].z);
+	};
+
+	uint32_t emittedCount = 0;
+	uint32_t seedCursor = 0;
+	uint32_t nextSeed = UINT32_MAX;
+	while (emittedCount < triCount)
+	{
+		uint32_t seed = nextSeed;
+		if (seed == UINT32_MAX)
+		{
+			while (emitted[seedCursor])
+			{
+				++seedCursor;
+			}
+			seed = seedCursor;
+		}
+
+		normalSum = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		centroidSum = XMFLOAT3(0.0f, 0.0f, 0.0f);
+		addTriangle(seed);
+
+		while (triangles.size() < MAX_TRIANGLES)
+		{
+			const XMFLOAT3 axis = Normalize(normalSum);
+			const float scale = 1.0f / triangles.size();
+			const XMFLOAT3 center(centroidSum.x * scale, centroidSum.y * scale, centroidSum.z * scale);
+
+			uint32_t best = UINT32_MAX;
+			float bestScore = std::numeric_limits<float>::max();
+			size_t live = 0;
+			for (size_t c = 0; c < candidates.size(); ++c)
+			{
+				const uint32_t t = candidates[c];
+				if (emitted[t])
+				{
+					continue;
+				}
+				candidates[live++] = t;
+
+				uint32_t newVertices = 0;
+				for (int corner = 0; corner < 3; ++corner)
+				{
+					newVertices += localIndex[indices[t * 3 + corner]] == NOT_IN_MESHLET ? 1 : 0;
+				}
+				if (vertices.size() + newVertices > MAX_VERTICES)
+				{
+					continue;
+				}
+
+				float score = newVertices + NORMAL_WEIGHT * (1.0f - Dot(normals[t], axis)) +
+					DISTANCE_WEIGHT * Length(Subtract(centroids[t], center)) / edgeLength;
+				if (score < bestScore)
+				{
+					bestScore = score;
+					best = t;
+				}
+			}
+			candidates.resize(live);
+
+			if (best == UINT32_MAX)
+			{
+				break;
+			}
+			addTriangle(best);
+		}
+
+		Meshlet meshlet;
+		meshlet.vertexCount = (uint32_t)vertices.size();
+		meshlet.vertexOffset = (uint32_t)meshlets.VertexIndices.size();
+		meshlet.triangleCount = (uint32_t)triangles.size();
+		meshlet.triangleOffset = (uint32_t)meshlets.Triangles.size();
+		meshlets.Meshlets.push_back(meshlet);
+		meshlets.VertexIndices.insert(meshlets.VertexIndices.end(), vertices.begin(), vertices.end());
+		for (uint32_t t : triangles)
+		{
+			meshlets.Triangles.push_back(PackTriangle(
+				localIndex[indices[t * 3]], localIndex[indices[t * 3 + 1]], localIndex[indices[t * 3 + 2]]));
+		}
+		meshlets.Bounds.push_back(ComputeBounds(positions, vertices.data(), meshlet.vertexCount,
+			normals.data(), triangles.data(), meshlet.triangleCount));
+		emittedCount += meshlet.triangleCount;
+
+		// Continue next to this meshlet; candidates are in the order their vertices joined it.
+		nextSeed = UINT32_MAX;
+		for (uint32_t t : candidates)
+		{
+			if (!emitted[t])
+			{
+				nextSeed = t;
+				break;
+			}
+		}
+
+		for (uint32_t v : vertices)
+		{
+			localIndex[v] = NOT_IN_MESHLET;
+		}
+		vertices.clear();
+		triangles.clear();
+		candidates.clear();
+	}
+}
+
+MeshletBuilder::CullStatistics MeshletBuilder::Cull(const MeshletMesh& meshlets, float scale, const TerrainCulling::View& view, std::vector<uint8_t>& visible)
+{
+	CullStatistics statistics = {};
+	statistics.meshlets = meshlets.Meshlets.size();
+	visible.assign(meshlets.Meshlets.size(), 0);
+
+	for (size_t i = 0; i < meshlets.Bounds.size(); ++i)
+	{
+		// Scaling all positions, even by a negative factor, keeps the direction of every triangle normal.
+		const MeshletBounds& bounds = meshlets.Bounds[i];
+		const XMFLOAT3 center(bounds.center.x * scale, bounds.center.y * scale, bounds.center.z * scale);
+		const float radius = bounds.radius * fabsf(scale);
+		if (!TerrainCulling::IsVisible(view, center, radius))
+		{
+			++statistics.frustumCulled;
+			continue;
+		}
+
+		XMFLOAT3 toCenter = Subtract(center, view.eye);
+		if (Dot(toCenter, bounds.coneAxis) >= bounds.coneCutoff * Length(toCenter) + radius)
+		{
+			++statistics.coneCulled;
+			continue;
+		}
+		visible[i] = 1;
+	}
+	return statistics;
+}
+
+MeshletBuilder::CullStatistics MeshletBuilder::CullScriptedViews(const MeshletMesh& meshlets, float scale, float distance, float occluderRadius, uint32_t viewCount)
+{
+	// Same projection as Camera.
+	const XMMATRIX projection = XMMatrixPerspectiveFovLH(XMConvertToRadians(45.0f), 16.0f / 9.0f, 0.1f, 100000.0f);
+
+	CullStatistics total = {};
+	std::vector<uint8_t> visible;
+	for (uint32_t v = 0; v < viewCount; ++v)
+	{
+		float longitude = XM_2PI * v / viewCount;
+		float latitude = ((int)(v % 3) - 1) * XM_PI / 6.0f;
+		XMFLOAT3 eye(distance * cosf(latitude) * cosf(longitude), distance * sinf(latitude), distance * cosf(latitude) * sinf(longitude));
+
+		XMVECTOR position = XMVectorSet(eye.x, eye.y, eye.z, 1.0f);
+		XMVECTOR target = v % 2 == 0 ? XMVectorSet(0.0f, 0.0f, 0.0f, 1.0f) :
+			XMVectorSet(eye.x - sinf(longitude), eye.y, eye.z + cosf(longitude), 1.0f);
+		XMMATRIX view = XMMatrixLookAtLH(position, target, XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f));
+
+		XMFLOAT4X4 viewproj;
+		XMStoreFloat4x4(&viewproj, XMMatrixTranspose(XMMatrixMultiply(view, projection)));
+
+		CullStatistics statistics = Cull(meshlets, scale, TerrainCulling::MakeView(viewproj, eye, occluderRadius), visible);
+		total.meshlets += statistics.meshlets;
+		total.frustumCulled += statistics.frustumCulled;
+		total.coneCulled += statistics.coneCulled;
+	}
+	return total;
+}
+
+bool MeshletBuilder::Validate(const MeshletMesh& meshlets, const std::vector<XMFLOAT3>& positions, const std::vector<uint32_t>& indices)
+{
+	if (meshlets.Bounds.size() != meshlets.Meshlets.size())
+	{
+		return false;
+	}
+
+	std::vector<Triangle> rebuilt;
+	rebuilt.reserve(indices.size() / 3);
+	uint32_t vertexOffset = 0;
+	uint32_t triangleOffset = 0;
+	for (size_t m = 0; m < meshlets.Meshlets.size(); ++m)
+	{
+		const Meshlet& meshlet = meshlets.Meshlets[m];
+		const MeshletBounds& bounds = meshlets.Bounds[m];
+		if (meshlet.vertexCount == 0 || meshlet.vertexCount > MAX_VERTICES ||
+			meshlet.triangleCount == 0 || meshlet.triangleCount > MAX_TRIANGLES ||
+			meshlet.vertexOffset != vertexOffset || meshlet.triangleOffset != triangleOffset ||
+			(size_t)vertexOffset + meshlet.vertexCount > meshlets.VertexIndices.size() ||
+			(size_t)triangleOffset + meshlet.triangleCount > meshlets.Triangles.size())
+		{
+			return false;
+		}
+
+		const uint32_t* vertices = &meshlets.VertexIndices[vertexOffset];
+		for (uint32_t i = 0; i < meshlet.vertexCount; ++i)
+		{
+			if (vertices[i] >= positions.size() ||
+				Length(Subtract(positions[vertices[i]], bounds.center)) > bounds.radius * 1.0001f + 1e-4f)
+			{
+				return false;
+			}
+		}
+
+		// The cone holds a normal if its angle to the axis is at most asin(coneCutoff).
+		const float minimumDot = sqrtf(std::max(0.0f, 1.0f - bounds.coneCutoff * bounds.coneCutoff));
+		for (uint32_t t = 0; t < meshlet.triangleCount; ++t)
+		{
+			const uint32_t packed = meshlets.Triangles[triangleOffset + t];
+			if ((packed >> 24) != 0)
+			{
+				return false;
+			}
+			uint32_t corners[3];
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				uint32_t local = LocalIndex(packed, corner);
+				if (local >= meshlet.vertexCount)
+				{
+					return false;
+				}
+				corners[corner] = vertices[local];
+			}
+
+			XMFLOAT3 n = TriangleNormal(positions[corners[0]], positions[corners[1]], positions[corners[2]]);
+			if (bounds.coneCutoff < 1.0f && Dot(n, n) > 0.0f && Dot(n, bounds.coneAxis) < minimumDot - 1e-4f)
+			{
+				return false;
+			}
+			rebuilt.push_back(Triangle::Canonical(corners[0], corners[1], corners[2]));
+		}
+
+		vertexOffset += meshlet.vertexCount;
+		triangleOffset += meshlet.triangleCount;
+	}
+	if (vertexOffset != meshlets.VertexIndices.size() || triangleOffset != meshlets.Triangles.size() ||
+		rebuilt.size() != indices.size() / 3)
+	{
+		return false;
+	}
+
+	std::vector<Triangle> source(indices.size() / 3);
+	for (size_t t = 0; t < source.size(); ++t)
+	{
+		source[t] = Triangle::Canonical(indices[t * 3], indices[t * 3 + 1], indices[t * 3 + 2]);
+	}
+	std::sort(source.begin(), source.end());
+	std::sort(rebuilt.begin(), rebuilt.end());
+	return source == rebuilt;
+}
+
+void MeshletBuilder::GetGeometry(const MeshBlob& mesh, std::vector<XMFLOAT3>& positions, std::vector<uint32_t>& indices)
+{
+	positions.resize(mesh.vertexCount);
+	const uint8_t* bytes = static_cast<const uint8_t*>(mesh.vertices);
+	for (size_t i = 0; i < mesh.vertexCount; ++i)
+	{
+		const uint8_t* vertex = bytes + i * mesh.vertexStride;
+		if (mesh.vertexStride == sizeof(PackedVertex))
+		{
+			positions[i] = VertexPacking::Decode(*reinterpret_cast<const PackedVertex*>(vertex), mesh.meshOrigin, mesh.meshScale).Position;
+		}
+		else
+		{
+			positions[i] = reinterpret_cast<const Vertex*>(vertex)->Position;
+		}
+	}
+
+	indices.resize(mesh.indexCount);
+	for (size_t c = 0; c < mesh.chunkCount; ++c)
+	{
+		const MeshChunk& chunk = mesh.chunks[c];
+		for (uint32_t i = 0; i < chunk.indexCount; ++i)
+		{
+			indices[chunk.indexStart + i] = (uint32_t)(chunk.baseVertex + mesh.indices[chunk.indexStart + i]);
+		}
+	}
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "MeshCache.h"
+#include "TerrainCulling.h"
+#include <DirectXMath.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+using namespace DirectX;
+
+// A small cluster of triangles, laid out like the meshlets of the D3D12 mesh shader samples:
+// vertexCount entries of MeshletMesh::VertexIndices from vertexOffset on, triangleCount packed
+// triangles of MeshletMesh::Triangles from triangleOffset on. 16 bytes, StructuredBuffer ready.
+struct Meshlet
+{
+	uint32_t vertexCount;
+	uint32_t vertexOffset;
+	uint32_t triangleCount;
+	uint32_t triangleOffset;
+};
+
+// Culling data of a meshlet, 32 bytes. Every triangle faces away from any eye for which
+// dot(center - eye, coneAxis) >= coneCutoff * |center - eye| + radius.
+struct MeshletBounds
+{
+	XMFLOAT3 center;		// bounding sphere
+	float radius;
+	XMFLOAT3 coneAxis;		// average triangle normal
+	float coneCutoff;		// sine of the cone half angle, 1 disables the cone test
+};
+
+// Splits an indexed triangle list into meshlets of at most 64 vertices and 124 triangles,
+// the limits the mesh shader samples use, with a bounding sphere and a normal cone each.
+// Not drawn yet; meant for a mesh shader or compute culling path. CPU only.
+class MeshletBuilder
+{
+public:
+	static const uint32_t MAX_VERTICES = 64;
+	static const uint32_t MAX_TRIANGLES = 124;
+
+	struct MeshletMesh
+	{
+		std::vector<Meshlet> Meshlets;
+		std::vector<MeshletBounds> Bounds;		// one per meshlet
+		std::vector<uint32_t> VertexIndices;	// meshlet vertex -> mesh vertex
+		std::vector<uint32_t> Triangles;		// 3 local vertex indices, bits 0-7, 8-15 and 16-23
+
+		size_t Bytes() const
+		{
+			return Meshlets.size() * sizeof(Meshlet) + Bounds.size() * sizeof(MeshletBounds) +
+				VertexIndices.size() * sizeof(uint32_t) + Triangles.size() * sizeof(uint32_t);
+		}
+	};
+
+	struct CullStatistics
+	{
+		size_t meshlets;
+		size_t frustumCulled;	// outside the frustum or behind the horizon
+		size_t coneCulled;		// in view but facing away
+	};
+
+	// Grows every meshlet from a seed triangle by the neighbour that adds the fewest new vertices,
+	// ties broken by how well its normal and position fit the meshlet so far. The next seed is
+	// taken from the border of the previous meshlet, which keeps the meshlets in input order.
+	static void Build(const std::vector<XMFLOAT3>& positions, const std::vector<uint32_t>& indices, MeshletMesh& meshlets);
+
+	// visible gets one entry per meshlet. Frustum and horizon test of the bounding sphere
+	// (TerrainCulling), then the normal cone against the eye. The mesh is drawn with its positions
+	// multiplied by scale, which may be negative like the sky's; that leaves the cones as they are.
+	static CullStatistics Cull(const MeshletMesh& meshlets, float scale, const TerrainCulling::View& view, std::vector<uint8_t>& visible);
+
+	// Cull from a fixed set of viewpoints at the given distance from the origin, half of them
+	// looking at the origin and half along the orbit like the default camera. Summed over the views.
+	static CullStatistics CullScriptedViews(const MeshletMesh& meshlets, float scale, float distance, float occluderRadius, uint32_t viewCount);
+
+	// True if the meshlets hold exactly the source triangles, each once and with the same
+	// winding, within the vertex and triangle limits, and the bounds contain every vertex
+	// and triangle normal of their meshlet.
+	static bool Validate(const MeshletMesh& meshlets, const std::vector<XMFLOAT3>& positions, const std::vector<uint32_t>& indices);
+
+	// Positions and 32-bit indices of an upload-ready mesh, float Vertex or PackedVertex. Meshlets
+	// built from them refer to the vertex buffer the blob uploads, so a mesh shader can read it directly.
+	static void GetGeometry(const MeshBlob& mesh, std::vector<XMFLOAT3>& positions, std::vector<uint32_t>& indices);
+};
@@ -0,0 +1,740 @@
+#include "MipChain.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <emmintrin.h>
+
+namespace
+{
+	const double PI = 3.14159265358979323846;
+
+	// Source texels a target texel is filtered from: count weights from source texel first on,
+	// which may lie outside the map. Weights sum to 1.
+	struct Taps
+	{
+		int first;
+		uint32_t count;
+		uint32_t offset;	// into Kernel::weights
+	};
+
+	struct Kernel
+	{
+		std::vector<Taps> taps;
+		std::vector<float> weights;
+		int reachBefore;	// texels read before the first one of the map
+		int reachAfter;		// and after the last one
+		bool halving;		// target texel i reads the same weights from 2 * i + taps[0].first on
+	};
+
+	int Wrap(int value, int size)
+	{
+		int wrapped = value % size;
+		return wrapped < 0 ? wrapped + size : wrapped;
+	}
+
+	// Modified Bessel function of the first kind, order 0, by its power series.
+	double BesselI0(double x)
+	{
+		double sum = 1.0;
+		double term = 1.0;
+		const double quarter = x * x / 4.0;
+		for (int k = 1; k < 32 && term > sum * 1e-12; ++k)
+		{
+			term *= quarter / ((double)k * k);
+			sum += term;
+		}
+		return sum;
+	}
+
+	double Kaiser(double x)
+	{
+		const double width = MipChain::KAISER_WIDTH;
+		if (fabs(x) >= width)
+		{
+			return 0.0;
+		}
+		const double sinc = x == 0.0 ? 1.0 : sin(PI * x) / (PI * x);
+		const double window = BesselI0(MipChain::KAISER_ALPHA * sqrt(1.0 - (x / width) * (x / width))) / BesselI0(MipChain::KAISER_ALPHA);
+		return sinc * window;
+	}
+
+	// Weights of every target texel, in source texels. The box filter weighs each source texel
+	// by how much of it the target texel covers; the Kaiser filter is evaluated at the source
+	// texel centers in target texels, so it widens with the reduction.
+	void BuildKernel(uint32_t source, uint32_t target, MipFilter filter, Kernel& kernel)
+	{
+		const double scale = (double)source / target;
+		kernel.taps.resize(target);
+		kernel.weights.clear();
+		kernel.reachBefore = 0;
+		kernel.reachAfter = 0;
+		std::vector<double> weights;
+		for (uint32_t i = 0; i < target; ++i)
+		{
+			const double center = (i + 0.5) * scale;
+			const double radius = filter == MipFilter::BOX ? 0.5 * scale : MipChain::KAISER_WIDTH * scale;
+			int first = (int)floor(center - radius);
+			const int last = (int)ceil(center + radius);
+			weights.clear();
+			for (int j = first; j < last; ++j)
+			{
+				weights.push_back(filter == MipFilter::BOX ?
+					std::max(0.0, std::min(j + 1.0, center + radius) - std::max((double)j, center - radius)) :
+					Kaiser((j + 0.5 - center) / scale));
+			}
+			while (!weights.empty() && weights.back() == 0.0)
+			{
+				weights.pop_back();
+			}
+			size_t leading = 0;
+			while (leading < weights.size() && weights[leading] == 0.0)
+			{
+				++leading;
+			}
+			first += (int)leading;
+
+			double sum = 0.0;
+			for (size_t k = leading; k < weights.size(); ++k)
+			{
+				sum += weights[k];
+			}
+			Taps& taps = kernel.taps[i];
+			taps.first = first;
+			taps.count = (uint32_t)(weights.size() - leading);
+			taps.offset = (uint32_t)kernel.weights.size();
+			for (size_t k = leading; k < weights.size(); ++k)
+			{
+				kernel.weights.push_back((float)(weights[k] / sum));
+			}
+			kernel.reachBefore = std::max(kernel.reachBefore, -first);
+			kernel.reachAfter = std::max(kernel.reachAfter, first + (int)taps.count - (int)source);
+		}
+
+		kernel.halving = source == 2 * target;
+		for (uint32_t i = 1; kernel.halving && i < target; ++i)
+		{
+			const Taps& taps = kernel.taps[i];
+			kernel.halving = taps.count == kernel.taps[0].count && taps.first == kernel.taps[0].first + 2 * (int)i &&
+				std::equal(kernel.weights.begin() + taps.offset, kernel.weights.begin() + taps.offset + taps.count, kernel.weights.begin());
+		}
+	}
+
+	// Filters one row whose texels before 0 and past the end have been filled in, channels 1 or 4.
+	void FilterRow(const float* row, uint32_t channels, const Kernel& kernel, float* out)
+	{
+		const uint32_t target = (uint32_t)kernel.taps.size();
+		uint32_t i = 0;
+		if (channels == 4)
+		{
+			// A texel per register.
+			for (; i < target; ++i)
+			{
+				const Taps& taps = kernel.taps[i];
+				const float* weights = &kernel.weights[taps.offset];
+				const float* texel = row + (ptrdiff_t)taps.first * 4;
+				__m128 sum = _mm_setzero_ps();
+				for (uint32_t k = 0; k < taps.count; ++k)
+				{
+					sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(texel + k * 4)));
+				}
+				_mm_storeu_ps(out + i * 4, sum);
+			}
+			return;
+		}
+
+		if (kernel.halving)
+		{
+			// Four target texels per register: tap k of them reads every other texel from
+			// 2 * i + first + k on, which the shuffle picks out of two loads.
+			const Taps& taps = kernel.taps[0];
+			const float* weights = kernel.weights.data();
+			for (; i + 4 <= target; i += 4)
+			{
+				const float* texel = row + 2 * (ptrdiff_t)i + taps.first;
+				__m128 sum = _mm_setzero_ps();
+				for (uint32_t k = 0; k < taps.count; ++k)
+				{
+					__m128 even = _mm_shuffle_ps(_mm_loadu_ps(texel + k), _mm_loadu_ps(texel + k + 4), _MM_SHUFFLE(2, 0, 2, 0));
+					sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), even));
+				}
+				_mm_storeu_ps(out + i, sum);
+			}
+		}
+		for (; i < target; ++i)
+		{
+			const Taps& taps = kernel.taps[i];
+			const float* weights = &kernel.weights[taps.offset];
+			float sum = 0.0f;
+			for (uint32_t k = 0; k < taps.count; ++k)
+			{
+				sum += weights[k] * row[taps.first + (int)k];
+			}
+			out[i] = sum;
+		}
+	}
+
+	// out = sum of weights[k] * rows[k], over count floats.
+	void AccumulateRows(const float* const* rows, const float* weights, uint32_t taps, size_t count, float* out)
+	{
+		size_t i = 0;
+		for (; i + 4 <= count; i += 4)
+		{
+			__m128 sum = _mm_setzero_ps();
+			for (uint32_t k = 0; k < taps; ++k)
+			{
+				sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[k]), _mm_loadu_ps(rows[k] + i)));
+			}
+			_mm_storeu_ps(out + i, sum);
+		}
+		for (; i < count; ++i)
+		{
+			float sum = 0.0f;
+			for (uint32_t k = 0; k < taps; ++k)
+			{
+				sum += weights[k] * rows[k][i];
+			}
+			out[i] = sum;
+		}
+	}
+
+	double SrgbToLinear(double value)
+	{
+		return value <= 0.04045 ? value / 12.92 : pow((value + 0.055) / 1.055, 2.4);
+	}
+
+	// 8-bit codes to 0..1, as stored and from sRGB, and the linear values halfway between
+	// consecutive sRGB codes, so encoding rounds in sRGB space exactly. Encoding starts from the
+	// highest code at or below 1/4096th steps of linear values, at most a few codes short.
+	struct ByteTables
+	{
+		static const int STEPS = 4096;
+
+		float unorm[256];
+		float linear[256];
+		float halfway[256];		// the last one is past 1
+		uint8_t start[STEPS + 1];
+
+		ByteTables()
+		{
+			for (int c = 0; c < 256; ++c)
+			{
+				unorm[c] = c / 255.0f;
+				linear[c] = (float)SrgbToLinear(c / 255.0);
+				halfway[c] = c < 255 ? (float)SrgbToLinear((c + 0.5) / 255.0) : 2.0f;
+			}
+			int code = 0;
+			for (int i = 0; i <= STEPS; ++i)
+			{
+				while ((float)i / STEPS >= halfway[code])
+				{
+					++code;
+				}
+				start[i] = (uint8_t)code;
+			}
+		}
+	};
+
+	const ByteTables& Tables()
+	{
+		static const ByteTables tables;
+		return tables;
+	}
+
+	void DecodeRow(const uint8_t* in, uint32_t width, MipFormat format, float* out)
+	{
+		const ByteTables& tables = Tables();
+		switch (format)
+		{
+		case MipFormat::R8_UNORM:
+		case MipFormat::R8G8B8A8_UNORM:
+			for (size_t i = 0; i < width * MipChain::TexelBytes(format); ++i)
+			{
+				out[i] = tables.unorm[in[i]];
+			}
+			break;
+		case MipFormat::R16_UNORM:
+			for (uint32_t i = 0; i < width; ++i)
+			{
+				uint16_t value;
+				memcpy(&value, in + i * 2, sizeof(value));
+				out[i] = value * (1.0f / 65535.0f);
+			}
+			break;
+		case MipFormat::R32_FLOAT:
+			memcpy(out, in, width * sizeof(float));
+			break;
+		case MipFormat::R8G8B8A8_SRGB:
+			for (uint32_t i = 0; i < width * 4; i += 4)
+			{
+				out[i + 0] = tables.linear[in[i + 0]];
+				out[i + 1] = tables.linear[in[i + 1]];
+				out[i + 2] = tables.linear[in[i + 2]];
+				out[i + 3] = tables.unorm[in[i + 3]];
+			}
+			break;
+		}
+	}
+
+	uint8_t EncodeUnorm8(float value)
+	{
+		return (uint8_t)(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+	}
+
+	uint8_t EncodeSrgb(const ByteTables& tables, float value)
+	{
+		value = std::min(std::max(value, 0.0f), 1.0f);
+		int code = tables.start[(int)(value * ByteTables::STEPS)];
+		while (value >= tables.halfway[code])
+		{
+			++code;
+		}
+		return (uint8_t)code;
+	}
+
+	void EncodeRow(const float* in, uint32_t width, MipFormat format, uint8_t* out)
+	{
+		const ByteTables& tables = Tables();
+		switch (format)
+		{
+		case MipFormat::R8_UNORM:
+		case MipFormat::R8G8B8A8_UNORM:
+			for (size_t i = 0; i < width * MipChain::TexelBytes(format); ++i)
+			{
+				out[i] = EncodeUnorm8(in[i]);
+			}
+			break;
+		case MipFormat::R16_UNORM:
+			for (uint32_t i = 0; i < width; ++i)
+			{
+				uint16_t value = (uint16_t)(std::min(std::max(in[i], 0.0f), 1.0f) * 65535.0f + 0.5f);
+				memcpy(out + i * 2, &value, sizeof(value));
+			}
+			break;
+		case MipFormat::R32_FLOAT:
+			memcpy(out, in, width * sizeof(float));
+			break;
+		case MipFormat::R8G8B8A8_SRGB:
+			for (uint32_t i = 0; i < width * 4; i += 4)
+			{
+				out[i + 0] = EncodeSrgb(tables, in[i + 0]);
+				out[i + 1] = EncodeSrgb(tables, in[i + 1]);
+				out[i + 2] = EncodeSrgb(tables, in[i + 2]);
+				out[i + 3] = EncodeUnorm8(in[i + 3]);
+			}
+			break;
+		}
+	}
+
+	// Straightforward double precision chain over decoded texels, for Validate.
+	void ReferenceChain(const std::vector<double>& texels, uint32_t width, uint32_t height, uint32_t channels, MipFilter filter,
+		uint32_t levelCount, std::vector<std::vector<double>>& levels)
+	{
+		levels.assign(1, texels);
+		for (uint32_t l = 1; l < levelCount; ++l)
+		{
+			const uint32_t targetWidth = std::max(1u, width / 2);
+			const uint32_t targetHeight = std::max(1u, height / 2);
+			Kernel horizontal, vertical;
+			BuildKernel(width, targetWidth, filter, horizontal);
+			BuildKernel(height, targetHeight, filter, vertical);
+
+			const std::vector<double>& source = levels.back();
+			std::vector<double> target((size_t)targetWidth * targetHeight * channels, 0.0);
+			for (uint32_t y = 0; y < targetHeight; ++y)
+			{
+				const Taps& rows = vertical.taps[y];
+				for (uint32_t x = 0; x < targetWidth; ++x)
+				{
+					const Taps& columns = horizontal.taps[x];
+					for (uint32_t ky = 0; ky < rows.count; ++ky)
+					{
+						const int sy = std::min(std::max(rows.first + (int)ky, 0), (int)height - 1);
+						for (uint32_t kx = 0; kx < columns.count; ++kx)
+						{
+							const int sx = Wrap(columns.first + (int)kx, (int)width);
+							const double weight = (double)vertical.weights[rows.offset + ky] * horizontal.weights[columns.offset + kx];
+							for (uint32_t c = 0; c < channels; ++c)
+							{
+								target[((size_t)y * targetWidth + x) * channels + c] += weight * source[((size_t)sy * width + sx) * channels + c];
+							}
+						}
+					}
+				}
+			}
+			levels.push_back(std::move(target));
+			width = targetWidth;
+			height = targetHeight;
+		}
+	}
+}
+
+const float MipChain::KAISER_WIDTH = 3.0f;
+const float MipChain::KAISER_ALPHA = 4.0f;
+
+uint32_t MipChain::LevelCount(uint32_t width, uint32_t height)
+{
+	uint32_t levels = 1;
+	for (uint32_t size = std::max(width, height); size > 1; size /= 2)
+	{
+		++levels;
+	}
+	return levels;
+}
+
+uint32_t MipChain::Channels(MipFormat format)
+{
+	return format == MipFormat::R8G8B8A8_UNORM || format == MipFormat::R8G8B8A8_SRGB ? 4 : 1;
+}
+
+size_t MipChain::TexelBytes(MipFormat format)
+{
+	switch (format)
+	{
+	case MipFormat::R8_UNORM: return 1;
+	case MipFormat::R16_UNORM: return 2;
+	default: return 4;
+	}
+}
+
+void MipChain::Generate(const void* texels, size_t rowPitch, uint32_t width, uint32_t height, MipFormat format, MipFilter filter,
+	uint32_t levelCount, std::vector<Level>& levels)
+{
+	const uint32_t channels = Channels(format);
+	const size_t texelBytes = TexelBytes(format);
+	levels.clear();
+
+	// The previous level as linear floats; level 0 is decoded row by row instead.
+	std::vector<float> source;
+	uint32_t sourceWidth = width;
+	uint32_t sourceHeight = height;
+	for (uint32_t l = 1; l < levelCount; ++l)
+	{
+		const uint32_t targetWidth = std::max(1u, sourceWidth / 2);
+		const uint32_t targetHeight = std::max(1u, sourceHeight / 2);
+		Kernel horizontal, vertical;
+		BuildKernel(sourceWidth, targetWidth, filter, horizontal);
+		BuildKernel(sourceHeight, targetHeight, filter, vertical);
+
+		// Horizontal pass over every source row, with the row wrapped around on both sides; one
+		// more texel after it for the last load of the halving kernel.
+		const int before = horizontal.reachBefore;
+		const int after = horizontal.reachAfter + 1;
+		const size_t targetFloats = (size_t)targetWidth * channels;
+		std::vector<float> filtered((size_t)sourceHeight * targetFloats);
+		ParallelFor(sourceHeight, [&](uint32_t begin, uint32_t end)
+		{
+			std::vector<float> padded((size_t)(before + sourceWidth + after) * channels);
+			float* row = padded.data() + (size_t)before * channels;
+			for (uint32_t y = begin; y < end; ++y)
+			{
+				if (source.empty())
+				{
+					DecodeRow(static_cast<const uint8_t*>(texels) + y * rowPitch, sourceWidth, format, row);
+				}
+				else
+				{
+					memcpy(row, &source[(size_t)y * sourceWidth * channels], (size_t)sourceWidth * channels * sizeof(float));
+				}
+				for (int x = -before; x < 0; ++x)
+				{
+					memcpy(row + x * (int)channels, row + Wrap(x, (int)sourceWidth) * channels, channels * sizeof(float));
+				}
+				for (int x = (int)sourceWidth; x < (int)sourceWidth + after; ++x)
+				{
+					memcpy(row + x * (int)channels, row + Wrap(x, (int)sourceWidth) * channels, channels * sizeof(float));
+				}
+				FilterRow(row, channels, horizontal, &filtered[(size_t)y * targetFloats]);
+			}
+		});
+
+		// Vertical pass, clamped at the poles, into the floats of this level and its texels.
+		std::vector<float> target((size_t)targetHeight * targetFloats);
+		Level level;
+		level.width = targetWidth;
+		level.height = targetHeight;
+		level.texels.resize((size_t)targetWidth * targetHeight * texelBytes);
+		ParallelFor(targetHeight, [&](uint32_t begin, uint32_t end)
+		{
+			std::vector<const float*> rows;
+			for (uint32_t y = begin; y < end; ++y)
+			{
+				const Taps& taps = vertical.taps[y];
+				rows.clear();
+				for (uint32_t k = 0; k < taps.count; ++k)
+				{
+					const int sy = std::min(std::max(taps.first + (int)k, 0), (int)sourceHeight - 1);
+					rows.push_back(&filtered[(size_t)sy * targetFloats]);
+				}
+				float* out = &target[(size_t)y * targetFloats];
+				AccumulateRows(rows.data(), &vertical.weights[taps.offset], taps.count, targetFloats, out);
+				EncodeRow(out, targetWidth, format, &level.texels[(size_t)y * targetWidth * texelBytes]);
+			}
+		});
+
+		levels.push_back(std::move(level));
+		source.swap(target);
+		sourceWidth = targetWidth;
+		sourceHeight = targetHeight;
+	}
+}
+
+bool MipChain::Validate()
+{
+	uint32_t random = 777;
+	auto next = [&random]() { random = random * 1664525u + 1013904223u; return random >> 8; };
+	const MipFormat formats[5] = { MipFormat::R8_UNORM, MipFormat::R16_UNORM, MipFormat::R32_FLOAT, MipFormat::R8G8B8A8_UNORM, MipFormat::R8G8B8A8_SRGB };
+	const MipFilter filters[2] = { MipFilter::BOX, MipFilter::KAISER };
+	std::vector<Level> levels;
+
+	// Every format and filter against the reference on smooth noise, for a map that halves
+	// evenly, one that does not and a thin one, through padded rows.
+	const uint32_t sizes[3][2] = { { 64, 32 }, { 45, 19 }, { 6, 40 } };
+	for (const MipFormat format : formats)
+	{
+		const uint32_t channels = Channels(format);
+		const size_t texelBytes = TexelBytes(format);
+		for (const auto& size : sizes)
+		{
+			const uint32_t width = size[0];
+			const uint32_t height = size[1];
+			const size_t rowPitch = width * texelBytes + 8;
+			std::vector<uint8_t> texels(rowPitch * height);
+			std::vector<double> decoded((size_t)width * height * channels);
+			for (uint32_t y = 0; y < height; ++y)
+			{
+				std::vector<float> row(width * channels);
+				for (uint32_t i = 0; i < width * texelBytes; ++i)
+				{
+					texels[y * rowPitch + i] = (uint8_t)next();
+				}
+				if (format == MipFormat::R32_FLOAT)
+				{
+					for (uint32_t x = 0; x < width; ++x)
+					{
+						float value = -100.0f + (float)(next() % 20000) * 0.01f;
+						memcpy(&texels[y * rowPitch + x * 4], &value, sizeof(value));
+					}
+				}
+				DecodeRow(&texels[y * rowPitch], width, format, row.data());
+				std::copy(row.begin(), row.end(), decoded.begin() + (size_t)y * width * channels);
+			}
+
+			const uint32_t levelCount = LevelCount(width, height);
+			for (const MipFilter filter : filters)
+			{
+				std::vector<std::vector<double>> reference;
+				ReferenceChain(decoded, width, height, channels, filter, levelCount, reference);
+				Generate(texels.data(), rowPitch, width, height, format, filter, levelCount, levels);
+				if (levels.size() != levelCount - 1 || levels.back().width != 1 || levels.back().height != 1)
+				{
+					return false;
+				}
+				for (uint32_t l = 1; l < levelCount; ++l)
+				{
+					const Level& level = levels[l - 1];
+					std::vector<float> expected(reference[l].begin(), reference[l].end());
+					std::vector<uint8_t> encoded(level.texels.size());
+					for (uint32_t y = 0; y < level.height; ++y)
+					{
+						const size_t rowFloats = (size_t)level.width * channels;
+						EncodeRow(&expected[y * rowFloats], level.width, format, &encoded[y * level.width * texelBytes]);
+					}
+					for (size_t i = 0; i < encoded.size(); i += texelBytes)
+					{
+						if (format == MipFormat::R32_FLOAT)
+						{
+							float a, b;
+							memcpy(&a, &encoded[i], sizeof(a));
+							memcpy(&b, &level.texels[i], sizeof(b));
+							if (fabs(a - b) > 1e-3f)
+							{
+								return false;
+							}
+						}
+						else if (format == MipFormat::R16_UNORM)
+						{
+							uint16_t a, b;
+							memcpy(&a, &encoded[i], sizeof(a));
+							memcpy(&b, &level.texels[i], sizeof(b));
+							if (abs((int)a - (int)b) > 1)
+							{
+								return false;
+							}
+						}
+						else
+						{
+							for (size_t c = 0; c < texelBytes; ++c)
+							{
+								if (abs((int)encoded[i + c] - (int)level.texels[i + c]) > 1)
+								{
+									return false;
+								}
+							}
+						}
+					}
+				}
+			}
+		}
+	}
+
+	// Constant maps stay constant on every level.
+	for (const MipFormat format : formats)
+	{
+		const uint8_t texel[4] = { 10, 128, 250, 77 };
+		const float floatTexel = -3.5f;
+		const uint32_t width = 37;
+		const uint32_t height = 23;
+		const size_t texelBytes = TexelBytes(format);
+		std::vector<uint8_t> texels(width * height * texelBytes);
+		for (size_t i = 0; i < texels.size(); i += texelBytes)
+		{
+			memcpy(&texels[i], format == MipFormat::R32_FLOAT ? reinterpret_cast<const uint8_t*>(&floatTexel) : texel, texelBytes);
+		}
+		for (const MipFilter filter : filters)
+		{
+			Generate(texels.data(), width * texelBytes, width, height, format, filter, LevelCount(width, height), levels);
+			for (const Level& level : levels)
+			{
+				for (size_t i = 0; i < level.texels.size(); i += texelBytes)
+				{
+					if (format == MipFormat::R32_FLOAT)
+					{
+						float value;
+						memcpy(&value, &level.texels[i], sizeof(value));
+						if (fabs(value - floatTexel) > 1e-5f)
+						{
+							return false;
+						}
+					}
+					else if (memcmp(&level.texels[i], texel, texelBytes) != 0)
+					{
+						return false;
+					}
+				}
+			}
+		}
+	}
+
+	// Box filtered 16-bit levels are the exact averages of the 2^l x 2^l texels they cover.
+	{
+		const uint32_t width = 64;
+		const uint32_t height = 32;
+		std::vector<uint16_t> heights(width * height);
+		for (uint16_t& value : heights)
+		{
+			value = (uint16_t)next();
+		}
+		Generate(heights.data(), width * 2, width, height, MipFormat::R16_UNORM, MipFilter::BOX, 3, levels);
+		for (uint32_t l = 1; l < 3; ++l)
+		{
+			const Level& level = levels[l - 1];
+			const uint32_t span = 1u << l;
+			for (uint32_t y = 0; y < level.height; ++y)
+			{
+				for (uint32_t x = 0; x < level.width; ++x)
+				{
+					uint64_t sum = 0;
+					for (uint32_t sy = y * span; sy < (y + 1) * span; ++sy)
+					{
+						for (uint32_t sx = x * span; sx < (x + 1) * span; ++sx)
+						{
+							sum += heights[sy * width + sx];
+						}
+					}
+					uint16_t value;
+					memcpy(&value, &level.texels[(y * level.width + x) * 2], sizeof(value));
+					if (fabs((double)value - (double)sum / (span * span)) > 0.5 + 1e-6)
+					{
+						return false;
+					}
+				}
+			}
+		}
+	}
+
+	// A black and white sRGB checkerboard averages to half the light, not to code 128.
+	{
+		std::vector<uint8_t> checker(16 * 16 * 4);
+		for (uint32_t i = 0; i < 16 * 16; ++i)
+		{
+			uint8_t value = ((i % 16) + (i / 16)) % 2 ? 255 : 0;
+			checker[i * 4 + 0] = checker[i * 4 + 1] = checker[i * 4 + 2] = value;
+			checker[i * 4 + 3] = 255;
+		}
+		Generate(checker.data(), 16 * 4, 16, 16, MipFormat::R8G8B8A8_SRGB, MipFilter::BOX, 2, levels);
+		const uint8_t gray[4] = { 188, 188, 188, 255 };
+		for (size_t i = 0; i < levels[0].texels.size(); i += 4)
+		{
+			if (memcmp(&levels[0].texels[i], gray, 4) != 0)
+			{
+				return false;
+			}
+		}
+	}
+
+	// Rotating the map by two texels in u rotates the next level by one, with either filter.
+	{
+		const uint32_t width = 64;
+		const uint32_t height = 16;
+		std::vector<float> map(width * height);
+		std::vector<float> rotated(width * height);
+		for (float& value : map)
+		{
+			value = (float)(next() % 1000);
+		}
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				rotated[y * width + (x + 2) % width] = map[y * width + x];
+			}
+		}
+		for (const MipFilter filter : filters)
+		{
+			std::vector<Level> rotatedLevels;
+			Generate(map.data(), width * 4, width, height, MipFormat::R32_FLOAT, filter, 2, levels);
+			Generate(rotated.data(), width * 4, width, height, MipFormat::R32_FLOAT, filter, 2, rotatedLevels);
+			const float* a = reinterpret_cast<const float*>(levels[0].texels.data());
+			const float* b = reinterpret_cast<const float*>(rotatedLevels[0].texels.data());
+			const uint32_t levelWidth = levels[0].width;
+			for (uint32_t y = 0; y < levels[0].height; ++y)
+			{
+				for (uint32_t x = 0; x < levelWidth; ++x)
+				{
+					if (fabs(a[y * levelWidth + x] - b[y * levelWidth + (x + 1) % levelWidth]) > 1e-3f)
+					{
+						return false;
+					}
+				}
+			}
+		}
+	}
+
+	// Amplitude left of a sine along u after one level: one the next level can still hold, and
+	// one past its Nyquist frequency that can only alias.
+	auto amplitude = [&](MipFilter filter, double period)
+	{
+		const uint32_t width = 512;
+		const uint32_t height = 4;
+		std::vector<float> wave(width * height);
+		for (uint32_t i = 0; i < width * height; ++i)
+		{
+			wave[i] = (float)sin(2.0 * PI * ((i % width) + 0.5) / period);
+		}
+		Generate(wave.data(), width * 4, width, height, MipFormat::R32_FLOAT, filter, 2, levels);
+		const float* level = reinterpret_cast<const float*>(levels[0].texels.data());
+		double power = 0.0;
+		for (uint32_t x = 0; x < levels[0].width; ++x)
+		{
+			power += (double)level[x] * level[x];
+		}
+		return sqrt(2.0 * power / levels[0].width);
+	};
+	// 512 texels hold whole periods of both, so wrapping adds no seam.
+	const double passBox = amplitude(MipFilter::BOX, 512.0 / 80.0);
+	const double passKaiser = amplitude(MipFilter::KAISER, 512.0 / 80.0);
+	const double stopBox = amplitude(MipFilter::BOX, 512.0 / 200.0);
+	const double stopKaiser = amplitude(MipFilter::KAISER, 512.0 / 200.0);
+	return passKaiser > passBox && passKaiser > 0.85 && stopKaiser < stopBox * 0.5;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Reconstruction filter of a mip level from the one above it.
+enum class MipFilter
+{
+	BOX,	// area average; stays within the range of the texels it covers
+	KAISER,	// Kaiser windowed sinc, sharper and with less aliasing, but rings past sharp edges
+};
+
+// Texel formats mips are generated for. Only the color formats have more than one channel.
+enum class MipFormat
+{
+	R8_UNORM,
+	R16_UNORM,
+	R32_FLOAT,
+	R8G8B8A8_UNORM,	// filtered as stored, e.g. heights in red
+	R8G8B8A8_SRGB,	// sRGB encoded colors, filtered in linear light; alpha is linear
+};
+
+// Full mip chains of equirectangular maps for the upload path: u wraps around in longitude and
+// v clamps at the poles, like the terrain samplers and TilePyramid. Levels follow the D3D12
+// sizes, each max(1, previous / 2), and are filtered from the previous level kept as floats,
+// so rounding does not add up along the chain. Separable, parallel over rows, SSE2 for the
+// filter kernels. CPU only.
+class MipChain
+{
+public:
+	static const float KAISER_WIDTH;	// filter radius in texels of the smaller level
+	static const float KAISER_ALPHA;
+
+	struct Level
+	{
+		uint32_t width;
+		uint32_t height;
+		std::vector<uint8_t> texels;	// tightly packed rows
+	};
+
+	static uint32_t LevelCount(uint32_t width, uint32_t height);
+	static uint32_t Channels(MipFormat format);
+	static size_t TexelBytes(MipFormat format);
+
+	// Levels 1 .. levelCount - 1 of a width x height map whose rows are rowPitch bytes apart;
+	// level 0 is left to the caller. levels receives levelCount - 1 levels.
+	static void Generate(const void* texels, size_t rowPitch, uint32_t width, uint32_t height, MipFormat format, MipFilter filter,
+		uint32_t levelCount, std::vector<Level>& levels);
+
+	// True if the chains of every format match a double precision reference to a rounding step,
+	// constant maps stay constant, box filtering averages exactly and in linear light for sRGB,
+	// wrapping makes the filter shift invariant in u, and the Kaiser filter keeps more of the
+	// passband and less of the aliased band than the box filter.
+	static bool Validate();
+};
@@ -0,0 +1,333 @@
+#include "NormalMap.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <emmintrin.h>
+#include <vector>
+
+namespace
+{
+	const float PI = 3.14159265358979f;
+
+	int Wrap(int value, int size)
+	{
+		int wrapped = value % size;
+		return wrapped < 0 ? wrapped + size : wrapped;
+	}
+
+	uint32_t Random(uint32_t& seed, uint32_t range)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	}
+
+	// What a row needs: its heights with the wrapped texel either side, the rows north and south,
+	// turned half way round where they cross a pole, and the scales of both differences.
+	struct RowInput
+	{
+		std::vector<float> center;	// width + 2, from x - 1
+		std::vector<float> north;
+		std::vector<float> south;
+		float eastScale;	// height difference two texels apart to a slope, once divided by the radius
+		float southScale;
+	};
+
+	void LoadRow(const uint16_t* heights, uint32_t width, uint32_t height, float heightScale, uint32_t y, RowInput& row)
+	{
+		auto copyRow = [&](int source, uint32_t shift, std::vector<float>& out, uint32_t offset)
+		{
+			const uint16_t* texels = heights + (size_t)source * width;
+			std::copy(texels + shift, texels + width, out.begin() + offset);
+			std::copy(texels, texels + shift, out.begin() + offset + (width - shift));
+		};
+		row.center.resize(width + 2);
+		row.north.resize(width);
+		row.south.resize(width);
+		copyRow((int)y, 0, row.center, 1);
+		row.center[0] = row.center[width];
+		row.center[width + 1] = row.center[1];
+		if (y == 0)
+		{
+			copyRow(0, width / 2, row.north, 0);
+		}
+		else
+		{
+			copyRow((int)y - 1, 0, row.north, 0);
+		}
+		if (y + 1 == height)
+		{
+			copyRow((int)y, width / 2, row.south, 0);
+		}
+		else
+		{
+			copyRow((int)y + 1, 0, row.south, 0);
+		}
+
+		// A texel spans 2 pi r sin(phi) / width to the east and pi r / height to the south; the
+		// rings nearest the poles are taken as half a texel wide, not zero.
+		const float phiStep = PI / height;
+		const float sinPhi = std::max(sinf((y + 0.5f) * phiStep), 0.5f * phiStep);
+		row.eastScale = heightScale / (2.0f * (2.0f * PI / width) * sinPhi);
+		row.southScale = heightScale / (2.0f * phiStep);
+	}
+
+	uint8_t Quantize(float value)
+	{
+		return (uint8_t)(int)(value * 127.5f + 128.0f);
+	}
+
+	void NormalAt(const RowInput& row, uint32_t x, float radius, float heightScale, uint8_t* texel)
+	{
+		const float r = radius + row.center[x + 1] * heightScale;
+		const float a = (row.center[x + 2] - row.center[x]) * row.eastScale / r;
+		const float b = (row.south[x] - row.north[x]) * row.southScale / r;
+		const float length = sqrtf(a * a + b * b + 1.0f);
+		texel[0] = Quantize(-a / length);
+		texel[1] = Quantize(-b / length);
+		texel[2] = Quantize(1.0f / length);
+		texel[3] = 255;
+	}
+
+	void GenerateRows(const uint16_t* heights, uint32_t width, uint32_t height, float radius, float heightScale, uint32_t begin, uint32_t end,
+		bool simd, uint8_t* texels)
+	{
+		RowInput row;
+		const __m128 half = _mm_set1_ps(127.5f);
+		const __m128 middle = _mm_set1_ps(128.0f);
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128i alpha = _mm_set1_epi32((int)0xff000000);
+		for (uint32_t y = begin; y < end; ++y)
+		{
+			LoadRow(heights, width, height, heightScale, y, row);
+			uint8_t* out = texels + (size_t)y * width * 4;
+			uint32_t x = 0;
+			if (simd)
+			{
+				const __m128 eastScale = _mm_set1_ps(row.eastScale);
+				const __m128 southScale = _mm_set1_ps(row.southScale);
+				const __m128 base = _mm_set1_ps(radius);
+				const __m128 scale = _mm_set1_ps(heightScale);
+				for (; x + 4 <= width; x += 4)
+				{
+					__m128 r = _mm_add_ps(base, _mm_mul_ps(_mm_loadu_ps(&row.center[x + 1]), scale));
+					__m128 a = _mm_div_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&row.center[x + 2]), _mm_loadu_ps(&row.center[x])), eastScale), r);
+					__m128 b = _mm_div_ps(_mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(&row.south[x]), _mm_loadu_ps(&row.north[x])), southScale), r);
+					__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(a, a), _mm_mul_ps(b, b)), one));
+
+					// -a / length, -b / length and 1 / length onto bytes, packed as RGBA.
+					__m128 zero = _mm_setzero_ps();
+					__m128i nx = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_div_ps(_mm_sub_ps(zero, a), length), half), middle));
+					__m128i ny = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_div_ps(_mm_sub_ps(zero, b), length), half), middle));
+					__m128i nz = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(_mm_div_ps(one, length), half), middle));
+					__m128i packed = _mm_or_si128(_mm_or_si128(nx, _mm_slli_epi32(ny, 8)), _mm_or_si128(_mm_slli_epi32(nz, 16), alpha));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x * 4), packed);
+				}
+			}
+			for (; x < width; ++x)
+			{
+				NormalAt(row, x, radius, heightScale, out + x * 4);
+			}
+		}
+	}
+
+	// Bilinear with wrapping, as the WRAP sampler of DomainShader.
+	float SampleHeight(const uint16_t* heights, uint32_t width, uint32_t height, float u, float v)
+	{
+		float x = u * width - 0.5f;
+		float y = v * height - 0.5f;
+		float x0 = floorf(x);
+		float y0 = floorf(y);
+		float fx = x - x0;
+		float fy = y - y0;
+		auto texel = [&](int tx, int ty) { return (float)heights[(size_t)Wrap(ty, (int)height) * width + Wrap(tx, (int)width)]; };
+		float top = texel((int)x0, (int)y0) + fx * (texel((int)x0 + 1, (int)y0) - texel((int)x0, (int)y0));
+		float bottom = texel((int)x0, (int)y0 + 1) + fx * (texel((int)x0 + 1, (int)y0 + 1) - texel((int)x0, (int)y0 + 1));
+		return top + fy * (bottom - top);
+	}
+
+	float AngleDegrees(const float a[3], const float b[3])
+	{
+		float la = sqrtf(a[0] * a[0] + a[1] * a[1] + a[2] * a[2]);
+		float lb = sqrtf(b[0] * b[0] + b[1] * b[1] + b[2] * b[2]);
+		float cosine = (a[0] * b[0] + a[1] * b[1] + a[2] * b[2]) / (la * lb);
+		return acosf(std::max(-1.0f, std::min(1.0f, cosine))) * 180.0f / PI;
+	}
+}
+
+void NormalMap::Generate(const uint16_t* heights, uint32_t width, uint32_t height, float radius, float heightScale, uint8_t* texels)
+{
+	ParallelFor(height, [=](uint32_t begin, uint32_t end)
+	{
+		GenerateRows(heights, width, height, radius, heightScale, begin, end, true, texels);
+	});
+}
+
+void NormalMap::GenerateScalar(const uint16_t* heights, uint32_t width, uint32_t height, float radius, float heightScale, uint8_t* texels)
+{
+	GenerateRows(heights, width, height, radius, heightScale, 0, height, false, texels);
+}
+
+void NormalMap::ShaderNormal(const uint16_t* heights, uint32_t width, uint32_t height, float heightScale, float u, float v, float tapTexels,
+	float normal[3])
+{
+	const float stepU = tapTexels / width;
+	const float stepV = tapTexels / height;
+	auto z = [&](float du, float dv) { return SampleHeight(heights, width, height, u + du, v + dv) * heightScale; };
+	float zb = z(0.0f, -stepV);
+	float zc = z(stepU, -stepV);
+	float zd = z(stepU, 0.0f);
+	float ze = z(stepU, stepV);
+	float zf = z(0.0f, stepV);
+	float zg = z(-stepU, stepV);
+	float zh = z(-stepU, 0.0f);
+	float zi = z(-stepU, -stepV);
+
+	float x = zg + 2 * zh + zi - zc - 2 * zd - ze;
+	float y = 2 * zb + zc + zi - ze - 2 * zf - zg;
+	float length = sqrtf(x * x + y * y + 64.0f);
+	normal[0] = x / length;
+	normal[1] = y / length;
+	normal[2] = 8.0f / length;
+}
+
+void NormalMap::Decode(const uint8_t* texel, float normal[3])
+{
+	normal[0] = texel[0] / 127.5f - 1.0f;
+	normal[1] = texel[1] / 127.5f - 1.0f;
+	normal[2] = sqrtf(std::max(0.0f, 1.0f - normal[0] * normal[0] - normal[1] * normal[1]));
+}
+
+bool NormalMap::Validate()
+{
+	const uint32_t sizes[2][2] = { { 64, 32 }, { 37, 19 } };
+	uint32_t seed = 5;
+	for (const uint32_t* size : sizes)
+	{
+		const uint32_t width = size[0];
+		const uint32_t height = size[1];
+		const size_t count = (size_t)width * height;
+		std::vector<uint16_t> heights(count);
+		std::vector<uint8_t> simd(count * 4);
+		std::vector<uint8_t> scalar(count * 4);
+
+		// Flat maps point straight up.
+		std::fill(heights.begin(), heights.end(), (uint16_t)30000);
+		Generate(heights.data(), width, height, 100.0f, 0.001f, simd.data());
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (simd[i * 4] != 128 || simd[i * 4 + 1] != 128 || simd[i * 4 + 2] != 255 || simd[i * 4 + 3] != 255)
+			{
+				return false;
+			}
+		}
+
+		// Noise through both paths, which must agree texel for texel.
+		for (uint16_t& h : heights)
+		{
+			h = (uint16_t)Random(seed, 65536);
+		}
+		Generate(heights.data(), width, height, 100.0f, 0.0005f, simd.data());
+		GenerateScalar(heights.data(), width, height, 100.0f, 0.0005f, scalar.data());
+		for (size_t i = 0; i < simd.size(); ++i)
+		{
+			if (abs((int)simd[i] - (int)scalar[i]) > 1)
+			{
+				return false;
+			}
+		}
+
+		// Turning the map round in u turns the normals with it, across the seam too.
+		const uint32_t turn = 7;
+		std::vector<uint16_t> turned(count);
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				turned[(size_t)y * width + (x + turn) % width] = heights[(size_t)y * width + x];
+			}
+		}
+		std::vector<uint8_t> turnedTexels(count * 4);
+		Generate(turned.data(), width, height, 100.0f, 0.0005f, turnedTexels.data());
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				if (memcmp(&simd[((size_t)y * width + x) * 4], &turnedTexels[((size_t)y * width + (x + turn) % width) * 4], 4) != 0)
+				{
+					return false;
+				}
+			}
+		}
+
+		// Heights that tilt the whole sphere along a direction, h = a + b (n . d): at every texel,
+		// poles included, the slope is b times d along the surface, over the radius.
+		const float radius = 100.0f;
+		const float scale = 0.0005f;
+		const float d[3] = { 0.48f, 0.6f, -0.64f };
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			const float phi = (y + 0.5f) * PI / height;
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				const float theta = (x + 0.5f) * 2.0f * PI / width;
+				const float n[3] = { sinf(phi) * cosf(theta), cosf(phi), sinf(phi) * sinf(theta) };
+				heights[(size_t)y * width + x] = (uint16_t)lroundf(32768.0f + 20000.0f * (n[0] * d[0] + n[1] * d[1] + n[2] * d[2]));
+			}
+		}
+		Generate(heights.data(), width, height, radius, scale, simd.data());
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			const float phi = (y + 0.5f) * PI / height;
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				const float theta = (x + 0.5f) * 2.0f * PI / width;
+				const float east[3] = { -sinf(theta), 0.0f, cosf(theta) };
+				const float south[3] = { cosf(phi) * cosf(theta), -sinf(phi), cosf(phi) * sinf(theta) };
+				const float r = radius + heights[(size_t)y * width + x] * scale;
+				const float a = 20000.0f * scale * (east[0] * d[0] + east[2] * d[2]) / r;
+				const float b = 20000.0f * scale * (south[0] * d[0] + south[1] * d[1] + south[2] * d[2]) / r;
+				const float expected[3] = { -a, -b, 1.0f };
+				float normal[3];
+				Decode(&simd[((size_t)y * width + x) * 4], normal);
+				if (AngleDegrees(normal, expected) > 1.5f)
+				{
+					return false;
+				}
+			}
+		}
+
+		// DomainShader's taps t texels apart with a z of 8 take a texel to be 1 / t wide. Near the
+		// equator of a sphere about that size, with t matched to each texel's width on the surface,
+		// both see the same slopes.
+		const float matched = width / (2.0f * PI * 0.3f);
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				const float u = (x + 0.5f) / width;
+				const float v = (y + 0.5f) / height;
+				heights[(size_t)y * width + x] = (uint16_t)lroundf(30000.0f + 9000.0f * sinf(2.0f * PI * u * 2.0f) + 6000.0f * cosf(2.0f * PI * v));
+			}
+		}
+		const float shaderScale = 0.0002f;
+		Generate(heights.data(), width, height, matched, shaderScale, simd.data());
+		for (uint32_t y = height * 2 / 5; y < height - height * 2 / 5; ++y)
+		{
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				float normal[3];
+				float shader[3];
+				Decode(&simd[((size_t)y * width + x) * 4], normal);
+				const float tap = width / (2.0f * PI * (matched + heights[(size_t)y * width + x] * shaderScale));
+				ShaderNormal(heights.data(), width, height, shaderScale, (x + 0.5f) / width, (y + 0.5f) / height, tap, shader);
+				if (AngleDegrees(normal, shader) > 2.0f)
+				{
+					return false;
+				}
+			}
+		}
+	}
+	return true;
+}
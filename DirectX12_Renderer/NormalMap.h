@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Normal map of an equirectangular heightmap wrapped on a sphere, for DomainShader to read once
+// per vertex instead of filtering eight height taps. Normals are in the tangent frame of the
+// shaders: east along u, south along v, up. They come from central differences of the heights
+// one texel apart, scaled by the width of a texel on the sphere, so they stay right towards the
+// poles. u wraps; a row past a pole continues half a turn round on the other side. Stored as
+// RGBA8 with x, y and z mapped from -1..1 onto 0..255, so MipChain filters it and BC5 keeps red
+// and green for the shader to rebuild z from. Parallel over rows, SSE2 along them. CPU only.
+class NormalMap
+{
+public:
+	// Heights are 0..65535, heightScale world units each, on a sphere of radius; texels receives
+	// width x height RGBA8 texels in tightly packed rows.
+	static void Generate(const uint16_t* heights, uint32_t width, uint32_t height, float radius, float heightScale, uint8_t* texels);
+
+	// Same as Generate, one texel at a time on the calling thread.
+	static void GenerateScalar(const uint16_t* heights, uint32_t width, uint32_t height, float radius, float heightScale, uint8_t* texels);
+
+	// The normal DomainShader filters at u, v on level 0: Sobel weights over eight bilinear taps
+	// tapTexels apart and a z of 8, in the same tangent frame. For comparing against the map.
+	static void ShaderNormal(const uint16_t* heights, uint32_t width, uint32_t height, float heightScale, float u, float v, float tapTexels,
+		float normal[3]);
+
+	// Tangent-space normal of an RGBA8 texel, z rebuilt from x and y as the shader does.
+	static void Decode(const uint8_t* texel, float normal[3]);
+
+	// True if the SSE and scalar paths agree, flat maps point up, slopes match their analytic
+	// normals at every latitude, the u seam and the poles are continuous, and near the equator
+	// the map matches the shader's own filter where a texel is as wide as its taps assume.
+	static bool Validate();
+};
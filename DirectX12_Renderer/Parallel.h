@@ -0,0 +1,31 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+// Runs fn(begin, end) over [0, count) split into one contiguous range per core. Items should
+// be worth at least a few microseconds each; small counts run on the calling thread.
+template<typename F>
+void ParallelFor(uint32_t count, const F& fn)
+{
+	uint32_t threads = std::max(1u, std::min(std::thread::hardware_concurrency(), count / 16));
+	if (threads == 1)
+	{
+		fn(0u, count);
+		return;
+	}
+
+	std::vector<std::thread> workers;
+	for (uint32_t t = 0; t < threads; ++t)
+	{
+		uint32_t begin = (uint32_t)((uint64_t)count * t / threads);
+		uint32_t end = (uint32_t)((uint64_t)count * (t + 1) / threads);
+		workers.emplace_back(fn, begin, end);
+	}
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+}
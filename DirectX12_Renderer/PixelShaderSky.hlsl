@@ -0,0 +1,30 @@
+Texture2D<float4> skymap : register(t0);
+SamplerState smsampler : register(s0);
+
+// SkyConstantBuffer in Sky.h.
+cbuffer SkyConstantBuffer : register(b0)
+{
+	float4x4 viewproj;
+	float4 eye;
+	int height;
+	int width;
+	float4x4 invViewproj;	// with the eye at the origin, SkyRay::InvertViewProjection
+}
+
+struct VS_OUTPUT
+{
+	float4 pos : SV_POSITION;
+	float2 clip : TEXCOORD;
+};
+
+// The sky is at infinity: the view ray through the pixel picks the texel, as SkyRay::Reconstruct
+// and SkyRay::Texcoord do on the CPU.
+float4 PSSky(VS_OUTPUT input) : SV_TARGET
+{
+	float3 direction = normalize(mul(float4(input.clip, 1.0f, 1.0f), invViewproj).xyz);
+
+	float theta = atan2(-direction.x, -direction.z);
+	float phi = acos(clamp(-direction.y, -1.0f, 1.0f));
+
+	return skymap.Sample(smsampler, float2(theta / (2.0f * 3.14f), phi / 3.14f));
+}
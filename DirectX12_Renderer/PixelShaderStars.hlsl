@@ -0,0 +1,13 @@
+struct VS_OUTPUT
+{
+	float4 pos : SV_POSITION;
+	float2 corner : TEXCOORD;
+	float3 color : COLOR;
+};
+
+// Round soft sprite, added to what is behind it.
+float4 PSStars(VS_OUTPUT input) : SV_TARGET
+{
+	float falloff = saturate(1.0f - dot(input.corner, input.corner));
+	return float4(input.color * falloff * falloff, 1.0f);
+}
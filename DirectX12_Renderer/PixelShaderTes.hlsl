@@ -1,5 +1,11 @@
 Texture2D<float4> displacementmap : register(t0);
 Texture2D<float4> colormap : register(t1);
+#ifdef VIRTUAL_TEXTURE
+Texture2D<uint4> colorPages : register(t3);
+#endif
+#ifdef HORIZON_MAP
+Texture2DArray<float4> horizonmap : register(t5);	// HorizonMap: sines of the horizon, azimuths 0-3 then 4-7
+#endif
 SamplerState dmsampler : register(s0);
 SamplerState cmsampler : register(s1);
 
@@ -22,6 +28,16 @@ cbuffer ConstantBuffer : register(b0)
 	LightData light;
 	int height;
 	int width;
+	float heightOffset;
+	float heightScale;
+	float3 meshOrigin;
+	float meshScale;
+	float planetRadius;
+	int patchGridSize;
+	uint virtualHeightWidth;	// level 0 size of the streamed maps
+	uint virtualHeightHeight;
+	uint virtualColorWidth;
+	uint virtualColorHeight;
 }
 
 struct DS_OUTPUT
@@ -32,11 +48,71 @@ struct DS_OUTPUT
 	float2 tex : TEXCOORD;
 };
 
+#ifdef VIRTUAL_TEXTURE
+static const float VT_TILE_SIZE = 128.0f;	// TilePyramid::TILE_SIZE
+static const float VT_BORDER = 1.0f;		// TilePyramid::BORDER
+
+// Physical cache coordinates of a virtual texture coordinate, inside the finest resident tile
+// over it as VirtualPageTable::WriteIndirection records it. u wraps and v clamps like the tile borders.
+float2 VirtualToPhysical(Texture2D<uint4> pages, float2 virtualSize, float2 physicalSize, float2 uv)
+{
+	float2 texel = min(float2(frac(uv.x), saturate(uv.y)) * virtualSize, virtualSize - 0.5f);
+	uint4 page = pages.Load(int3(texel / VT_TILE_SIZE, 0));
+	float2 local = fmod(texel / (float)(1u << page.z), VT_TILE_SIZE);
+	return (page.xy * (VT_TILE_SIZE + 2.0f * VT_BORDER) + VT_BORDER + local) / physicalSize;
+}
+#endif
+
+#ifdef HORIZON_MAP
+static const float HORIZON_AZIMUTHS = 8.0f;	// HorizonMap::AZIMUTHS, east first, then towards south
+static const float SUN_PENUMBRA = 0.02f;	// sine the sun sets over behind a ridge, a few 8-bit steps of the map
+
+// Light the terrain leaves itself: x is the share of the sun above the horizon towards it, that
+// horizon interpolated between the azimuths either side; y is the share of the sky above the
+// horizons all round, cosine weighted, for the ambient light. Two fetches.
+float2 HorizonLight(float2 uv, float3 toSun)
+{
+	float theta = uv.x * 2.0f * 3.14159265359f;
+	float phi = uv.y * 3.14159265359f;
+	float3 up = float3(sin(phi) * cos(theta), cos(phi), sin(phi) * sin(theta));
+	float3 east = float3(-sin(theta), 0.0f, cos(theta));
+	float3 south = float3(cos(phi) * cos(theta), -sin(phi), cos(phi) * sin(theta));
+
+	float4 horizons0 = horizonmap.SampleLevel(dmsampler, float3(uv, 0.0f), 0);
+	float4 horizons1 = horizonmap.SampleLevel(dmsampler, float3(uv, 1.0f), 0);
+
+	// Tent weights round the sun's azimuth, 0..8, wrapping past east.
+	float azimuth = frac(atan2(dot(toSun, south), dot(toSun, east)) / (2.0f * 3.14159265359f)) * HORIZON_AZIMUTHS;
+	float4 d0 = abs(azimuth - float4(0.0f, 1.0f, 2.0f, 3.0f));
+	float4 d1 = abs(azimuth - float4(4.0f, 5.0f, 6.0f, 7.0f));
+	float4 w0 = saturate(1.0f - min(d0, HORIZON_AZIMUTHS - d0));
+	float4 w1 = saturate(1.0f - min(d1, HORIZON_AZIMUTHS - d1));
+	float horizon = dot(w0, horizons0) + dot(w1, horizons1);
+
+	float sun = smoothstep(horizon - SUN_PENUMBRA, horizon + SUN_PENUMBRA, dot(toSun, up));
+	float sky = 1.0f - (dot(horizons0, horizons0) + dot(horizons1, horizons1)) / HORIZON_AZIMUTHS;
+	return float2(sun, sky);
+}
+#endif
+
 float4 PSTes(DS_OUTPUT input) : SV_TARGET
 {
 	float3 norm = input.norm.xyz;
 	
-	float4 color = float4(colormap.Sample(cmsampler, input.tex));
+#ifdef VIRTUAL_TEXTURE
+	float2 physicalSize;
+	colormap.GetDimensions(physicalSize.x, physicalSize.y);
+	float4 color = colormap.SampleLevel(cmsampler, VirtualToPhysical(colorPages, float2(virtualColorWidth, virtualColorHeight), physicalSize, input.tex), 0);
+#else
+	// u jumps from 1 to 0 across the seam at theta = pi, which would pick the coarsest mip there;
+	// the gradient of u shifted by half a turn is smooth there instead.
+	float2 dx = ddx(input.tex);
+	float2 dy = ddy(input.tex);
+	float shifted = frac(input.tex.x + 0.5f);
+	dx.x = abs(ddx(shifted)) < abs(dx.x) ? ddx(shifted) : dx.x;
+	dy.x = abs(ddy(shifted)) < abs(dy.x) ? ddy(shifted) : dy.x;
+	float4 color = colormap.SampleGrad(cmsampler, input.tex, dx, dy);
+#endif
 
 	float4 ambient = color * light.amb;
 	float4 diffuse = color * light.dif * dot(-light.dir, norm);
@@ -44,5 +120,12 @@ float4 PSTes(DS_OUTPUT input) : SV_TARGET
 	float3 toEye = normalize(eye.xyz - input.pos);
 	float4 specular = color * 0.1f * light.spec * pow(max(dot(V, toEye), 0.0f), 1.0f);
 
+#ifdef HORIZON_MAP
+	float2 horizon = HorizonLight(input.tex, normalize(-light.dir));
+	ambient *= horizon.y;
+	diffuse *= horizon.x;
+	specular *= horizon.x;
+#endif
+
 	return saturate(ambient + diffuse + specular);
 }
\ No newline at end of file
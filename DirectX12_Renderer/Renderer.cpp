@@ -345,6 +345,13 @@ namespace graphics {
 		commnadList->ClearDepthStencilView(dsvHandle, D3D12_CLEAR_FLAG_DEPTH, 1.0f, 0, 0, nullptr);
 	}
 
+	// Clears part of the back buffer SetBackBufferRender set, e.g. for a progress bar.
+	void Graphics::ClearBackBufferRect(ID3D12GraphicsCommandList* commnadList, const float color[4], const D3D12_RECT& rect)
+	{
+		CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHandle(m_RTVHeap->GetCPUDescriptorHandleForHeapStart(), m_BufferIndex, m_RTVDescSize);
+		commnadList->ClearRenderTargetView(rtvHandle, color, 1, &rect);
+	}
+
 	// BackBuffer Present  
 	void Graphics::SetBackBufferPresent(ID3D12GraphicsCommandList* commnadList)
 	{
@@ -436,7 +443,7 @@ namespace graphics {
 	}
 
 	// Shader Compile Լ
-	void Graphics::CompileShader(LPCWSTR filename, LPCSTR entryname, D3D12_SHADER_BYTECODE& shaderBytecode, ShaderType shadertype)
+	void Graphics::CompileShader(LPCWSTR filename, LPCSTR entryname, D3D12_SHADER_BYTECODE& shaderBytecode, ShaderType shadertype, const D3D_SHADER_MACRO* defines)
 	{
 		ID3DBlob* shader;
 		ID3DBlob* error;
@@ -463,7 +470,7 @@ namespace graphics {
 			version = ""; // will break on attempting to compile as not valid.
 		}
 
-		if (FAILED(D3DCompileFromFile(filename, NULL, NULL, entryname, version, D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION, 0, &shader, &error))) {
+		if (FAILED(D3DCompileFromFile(filename, defines, NULL, entryname, version, D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION, 0, &shader, &error))) {
 			if (shader) shader->Release();
 			if (error)
 			{
@@ -36,6 +36,7 @@ namespace graphics {
 		void Render();
 		void ResetPipeline();
 		void SetBackBufferRender(ID3D12GraphicsCommandList* commnadList, const float clearColor[4]);
+		void ClearBackBufferRect(ID3D12GraphicsCommandList* commnadList, const float color[4], const D3D12_RECT& rect);
 		void SetBackBufferPresent(ID3D12GraphicsCommandList* commnadList);
 		void createRootSignature(CD3DX12_ROOT_SIGNATURE_DESC* rootDesc, ID3D12RootSignature*& rootSignature);
 		void createPSO(D3D12_GRAPHICS_PIPELINE_STATE_DESC* psoDesc, ID3D12PipelineState*& pipelineState);
@@ -44,7 +45,7 @@ namespace graphics {
 		void CreateCBV(D3D12_CONSTANT_BUFFER_VIEW_DESC* desc, D3D12_CPU_DESCRIPTOR_HANDLE handle);
 		void CreateBuffer(ID3D12Resource*& buffer, D3D12_RESOURCE_DESC* texDesc);
 		void CreateDefaultBuffer(ID3D12Resource*& buffer, D3D12_RESOURCE_DESC* texDesc);
-		void CompileShader(LPCWSTR filename, LPCSTR entryname, D3D12_SHADER_BYTECODE& shaderBytecode, ShaderType shadertype);
+		void CompileShader(LPCWSTR filename, LPCSTR entryname, D3D12_SHADER_BYTECODE& shaderBytecode, ShaderType shadertype, const D3D_SHADER_MACRO* defines = nullptr);
 		void LoadAsset();
 		void CreateCommittedBuffer(ID3D12Resource*& buffer, ID3D12Resource*& upload, D3D12_RESOURCE_DESC* texDesc);
 		void ClearAllFrames();
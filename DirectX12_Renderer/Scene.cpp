@@ -1,11 +1,42 @@
 #include "Scene.h"
+#include <psapi.h>
+
+#pragma comment(lib, "psapi.lib")
+
+namespace
+{
+	// Most of the process ever resident at once, for the startup report.
+	double PeakWorkingSetMB()
+	{
+		PROCESS_MEMORY_COUNTERS counters = {};
+		counters.cb = sizeof(counters);
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		{
+			return 0.0;
+		}
+		return counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+	}
+}
 
 Scene::Scene(int height, int width, Graphics* renderer) : 
-	m_terrain(renderer),
-	m_sky(renderer),
+	m_start(steady_clock::now()),
+	m_terrain(renderer, m_geometryCache),
+	m_sky(renderer, m_geometryCache),
+	m_uploadRing(renderer, STAGING_RING_SIZE, STAGING_FRAME_BYTES),
+	m_loader(ASSET_LOADER_THREADS),
+	m_queuedMs(0.0),
+	m_firstFrameMs(0.0),
+	m_queuedPeakMB(0.0),
+	m_loadReported(false),
 	m_renderer(renderer),
 	m_camera(height, width)
 {
+	// The maps decode in the background from here on, and Draw stages them as they finish.
+	m_queuedPeakMB = PeakWorkingSetMB();
+	m_terrain.QueueLoads(renderer, m_loader, m_uploadRing);
+	m_sky.QueueLoads(renderer, m_loader, m_uploadRing);
+	m_queuedMs = duration<double, std::milli>(steady_clock::now() - m_start).count();
+
 	m_viewport.TopLeftX = 0;
 	m_viewport.TopLeftY = 0;
 	m_viewport.Width = (float)width;
@@ -21,8 +52,7 @@ Scene::Scene(int height, int width, Graphics* renderer) :
 	CloseCommandList();
 	m_renderer->LoadAsset();
 
-	m_terrain.ClearUnusedUploadBuffersAfterInit();
-	m_sky.ClearUnusedUploadBuffersAfterInit();
+	m_geometryCache.ReleaseUploadBuffers();
 }
 
 Scene::~Scene()
@@ -34,24 +64,35 @@ Scene::~Scene()
 void Scene::Draw()
 {
 	m_renderer->ResetPipeline();
+	UpdateLoading();
 
 	const float clearColor[] = { 0.1f, 0.1f, 0.1f, 1.0f };
 	m_renderer->SetBackBufferRender(m_renderer->GetCommandList(), clearColor);
 
 	SetViewport();
 
+	// Each draws once its maps are resident; until then there is the clear color and a loading bar.
 	//m_terrain.Draw2D(m_renderer->GetCommandList());
 	//m_terrain.Draw3D(m_renderer->GetCommandList(), m_camera.GetViewProjectionMatrixTransposed(), m_camera.GetEyePosition());
-	if (m_DrawMode == 1)
+	if (m_terrain.IsResident())
 	{
-		m_terrain.DrawTes(m_renderer->GetCommandList(), m_camera.GetViewProjectionMatrixTransposed(), m_camera.GetEyePosition());
-		m_sky.Draw3D(m_renderer->GetCommandList(), m_camera.GetViewProjectionMatrixTransposed(), m_camera.GetEyePosition());
+		if (m_DrawMode == 1)
+		{
+			m_terrain.DrawTes(m_renderer->GetCommandList(), m_camera.GetViewProjectionMatrixTransposed(), m_camera.GetEyePosition());
+		}
+		else
+		{
+			m_terrain.DrawTes_Wireframe(m_renderer->GetCommandList(), m_camera.GetViewProjectionMatrixTransposed(), m_camera.GetEyePosition());
+		}
 	}
-	else
+	if (m_sky.IsResident())
 	{
-		m_terrain.DrawTes_Wireframe(m_renderer->GetCommandList(), m_camera.GetViewProjectionMatrixTransposed(), m_camera.GetEyePosition());
 		m_sky.Draw3D(m_renderer->GetCommandList(), m_camera.GetViewProjectionMatrixTransposed(), m_camera.GetEyePosition());
 	}
+	if (!m_loadReported)
+	{
+		DrawLoadingBar(m_loader.GetProgress().fraction);
+	}
 
 	m_renderer->SetBackBufferPresent(m_renderer->GetCommandList());
 	CloseCommandList();
@@ -89,6 +130,7 @@ void Scene::HandleInput(const InputDirections& directions, float deltaTime)
 	{
 		m_camera.Translate(XMFLOAT3(0.0f, 0.0f, -SPEED * deltaTime));
 	}
+	KeepAboveTerrain();
 	if (directions.bMode1)
 	{
 		m_DrawMode = 1;
@@ -99,6 +141,27 @@ void Scene::HandleInput(const InputDirections& directions, float deltaTime)
 	}
 }
 
+// Lifts the eye straight up out of the terrain when a move has taken it below the surface.
+void Scene::KeepAboveTerrain()
+{
+	const TerrainHeightField& heightField = m_terrain.GetHeightField();
+	if (!heightField.IsBound())
+	{
+		return;
+	}
+
+	XMFLOAT4 eye = m_camera.GetEyePosition();
+	XMFLOAT3 surface = heightField.GetSurfacePoint(XMFLOAT3(eye.x, eye.y, eye.z));
+	float surfaceDistance = sqrtf(surface.x * surface.x + surface.y * surface.y + surface.z * surface.z);
+	float eyeDistance = sqrtf(eye.x * eye.x + eye.y * eye.y + eye.z * eye.z);
+	if (eyeDistance >= surfaceDistance + CAMERA_CLEARANCE)
+	{
+		return;
+	}
+	float lift = (surfaceDistance + CAMERA_CLEARANCE) / surfaceDistance;
+	m_camera.SetEyePosition(XMFLOAT4(surface.x * lift, surface.y * lift, surface.z * lift, eye.w));
+}
+
 void Scene::HandleMouseInput(int x, int y)
 {
 	m_camera.Pitch(ROT_ANGLE * y);
@@ -118,3 +181,62 @@ void Scene::SetViewport()
 	m_renderer->GetCommandList()->RSSetViewports(1, &m_viewport);
 	m_renderer->GetCommandList()->RSSetScissorRects(1, &m_scissorRect);
 }
+
+// Stages the maps that finished decoding into this frame's command list, until everything is
+// resident, and then reports how startup went.
+void Scene::UpdateLoading()
+{
+	if (m_loadReported)
+	{
+		return;
+	}
+	m_uploader.NextFrame();
+	if (m_uploader.GetFrame() == 1)
+	{
+		m_firstFrameMs = duration<double, std::milli>(steady_clock::now() - m_start).count();
+	}
+	m_uploadRing.Retire(m_uploader.GetCompletedFence());
+	m_loader.Update(m_uploader, ASSET_STAGES_PER_FRAME);
+	m_uploadRing.Close(m_uploader.GetFrame());
+
+	std::string failure;
+	if (m_loader.GetFailure(failure))
+	{
+		throw GFX_Exception(("Failed to load the " + failure).c_str());
+	}
+	if (!m_loader.IsComplete())
+	{
+		return;
+	}
+
+	m_loadReported = true;
+	char report[256];
+	sprintf_s(report, "Startup: pipelines and meshes in %.1f ms, first frame at %.1f ms, everything resident at %.1f ms after %llu frames\n",
+		m_queuedMs, m_firstFrameMs, duration<double, std::milli>(steady_clock::now() - m_start).count(), (unsigned long long)m_uploader.GetFrame());
+	OutputDebugStringA(report);
+	sprintf_s(report, "Peak working set: %.1f MB before the maps loaded, %.1f MB once resident, TERRAIN_HEIGHT_ZERO_COPY %s\n", m_queuedPeakMB,
+		PeakWorkingSetMB(), TERRAIN_HEIGHT_ZERO_COPY ? "on" : "off");
+	OutputDebugStringA(report);
+	OutputDebugStringA(m_loader.Report().c_str());
+	m_uploadRing.Report();
+	m_geometryCache.Report();
+}
+
+// A bar across the lower part of the screen that fills up as the maps load.
+void Scene::DrawLoadingBar(float fraction)
+{
+	const float track[] = { 0.2f, 0.2f, 0.2f, 1.0f };
+	const float fill[] = { 0.7f, 0.7f, 0.7f, 1.0f };
+	D3D12_RECT bar;
+	bar.left = m_scissorRect.right / 4;
+	bar.right = m_scissorRect.right - bar.left;
+	bar.top = m_scissorRect.bottom * 7 / 8;
+	bar.bottom = bar.top + (m_scissorRect.bottom < 256 ? 4 : m_scissorRect.bottom / 64);
+	m_renderer->ClearBackBufferRect(m_renderer->GetCommandList(), track, bar);
+
+	bar.right = bar.left + (LONG)(fraction * (bar.right - bar.left));
+	if (bar.right > bar.left)
+	{
+		m_renderer->ClearBackBufferRect(m_renderer->GetCommandList(), fill, bar);
+	}
+}
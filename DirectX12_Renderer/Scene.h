@@ -9,6 +9,12 @@ using namespace graphics;
 #define SPEED 1000.0f
 #define ROT_ANGLE 0.75f
 
+static const UINT ASSET_LOADER_THREADS = 3; // maps decoded at once; each still spreads its mips and block compression over all cores.
+static const UINT ASSET_STAGES_PER_FRAME = 1; // decoded maps staged per frame, to bound the hitch of a frame.
+static const UINT64 STAGING_RING_SIZE = 64 << 20; // all the upload memory the maps go through, however large they are.
+static const UINT64 STAGING_FRAME_BYTES = 16 << 20; // copied per frame at most; a frame's worth is reused FRAME_BUFFER_COUNT frames later.
+static const float CAMERA_CLEARANCE = 0.5f; // world units the eye is kept above the terrain under it, once the heightmap is resident.
+
 struct InputDirections
 {
 	BOOL bFront;
@@ -21,6 +27,22 @@ struct InputDirections
 	BOOL bMode2;
 };
 
+// Copies recorded in a frame's command list have run once that frame's back buffer comes round
+// again, when ResetPipeline has waited for its fence.
+class FrameUploader : public AssetUploader
+{
+public:
+	FrameUploader() : m_frame(0) {}
+
+	void NextFrame() { ++m_frame; }
+	uint64_t GetFrame() const { return m_frame; }
+	uint64_t Submit() override { return m_frame; }
+	uint64_t GetCompletedFence() override { return m_frame > (uint64_t)FRAME_BUFFER_COUNT ? m_frame - FRAME_BUFFER_COUNT : 0; }
+
+private:
+	uint64_t m_frame;
+};
+
 class Scene
 {
 public:
@@ -36,10 +58,22 @@ public:
 private:
 	void CloseCommandList();
 	void SetViewport();
+	void UpdateLoading();
+	void KeepAboveTerrain();
+	void DrawLoadingBar(float fraction);
 
 	Graphics* m_renderer;
+	steady_clock::time_point m_start;	// before everything else is constructed, for the startup report
+	GeometryCache m_geometryCache;	// before the terrain and sky, which release into it
 	Terrain m_terrain;
 	Sky m_sky;
+	UploadRing m_uploadRing;
+	AssetLoader m_loader;	// after the terrain and sky, so its threads stop before they are destroyed
+	FrameUploader m_uploader;
+	double m_queuedMs;	// since m_start
+	double m_firstFrameMs;
+	double m_queuedPeakMB;	// peak working set before the maps were queued
+	bool m_loadReported;
 	Camera m_camera;
 	D3D12_VIEWPORT m_viewport;
 	D3D12_RECT m_scissorRect;
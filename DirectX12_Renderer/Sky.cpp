@@ -1,25 +1,34 @@
 #include "Sky.h"
 
-Sky::Sky(Graphics* renderer) :
+Sky::Sky(Graphics* renderer, GeometryCache& geometryCache) :
 	m_pipelineState3D(nullptr),
 	m_rootSignature3D(nullptr),
 	m_srvHeap(nullptr),
-	m_uploadHeap(nullptr),
+	m_residentLoads(0),
 	m_image(),
 	m_width(0),
 	m_height(0),
 	m_CBV(nullptr),
-	m_vertexBuffer(nullptr),
-	m_vertexBufferUpload(nullptr),
-	m_indexBuffer(nullptr),
-	m_indexBufferUpload(nullptr),
+	m_geometryCache(&geometryCache),
+	m_geometry(nullptr),
+	m_starBuffer(nullptr),
+	m_starCursor(),
+	m_starCount(0),
 	m_orbitCycle(5760)
 {
-	LoadHeightMap(renderer, L"TychoSkymapII.t5_16384x08192.tif", L"lroc_color_poles_4k.tif");
+	CreateDescriptorHeap(renderer);
+	if (SKY_STAR_FIELD)
+	{
+		InitPipelineStars(renderer);
+		return;
+	}
 
 	InitPipeline3D(renderer);
 
-	CreateGeosphere(renderer, 20000, 10);
+	if (!SKY_FULLSCREEN)
+	{
+		CreateGeosphere(renderer, 20000, 5);
+	}
 }
 
 Sky::~Sky()
@@ -29,30 +38,16 @@ Sky::~Sky()
 		m_srvHeap->Release();
 		m_srvHeap = nullptr;
 	}
-	if (m_uploadHeap)
-	{
-		m_uploadHeap->Release();
-		m_uploadHeap = nullptr;
-	}
-	if (m_indexBufferUpload)
-	{
-		m_indexBufferUpload->Release();
-		m_indexBufferUpload = nullptr;
-	}
-	if (m_indexBuffer)
-	{
-		m_indexBuffer->Release();
-		m_indexBuffer = nullptr;
-	}
-	if (m_vertexBufferUpload)
+	m_skyMap.Release();
+	m_colorMap.Release();
+	if (m_geometry)
 	{
-		m_vertexBufferUpload->Release();
-		m_vertexBufferUpload = nullptr;
+		m_geometryCache->Release(m_geometry);
 	}
-	if (m_vertexBuffer)
+	if (m_starBuffer)
 	{
-		m_vertexBuffer->Release();
-		m_vertexBuffer = nullptr;
+		m_starBuffer->Release();
+		m_starBuffer = nullptr;
 	}
 	if (m_pipelineState3D)
 	{
@@ -78,44 +73,106 @@ void Sky::Draw3D(ID3D12GraphicsCommandList* m_commandList, XMFLOAT4X4 viewproj,
 	m_commandList->SetPipelineState(m_pipelineState3D);
 	m_commandList->SetGraphicsRootSignature(m_rootSignature3D);
 
-	m_constantBufferData.viewproj = viewproj;
-	m_constantBufferData.eye = eye;
-	m_constantBufferData.height = m_height;
-	m_constantBufferData.width = m_width;
-	memcpy(m_cbvDataBegin, &m_constantBufferData, sizeof(m_constantBufferData));
+	if (SKY_STAR_FIELD || SKY_FULLSCREEN)
+	{
+		m_skyConstantBufferData.viewproj = viewproj;
+		m_skyConstantBufferData.eye = eye;
+		m_skyConstantBufferData.height = m_height;
+		m_skyConstantBufferData.width = m_width;
+		m_skyConstantBufferData.invViewproj = SkyRay::InvertViewProjection(viewproj, XMFLOAT3(eye.x, eye.y, eye.z));
+		memcpy(m_cbvDataBegin, &m_skyConstantBufferData, sizeof(m_skyConstantBufferData));
+	}
+	else
+	{
+		m_constantBufferData.viewproj = viewproj;
+		m_constantBufferData.eye = eye;
+		m_constantBufferData.height = m_height;
+		m_constantBufferData.width = m_width;
+		memcpy(m_cbvDataBegin, &m_constantBufferData, sizeof(m_constantBufferData));
+	}
 
 	ID3D12DescriptorHeap* heaps[] = { m_srvHeap };
 	m_commandList->SetDescriptorHeaps(_countof(heaps), heaps);
-	m_commandList->SetGraphicsRootDescriptorTable(0, m_srvHeap->GetGPUDescriptorHandleForHeapStart());
 	CD3DX12_GPU_DESCRIPTOR_HANDLE cbvHandle(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), 1, m_srvDescSize);
+	if (SKY_STAR_FIELD)
+	{
+		m_commandList->SetGraphicsRootDescriptorTable(0, cbvHandle);
+		m_commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP);
+		m_commandList->IASetVertexBuffers(0, 1, &m_starBufferView);
+		m_commandList->DrawInstanced(4, m_starCount, 0, 0);
+		return;
+	}
+
+	m_commandList->SetGraphicsRootDescriptorTable(0, m_srvHeap->GetGPUDescriptorHandleForHeapStart());
 	m_commandList->SetGraphicsRootDescriptorTable(1, cbvHandle);
 	CD3DX12_GPU_DESCRIPTOR_HANDLE srvhandle2(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), 2, m_srvDescSize);
 	m_commandList->SetGraphicsRootDescriptorTable(2, srvhandle2);
 
 	m_commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST); // describe how to read the vertex buffer.
-	m_commandList->IASetVertexBuffers(0, 1, &m_vertexBufferView);
-	m_commandList->IASetIndexBuffer(&m_indexBufferView);
-
-	m_commandList->DrawIndexedInstanced(m_indexcount, 1, 0, 0, 0);
-}
-
-void Sky::ClearUnusedUploadBuffersAfterInit()
-{
-	if (m_uploadHeap)
+	if (SKY_FULLSCREEN)
 	{
-		m_uploadHeap->Release();
-		m_uploadHeap = nullptr;
+		m_commandList->DrawInstanced(3, 1, 0, 0);
+		return;
 	}
-	if (m_indexBufferUpload)
+
+	m_commandList->IASetVertexBuffers(0, 1, &m_geometry->vertexBufferView);
+	m_commandList->IASetIndexBuffer(&m_geometry->indexBufferView);
+
+	for (const MeshChunk& chunk : m_geometry->chunks)
 	{
-		m_indexBufferUpload->Release();
-		m_indexBufferUpload = nullptr;
+		m_commandList->DrawIndexedInstanced(chunk.indexCount, 1, chunk.indexStart, chunk.baseVertex, 0);
 	}
-	if (m_vertexBufferUpload)
+}
+
+void Sky::QueueLoads(Graphics* renderer, AssetLoader& loader, UploadRing& ring)
+{
+	if (SKY_STAR_FIELD)
 	{
-		m_vertexBufferUpload->Release();
-		m_vertexBufferUpload = nullptr;
+		loader.Add("Sky stars",
+			[this, renderer]() { LoadStars(renderer, L"TychoSkymapII.stars", L"StarCatalog.txt", L"TychoSkymapII.t5_16384x08192.tif"); },
+			[this, renderer, &ring](size_t& bytes) { return StageStars(renderer, ring, bytes); },
+			[this]()
+			{
+				m_stars = StarCatalog();
+				++m_residentLoads;
+			});
+		return;
 	}
+
+	loader.Add("Sky map",
+		[this, renderer]() { DecodeSkyMap(renderer, L"TychoSkymapII.t5_16384x08192.tif"); },
+		[this, renderer, &ring](size_t& bytes)
+		{
+			if (!m_skyMap.Stage(renderer, ring, bytes))
+			{
+				return false;
+			}
+			CD3DX12_CPU_DESCRIPTOR_HANDLE handleSRV(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), 0, m_srvDescSize);
+			renderer->CreateSRV(m_skyMap.texture, &m_skyMap.srvDesc, handleSRV);
+			return true;
+		},
+		[this]()
+		{
+			m_skyMap.ReleaseStaging();
+			++m_residentLoads;
+		});
+	loader.Add("Sky color map",
+		[this, renderer]() { DecodeColorMap(renderer, L"lroc_color_poles_4k.tif"); },
+		[this, renderer, &ring](size_t& bytes)
+		{
+			if (!m_colorMap.Stage(renderer, ring, bytes))
+			{
+				return false;
+			}
+			CD3DX12_CPU_DESCRIPTOR_HANDLE colorhandle(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), 2, m_srvDescSize);
+			renderer->CreateSRV(m_colorMap.texture, &m_colorMap.srvDesc, colorhandle);
+			return true;
+		},
+		[this]()
+		{
+			m_colorMap.ReleaseStaging();
+			++m_residentLoads;
+		});
 }
 
 void Sky::InitPipeline3D(Graphics* Renderer)
@@ -157,8 +214,16 @@ void Sky::InitPipeline3D(Graphics* Renderer)
 	// Shader Compile
 	D3D12_SHADER_BYTECODE PSBytecode = {};
 	D3D12_SHADER_BYTECODE VSBytecode = {};
-	Renderer->CompileShader(L"VertexShader.hlsl", "VS", VSBytecode, VERTEX_SHADER);
-	Renderer->CompileShader(L"PixelShader.hlsl", "PS", PSBytecode, PIXEL_SHADER);
+	if (SKY_FULLSCREEN)
+	{
+		Renderer->CompileShader(L"VertexShaderSky.hlsl", "VSSky", VSBytecode, VERTEX_SHADER);
+		Renderer->CompileShader(L"PixelShaderSky.hlsl", "PSSky", PSBytecode, PIXEL_SHADER);
+	}
+	else
+	{
+		Renderer->CompileShader(L"VertexShader.hlsl", "VS", VSBytecode, VERTEX_SHADER);
+		Renderer->CompileShader(L"PixelShader.hlsl", "PS", PSBytecode, PIXEL_SHADER);
+	}
 
 	// Input Layout 
 	D3D12_INPUT_ELEMENT_DESC inputLayout[] =
@@ -167,6 +232,75 @@ void Sky::InitPipeline3D(Graphics* Renderer)
 		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
 	};
 
+	D3D12_INPUT_LAYOUT_DESC	inputLayoutDesc = {};
+	if (!SKY_FULLSCREEN)
+	{
+		inputLayoutDesc.NumElements = sizeof(inputLayout) / sizeof(D3D12_INPUT_ELEMENT_DESC);
+		inputLayoutDesc.pInputElementDescs = inputLayout;
+	}
+
+	D3D12_GRAPHICS_PIPELINE_STATE_DESC psoDesc = {};
+	psoDesc.pRootSignature = m_rootSignature3D;
+	psoDesc.InputLayout = inputLayoutDesc;
+	psoDesc.VS = VSBytecode;
+	psoDesc.PS = PSBytecode;
+	psoDesc.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
+	psoDesc.SampleMask = UINT_MAX;
+	psoDesc.RasterizerState = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
+	psoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_BACK;
+	psoDesc.RasterizerState.FillMode = D3D12_FILL_MODE_SOLID;
+	psoDesc.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
+	if (SKY_FULLSCREEN)
+	{
+		// The triangle is at depth 1, where the depth buffer is cleared to: draw where it still is.
+		psoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
+		psoDesc.DepthStencilState.DepthFunc = D3D12_COMPARISON_FUNC_LESS_EQUAL;
+		psoDesc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;
+	}
+	psoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+	psoDesc.NumRenderTargets = 1;
+	psoDesc.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
+	psoDesc.SampleDesc.Count = 1;
+
+	Renderer->createPSO(&psoDesc, m_pipelineState3D);
+}
+
+void Sky::InitPipelineStars(Graphics* Renderer)
+{
+	// Root Signature: the constant buffer alone.
+	CD3DX12_DESCRIPTOR_RANGE range[1];
+	CD3DX12_ROOT_PARAMETER paramsRoot[1];
+	range[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_CBV, 1, 0);
+	paramsRoot[0].InitAsDescriptorTable(1, &range[0], D3D12_SHADER_VISIBILITY_VERTEX);
+
+	CD3DX12_ROOT_SIGNATURE_DESC rootDesc;
+	rootDesc.Init(
+		_countof(paramsRoot),
+		paramsRoot,
+		0,
+		nullptr,
+		D3D12_ROOT_SIGNATURE_FLAG_DENY_HULL_SHADER_ROOT_ACCESS |
+		D3D12_ROOT_SIGNATURE_FLAG_DENY_DOMAIN_SHADER_ROOT_ACCESS |
+		D3D12_ROOT_SIGNATURE_FLAG_DENY_GEOMETRY_SHADER_ROOT_ACCESS |
+		D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT);
+
+	Renderer->createRootSignature(&rootDesc, m_rootSignature3D);
+
+	CreateConstantBuffer(Renderer);
+
+	D3D12_SHADER_BYTECODE PSBytecode = {};
+	D3D12_SHADER_BYTECODE VSBytecode = {};
+	Renderer->CompileShader(L"VertexShaderStars.hlsl", "VSStars", VSBytecode, VERTEX_SHADER);
+	Renderer->CompileShader(L"PixelShaderStars.hlsl", "PSStars", PSBytecode, PIXEL_SHADER);
+
+	// Star in StarCatalog.h, stepped once per sprite.
+	D3D12_INPUT_ELEMENT_DESC inputLayout[] =
+	{
+		{ "DIRECTION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_INSTANCE_DATA, 1 },
+		{ "MAGNITUDE", 0, DXGI_FORMAT_R32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_INSTANCE_DATA, 1 },
+		{ "COLOR", 0, DXGI_FORMAT_R8G8B8A8_UNORM, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_INSTANCE_DATA, 1 },
+	};
+
 	D3D12_INPUT_LAYOUT_DESC	inputLayoutDesc = {};
 	inputLayoutDesc.NumElements = sizeof(inputLayout) / sizeof(D3D12_INPUT_ELEMENT_DESC);
 	inputLayoutDesc.pInputElementDescs = inputLayout;
@@ -177,11 +311,19 @@ void Sky::InitPipeline3D(Graphics* Renderer)
 	psoDesc.VS = VSBytecode;
 	psoDesc.PS = PSBytecode;
 	psoDesc.BlendState = CD3DX12_BLEND_DESC(D3D12_DEFAULT);
+	// Overlapping sprites add up.
+	psoDesc.BlendState.RenderTarget[0].BlendEnable = TRUE;
+	psoDesc.BlendState.RenderTarget[0].SrcBlend = D3D12_BLEND_ONE;
+	psoDesc.BlendState.RenderTarget[0].DestBlend = D3D12_BLEND_ONE;
+	psoDesc.BlendState.RenderTarget[0].BlendOp = D3D12_BLEND_OP_ADD;
 	psoDesc.SampleMask = UINT_MAX;
 	psoDesc.RasterizerState = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
-	psoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_BACK;
+	psoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_NONE;
 	psoDesc.RasterizerState.FillMode = D3D12_FILL_MODE_SOLID;
+	// On the far plane, like the fullscreen sky: drawn where nothing else was.
 	psoDesc.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
+	psoDesc.DepthStencilState.DepthFunc = D3D12_COMPARISON_FUNC_LESS_EQUAL;
+	psoDesc.DepthStencilState.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;
 	psoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
 	psoDesc.NumRenderTargets = 1;
 	psoDesc.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
@@ -192,7 +334,7 @@ void Sky::InitPipeline3D(Graphics* Renderer)
 
 void Sky::CreateConstantBuffer(Graphics* Renderer)
 {
-	UINT64 bufferSize = sizeof(ConstantBuffer);
+	UINT64 bufferSize = SKY_STAR_FIELD || SKY_FULLSCREEN ? sizeof(SkyConstantBuffer) : sizeof(ConstantBuffer);
 	Renderer->CreateBuffer(m_CBV, &CD3DX12_RESOURCE_DESC::Buffer(bufferSize));
 	m_CBV->SetName(L"CBV");
 
@@ -206,6 +348,7 @@ void Sky::CreateConstantBuffer(Graphics* Renderer)
 	Renderer->CreateCBV(&cbvDesc, srvHandle);
 
 	ZeroMemory(&m_constantBufferData, sizeof(m_constantBufferData));
+	ZeroMemory(&m_skyConstantBufferData, sizeof(m_skyConstantBufferData));
 
 	CD3DX12_RANGE readRange(0, 0);
 	if (FAILED(m_CBV->Map(0, &readRange, reinterpret_cast<void**>(&m_cbvDataBegin))))
@@ -214,249 +357,170 @@ void Sky::CreateConstantBuffer(Graphics* Renderer)
 	}
 }
 
-void Sky::LoadHeightMap(Graphics* Renderer, const wchar_t* displacementmap, const wchar_t* colormap)
+void Sky::CreateDescriptorHeap(Graphics* Renderer)
 {
-	// SRV Discriptor Heap 
+	// SRV Discriptor Heap : the sky map, the CBV and the color map, or only the CBV in slot 1 for the stars.
 	D3D12_DESCRIPTOR_HEAP_DESC srvHeapDesc = {};
-	srvHeapDesc.NumDescriptors = 3;
+	srvHeapDesc.NumDescriptors = SKY_STAR_FIELD ? 2 : 3;
 	srvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
 	srvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
 	Renderer->CreateDescriptorHeap(&srvHeapDesc, m_srvHeap);
 
 	m_srvDescSize = Renderer->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+}
 
+void Sky::DecodeSkyMap(Graphics* Renderer, const wchar_t* displacementmap)
+{
 	// Displacement Map Ҵ
-	std::unique_ptr<uint8_t[]> displacementMapdecodedData;
-	ID3D12Resource* displacementMap;
+	LoadingTexture& map = m_skyMap;
 	D3D12_SUBRESOURCE_DATA displacementMapData;
 
-	D3D12_SHADER_RESOURCE_VIEW_DESC	srvDesc = {};
-	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-	srvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	map.srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	map.srvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
 	//srvDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-	srvDesc.Texture2D.MipLevels = 1;
-
-	LoadWICTextureFromFileEx(Renderer->GetDevice(), displacementmap, 0, D3D12_RESOURCE_FLAG_NONE, WIC_LOADER_FORCE_RGBA32, &displacementMap, displacementMapdecodedData, displacementMapData);
-
-	// Color Map Ҵ
-	std::unique_ptr<uint8_t[]> colorMapdecodedData;
-	ID3D12Resource* colorMap;
-	D3D12_SUBRESOURCE_DATA colorMapData;
-
-	D3D12_SHADER_RESOURCE_VIEW_DESC colorsrvDesc = {};
-	colorsrvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-	colorsrvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-	colorsrvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-	colorsrvDesc.Texture2D.MipLevels = 1;
+	map.srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	map.srvDesc.Texture2D.MipLevels = 1;
 
-	LoadWICTextureFromFileEx(Renderer->GetDevice(), colormap, 0, D3D12_RESOURCE_FLAG_NONE, WIC_LOADER_FORCE_RGBA32, &colorMap, colorMapdecodedData, colorMapData);
+	if (FAILED(LoadWICTextureFromFileEx(Renderer->GetDevice(), displacementmap, 0, D3D12_RESOURCE_FLAG_NONE, WIC_LOADER_FORCE_RGBA32, &map.texture, map.decodedData, displacementMapData)))
+	{
+		throw (GFX_Exception("Failed to load the sky map."));
+	}
 
-	D3D12_RESOURCE_DESC texDesc = displacementMap->GetDesc();
+	D3D12_RESOURCE_DESC texDesc = map.texture->GetDesc();
 	m_width = texDesc.Width;
 	m_height = texDesc.Height;
 
-	const UINT64 displacementMapSize = GetRequiredIntermediateSize(displacementMap, 0, 1);
-	const UINT64 colorMapSize = GetRequiredIntermediateSize(colorMap, 0, 1);
-
-	Renderer->GetDevice()->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD), D3D12_HEAP_FLAG_NONE,
-		&CD3DX12_RESOURCE_DESC::Buffer(displacementMapSize + colorMapSize), D3D12_RESOURCE_STATE_GENERIC_READ,
-		NULL, IID_PPV_ARGS(&m_uploadHeap));
-
-	//const unsigned int subresourceCount = texDesc.DepthOrArraySize * texDesc.MipLevels;
-	UpdateSubresources(Renderer->GetCommandList(), displacementMap, m_uploadHeap, 0, 0, 1, &displacementMapData);
-	Renderer->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(displacementMap, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
-	CD3DX12_CPU_DESCRIPTOR_HANDLE handleSRV(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), 0, m_srvDescSize);
-	Renderer->CreateSRV(displacementMap, &srvDesc, handleSRV);
-
-	UpdateSubresources(Renderer->GetCommandList(), colorMap, m_uploadHeap, displacementMapSize, 0, 1, &colorMapData);
-	Renderer->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(colorMap, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
-	CD3DX12_CPU_DESCRIPTOR_HANDLE colorhandle(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), 2, m_srvDescSize);
-	Renderer->CreateSRV(colorMap, &colorsrvDesc, colorhandle);
+	// The sky map swapped for a BC1 texture of the same size, if it is a whole number of blocks.
+	if (SKY_BLOCK_COMPRESSION && m_width % 4 == 0 && m_height % 4 == 0)
+	{
+		auto start = steady_clock::now();
+		map.blocks.resize(1);
+		BlockCompressor::Encode(displacementMapData.pData, displacementMapData.RowPitch, m_width, m_height, MipFormat::R8G8B8A8_UNORM, BlockFormat::BC1, map.blocks[0]);
+		double blockMs = duration<double, std::milli>(steady_clock::now() - start).count();
+
+		char report[256];
+		sprintf_s(report, "Sky map: %ux%u as BC1 in %.1f ms (%.1f Mblocks/s), %.1f MB instead of %.1f MB\n", m_width, m_height, blockMs,
+			map.blocks[0].size() / 8 / (blockMs * 1000.0), map.blocks[0].size() / (1024.0 * 1024.0), (double)m_width * m_height * 4 / (1024.0 * 1024.0));
+		OutputDebugStringA(report);
+
+		texDesc.Format = (DXGI_FORMAT)BlockCompressor::DxgiFormat(BlockFormat::BC1);
+		map.texture->Release();
+		Renderer->CreateDefaultBuffer(map.texture, &texDesc);
+		map.srvDesc.Format = texDesc.Format;
+		map.decodedData.reset();
+		displacementMapData.pData = map.blocks[0].data();
+		displacementMapData.RowPitch = (LONG_PTR)BlockCompressor::BlocksAcross(m_width) * 8;
+		displacementMapData.SlicePitch = (LONG_PTR)map.blocks[0].size();
+	}
+	map.subresources.assign(1, displacementMapData);
 }
 
-void Sky::CreateGeosphere(Graphics* Renderer, float radius, UINT numSubdivisions)
+void Sky::DecodeColorMap(Graphics* Renderer, const wchar_t* colormap)
 {
-	numSubdivisions = min(numSubdivisions, 5u);
-
-	const float X = 0.525731f;
-	const float Z = 0.850651f;
-
-	XMFLOAT3 pos[12] =
-	{
-		XMFLOAT3(-X, 0.0f, Z),  XMFLOAT3(X, 0.0f, Z),
-		XMFLOAT3(-X, 0.0f, -Z), XMFLOAT3(X, 0.0f, -Z),
-		XMFLOAT3(0.0f, Z, X),   XMFLOAT3(0.0f, Z, -X),
-		XMFLOAT3(0.0f, -Z, X),  XMFLOAT3(0.0f, -Z, -X),
-		XMFLOAT3(Z, X, 0.0f),   XMFLOAT3(-Z, X, 0.0f),
-		XMFLOAT3(Z, -X, 0.0f),  XMFLOAT3(-Z, -X, 0.0f)
-	};
-
-	DWORD k[60] =
-	{
-		1,4,0,  4,9,0,  4,5,9,  8,5,4,  1,8,4,
-		1,10,8, 10,3,8, 8,3,5,  3,2,5,  3,7,2,
-		3,10,7, 10,6,7, 6,11,7, 6,0,11, 6,1,0,
-		10,1,6, 11,0,9, 2,11,9, 5,2,9,  11,2,7
-	};
-
-	std::vector<Vertex> vertices;
-	std::vector<UINT> indices;
+	// Color Map Ҵ
+	LoadingTexture& map = m_colorMap;
+	D3D12_SUBRESOURCE_DATA colorMapData;
 
-	vertices.resize(12);
-	indices.resize(60);
+	map.srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	map.srvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	map.srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	map.srvDesc.Texture2D.MipLevels = 1;
 
-	for (UINT i = 0; i < 12; ++i)
+	if (FAILED(LoadWICTextureFromFileEx(Renderer->GetDevice(), colormap, 0, D3D12_RESOURCE_FLAG_NONE, WIC_LOADER_FORCE_RGBA32, &map.texture, map.decodedData, colorMapData)))
 	{
-		vertices[i].Position = pos[i];
+		throw (GFX_Exception("Failed to load the sky color map."));
 	}
+	map.subresources.assign(1, colorMapData);
+}
 
-	for (UINT i = 0; i < 60; ++i)
-	{
-		indices[i] = k[i];
-	}
+void Sky::LoadStars(Graphics* Renderer, const wchar_t* starFile, const wchar_t* catalog, const wchar_t* skymap)
+{
+	auto start = steady_clock::now();
 
-	for (UINT i = 0; i < numSubdivisions; ++i)
+	StarCatalog& stars = m_stars;
+	const char* source = "star file";
+	if (!stars.Load(starFile))
 	{
-		std::vector<Vertex> tempvertices = vertices;
-		std::vector<UINT> tempindices = indices;
-
-		vertices.resize(0);
-		indices.resize(0);
-
-		//       v1
-		//       *
-		//      / \
-		//     /   \
-		//  m0*-----*m1
-		//   / \   / \
-		//  /   \ /   \
-		// *-----*-----*
-		// v0    m2     v2
-
-		UINT numTris = tempindices.size() / 3;
-		for (UINT i = 0; i < numTris; ++i)
+		if (stars.LoadText(catalog))
+		{
+			source = "text catalog";
+		}
+		else
 		{
-			Vertex v0 = tempvertices[tempindices[i * 3 + 0]];
-			Vertex v1 = tempvertices[tempindices[i * 3 + 1]];
-			Vertex v2 = tempvertices[tempindices[i * 3 + 2]];
-
-			//
-			// Generate the midpoints.
-			//
-
-			Vertex m0, m1, m2;
-
-			// For subdivision, we just care about the position component.  We derive the other
-			// vertex components in CreateGeosphere.
-
-			m0.Position = XMFLOAT3(
-				0.5f * (v0.Position.x + v1.Position.x),
-				0.5f * (v0.Position.y + v1.Position.y),
-				0.5f * (v0.Position.z + v1.Position.z));
-
-			m1.Position = XMFLOAT3(
-				0.5f * (v1.Position.x + v2.Position.x),
-				0.5f * (v1.Position.y + v2.Position.y),
-				0.5f * (v1.Position.z + v2.Position.z));
-
-			m2.Position = XMFLOAT3(
-				0.5f * (v0.Position.x + v2.Position.x),
-				0.5f * (v0.Position.y + v2.Position.y),
-				0.5f * (v0.Position.z + v2.Position.z));
-
-			//
-			// Add new geometry.
-			//
-
-			vertices.push_back(v0); // 0
-			vertices.push_back(v1); // 1
-			vertices.push_back(v2); // 2
-			vertices.push_back(m0); // 3
-			vertices.push_back(m1); // 4
-			vertices.push_back(m2); // 5
-
-			indices.push_back(i * 6 + 0);
-			indices.push_back(i * 6 + 3);
-			indices.push_back(i * 6 + 5);
-
-			indices.push_back(i * 6 + 3);
-			indices.push_back(i * 6 + 4);
-			indices.push_back(i * 6 + 5);
-
-			indices.push_back(i * 6 + 5);
-			indices.push_back(i * 6 + 4);
-			indices.push_back(i * 6 + 2);
-
-			indices.push_back(i * 6 + 3);
-			indices.push_back(i * 6 + 1);
-			indices.push_back(i * 6 + 4);
+			// Decoded once to find the stars; the texture itself is never uploaded.
+			std::unique_ptr<uint8_t[]> skymapDecodedData;
+			ID3D12Resource* skymapTexture = nullptr;
+			D3D12_SUBRESOURCE_DATA skymapData;
+			if (FAILED(LoadWICTextureFromFileEx(Renderer->GetDevice(), skymap, 0, D3D12_RESOURCE_FLAG_NONE, WIC_LOADER_FORCE_RGBA32, &skymapTexture, skymapDecodedData, skymapData)))
+			{
+				throw (GFX_Exception("Failed to load the sky map to extract the stars from."));
+			}
+			D3D12_RESOURCE_DESC texDesc = skymapTexture->GetDesc();
+			skymapTexture->Release();
+
+			stars.Extract(skymapDecodedData.get(), (UINT)texDesc.Width, texDesc.Height, SKY_STAR_CONTRAST);
+			source = "sky map";
+		}
+		if (!stars.Save(starFile))
+		{
+			OutputDebugStringA("Sky: could not write the star file\n");
 		}
 	}
-
-	// Project vertices onto sphere and scale.
-	for (UINT i = 0; i < vertices.size(); ++i)
+	if (stars.GetStars().empty())
 	{
-		// Project onto unit sphere.
-		XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&vertices[i].Position));
-
-		// Project onto sphere.
-		XMVECTOR p = - radius * n;
-
-		XMStoreFloat3(&vertices[i].Position, p);
-		XMStoreFloat3(&vertices[i].Normal, n);
-
-		// Derive texture coordinates from spherical coordinates.
-		float theta = MathHelper::AngleFromXY(
-			vertices[i].Position.x,
-			vertices[i].Position.z);
-
-
-		float phi = acosf(vertices[i].Position.y / radius);
-
-		vertices[i].TexC.x = theta / XM_2PI;
-		vertices[i].TexC.y = phi / XM_PI;
-
-		// Partial derivative of P with respect to theta
-		vertices[i].TangentU.x = -radius * sinf(phi) * sinf(theta);
-		vertices[i].TangentU.y = 0.0f;
-		vertices[i].TangentU.z = +radius * sinf(phi) * cosf(theta);
-
-		XMVECTOR T = XMLoadFloat3(&vertices[i].TangentU);
-		XMStoreFloat3(&vertices[i].TangentU, XMVector3Normalize(T));
+		throw (GFX_Exception("The star catalog holds no stars."));
 	}
+	double elapsedMs = duration<double, std::milli>(steady_clock::now() - start).count();
 
-	int bufferSize = sizeof(Vertex) * vertices.size();
-
-	Renderer->CreateCommittedBuffer(m_vertexBuffer, m_vertexBufferUpload, &CD3DX12_RESOURCE_DESC::Buffer(bufferSize));
-
-	D3D12_SUBRESOURCE_DATA vertexData = {};
-	vertexData.pData = &vertices[0];
-	vertexData.RowPitch = bufferSize;
-	vertexData.SlicePitch = bufferSize;
-
-	UpdateSubresources(Renderer->GetCommandList(), m_vertexBuffer, m_vertexBufferUpload, 0, 0, 1, &vertexData);
-	Renderer->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_vertexBuffer, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER));
+	m_width = stars.GetSourceWidth();
+	m_height = stars.GetSourceHeight();
+	m_starCount = (UINT)stars.GetStars().size();
 
-	m_vertexBufferView.BufferLocation = m_vertexBuffer->GetGPUVirtualAddress();
-	m_vertexBufferView.StrideInBytes = sizeof(Vertex);
-	m_vertexBufferView.SizeInBytes = bufferSize;
-
-	bufferSize = sizeof(UINT) * indices.size();
+	char report[256];
+	sprintf_s(report, "Sky stars: %u from the %s in %.1f ms, %zu bytes on the GPU, uploaded through the staging ring\n",
+		m_starCount, source, elapsedMs, stars.Bytes());
+	OutputDebugStringA(report);
+	if (m_width != 0)
+	{
+		// The RGBA32 sky map texture, its decoded copy and its upload heap.
+		size_t skymapBytes = (size_t)m_width * m_height * 4;
+		sprintf_s(report, "Sky stars: the %ux%u sky map took %zu bytes on the GPU, %zu decoded and %zu to upload, %.0fx the star buffer\n",
+			m_width, m_height, skymapBytes, skymapBytes, skymapBytes, (double)skymapBytes / stars.Bytes());
+		OutputDebugStringA(report);
+	}
+}
 
-	Renderer->CreateCommittedBuffer(m_indexBuffer, m_indexBufferUpload, &CD3DX12_RESOURCE_DESC::Buffer(bufferSize));
+bool Sky::StageStars(Graphics* Renderer, UploadRing& ring, size_t& bytes)
+{
+	const StarCatalog& stars = m_stars;
+	int bufferSize = (int)stars.Bytes();
 
-	D3D12_SUBRESOURCE_DATA indexData = {};
-	indexData.pData = &indices[0];
-	indexData.RowPitch = bufferSize;
-	indexData.SlicePitch = bufferSize;
+	if (!m_starBuffer)
+	{
+		Renderer->CreateDefaultBuffer(m_starBuffer, &CD3DX12_RESOURCE_DESC::Buffer(bufferSize));
+	}
+	const uint64_t copied = m_starCursor.bytes;
+	const bool done = ring.CopyBuffer(Renderer->GetCommandList(), m_starBuffer, stars.GetStars().data(), bufferSize, m_starCursor);
+	bytes += (size_t)(m_starCursor.bytes - copied);
+	if (!done)
+	{
+		return false;
+	}
+	Renderer->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_starBuffer, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER));
 
-	UpdateSubresources(Renderer->GetCommandList(), m_indexBuffer, m_indexBufferUpload, 0, 0, 1, &indexData);
-	Renderer->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_indexBuffer, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_INDEX_BUFFER));
+	m_starBufferView.BufferLocation = m_starBuffer->GetGPUVirtualAddress();
+	m_starBufferView.StrideInBytes = sizeof(Star);
+	m_starBufferView.SizeInBytes = bufferSize;
+	return true;
+}
 
-	m_indexBufferView.BufferLocation = m_indexBuffer->GetGPUVirtualAddress();
-	m_indexBufferView.Format = DXGI_FORMAT_R32_UINT;
-	m_indexBufferView.SizeInBytes = bufferSize;
+void Sky::CreateGeosphere(Graphics* Renderer, float radius, UINT numSubdivisions)
+{
+	// The same unit geosphere a geosphere Terrain draws. The sky is seen from inside, so it is
+	// scaled by -radius; the normals still point outwards, which is what the texture lookup wants.
+	m_geometry = m_geometryCache->AcquireGeosphere(Renderer, numSubdivisions, TERRAIN_CHUNK_VERTICES, false, TERRAIN_MESHLETS);
 
-	m_indexcount = indices.size();
+	const float scale = -radius;
+	m_constantBufferData.meshOrigin = XMFLOAT3(m_geometry->meshOrigin.x * scale, m_geometry->meshOrigin.y * scale, m_geometry->meshOrigin.z * scale);
+	m_constantBufferData.meshScale = m_geometry->meshScale * scale;
 }
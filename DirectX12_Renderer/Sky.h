@@ -4,42 +4,63 @@
 #include "WICTextureLoader.h"
 #include "MathHelper.h"
 #include "Terrain.h"
+#include "SkyRay.h"
+#include "StarCatalog.h"
 #include <iostream>
 #include <vector>
 
 using namespace graphics;
 
+static const bool SKY_FULLSCREEN = true; // draw the sky as one triangle at the far plane, looked up along the view ray, instead of a geosphere of radius 20000.
+static const bool SKY_STAR_FIELD = true; // draw the stars of a StarCatalog as sprites instead of loading the 16384x8192 sky map; overrides SKY_FULLSCREEN.
+static const float SKY_STAR_CONTRAST = 24.0f; // how much brighter than its surroundings a sky map pixel must be to become a star, 0-255.
+static const bool SKY_BLOCK_COMPRESSION = true; // upload the sky map as BC1, 64 MB instead of 512 MB at 16384x8192, when SKY_STAR_FIELD is off.
+
 struct SkyConstantBuffer
 {
 	XMFLOAT4X4 viewproj;
 	XMFLOAT4 eye;
 	UINT height;
 	UINT width;
+	UINT padding[2];
+	XMFLOAT4X4 invViewproj;	// PSSky, SkyRay::InvertViewProjection
 };
 
 class Sky
 {
 public:
-	Sky(Graphics* renderer);
+	Sky(Graphics* renderer, GeometryCache& geometryCache);
 	~Sky();
 
 	void Draw3D(ID3D12GraphicsCommandList* m_commandList, XMFLOAT4X4 viewproj, XMFLOAT4 eye);
 
-	void ClearUnusedUploadBuffersAfterInit();
+	// Queues the stars, or the sky and color maps, on loader; nothing is drawn until they are resident.
+	void QueueLoads(Graphics* renderer, AssetLoader& loader, UploadRing& ring);
+	bool IsResident() const { return m_residentLoads == (SKY_STAR_FIELD ? 1u : 2u); }
 
 	OrbitCycle GetOrbitcycle() { return m_orbitCycle; }
 
 private:
 	void InitPipeline3D(Graphics* Renderer);
+	void InitPipelineStars(Graphics* Renderer);
 
 	void CreateConstantBuffer(Graphics* Renderer);
+	void CreateDescriptorHeap(Graphics* Renderer);
+
+	void DecodeSkyMap(Graphics* Renderer, const wchar_t* displacementmap);
+	void DecodeColorMap(Graphics* Renderer, const wchar_t* colormap);
 
-	void LoadHeightMap(Graphics* Renderer, const wchar_t* displacementmap, const wchar_t* colormap);
+	// The star file, else the text catalog, else the stars extracted from the sky map, which are
+	// then written to the star file. On a loader thread; StageStars uploads them.
+	void LoadStars(Graphics* Renderer, const wchar_t* starFile, const wchar_t* catalog, const wchar_t* skymap);
+	bool StageStars(Graphics* Renderer, UploadRing& ring, size_t& bytes);
 
 	void CreateGeosphere(Graphics* Renderer, float radius, UINT numSubdivisions);
 
 	ID3D12DescriptorHeap* m_srvHeap;
-	ID3D12Resource* m_uploadHeap;
+	LoadingTexture m_skyMap;
+	LoadingTexture m_colorMap;
+	UINT m_residentLoads;
 	std::vector<unsigned char> m_image;
 	UINT m_width;
 	UINT m_height;
@@ -48,15 +69,17 @@ private:
 	ID3D12RootSignature* m_rootSignature3D;
 	ID3D12Resource* m_CBV;
 	ConstantBuffer m_constantBufferData;
+	SkyConstantBuffer m_skyConstantBufferData;	// SKY_FULLSCREEN and SKY_STAR_FIELD
 	UINT8* m_cbvDataBegin;
 	UINT m_srvDescSize;
 
-	ID3D12Resource* m_vertexBuffer;
-	ID3D12Resource* m_vertexBufferUpload;
-	ID3D12Resource* m_indexBuffer;
-	ID3D12Resource* m_indexBufferUpload;
-	D3D12_VERTEX_BUFFER_VIEW m_vertexBufferView;
-	D3D12_INDEX_BUFFER_VIEW	m_indexBufferView;
-	UINT m_indexcount;
+	GeometryCache* m_geometryCache;
+	const SharedGeometry* m_geometry;	// the unit geosphere, shared with a geosphere Terrain; none if SKY_FULLSCREEN
+
+	StarCatalog m_stars;	// between LoadStars and the upload
+	ID3D12Resource* m_starBuffer;
+	UploadRing::Cursor m_starCursor;
+	D3D12_VERTEX_BUFFER_VIEW m_starBufferView;	// one Star per instance
+	UINT m_starCount;
 	OrbitCycle m_orbitCycle;
 };
\ No newline at end of file
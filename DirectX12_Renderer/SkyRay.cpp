@@ -0,0 +1,137 @@
+#include "SkyRay.h"
+#include <cmath>
+
+namespace
+{
+	float Dot(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		return a.x * b.x + a.y * b.y + a.z * b.z;
+	}
+
+	// Clip space position of a world point, row i of the transposed matrix times the point.
+	XMFLOAT4 Project(const XMFLOAT4X4& viewproj, const XMFLOAT3& p)
+	{
+		const float(&m)[4][4] = viewproj.m;
+		return XMFLOAT4(
+			m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+			m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+			m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3],
+			m[3][0] * p.x + m[3][1] * p.y + m[3][2] * p.z + m[3][3]);
+	}
+
+	// Sign of the area of a, b, c; positive for clockwise corners on screen, where y points up.
+	float EdgeFunction(const XMFLOAT2& a, const XMFLOAT2& b, const XMFLOAT2& c)
+	{
+		return (b.x - a.x) * (a.y - c.y) - (a.y - b.y) * (c.x - a.x);
+	}
+}
+
+XMFLOAT2 SkyRay::FullscreenVertex(uint32_t vertexId)
+{
+	float u = (float)((vertexId << 1) & 2);
+	float v = (float)(vertexId & 2);
+	return XMFLOAT2(u * 2.0f - 1.0f, 1.0f - v * 2.0f);
+}
+
+XMFLOAT4X4 SkyRay::InvertViewProjection(const XMFLOAT4X4& viewproj, const XMFLOAT3& eye)
+{
+	// Clip space of p relative to the eye: the translation column takes the eye's clip position,
+	// which nearly cancels it, so it is summed in double.
+	XMFLOAT4X4 centered = viewproj;
+	for (int i = 0; i < 4; ++i)
+	{
+		const float(&row)[4] = viewproj.m[i];
+		centered.m[i][3] = (float)((double)row[0] * eye.x + (double)row[1] * eye.y + (double)row[2] * eye.z + row[3]);
+	}
+
+	// The inverse of the transposed matrix is the transposed inverse.
+	XMMATRIX inverse = XMMatrixInverse(nullptr, XMLoadFloat4x4(&centered));
+	XMFLOAT4X4 result;
+	XMStoreFloat4x4(&result, inverse);
+	return result;
+}
+
+XMFLOAT3 SkyRay::Reconstruct(const XMFLOAT4X4& invViewproj, float x, float y)
+{
+	// Homogeneous position of the far plane point relative to the eye. w is positive in front of
+	// the eye, so normalizing without the divide keeps the direction.
+	XMFLOAT4 p = Project(invViewproj, XMFLOAT3(x, y, 1.0f));
+	XMFLOAT3 direction(p.x, p.y, p.z);
+	float length = sqrtf(Dot(direction, direction));
+	return XMFLOAT3(direction.x / length, direction.y / length, direction.z / length);
+}
+
+XMFLOAT2 SkyRay::Texcoord(const XMFLOAT3& direction)
+{
+	float theta = atan2f(-direction.x, -direction.z);
+	float phi = acosf(fminf(fmaxf(-direction.y, -1.0f), 1.0f));
+	return XMFLOAT2(theta / (2.0f * 3.14f), phi / 3.14f);
+}
+
+XMFLOAT3 SkyRay::Direction(const XMFLOAT2& texcoord)
+{
+	// Texcoord puts negative angles at the right end of the map, which the WRAP sampler brings back.
+	float theta = (texcoord.x < 0.5f ? texcoord.x : texcoord.x - 1.0f) * (2.0f * 3.14f);
+	float phi = texcoord.y * 3.14f;
+	return XMFLOAT3(-sinf(phi) * sinf(theta), -cosf(phi), -sinf(phi) * cosf(theta));
+}
+
+bool SkyRay::Validate(const XMFLOAT4X4& viewproj, const XMFLOAT3& eye)
+{
+	const XMFLOAT2 triangle[3] = { FullscreenVertex(0), FullscreenVertex(1), FullscreenVertex(2) };
+	if (EdgeFunction(triangle[0], triangle[1], triangle[2]) <= 0.0f)
+	{
+		return false;
+	}
+	for (int corner = 0; corner < 4; ++corner)
+	{
+		XMFLOAT2 p((corner & 1) ? 1.0f : -1.0f, (corner & 2) ? 1.0f : -1.0f);
+		for (int edge = 0; edge < 3; ++edge)
+		{
+			if (EdgeFunction(triangle[edge], triangle[(edge + 1) % 3], p) < -1e-5f)
+			{
+				return false;
+			}
+		}
+	}
+
+	for (int j = 1; j < 8; ++j)
+	{
+		for (int i = 0; i < 16; ++i)
+		{
+			XMFLOAT2 texcoord(i / 16.0f + 0.01f, j / 8.0f);
+			XMFLOAT2 back = Texcoord(Direction(texcoord));
+			back.x = back.x < 0.0f ? back.x + 1.0f : back.x;
+			if (fabsf(back.x - texcoord.x) > 1e-4f || fabsf(back.y - texcoord.y) > 1e-4f)
+			{
+				return false;
+			}
+		}
+	}
+
+	const XMFLOAT4X4 invViewproj = InvertViewProjection(viewproj, eye);
+	const int gridSize = 9;
+	for (int j = 0; j < gridSize; ++j)
+	{
+		for (int i = 0; i < gridSize; ++i)
+		{
+			float x = -1.0f + 2.0f * i / (gridSize - 1);
+			float y = -1.0f + 2.0f * j / (gridSize - 1);
+			XMFLOAT3 direction = Reconstruct(invViewproj, x, y);
+
+			XMFLOAT3 p(eye.x + direction.x * 1000.0f, eye.y + direction.y * 1000.0f, eye.z + direction.z * 1000.0f);
+			XMFLOAT4 clip = Project(viewproj, p);
+			if (clip.w <= 0.0f || fabsf(clip.x / clip.w - x) > 1e-4f || fabsf(clip.y / clip.w - y) > 1e-4f)
+			{
+				return false;
+			}
+		}
+	}
+
+	const XMFLOAT3 center = Reconstruct(invViewproj, 0.0f, 0.0f);
+	const float top = Dot(center, Reconstruct(invViewproj, 0.0f, 1.0f));
+	const float bottom = Dot(center, Reconstruct(invViewproj, 0.0f, -1.0f));
+	const float left = Dot(center, Reconstruct(invViewproj, -1.0f, 0.0f));
+	const float right = Dot(center, Reconstruct(invViewproj, 1.0f, 0.0f));
+	return fabsf(top - bottom) < 1e-4f && fabsf(left - right) < 1e-4f && top < 1.0f && left < 1.0f;
+}
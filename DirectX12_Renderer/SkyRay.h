@@ -0,0 +1,34 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <cstdint>
+
+using namespace DirectX;
+
+// View rays of a sky at infinity, the CPU reference of VertexShaderSky.hlsl and PixelShaderSky.hlsl.
+// Matrices are transposed for the shaders, as Camera::GetViewProjectionMatrixTransposed returns them.
+class SkyRay
+{
+public:
+	// Clip space x and y of vertex 0, 1 or 2 of the triangle that covers the screen: (-1, 1), (3, 1), (-1, -3).
+	static XMFLOAT2 FullscreenVertex(uint32_t vertexId);
+
+	// Inverse of viewproj with the eye moved to the origin, so it maps clip space straight to view
+	// rays. Inverting the matrix of an eye thousands of units out costs about a milliradian.
+	static XMFLOAT4X4 InvertViewProjection(const XMFLOAT4X4& viewproj, const XMFLOAT3& eye);
+
+	// Unit direction from the eye through the far plane at clip space x and y.
+	static XMFLOAT3 Reconstruct(const XMFLOAT4X4& invViewproj, float x, float y);
+
+	// Sky map coordinate seen along direction. The sky geosphere was scaled by a negative radius, so
+	// this is its texture coordinate at the normal -direction, as VertexShader.hlsl computes it.
+	static XMFLOAT2 Texcoord(const XMFLOAT3& direction);
+
+	// Inverse of Texcoord for coordinates in [0, 1).
+	static XMFLOAT3 Direction(const XMFLOAT2& texcoord);
+
+	// True if the fullscreen triangle covers the screen, Direction inverts Texcoord, and the rays
+	// through a grid of screen points project back onto them, lie in front of the eye and open
+	// symmetrically around the center ray.
+	static bool Validate(const XMFLOAT4X4& viewproj, const XMFLOAT3& eye);
+};
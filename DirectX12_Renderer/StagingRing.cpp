@@ -0,0 +1,197 @@
+#include "StagingRing.h"
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+	uint64_t AlignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+StagingRing::StagingRing(uint64_t capacity) :
+	m_capacity(capacity),
+	m_head(0),
+	m_tail(0),
+	m_used(0),
+	m_peakUsed(0),
+	m_openBytes(0)
+{
+}
+
+bool StagingRing::Allocate(uint64_t size, uint64_t alignment, uint64_t& offset)
+{
+	if (size > m_capacity)
+	{
+		return false;
+	}
+	if (m_used == 0)
+	{
+		// Nothing in use, so the whole ring is free from 0.
+		m_head = 0;
+		m_tail = 0;
+	}
+
+	uint64_t start;
+	const uint64_t aligned = AlignUp(m_head, std::max<uint64_t>(alignment, 1));
+	if (m_used == 0)
+	{
+		start = 0;
+	}
+	else if (m_head > m_tail)
+	{
+		// Free from the head to the end and from 0 to the tail.
+		if (aligned + size <= m_capacity)
+		{
+			start = aligned;
+		}
+		else if (size <= m_tail)
+		{
+			start = 0;
+		}
+		else
+		{
+			return false;
+		}
+	}
+	else if (m_head < m_tail && aligned + size <= m_tail)
+	{
+		start = aligned;
+	}
+	else
+	{
+		// The head has caught up with the tail: full.
+		return false;
+	}
+
+	const uint64_t consumed = start >= m_head ? start + size - m_head : m_capacity - m_head + start + size;
+	m_head = start + size == m_capacity ? 0 : start + size;
+	m_used += consumed;
+	m_openBytes += consumed;
+	m_peakUsed = std::max(m_peakUsed, m_used);
+	offset = start;
+	return true;
+}
+
+void StagingRing::Close(uint64_t fence)
+{
+	if (m_openBytes == 0)
+	{
+		return;
+	}
+	Frame frame = { fence, m_head, m_openBytes };
+	m_frames.push_back(frame);
+	m_openBytes = 0;
+}
+
+void StagingRing::Retire(uint64_t completedFence)
+{
+	while (!m_frames.empty() && m_frames.front().fence <= completedFence)
+	{
+		m_tail = m_frames.front().head;
+		m_used -= m_frames.front().bytes;
+		m_frames.pop_front();
+	}
+}
+
+bool StagingRing::Validate()
+{
+	// By hand: aligned allocations, one that only fits once the first frame is retired, and the
+	// wrap to 0 that it then takes.
+	{
+		StagingRing ring(1024);
+		uint64_t a, b, c, d;
+		if (!ring.Allocate(100, 256, a) || !ring.Allocate(100, 256, b) || a != 0 || b != 256 || ring.GetUsed() != 356)
+		{
+			return false;
+		}
+		ring.Close(1);
+		if (ring.Allocate(600, 256, c) || !ring.Allocate(400, 256, c) || c != 512 || ring.GetOpenBytes() != 556)
+		{
+			return false;
+		}
+		ring.Close(2);
+		ring.Retire(0);
+		if (ring.Allocate(300, 256, d))
+		{
+			return false;
+		}
+		ring.Retire(1);
+		if (ring.GetUsed() != 556 || !ring.Allocate(300, 256, d) || d != 0 || ring.Allocate(100, 1, d))
+		{
+			return false;
+		}
+		ring.Close(3);
+		ring.Retire(3);
+		if (ring.GetUsed() != 0 || !ring.Allocate(1024, 512, d) || d != 0 || ring.Allocate(1, 1, d) || ring.Allocate(1025, 1, d) ||
+			ring.GetPeakUsed() != 1024)
+		{
+			return false;
+		}
+	}
+
+	// Frames of random allocations through a GPU three frames behind, against a list of what is
+	// still in use.
+	struct Live
+	{
+		uint64_t offset;
+		uint64_t size;
+		uint64_t fence;
+	};
+	const uint64_t capacity = 1 << 20;
+	const uint64_t alignments[4] = { 1, 16, 256, 512 };
+	StagingRing ring(capacity);
+	std::vector<Live> live;
+	uint32_t seed = 12345;
+	auto random = [&seed](uint32_t range)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	};
+	uint64_t lastOffset = 0;
+	uint32_t wraps = 0, full = 0;
+	for (uint64_t frame = 1; frame <= 2000; ++frame)
+	{
+		const uint64_t completed = frame > 3 ? frame - 3 : 0;
+		ring.Retire(completed);
+		live.erase(std::remove_if(live.begin(), live.end(), [completed](const Live& l) { return l.fence <= completed; }), live.end());
+
+		const uint32_t count = random(6);
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			const uint64_t size = 1 + random(capacity / (random(4) == 0 ? 3 : 16));
+			const uint64_t alignment = alignments[random(4)];
+			uint64_t offset;
+			if (!ring.Allocate(size, alignment, offset))
+			{
+				++full;
+				break;
+			}
+			if (offset % alignment != 0 || offset + size > capacity)
+			{
+				return false;
+			}
+			for (const Live& l : live)
+			{
+				if (offset < l.offset + l.size && l.offset < offset + size)
+				{
+					return false;
+				}
+			}
+			wraps += offset < lastOffset ? 1 : 0;
+			lastOffset = offset;
+			Live allocation = { offset, size, frame };
+			live.push_back(allocation);
+		}
+		ring.Close(frame);
+		if (ring.GetUsed() > capacity)
+		{
+			return false;
+		}
+	}
+	ring.Retire(UINT64_MAX);
+	uint64_t offset;
+	return wraps > 10 && full > 10 && ring.GetUsed() == 0 && ring.GetPeakUsed() <= capacity &&
+		ring.Allocate(capacity, 1, offset) && offset == 0;
+}
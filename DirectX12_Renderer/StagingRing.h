@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+
+// Suballocates a buffer of fixed size as a ring. Allocations are made at the head and belong to
+// the frame that is open; Close ends the frame with the fence its copies will have run at, and
+// Retire hands the space of every frame whose fence has passed back at the tail. An allocation
+// that does not fit the space between the head and the end of the buffer starts over at 0.
+// Offsets only, CPU only; UploadRing maps the buffer and records the copies.
+class StagingRing
+{
+public:
+	explicit StagingRing(uint64_t capacity);
+
+	// Offset of size bytes aligned to alignment, a power of two. False if they do not fit until
+	// more frames are retired, or ever, when size is larger than the ring.
+	bool Allocate(uint64_t size, uint64_t alignment, uint64_t& offset);
+
+	// Ends the open frame; its allocations come back once fence has passed.
+	void Close(uint64_t fence);
+
+	// Frees the frames closed with a fence up to completedFence.
+	void Retire(uint64_t completedFence);
+
+	uint64_t GetCapacity() const { return m_capacity; }
+	uint64_t GetUsed() const { return m_used; }		// allocated and not retired, alignment and wrapping included
+	uint64_t GetPeakUsed() const { return m_peakUsed; }
+	uint64_t GetOpenBytes() const { return m_openBytes; }	// allocated since the last Close
+
+	// True if allocations are aligned, inside the ring and never overlap one still in use, space
+	// comes back only once its fence has passed, the ring wraps and fills up completely, and
+	// anything that fits an empty ring can be allocated once everything is retired.
+	static bool Validate();
+
+private:
+	struct Frame
+	{
+		uint64_t fence;
+		uint64_t head;	// where the head was when the frame closed
+		uint64_t bytes;
+	};
+
+	uint64_t m_capacity;
+	uint64_t m_head;
+	uint64_t m_tail;
+	uint64_t m_used;
+	uint64_t m_peakUsed;
+	uint64_t m_openBytes;
+	std::deque<Frame> m_frames;	// closed and not retired, oldest first
+};
@@ -0,0 +1,436 @@
+#include "StarCatalog.h"
+#include "Parallel.h"
+#include "SkyRay.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+namespace
+{
+	const char STAR_MAGIC[4] = { 'S', 'T', 'A', 'R' };
+	const uint32_t STAR_VERSION = 1;
+
+	struct StarHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t count;
+		uint32_t stride;
+		uint32_t sourceWidth;
+		uint32_t sourceHeight;
+	};
+
+	// MSVC's fstreams open the wide path as it is; elsewhere the catalog paths are ASCII.
+#ifdef _WIN32
+	const std::wstring& FilePath(const std::wstring& path)
+	{
+		return path;
+	}
+#else
+	std::string FilePath(const std::wstring& path)
+	{
+		return std::string(path.begin(), path.end());
+	}
+#endif
+
+	float Luminance(const uint8_t* pixel)
+	{
+		return 0.2126f * pixel[0] + 0.7152f * pixel[1] + 0.0722f * pixel[2];
+	}
+
+	uint32_t PackColor(float r, float g, float b)
+	{
+		float brightest = std::max(r, std::max(g, b));
+		if (brightest <= 0.0f)
+		{
+			return 0xffffffff;
+		}
+		uint32_t R = (uint32_t)(r * 255.0f / brightest + 0.5f);
+		uint32_t G = (uint32_t)(g * 255.0f / brightest + 0.5f);
+		uint32_t B = (uint32_t)(b * 255.0f / brightest + 0.5f);
+		return R | (G << 8) | (B << 16) | 0xff000000;
+	}
+
+	float Channel(uint32_t color, int channel)
+	{
+		return (float)((color >> (8 * channel)) & 0xff);
+	}
+
+	float Angle(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		XMFLOAT3 c(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+		return atan2f(sqrtf(c.x * c.x + c.y * c.y + c.z * c.z), a.x * b.x + a.y * b.y + a.z * b.z);
+	}
+}
+
+const float StarCatalog::SPRITE_RADIUS = 0.002f;
+
+StarCatalog::StarCatalog() :
+	m_stars(),
+	m_sourceWidth(0),
+	m_sourceHeight(0)
+{
+}
+
+void StarCatalog::Extract(const uint8_t* rgba, uint32_t width, uint32_t height, float contrast)
+{
+	m_sourceWidth = width;
+	m_sourceHeight = height;
+	m_stars.clear();
+
+	// The first and last rows are single points of the sphere stretched across the map.
+	std::vector<std::vector<Star>> rows(height);
+	ParallelFor(height, [rgba, width, height, contrast, &rows](uint32_t begin, uint32_t end)
+	{
+		auto at = [rgba, width, height](int x, int y)
+		{
+			x = x < 0 ? x + (int)width : x >= (int)width ? x - (int)width : x;
+			y = std::min(std::max(y, 0), (int)height - 1);
+			return rgba + ((size_t)y * width + x) * 4;
+		};
+
+		for (uint32_t y = std::max(begin, 1u); y < std::min(end, height - 1); ++y)
+		{
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				const float peak = Luminance(at(x, y));
+				if (peak < contrast)
+				{
+					continue;
+				}
+
+				// Brightest of the 3x3 neighbourhood; a plateau keeps its first pixel in scan order.
+				bool maximum = true;
+				for (int dy = -1; dy <= 1 && maximum; ++dy)
+				{
+					for (int dx = -1; dx <= 1 && maximum; ++dx)
+					{
+						float l = Luminance(at(x + dx, y + dy));
+						maximum = !(l > peak || (l == peak && (dy < 0 || (dy == 0 && dx < 0))));
+					}
+				}
+				if (!maximum)
+				{
+					continue;
+				}
+
+				// Background from the 16 pixels of the 5x5 ring.
+				float background[4] = {};
+				for (int dy = -2; dy <= 2; ++dy)
+				{
+					for (int dx = -2; dx <= 2; ++dx)
+					{
+						if (std::abs(dx) == 2 || std::abs(dy) == 2)
+						{
+							const uint8_t* pixel = at(x + dx, y + dy);
+							background[0] += pixel[0] / 16.0f;
+							background[1] += pixel[1] / 16.0f;
+							background[2] += pixel[2] / 16.0f;
+							background[3] += Luminance(pixel) / 16.0f;
+						}
+					}
+				}
+				if (peak - background[3] < contrast)
+				{
+					continue;
+				}
+
+				float flux = 0.0f;
+				float cx = 0.0f;
+				float cy = 0.0f;
+				float color[3] = {};
+				for (int dy = -1; dy <= 1; ++dy)
+				{
+					for (int dx = -1; dx <= 1; ++dx)
+					{
+						const uint8_t* pixel = at(x + dx, y + dy);
+						float l = std::max(Luminance(pixel) - background[3], 0.0f);
+						flux += l;
+						cx += l * dx;
+						cy += l * dy;
+						for (int c = 0; c < 3; ++c)
+						{
+							color[c] += std::max(pixel[c] - background[c], 0.0f);
+						}
+					}
+				}
+
+				Star star;
+				star.direction = SkyRay::Direction(XMFLOAT2((x + 0.5f + cx / flux) / width, (y + 0.5f + cy / flux) / height));
+				star.magnitude = -2.5f * log10f(flux / 255.0f);
+				star.color = PackColor(color[0], color[1], color[2]);
+				rows[y].push_back(star);
+			}
+		}
+	});
+
+	for (const std::vector<Star>& row : rows)
+	{
+		m_stars.insert(m_stars.end(), row.begin(), row.end());
+	}
+	Sort();
+}
+
+bool StarCatalog::ParseText(std::istream& text)
+{
+	m_sourceWidth = 0;
+	m_sourceHeight = 0;
+	m_stars.clear();
+
+	std::string line;
+	while (std::getline(text, line))
+	{
+		if (line.find_first_not_of(" \t\r") == std::string::npos || line[line.find_first_not_of(" \t\r")] == '#')
+		{
+			continue;
+		}
+		std::replace(line.begin(), line.end(), ',', ' ');
+
+		std::istringstream fields(line);
+		float rightAscension, declination, magnitude, bv;
+		if (!(fields >> rightAscension >> declination >> magnitude >> bv))
+		{
+			return false;
+		}
+
+		float u = fmodf(rightAscension / 360.0f, 1.0f);
+		u = u < 0.0f ? u + 1.0f : u;
+		Star star;
+		star.direction = SkyRay::Direction(XMFLOAT2(u, (90.0f - declination) / 180.0f));
+		star.magnitude = magnitude;
+		star.color = ColorFromBV(bv);
+		m_stars.push_back(star);
+	}
+
+	Sort();
+	return true;
+}
+
+bool StarCatalog::LoadText(const std::wstring& path)
+{
+	std::ifstream file(FilePath(path));
+	return file && ParseText(file);
+}
+
+bool StarCatalog::Load(const std::wstring& path)
+{
+	std::ifstream file(FilePath(path), std::ios::binary);
+	if (!file)
+	{
+		return false;
+	}
+
+	StarHeader header;
+	if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) ||
+		!std::equal(STAR_MAGIC, STAR_MAGIC + 4, header.magic) || header.version != STAR_VERSION || header.stride != sizeof(Star))
+	{
+		return false;
+	}
+
+	m_stars.resize(header.count);
+	if (!file.read(reinterpret_cast<char*>(m_stars.data()), (std::streamsize)Bytes()))
+	{
+		m_stars.clear();
+		return false;
+	}
+	m_sourceWidth = header.sourceWidth;
+	m_sourceHeight = header.sourceHeight;
+	return true;
+}
+
+bool StarCatalog::Save(const std::wstring& path) const
+{
+	std::ofstream file(FilePath(path), std::ios::binary | std::ios::trunc);
+	if (!file)
+	{
+		return false;
+	}
+
+	StarHeader header = {};
+	std::copy(STAR_MAGIC, STAR_MAGIC + 4, header.magic);
+	header.version = STAR_VERSION;
+	header.count = (uint32_t)m_stars.size();
+	header.stride = sizeof(Star);
+	header.sourceWidth = m_sourceWidth;
+	header.sourceHeight = m_sourceHeight;
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	file.write(reinterpret_cast<const char*>(m_stars.data()), (std::streamsize)Bytes());
+	return (bool)file;
+}
+
+void StarCatalog::Sort()
+{
+	std::stable_sort(m_stars.begin(), m_stars.end(), [](const Star& a, const Star& b) { return a.magnitude < b.magnitude; });
+}
+
+uint32_t StarCatalog::ColorFromBV(float bv)
+{
+	// Temperature after Ballesteros (2012), black body color after Tanner Helland's fit.
+	bv = std::min(std::max(bv, -0.4f), 2.0f);
+	float t = 4600.0f * (1.0f / (0.92f * bv + 1.7f) + 1.0f / (0.92f * bv + 0.62f)) / 100.0f;
+
+	float r = t <= 66.0f ? 255.0f : 329.698727446f * powf(t - 60.0f, -0.1332047592f);
+	float g = t <= 66.0f ? 99.4708025861f * logf(t) - 161.1195681661f : 288.1221695283f * powf(t - 60.0f, -0.0755148492f);
+	float b = t >= 66.0f ? 255.0f : t <= 19.0f ? 0.0f : 138.5177312231f * logf(t - 10.0f) - 305.0447927307f;
+	return PackColor(std::min(std::max(r, 0.0f), 255.0f), std::min(std::max(g, 0.0f), 255.0f), std::min(std::max(b, 0.0f), 255.0f));
+}
+
+XMFLOAT4 StarCatalog::ProjectSprite(const Star& star, const XMFLOAT4X4& viewproj, float cx, float cy)
+{
+	const XMFLOAT3& d = star.direction;
+	XMFLOAT3 reference = fabsf(d.y) < 0.99f ? XMFLOAT3(0.0f, 1.0f, 0.0f) : XMFLOAT3(1.0f, 0.0f, 0.0f);
+	XMFLOAT3 right(reference.y * d.z - reference.z * d.y, reference.z * d.x - reference.x * d.z, reference.x * d.y - reference.y * d.x);
+	float length = sqrtf(right.x * right.x + right.y * right.y + right.z * right.z);
+	right = XMFLOAT3(right.x / length, right.y / length, right.z / length);
+	XMFLOAT3 up(d.y * right.z - d.z * right.y, d.z * right.x - d.x * right.z, d.x * right.y - d.y * right.x);
+
+	float radius = SpriteRadius(star.magnitude);
+	XMFLOAT3 p(d.x + (right.x * cx + up.x * cy) * radius, d.y + (right.y * cx + up.y * cy) * radius, d.z + (right.z * cx + up.z * cy) * radius);
+
+	const float(&m)[4][4] = viewproj.m;
+	XMFLOAT4 clip(
+		m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z,
+		m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z,
+		0.0f,
+		m[3][0] * p.x + m[3][1] * p.y + m[3][2] * p.z);
+	clip.z = clip.w;
+	return clip;
+}
+
+float StarCatalog::SpriteRadius(float magnitude)
+{
+	return SPRITE_RADIUS * std::min(std::max(1.0f - 0.1f * magnitude, 0.5f), 2.0f);
+}
+
+float StarCatalog::Brightness(float magnitude)
+{
+	return std::min(powf(10.0f, -0.4f * magnitude), 1.0f);
+}
+
+bool StarCatalog::Validate()
+{
+	// Gaussian spots on a grey sky; the third straddles the seam of the map.
+	const uint32_t width = 512;
+	const uint32_t height = 256;
+	struct Spot { float x, y, peak; uint32_t color; };
+	const Spot spots[] =
+	{
+		{ 100.5f, 60.5f, 250.0f, 0xffffffff },
+		{ 300.8f, 128.3f, 120.0f, 0xff4080ff },
+		{ 0.2f, 200.5f, 180.0f, 0xffff8040 },
+		{ 20.5f, 30.7f, 60.0f, 0xffffffff },
+	};
+	const size_t spotCount = sizeof(spots) / sizeof(spots[0]);
+	const size_t brightness[spotCount] = { 0, 2, 1, 3 };	// spots brightest first
+
+	std::vector<uint8_t> rgba((size_t)width * height * 4, 10);
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			float value[3] = { 10.0f, 10.0f, 10.0f };
+			for (const Spot& spot : spots)
+			{
+				float dx = fabsf(x + 0.5f - spot.x);
+				dx = std::min(dx, width - dx);
+				float dy = y + 0.5f - spot.y;
+				float falloff = spot.peak * expf(-(dx * dx + dy * dy) / (2.0f * 0.7f * 0.7f));
+				for (int c = 0; c < 3; ++c)
+				{
+					value[c] += falloff * Channel(spot.color, c) / 255.0f;
+				}
+			}
+			for (int c = 0; c < 3; ++c)
+			{
+				rgba[((size_t)y * width + x) * 4 + c] = (uint8_t)std::min(value[c] + 0.5f, 255.0f);
+			}
+		}
+	}
+
+	StarCatalog catalog;
+	catalog.Extract(rgba.data(), width, height, 16.0f);
+	if (catalog.GetStars().size() != spotCount)
+	{
+		return false;
+	}
+	const float texel = 2.0f * 3.14f / width;
+	for (size_t i = 0; i < spotCount; ++i)
+	{
+		const Spot& spot = spots[brightness[i]];
+		const Star& star = catalog.GetStars()[i];
+		XMFLOAT3 expected = SkyRay::Direction(XMFLOAT2(spot.x / width, spot.y / height));
+		if (Angle(star.direction, expected) > 0.5f * texel)
+		{
+			return false;
+		}
+		for (int c = 0; c < 3; ++c)
+		{
+			if (fabsf(Channel(star.color, c) - Channel(spot.color, c)) > 24.0f)
+			{
+				return false;
+			}
+		}
+	}
+
+	std::istringstream text("# ra dec vmag b-v\n0 0 1.0 0.65\n\n90, 45, -0.5, -0.2\n");
+	if (!catalog.ParseText(text) || catalog.GetStars().size() != 2 || catalog.GetStars()[0].magnitude != -0.5f ||
+		Angle(catalog.GetStars()[0].direction, SkyRay::Direction(XMFLOAT2(0.25f, 0.25f))) > 1e-5f ||
+		Angle(catalog.GetStars()[1].direction, SkyRay::Direction(XMFLOAT2(0.0f, 0.5f))) > 1e-5f ||
+		Channel(catalog.GetStars()[0].color, 2) != 255.0f || Channel(catalog.GetStars()[1].color, 0) != 255.0f)
+	{
+		return false;
+	}
+	std::istringstream malformed("10 20 3\n");
+	if (StarCatalog().ParseText(malformed))
+	{
+		return false;
+	}
+
+	const char* file = "StarCatalogValidate.stars";
+	const std::wstring path(file, file + strlen(file));
+	StarCatalog loaded;
+	bool roundTrip = catalog.Save(path) && loaded.Load(path) && loaded.GetStars().size() == catalog.GetStars().size() &&
+		std::equal(catalog.GetStars().begin(), catalog.GetStars().end(), loaded.GetStars().begin(), [](const Star& a, const Star& b)
+		{
+			return memcmp(&a, &b, sizeof(Star)) == 0;
+		});
+	std::remove(file);
+	return roundTrip;
+}
+
+bool StarCatalog::ValidateProjection(const XMFLOAT4X4& viewproj, const XMFLOAT3& eye)
+{
+	const XMFLOAT4X4 invViewproj = SkyRay::InvertViewProjection(viewproj, eye);
+	const float corners[4][2] = { { -1.0f, -1.0f }, { 1.0f, -1.0f }, { -1.0f, 1.0f }, { 1.0f, 1.0f } };
+	for (int j = 0; j < 5; ++j)
+	{
+		for (int i = 0; i < 5; ++i)
+		{
+			Star star = { SkyRay::Reconstruct(invViewproj, -0.8f + 0.4f * i, -0.8f + 0.4f * j), (float)(i + j) - 2.0f, 0xffffffff };
+			const float expected = atanf(SpriteRadius(star.magnitude) * sqrtf(2.0f));
+			for (const float(&corner)[2] : corners)
+			{
+				XMFLOAT4 clip = ProjectSprite(star, viewproj, corner[0], corner[1]);
+				if (clip.w <= 0.0f || clip.z != clip.w)
+				{
+					return false;
+				}
+				XMFLOAT3 ray = SkyRay::Reconstruct(invViewproj, clip.x / clip.w, clip.y / clip.w);
+				if (fabsf(Angle(ray, star.direction) - expected) > 0.01f * expected)
+				{
+					return false;
+				}
+			}
+
+			Star behind = { XMFLOAT3(-star.direction.x, -star.direction.y, -star.direction.z), 0.0f, 0xffffffff };
+			if (ProjectSprite(behind, viewproj, 1.0f, 1.0f).w >= 0.0f)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
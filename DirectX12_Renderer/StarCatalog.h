@@ -0,0 +1,74 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <string>
+#include <vector>
+
+using namespace DirectX;
+
+// One star as VSStars reads it per instance, 20 bytes.
+struct Star
+{
+	XMFLOAT3 direction;	// unit vector towards the star, the sky is at infinity
+	float magnitude;	// 0 for the flux of one saturated sky map pixel, 5 magnitudes per factor 100 fainter
+	uint32_t color;		// R8G8B8A8_UNORM, brightest channel 255
+};
+
+// A star list converted once from the equirectangular sky map or from a text catalog, stored as a
+// small binary file and drawn as sprites in place of the sky map. Brightest stars first. CPU only.
+class StarCatalog
+{
+public:
+	static const float SPRITE_RADIUS;	// angular half size of a magnitude 0 sprite, as in VertexShaderStars.hlsl
+
+	StarCatalog();
+
+	// Finds the stars of a row major RGBA8 sky map laid out as SkyRay::Texcoord: every pixel that is
+	// the brightest of its 3x3 neighbourhood and at least contrast (0-255) brighter than the ring
+	// around that. Position, flux and color are taken over the 3x3 neighbourhood above the ring.
+	void Extract(const uint8_t* rgba, uint32_t width, uint32_t height, float contrast);
+
+	// Reads "right ascension, declination (degrees), visual magnitude, B-V color index" lines,
+	// separated by spaces or commas; lines starting with # are skipped. Right ascension runs along
+	// the sky map from its left edge and declination from +90 at the top, so the catalog lines up
+	// with the map. False on a malformed line.
+	bool ParseText(std::istream& text);
+	bool LoadText(const std::wstring& path);
+
+	bool Load(const std::wstring& path);
+	bool Save(const std::wstring& path) const;
+
+	const std::vector<Star>& GetStars() const { return m_stars; }
+	size_t Bytes() const { return m_stars.size() * sizeof(Star); }
+	uint32_t GetSourceWidth() const { return m_sourceWidth; }		// 0 unless extracted from a sky map
+	uint32_t GetSourceHeight() const { return m_sourceHeight; }
+
+	// RGBA8 of a black body with the temperature of the B-V color index, brightest channel 255.
+	static uint32_t ColorFromBV(float bv);
+
+	// Clip space position of sprite corner (cx, cy), each -1 or 1, of a star: the direction moved by
+	// SpriteRadius along a basis perpendicular to it, at w = 0 so the eye position drops out, then
+	// pushed to the far plane. viewproj is transposed, as Camera returns it.
+	static XMFLOAT4 ProjectSprite(const Star& star, const XMFLOAT4X4& viewproj, float cx, float cy);
+	static float SpriteRadius(float magnitude);
+	static float Brightness(float magnitude);	// sprite color scale, 1 at magnitude 0 and brighter
+
+	// True if stars planted in a synthetic sky map are extracted at their directions with their
+	// order and colors, a text catalog parses to the expected directions, and a binary file
+	// round trips.
+	static bool Validate();
+
+	// True if the corners of sprites across the view project at their SpriteRadius from the star
+	// as SkyRay reconstructs the view rays, and stars behind the eye are clipped.
+	static bool ValidateProjection(const XMFLOAT4X4& viewproj, const XMFLOAT3& eye);
+
+private:
+	void Sort();
+
+	std::vector<Star> m_stars;
+	uint32_t m_sourceWidth;
+	uint32_t m_sourceHeight;
+};
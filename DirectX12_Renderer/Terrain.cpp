@@ -1,6 +1,191 @@
 #include "Terrain.h"
+#include "TiffReader.h"
+#include <algorithm>
+#include <psapi.h>
 
-Terrain::Terrain(Graphics* renderer) :
+namespace
+{
+	// Of the whole process, so other loader threads move it too.
+	double WorkingSetMB()
+	{
+		PROCESS_MEMORY_COUNTERS counters = {};
+		counters.cb = sizeof(counters);
+		if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		{
+			return 0.0;
+		}
+		return counters.WorkingSetSize / (1024.0 * 1024.0);
+	}
+
+	// Heightmap texel format of a texture WIC loaded without conversion; false for layouts that
+	// need forcing to RGBA32.
+	bool HeightmapFormatOf(DXGI_FORMAT format, HeightmapFormat& heightmapFormat)
+	{
+		switch (format)
+		{
+		case DXGI_FORMAT_R8_UNORM: heightmapFormat = HeightmapFormat::R8_UNORM; return true;
+		case DXGI_FORMAT_R16_UNORM: heightmapFormat = HeightmapFormat::R16_UNORM; return true;
+		case DXGI_FORMAT_R32_FLOAT: heightmapFormat = HeightmapFormat::R32_FLOAT; return true;
+		case DXGI_FORMAT_R8G8B8A8_UNORM: heightmapFormat = HeightmapFormat::R8G8B8A8_UNORM; return true;
+		default: return false;
+		}
+	}
+
+	MipFormat MipFormatOf(HeightmapFormat format)
+	{
+		switch (format)
+		{
+		case HeightmapFormat::R8_UNORM: return MipFormat::R8_UNORM;
+		case HeightmapFormat::R16_UNORM: return MipFormat::R16_UNORM;
+		case HeightmapFormat::R32_FLOAT: return MipFormat::R32_FLOAT;
+		default: return MipFormat::R8G8B8A8_UNORM;
+		}
+	}
+
+	// Level 0 as WIC decoded it, then the generated levels.
+	std::vector<D3D12_SUBRESOURCE_DATA> MipSubresources(const D3D12_SUBRESOURCE_DATA& top, const std::vector<MipChain::Level>& levels, size_t texelBytes)
+	{
+		std::vector<D3D12_SUBRESOURCE_DATA> subresources(1, top);
+		for (const MipChain::Level& level : levels)
+		{
+			D3D12_SUBRESOURCE_DATA data;
+			data.pData = level.texels.data();
+			data.RowPitch = (LONG_PTR)(level.width * texelBytes);
+			data.SlicePitch = data.RowPitch * level.height;
+			subresources.push_back(data);
+		}
+		return subresources;
+	}
+
+	// Level 0 and the generated mips block compressed, one buffer per level. D3D12 needs level 0 a
+	// whole number of blocks; false, and nothing encoded, if it is not.
+	bool CompressLevels(const D3D12_SUBRESOURCE_DATA& top, UINT width, UINT height, MipFormat source, const std::vector<MipChain::Level>& mips,
+		BlockFormat format, std::vector<std::vector<uint8_t>>& blocks)
+	{
+		if (width % 4 != 0 || height % 4 != 0)
+		{
+			return false;
+		}
+		blocks.resize(mips.size() + 1);
+		BlockCompressor::Encode(top.pData, top.RowPitch, width, height, source, format, blocks[0]);
+		for (size_t level = 0; level < mips.size(); ++level)
+		{
+			const MipChain::Level& mip = mips[level];
+			BlockCompressor::Encode(mip.texels.data(), mip.width * MipChain::TexelBytes(source), mip.width, mip.height, source, format, blocks[level + 1]);
+		}
+		return true;
+	}
+
+	std::vector<D3D12_SUBRESOURCE_DATA> BlockSubresources(const std::vector<std::vector<uint8_t>>& blocks, UINT width, BlockFormat format)
+	{
+		std::vector<D3D12_SUBRESOURCE_DATA> subresources;
+		for (const std::vector<uint8_t>& level : blocks)
+		{
+			D3D12_SUBRESOURCE_DATA data;
+			data.pData = level.data();
+			data.RowPitch = (LONG_PTR)(BlockCompressor::BlocksAcross(width) * BlockCompressor::BlockBytes(format));
+			data.SlicePitch = (LONG_PTR)level.size();
+			subresources.push_back(data);
+			width = std::max(1u, width / 2);
+		}
+		return subresources;
+	}
+
+	// Swaps a texture WIC created for an empty one of the same size and mips in a block format.
+	void ReplaceWithBlockTexture(Graphics* Renderer, ID3D12Resource*& texture, BlockFormat format)
+	{
+		D3D12_RESOURCE_DESC desc = texture->GetDesc();
+		desc.Format = (DXGI_FORMAT)BlockCompressor::DxgiFormat(format);
+		texture->Release();
+		Renderer->CreateDefaultBuffer(texture, &desc);
+	}
+
+	// A heightmap TiffReader reads, strips or tiles decoded on every core straight into level 0,
+	// in a texture of its own single-channel format with a full mip chain reserved, as WIC would
+	// have left it. Signed heights have their sign bit flipped to keep their order as R16_UNORM.
+	// The reader is left open for level 0 to be read again. False, and nothing created, for
+	// anything else, which is left to WIC.
+	bool LoadTiffHeightmap(Graphics* Renderer, const wchar_t* path, LoadingTexture& map, D3D12_SUBRESOURCE_DATA& data, HeightmapFormat& format,
+		std::shared_ptr<TiffReader>& opened)
+	{
+		char narrowPath[MAX_PATH];
+		std::shared_ptr<TiffReader> reader = std::make_shared<TiffReader>();
+		if (WideCharToMultiByte(CP_ACP, 0, path, -1, narrowPath, MAX_PATH, nullptr, nullptr) == 0 || !reader->Open(narrowPath))
+		{
+			return false;
+		}
+		const TiffInfo& info = reader->GetInfo();
+		DXGI_FORMAT textureFormat;
+		if (info.samplesPerPixel != 1 || info.width > D3D12_REQ_TEXTURE2D_U_OR_V_DIMENSION || info.height > D3D12_REQ_TEXTURE2D_U_OR_V_DIMENSION)
+		{
+			return false;
+		}
+		if (info.floatSamples)
+		{
+			textureFormat = DXGI_FORMAT_R32_FLOAT;
+			format = HeightmapFormat::R32_FLOAT;
+		}
+		else if (info.bitsPerSample == 16)
+		{
+			textureFormat = DXGI_FORMAT_R16_UNORM;
+			format = HeightmapFormat::R16_UNORM;
+		}
+		else if (info.bitsPerSample == 8 && !info.signedSamples)
+		{
+			textureFormat = DXGI_FORMAT_R8_UNORM;
+			format = HeightmapFormat::R8_UNORM;
+		}
+		else
+		{
+			return false;
+		}
+
+		const size_t rowBytes = reader->GetRowBytes();
+		std::unique_ptr<uint8_t[]> texels(new uint8_t[rowBytes * info.height]);
+		if (!reader->ReadRows(texels.get(), rowBytes))
+		{
+			return false;
+		}
+		if (info.signedSamples)
+		{
+			uint16_t* samples = reinterpret_cast<uint16_t*>(texels.get());
+			for (size_t i = 0; i < (size_t)info.width * info.height; ++i)
+			{
+				samples[i] ^= 0x8000;
+			}
+		}
+
+		D3D12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Tex2D(textureFormat, info.width, info.height, 1,
+			(UINT16)MipChain::LevelCount(info.width, info.height));
+		Renderer->CreateDefaultBuffer(map.texture, &desc);
+		map.decodedData = std::move(texels);
+		data.pData = map.decodedData.get();
+		data.RowPitch = (LONG_PTR)rowBytes;
+		data.SlicePitch = data.RowPitch * info.height;
+		opened = std::move(reader);
+		return true;
+	}
+
+	UINT64 AlignPlacement(UINT64 offset)
+	{
+		return (offset + D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT - 1) & ~(UINT64)(D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT - 1);
+	}
+
+	// Tiles a patch selection samples, each patch at the size of its tessellated quads;
+	// HullShader splits every patch edge 9 times.
+	void AddSelectionFootprint(const VirtualTexture& texture, const std::vector<SelectedPatch>& selection, std::vector<TileKey>& tiles)
+	{
+		for (const SelectedPatch& patch : selection)
+		{
+			float thetaMin, thetaMax, phiMin, phiMax;
+			TerrainQuadtree::NodeAngularBounds(patch.face, patch.level, patch.x, patch.y, thetaMin, thetaMax, phiMin, phiMax);
+			float texelAngle = XM_PIDIV2 / ((float)(1u << patch.level) * TERRAIN_PATCH_GRID * 9.0f);
+			texture.AddFootprint(thetaMin, thetaMax, phiMin, phiMax, texelAngle, tiles);
+		}
+	}
+}
+
+Terrain::Terrain(Graphics* renderer, GeometryCache& geometryCache) :
 	m_pipelineStateTes(nullptr),
 	m_pipelineStateTes2(nullptr),
 	m_pipelineState3D(nullptr),
@@ -10,26 +195,49 @@ Terrain::Terrain(Graphics* renderer) :
 	m_rootSignature3D(nullptr),
 	m_rootSignature2D(nullptr),
 	m_srvHeap(nullptr),
-	m_uploadHeap(nullptr),
+	m_residentMaps(0),
 	m_image(),
+	m_heightPyramid(),
+	m_heightRange(),
 	m_width(0),
 	m_height(0),
 	m_CBV(nullptr),
-	m_vertexBuffer(nullptr),
-	m_vertexBufferUpload(nullptr),
-	m_indexBuffer(nullptr),
-	m_indexBufferUpload(nullptr),
-	m_orbitCycle(5760)
+	m_geometryCache(&geometryCache),
+	m_geometry(nullptr),
+	m_instanceBuffer(nullptr),
+	m_instanceDataBegin(nullptr),
+	m_instanceCapacity(0),
+	m_instanceFrame(0),
+	m_lodTotals(),
+	m_lodSelectMs(0.0),
+	m_lodFrames(0),
+	m_orbitCycle(5760),
+	m_virtualTexture(false),
+	m_domainNormalMap(false),
+	m_pixelHorizonMap(false),
+	m_streamFrame(0)
 {
-	LoadHeightMap(renderer, L"ldem_16.tif", L"lroc_color_poles_4k.tif");
+	// The maps stream from the tile archive only once TileBaker has baked it; until then the
+	// whole maps are loaded as without TERRAIN_VIRTUAL_TEXTURE.
+	m_virtualTexture = TERRAIN_VIRTUAL_TEXTURE && OpenTileArchive("terrain.vtar");
+
+	// DomainShader reads normals from the normal map; the streamed heights have none, and the
+	// static terrain has its normals on the vertices.
+	m_domainNormalMap = TERRAIN_NORMAL_MAP && !m_virtualTexture && !STATIC_TERRAIN;
+
+	// PixelShaderTes shadows by the horizon map, which follows the normal map in its root parameter.
+	m_pixelHorizonMap = TERRAIN_HORIZON_MAP && m_domainNormalMap;
+
+	CreateDescriptorHeap(renderer);
+	if (m_virtualTexture)
+	{
+		LoadStreamedTextures(renderer);
+	}
 	
 	//InitPipeline2D(renderer);
 	//InitPipeline3D(renderer);
 	InitPipelineTes(renderer);
 	InitPipelineTes_Wireframe(renderer);
-
-	CreateGeosphere(renderer, 1737, 10);
-	//CreateGeosphere(Renderer, 17374, 10);
 }
 
 Terrain::~Terrain()
@@ -39,30 +247,13 @@ Terrain::~Terrain()
 		m_srvHeap->Release();
 		m_srvHeap = nullptr;
 	}
-	if (m_uploadHeap)
+	m_displacementMap.Release();
+	m_colorMap.Release();
+	m_normalMap.Release();
+	m_horizonMap.Release();
+	if (m_geometry)
 	{
-		m_uploadHeap->Release();
-		m_uploadHeap = nullptr;
-	}
-	if (m_indexBufferUpload)
-	{
-		m_indexBufferUpload->Release();
-		m_indexBufferUpload = nullptr;
-	}
-	if (m_indexBuffer)
-	{
-		m_indexBuffer->Release();
-		m_indexBuffer = nullptr;
-	}
-	if (m_vertexBufferUpload)
-	{
-		m_vertexBufferUpload->Release();
-		m_vertexBufferUpload = nullptr;
-	}
-	if (m_vertexBuffer)
-	{
-		m_vertexBuffer->Release();
-		m_vertexBuffer = nullptr;
+		m_geometryCache->Release(m_geometry);
 	}
 	if (m_pipelineStateTes)
 	{
@@ -104,6 +295,13 @@ Terrain::~Terrain()
 		m_rootSignature2D->Release();
 		m_rootSignature2D = nullptr;
 	}
+	if (m_instanceBuffer)
+	{
+		m_instanceBuffer->Unmap(0, nullptr);
+		m_instanceDataBegin = nullptr;
+		m_instanceBuffer->Release();
+		m_instanceBuffer = nullptr;
+	}
 	if (m_CBV)
 	{
 		m_CBV->Unmap(0, nullptr);
@@ -111,10 +309,19 @@ Terrain::~Terrain()
 		m_CBV->Release();
 		m_CBV = nullptr;
 	}
+	ReleaseStreamedTexture(m_streamedHeight);
+	ReleaseStreamedTexture(m_streamedColor);
 }
 
 void Terrain::DrawTes(ID3D12GraphicsCommandList* m_commandList, XMFLOAT4X4 viewproj, XMFLOAT4 eye)
 {
+	if (m_virtualTexture)
+	{
+		UpdateStreamedTexture(m_commandList, m_streamedHeight);
+		UpdateStreamedTexture(m_commandList, m_streamedColor);
+		++m_streamFrame;
+	}
+
 	m_commandList->SetPipelineState(m_pipelineStateTes);
 	m_commandList->SetGraphicsRootSignature(m_rootSignatureTes);
 
@@ -124,6 +331,8 @@ void Terrain::DrawTes(ID3D12GraphicsCommandList* m_commandList, XMFLOAT4X4 viewp
 	m_constantBufferData.eye = eye;
 	m_constantBufferData.height = m_height;
 	m_constantBufferData.width = m_width;
+	m_constantBufferData.heightOffset = m_heightRange.offset;
+	m_constantBufferData.heightScale = m_heightRange.scale;
 	m_constantBufferData.light = m_orbitCycle.GetLight();
 	memcpy(m_cbvDataBegin, &m_constantBufferData, sizeof(ConstantBuffer));
 
@@ -134,16 +343,45 @@ void Terrain::DrawTes(ID3D12GraphicsCommandList* m_commandList, XMFLOAT4X4 viewp
 	m_commandList->SetGraphicsRootDescriptorTable(1, cbvHandle);
 	CD3DX12_GPU_DESCRIPTOR_HANDLE srvhandle2(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), 2, m_srvDescSize);
 	m_commandList->SetGraphicsRootDescriptorTable(2, srvhandle2);
+	if (m_virtualTexture || m_domainNormalMap)
+	{
+		CD3DX12_GPU_DESCRIPTOR_HANDLE pagesHandle(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), 3, m_srvDescSize);
+		m_commandList->SetGraphicsRootDescriptorTable(3, pagesHandle);
+	}
+
+	if (STATIC_TERRAIN)
+	{
+		m_commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		m_commandList->IASetVertexBuffers(0, 1, &m_geometry->vertexBufferView);
+		m_commandList->IASetIndexBuffer(&m_geometry->indexBufferView);
+
+		DrawChunks(m_commandList);
+		return;
+	}
 
 	m_commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_3_CONTROL_POINT_PATCHLIST); // describe how to read the vertex buffer.
-	m_commandList->IASetVertexBuffers(0, 1, &m_vertexBufferView);
-	m_commandList->IASetIndexBuffer(&m_indexBufferView);
+	if (TERRAIN_QUADTREE)
+	{
+		DrawPatches(m_commandList, viewproj, eye);
+	}
+	else
+	{
+		m_commandList->IASetVertexBuffers(0, 1, &m_geometry->vertexBufferView);
+		m_commandList->IASetIndexBuffer(&m_geometry->indexBufferView);
 
-	m_commandList->DrawIndexedInstanced(m_indexcount, 1, 0, 0, 0);
+		DrawChunks(m_commandList);
+	}
 }
 
 void Terrain::DrawTes_Wireframe(ID3D12GraphicsCommandList* m_commandList, XMFLOAT4X4 viewproj, XMFLOAT4 eye)
 {
+	if (m_virtualTexture)
+	{
+		UpdateStreamedTexture(m_commandList, m_streamedHeight);
+		UpdateStreamedTexture(m_commandList, m_streamedColor);
+		++m_streamFrame;
+	}
+
 	m_commandList->SetPipelineState(m_pipelineStateTes2);
 	m_commandList->SetGraphicsRootSignature(m_rootSignatureTes2);
 
@@ -153,6 +391,8 @@ void Terrain::DrawTes_Wireframe(ID3D12GraphicsCommandList* m_commandList, XMFLOA
 	m_constantBufferData.eye = eye;
 	m_constantBufferData.height = m_height;
 	m_constantBufferData.width = m_width;
+	m_constantBufferData.heightOffset = m_heightRange.offset;
+	m_constantBufferData.heightScale = m_heightRange.scale;
 	m_constantBufferData.light = m_orbitCycle.GetLight();
 	memcpy(m_cbvDataBegin, &m_constantBufferData, sizeof(ConstantBuffer));
 
@@ -163,12 +403,34 @@ void Terrain::DrawTes_Wireframe(ID3D12GraphicsCommandList* m_commandList, XMFLOA
 	m_commandList->SetGraphicsRootDescriptorTable(1, cbvHandle);
 	CD3DX12_GPU_DESCRIPTOR_HANDLE srvhandle2(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), 2, m_srvDescSize);
 	m_commandList->SetGraphicsRootDescriptorTable(2, srvhandle2);
+	if (m_virtualTexture || m_domainNormalMap)
+	{
+		CD3DX12_GPU_DESCRIPTOR_HANDLE pagesHandle(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), 3, m_srvDescSize);
+		m_commandList->SetGraphicsRootDescriptorTable(3, pagesHandle);
+	}
+
+	if (STATIC_TERRAIN)
+	{
+		m_commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+		m_commandList->IASetVertexBuffers(0, 1, &m_geometry->vertexBufferView);
+		m_commandList->IASetIndexBuffer(&m_geometry->indexBufferView);
+
+		DrawChunks(m_commandList);
+		return;
+	}
 
 	m_commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_3_CONTROL_POINT_PATCHLIST); // describe how to read the vertex buffer.
-	m_commandList->IASetVertexBuffers(0, 1, &m_vertexBufferView);
-	m_commandList->IASetIndexBuffer(&m_indexBufferView);
+	if (TERRAIN_QUADTREE)
+	{
+		DrawPatches(m_commandList, viewproj, eye);
+	}
+	else
+	{
+		m_commandList->IASetVertexBuffers(0, 1, &m_geometry->vertexBufferView);
+		m_commandList->IASetIndexBuffer(&m_geometry->indexBufferView);
 
-	m_commandList->DrawIndexedInstanced(m_indexcount, 1, 0, 0, 0);
+		DrawChunks(m_commandList);
+	}
 }
 
 void Terrain::Draw3D(ID3D12GraphicsCommandList* m_commandList, XMFLOAT4X4 viewproj, XMFLOAT4 eye)
@@ -180,6 +442,8 @@ void Terrain::Draw3D(ID3D12GraphicsCommandList* m_commandList, XMFLOAT4X4 viewpr
 	m_constantBufferData.eye = eye;
 	m_constantBufferData.height = m_height;
 	m_constantBufferData.width = m_width;
+	m_constantBufferData.heightOffset = m_heightRange.offset;
+	m_constantBufferData.heightScale = m_heightRange.scale;
 	memcpy(m_cbvDataBegin, &m_constantBufferData, sizeof(m_constantBufferData));
 
 	ID3D12DescriptorHeap* heaps[] = { m_srvHeap };
@@ -191,10 +455,10 @@ void Terrain::Draw3D(ID3D12GraphicsCommandList* m_commandList, XMFLOAT4X4 viewpr
 	m_commandList->SetGraphicsRootDescriptorTable(2, srvhandle2);
 	
 	m_commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST); // describe how to read the vertex buffer.
-	m_commandList->IASetVertexBuffers(0, 1, &m_vertexBufferView);
-	m_commandList->IASetIndexBuffer(&m_indexBufferView);
+	m_commandList->IASetVertexBuffers(0, 1, &m_geometry->vertexBufferView);
+	m_commandList->IASetIndexBuffer(&m_geometry->indexBufferView);
 
-	m_commandList->DrawIndexedInstanced(m_indexcount, 1, 0, 0, 0);
+	DrawChunks(m_commandList);
 }
 
 void Terrain::Draw2D(ID3D12GraphicsCommandList* m_commandList)
@@ -215,29 +479,45 @@ void Terrain::Draw2D(ID3D12GraphicsCommandList* m_commandList)
 	m_commandList->DrawInstanced(3, 1, 0, 0);
 }
 
-void Terrain::ClearUnusedUploadBuffersAfterInit()
+void Terrain::QueueLoads(Graphics* renderer, AssetLoader& loader, UploadRing& ring)
 {
-	if (m_uploadHeap)
-	{
-		m_uploadHeap->Release();
-		m_uploadHeap = nullptr;
-	}
-	if (m_indexBufferUpload)
-	{
-		m_indexBufferUpload->Release();
-		m_indexBufferUpload = nullptr;
-	}
-	if (m_vertexBufferUpload) 
-	{
-		m_vertexBufferUpload->Release();
-		m_vertexBufferUpload = nullptr;
-	}
+	loader.Add("Terrain displacement map",
+		[this, renderer]() { DecodeDisplacementMap(renderer, L"ldem_16.tif"); },
+		[this, renderer, &ring](size_t& bytes) { return StageDisplacementMap(renderer, ring, bytes); },
+		[this]()
+		{
+			m_displacementMap.ReleaseStaging();
+			m_normalMap.ReleaseStaging();
+			m_horizonMap.ReleaseStaging();
+			m_geometryCache->ReleaseUploadBuffers();
+			++m_residentMaps;
+		});
+	loader.Add("Terrain color map",
+		[this, renderer]() { DecodeColorMap(renderer, L"lroc_color_poles_4k.tif"); },
+		[this, renderer, &ring](size_t& bytes)
+		{
+			if (!m_colorMap.Stage(renderer, ring, bytes))
+			{
+				return false;
+			}
+			if (!m_virtualTexture)
+			{
+				CD3DX12_CPU_DESCRIPTOR_HANDLE colorhandle(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), 2, m_srvDescSize);
+				renderer->CreateSRV(m_colorMap.texture, &m_colorMap.srvDesc, colorhandle);
+			}
+			return true;
+		},
+		[this]()
+		{
+			m_colorMap.ReleaseStaging();
+			++m_residentMaps;
+		});
 }
 
 void Terrain::InitPipelineTes(Graphics* Renderer)
 {
-	CD3DX12_DESCRIPTOR_RANGE range[3];
-	CD3DX12_ROOT_PARAMETER paramsRoot[3];
+	CD3DX12_DESCRIPTOR_RANGE range[4];
+	CD3DX12_ROOT_PARAMETER paramsRoot[4];
 	// Root Signature 
 	range[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
 	paramsRoot[0].InitAsDescriptorTable(1, &range[0]);
@@ -250,6 +530,17 @@ void Terrain::InitPipelineTes(Graphics* Renderer)
 	range[2].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 1);
 	paramsRoot[2].InitAsDescriptorTable(1, &range[2]);
 
+	// Virtual texture indirection of the height and color maps, Register(t2, t3); or the normal and horizon maps, Register(t4, t5)
+	if (m_virtualTexture)
+	{
+		range[3].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 2, 2);
+	}
+	else
+	{
+		range[3].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, m_pixelHorizonMap ? 2 : 1, 4);
+	}
+	paramsRoot[3].InitAsDescriptorTable(1, &range[3]);
+
 	CD3DX12_STATIC_SAMPLER_DESC descSamplers[2];
 	descSamplers[0].Init(0, D3D12_FILTER_MIN_MAG_MIP_LINEAR);
 	descSamplers[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
@@ -258,7 +549,7 @@ void Terrain::InitPipelineTes(Graphics* Renderer)
 
 	CD3DX12_ROOT_SIGNATURE_DESC rootDesc;
 	rootDesc.Init(
-		_countof(paramsRoot),
+		m_virtualTexture || m_domainNormalMap ? 4 : 3,
 		paramsRoot,
 		2,
 		descSamplers,
@@ -274,23 +565,34 @@ void Terrain::InitPipelineTes(Graphics* Renderer)
 	D3D12_SHADER_BYTECODE VSBytecode = {};
 	D3D12_SHADER_BYTECODE HSBytecode = {};
 	D3D12_SHADER_BYTECODE DSBytecode = {};
-	Renderer->CompileShader(L"VertexShaderTes.hlsl", "VSTes", VSBytecode, VERTEX_SHADER);
-	Renderer->CompileShader(L"PixelShaderTes.hlsl", "PSTes", PSBytecode, PIXEL_SHADER);
-	Renderer->CompileShader(L"HullShader.hlsl", "HS", HSBytecode, HULL_SHADER);
-	Renderer->CompileShader(L"DomainShader.hlsl", "DS", DSBytecode, DOMAIN_SHADER);
-
-	// Input Layout 
-	D3D12_INPUT_ELEMENT_DESC inputLayout[] =
+	const D3D_SHADER_MACRO packedDefines[] = { { "PACKED_VERTEX", "1" }, { NULL, NULL } };
+	const D3D_SHADER_MACRO virtualDefines[] = { { "VIRTUAL_TEXTURE", "1" }, { NULL, NULL } };
+	const D3D_SHADER_MACRO normalDefines[] = { { "NORMAL_MAP", "1" }, { NULL, NULL } };
+	const D3D_SHADER_MACRO horizonDefines[] = { { "HORIZON_MAP", "1" }, { NULL, NULL } };
+	if (STATIC_TERRAIN)
 	{
-		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		//{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-	};
+		Renderer->CompileShader(L"VertexShaderStatic.hlsl", "VSStatic", VSBytecode, VERTEX_SHADER);
+	}
+	else if (TERRAIN_QUADTREE)
+	{
+		Renderer->CompileShader(L"VertexShaderPatch.hlsl", "VSPatch", VSBytecode, VERTEX_SHADER);
+	}
+	else
+	{
+		Renderer->CompileShader(L"VertexShaderTes.hlsl", "VSTes", VSBytecode, VERTEX_SHADER, PACKED_TERRAIN_VERTEX ? packedDefines : nullptr);
+	}
+	Renderer->CompileShader(L"PixelShaderTes.hlsl", "PSTes", PSBytecode, PIXEL_SHADER,
+		m_virtualTexture ? virtualDefines : m_pixelHorizonMap ? horizonDefines : nullptr);
+	if (!STATIC_TERRAIN)
+	{
+		Renderer->CompileShader(L"HullShader.hlsl", "HS", HSBytecode, HULL_SHADER);
+		Renderer->CompileShader(L"DomainShader.hlsl", "DS", DSBytecode, DOMAIN_SHADER,
+			m_virtualTexture ? virtualDefines : m_domainNormalMap ? normalDefines : nullptr);
+	}
 
+	// Input Layout 
 	D3D12_INPUT_LAYOUT_DESC	inputLayoutDesc = {};
-	inputLayoutDesc.NumElements = sizeof(inputLayout) / sizeof(D3D12_INPUT_ELEMENT_DESC);
-	inputLayoutDesc.pInputElementDescs = inputLayout;
+	GetTesInputLayout(inputLayoutDesc);
 
 	D3D12_GRAPHICS_PIPELINE_STATE_DESC psoDesc = {};
 	psoDesc.InputLayout = inputLayoutDesc;
@@ -305,7 +607,7 @@ void Terrain::InitPipelineTes(Graphics* Renderer)
 	psoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_BACK;
 	psoDesc.RasterizerState.FillMode = D3D12_FILL_MODE_SOLID;
 	psoDesc.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
-	psoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_PATCH;
+	psoDesc.PrimitiveTopologyType = STATIC_TERRAIN ? D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE : D3D12_PRIMITIVE_TOPOLOGY_TYPE_PATCH;
 	psoDesc.NumRenderTargets = 1;
 	psoDesc.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
 	psoDesc.SampleDesc.Count = 1;
@@ -315,8 +617,8 @@ void Terrain::InitPipelineTes(Graphics* Renderer)
 
 void Terrain::InitPipelineTes_Wireframe(Graphics* Renderer)
 {
-	CD3DX12_DESCRIPTOR_RANGE range[3];
-	CD3DX12_ROOT_PARAMETER paramsRoot[3];
+	CD3DX12_DESCRIPTOR_RANGE range[4];
+	CD3DX12_ROOT_PARAMETER paramsRoot[4];
 	// Root Signature 
 	range[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0);
 	paramsRoot[0].InitAsDescriptorTable(1, &range[0]);
@@ -329,6 +631,17 @@ void Terrain::InitPipelineTes_Wireframe(Graphics* Renderer)
 	range[2].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 1);
 	paramsRoot[2].InitAsDescriptorTable(1, &range[2]);
 
+	// Virtual texture indirection of the height and color maps, Register(t2, t3); or the normal and horizon maps, Register(t4, t5)
+	if (m_virtualTexture)
+	{
+		range[3].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 2, 2);
+	}
+	else
+	{
+		range[3].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, m_pixelHorizonMap ? 2 : 1, 4);
+	}
+	paramsRoot[3].InitAsDescriptorTable(1, &range[3]);
+
 	CD3DX12_STATIC_SAMPLER_DESC descSamplers[2];
 	descSamplers[0].Init(0, D3D12_FILTER_MIN_MAG_MIP_LINEAR);
 	descSamplers[0].ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
@@ -337,7 +650,7 @@ void Terrain::InitPipelineTes_Wireframe(Graphics* Renderer)
 
 	CD3DX12_ROOT_SIGNATURE_DESC rootDesc;
 	rootDesc.Init(
-		_countof(paramsRoot),
+		m_virtualTexture || m_domainNormalMap ? 4 : 3,
 		paramsRoot,
 		2,
 		descSamplers,
@@ -353,23 +666,34 @@ void Terrain::InitPipelineTes_Wireframe(Graphics* Renderer)
 	D3D12_SHADER_BYTECODE VSBytecode = {};
 	D3D12_SHADER_BYTECODE HSBytecode = {};
 	D3D12_SHADER_BYTECODE DSBytecode = {};
-	Renderer->CompileShader(L"VertexShaderTes.hlsl", "VSTes", VSBytecode, VERTEX_SHADER);
-	Renderer->CompileShader(L"PixelShaderTes.hlsl", "PSTes", PSBytecode, PIXEL_SHADER);
-	Renderer->CompileShader(L"HullShader.hlsl", "HS", HSBytecode, HULL_SHADER);
-	Renderer->CompileShader(L"DomainShader.hlsl", "DS", DSBytecode, DOMAIN_SHADER);
-
-	// Input Layout 
-	D3D12_INPUT_ELEMENT_DESC inputLayout[] =
+	const D3D_SHADER_MACRO packedDefines[] = { { "PACKED_VERTEX", "1" }, { NULL, NULL } };
+	const D3D_SHADER_MACRO virtualDefines[] = { { "VIRTUAL_TEXTURE", "1" }, { NULL, NULL } };
+	const D3D_SHADER_MACRO normalDefines[] = { { "NORMAL_MAP", "1" }, { NULL, NULL } };
+	const D3D_SHADER_MACRO horizonDefines[] = { { "HORIZON_MAP", "1" }, { NULL, NULL } };
+	if (STATIC_TERRAIN)
 	{
-		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		{ "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-		//{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-	};
+		Renderer->CompileShader(L"VertexShaderStatic.hlsl", "VSStatic", VSBytecode, VERTEX_SHADER);
+	}
+	else if (TERRAIN_QUADTREE)
+	{
+		Renderer->CompileShader(L"VertexShaderPatch.hlsl", "VSPatch", VSBytecode, VERTEX_SHADER);
+	}
+	else
+	{
+		Renderer->CompileShader(L"VertexShaderTes.hlsl", "VSTes", VSBytecode, VERTEX_SHADER, PACKED_TERRAIN_VERTEX ? packedDefines : nullptr);
+	}
+	Renderer->CompileShader(L"PixelShaderTes.hlsl", "PSTes", PSBytecode, PIXEL_SHADER,
+		m_virtualTexture ? virtualDefines : m_pixelHorizonMap ? horizonDefines : nullptr);
+	if (!STATIC_TERRAIN)
+	{
+		Renderer->CompileShader(L"HullShader.hlsl", "HS", HSBytecode, HULL_SHADER);
+		Renderer->CompileShader(L"DomainShader.hlsl", "DS", DSBytecode, DOMAIN_SHADER,
+			m_virtualTexture ? virtualDefines : m_domainNormalMap ? normalDefines : nullptr);
+	}
 
+	// Input Layout 
 	D3D12_INPUT_LAYOUT_DESC	inputLayoutDesc = {};
-	inputLayoutDesc.NumElements = sizeof(inputLayout) / sizeof(D3D12_INPUT_ELEMENT_DESC);
-	inputLayoutDesc.pInputElementDescs = inputLayout;
+	GetTesInputLayout(inputLayoutDesc);
 
 	D3D12_GRAPHICS_PIPELINE_STATE_DESC psoDesc = {};
 	psoDesc.InputLayout = inputLayoutDesc;
@@ -384,7 +708,7 @@ void Terrain::InitPipelineTes_Wireframe(Graphics* Renderer)
 	psoDesc.RasterizerState.CullMode = D3D12_CULL_MODE_BACK;
 	psoDesc.RasterizerState.FillMode = D3D12_FILL_MODE_WIREFRAME;
 	psoDesc.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(D3D12_DEFAULT);
-	psoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_PATCH;
+	psoDesc.PrimitiveTopologyType = STATIC_TERRAIN ? D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE : D3D12_PRIMITIVE_TOPOLOGY_TYPE_PATCH;
 	psoDesc.NumRenderTargets = 1;
 	psoDesc.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
 	psoDesc.SampleDesc.Count = 1;
@@ -392,6 +716,62 @@ void Terrain::InitPipelineTes_Wireframe(Graphics* Renderer)
 	Renderer->createPSO(&psoDesc, m_pipelineStateTes2);
 }
 
+void Terrain::GetTesInputLayout(D3D12_INPUT_LAYOUT_DESC& inputLayoutDesc)
+{
+	static const D3D12_INPUT_ELEMENT_DESC inputLayout[] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		//{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+	};
+
+	// Tangent is rebuilt from the normal in VSTes.
+	static const D3D12_INPUT_ELEMENT_DESC packedInputLayout[] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_SNORM, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+	};
+
+	// Patch grid in slot 0, one PatchInstance per selected node in slot 1.
+	static const D3D12_INPUT_ELEMENT_DESC patchInputLayout[] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "PATCH", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, 0, D3D12_INPUT_CLASSIFICATION_PER_INSTANCE_DATA, 1 },
+		{ "MORPH", 0, DXGI_FORMAT_R32G32_FLOAT, 1, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_INSTANCE_DATA, 1 },
+	};
+
+	// The full Vertex, displaced and with texture coordinates, for VSStatic.
+	static const D3D12_INPUT_ELEMENT_DESC staticInputLayout[] =
+	{
+		{ "POSITION", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "NORMAL", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+		{ "TEXCOORD", 0, DXGI_FORMAT_R32G32_FLOAT, 0, D3D12_APPEND_ALIGNED_ELEMENT, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
+	};
+
+	if (STATIC_TERRAIN)
+	{
+		inputLayoutDesc.NumElements = _countof(staticInputLayout);
+		inputLayoutDesc.pInputElementDescs = staticInputLayout;
+	}
+	else if (TERRAIN_QUADTREE)
+	{
+		inputLayoutDesc.NumElements = _countof(patchInputLayout);
+		inputLayoutDesc.pInputElementDescs = patchInputLayout;
+	}
+	else if (PACKED_TERRAIN_VERTEX)
+	{
+		inputLayoutDesc.NumElements = _countof(packedInputLayout);
+		inputLayoutDesc.pInputElementDescs = packedInputLayout;
+	}
+	else
+	{
+		inputLayoutDesc.NumElements = _countof(inputLayout);
+		inputLayoutDesc.pInputElementDescs = inputLayout;
+	}
+}
+
 void Terrain::InitPipeline3D(Graphics* Renderer)
 {
 	// Root Signature 
@@ -553,8 +933,7 @@ void Terrain::CreateMesh3D(Graphics* Renderer)
 	int width = m_width;
 	int arraysize = height * width;
 
-	// Vertex Buffer 
-	Vertex1 *vertices = new Vertex1[arraysize];
+	std::vector<Vertex1> vertices(arraysize);
 	for (int y = 0; y < height; ++y) 
 	{
 		for (int x = 0; x < width; ++x) 
@@ -563,27 +942,10 @@ void Terrain::CreateMesh3D(Graphics* Renderer)
 		}
 	}
 
-	int bufferSize = sizeof(Vertex1) * arraysize;
-
-	Renderer->CreateCommittedBuffer(m_vertexBuffer, m_vertexBufferUpload, &CD3DX12_RESOURCE_DESC::Buffer(bufferSize));
-
-	D3D12_SUBRESOURCE_DATA vertexData = {};
-	vertexData.pData = vertices;
-	vertexData.RowPitch = bufferSize;
-	vertexData.SlicePitch = bufferSize;
-
-	UpdateSubresources(Renderer->GetCommandList(), m_vertexBuffer, m_vertexBufferUpload, 0, 0, 1, &vertexData);
-	Renderer->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_vertexBuffer, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER));
-
-	m_vertexBufferView.BufferLocation = m_vertexBuffer->GetGPUVirtualAddress();
-	m_vertexBufferView.StrideInBytes = sizeof(Vertex1);
-	m_vertexBufferView.SizeInBytes = bufferSize;
-
-
 	// Index Buffer 
 	arraysize = (m_width - 1) * (m_height - 1) * 6;
 
-	UINT* indices = new UINT[arraysize];
+	std::vector<UINT> indices(arraysize);
 	int i = 0;
 	for (int y = 0; y < m_height - 1; ++y)
 	{
@@ -599,84 +961,405 @@ void Terrain::CreateMesh3D(Graphics* Renderer)
 		}
 	}
 
-	bufferSize = sizeof(UINT) * arraysize;
+	std::vector<XMFLOAT3> positions(vertices.size());
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		positions[i] = vertices[i].position;
+	}
 
-	Renderer->CreateCommittedBuffer(m_indexBuffer, m_indexBufferUpload, &CD3DX12_RESOURCE_DESC::Buffer(bufferSize));
+	MeshChunker::ChunkedMesh chunked;
+	MeshChunker::Build(positions, indices, MeshChunker::MAX_CHUNK_VERTICES, chunked);
+	std::vector<Vertex1> chunkedVertices = MeshChunker::GatherVertices(vertices, chunked);
 
-	D3D12_SUBRESOURCE_DATA indexData = {};
-	indexData.pData = indices;
-	indexData.RowPitch = bufferSize;
-	indexData.SlicePitch = bufferSize;
+	const MeshCache::Key key = { "Heightmap grid", 0.0f, m_width, MeshChunker::MAX_CHUNK_VERTICES, sizeof(Vertex1), m_height };
+	UseGeometry(m_geometryCache->Add(Renderer, key, MeshCache::MakeBlob(&chunkedVertices[0], sizeof(Vertex1), chunkedVertices.size(), chunked), false), 1.0f);
+}
 
-	UpdateSubresources(Renderer->GetCommandList(), m_indexBuffer, m_indexBufferUpload, 0, 0, 1, &indexData);
-	Renderer->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_indexBuffer, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_INDEX_BUFFER));
+bool LoadingTexture::Stage(Graphics* renderer, UploadRing& ring, size_t& bytes)
+{
+	// Already transitioned by the call that copied the last rows.
+	if (!subresources.empty() && cursor.subresource == subresources.size())
+	{
+		return true;
+	}
 
-	m_indexBufferView.BufferLocation = m_indexBuffer->GetGPUVirtualAddress();
-	m_indexBufferView.Format = DXGI_FORMAT_R32_UINT;
-	m_indexBufferView.SizeInBytes = bufferSize;
+	const uint64_t copied = cursor.bytes;
+	bool done;
+	if (writeTop)
+	{
+		// Level 0 from writeTop, the rest copied; writeTop decodes on this thread, so a few rows a frame.
+		done = ring.WriteTexture(renderer->GetCommandList(), texture, (UINT)subresources.size(),
+			[this](UINT subresource, UINT firstRow, UINT rowCount, uint8_t* destination, uint64_t rowPitch)
+			{
+				return subresource == 0 ? writeTop(subresource, firstRow, rowCount, destination, rowPitch) :
+					UploadRing::CopyRows(subresources[subresource], firstRow, rowCount, destination, rowPitch);
+			}, cursor, TERRAIN_HEIGHT_DECODE_FRAME_BYTES);
+	}
+	else
+	{
+		done = ring.CopyTexture(renderer->GetCommandList(), texture, subresources.data(), (UINT)subresources.size(), cursor);
+	}
+	bytes += (size_t)(cursor.bytes - copied);
+	if (!done)
+	{
+		return false;
+	}
+	renderer->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(texture, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
+	return true;
+}
 
-	m_indexcount = arraysize;
+void LoadingTexture::ReleaseStaging()
+{
+	decodedData.reset();
+	writeTop = nullptr;
+	std::vector<MipChain::Level>().swap(mips);
+	std::vector<std::vector<uint8_t>>().swap(blocks);
+	std::vector<D3D12_SUBRESOURCE_DATA>().swap(subresources);
+}
+
+void LoadingTexture::Release()
+{
+	ReleaseStaging();
+	if (texture)
+	{
+		texture->Release();
+		texture = nullptr;
+	}
 }
 
-void Terrain::LoadHeightMap(Graphics* Renderer, const wchar_t* displacementmap, const wchar_t* colormap)
+void Terrain::CreateDescriptorHeap(Graphics* Renderer)
 {
 	// SRV Discriptor Heap 
 	D3D12_DESCRIPTOR_HEAP_DESC srvHeapDesc = {};
-	srvHeapDesc.NumDescriptors = 3;
+	srvHeapDesc.NumDescriptors = m_virtualTexture ? 5 : 3 + (m_domainNormalMap ? 1 : 0) + (m_pixelHorizonMap ? 1 : 0);
 	srvHeapDesc.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
 	srvHeapDesc.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
 	Renderer->CreateDescriptorHeap(&srvHeapDesc, m_srvHeap);
 
 	m_srvDescSize = Renderer->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
+}
 
+void Terrain::DecodeDisplacementMap(Graphics* Renderer, const wchar_t* displacementmap)
+{
 	// Displacement Map Ҵ
-	std::unique_ptr<uint8_t[]> displacementMapdecodedData;
-	ID3D12Resource* displacementMap;
+	LoadingTexture& map = m_displacementMap;
 	D3D12_SUBRESOURCE_DATA displacementMapData;
 
-	D3D12_SHADER_RESOURCE_VIEW_DESC	srvDesc = {};
-	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-	srvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-	//srvDesc.Format = DXGI_FORMAT_R32G32B32A32_FLOAT;
-	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-	srvDesc.Texture2D.MipLevels = 1;
+	// Keep the file's own single-channel format, 16-bit or float heights stay as they are; anything
+	// WIC decodes to another layout is forced to RGBA32 and its red channel used.
+	// The texture reserves a full mip chain, generated on the CPU below.
+	// TIFF heightmaps are read natively first, in parallel and without WIC's conversions.
+	auto start = steady_clock::now();
+	HeightmapFormat heightmapFormat;
+	std::shared_ptr<TiffReader> reader;
+	const bool native = LoadTiffHeightmap(Renderer, displacementmap, map, displacementMapData, heightmapFormat, reader);
+	if (!native && FAILED(LoadWICTextureFromFileEx(Renderer->GetDevice(), displacementmap, 0, D3D12_RESOURCE_FLAG_NONE, WIC_LOADER_MIP_RESERVE, &map.texture, map.decodedData, displacementMapData)))
+	{
+		throw (GFX_Exception("Failed to load the displacement map."));
+	}
+	if (!native && !HeightmapFormatOf(map.texture->GetDesc().Format, heightmapFormat))
+	{
+		map.texture->Release();
+		map.texture = nullptr;
+		if (FAILED(LoadWICTextureFromFileEx(Renderer->GetDevice(), displacementmap, 0, D3D12_RESOURCE_FLAG_NONE, WIC_LOADER_FORCE_RGBA32 | WIC_LOADER_MIP_RESERVE, &map.texture, map.decodedData, displacementMapData)))
+		{
+			throw (GFX_Exception("Failed to load the displacement map."));
+		}
+		heightmapFormat = HeightmapFormat::R8G8B8A8_UNORM;
+	}
+
+	D3D12_RESOURCE_DESC texDesc = map.texture->GetDesc();
+	m_width = texDesc.Width;
+	m_height = texDesc.Height;
+	double readMs = duration<double, std::milli>(steady_clock::now() - start).count();
+
+	// The quadtree bounds need the heights on the CPU too, with a min/max pyramid over them
+	// that is cached next to the heightmap.
+	start = steady_clock::now();
+	std::vector<uint16_t> heights;
+	Heightmap::Decode(displacementMapData.pData, displacementMapData.RowPitch, m_width, m_height, heightmapFormat, heights, m_heightRange);
+	bool cached = m_heightPyramid.LoadOrBuild(std::wstring(displacementmap) + L".minmax", std::move(heights), m_width, m_height);
+	double pyramidMs = duration<double, std::milli>(steady_clock::now() - start).count();
+
+	char report[256];
+	const size_t texelBytes = Heightmap::TexelBytes(heightmapFormat);
+	sprintf_s(report, "Heightmap: %ux%u, %zu bytes per texel, %.1f MB texture (%.1f MB as RGBA32), read by %s in %.1f ms\n", m_width, m_height,
+		texelBytes, (double)m_width * m_height * texelBytes / (1024.0 * 1024.0), (double)m_width * m_height * 4 / (1024.0 * 1024.0),
+		native ? "TiffReader" : "WIC", readMs);
+	OutputDebugStringA(report);
+	sprintf_s(report, "Height pyramid: %u levels %s in %.1f ms\n", m_heightPyramid.GetLevelCount(), cached ? "loaded" : "built", pyramidMs);
+	OutputDebugStringA(report);
+
+	// 16-bit heights are level 0 bit for bit, so the pyramid's copy is the one the mips are filtered
+	// from and the upload reads, and the decoded texels go as soon as the pyramid has them.
+	const size_t levelBytes = (size_t)displacementMapData.SlicePitch;
+	const double workingSetMB = WorkingSetMB();
+	const bool shareHeights = TERRAIN_HEIGHT_ZERO_COPY && heightmapFormat == HeightmapFormat::R16_UNORM;
+	if (shareHeights)
+	{
+		displacementMapData.pData = m_heightPyramid.GetHeights().data();
+		displacementMapData.RowPitch = (LONG_PTR)m_width * sizeof(uint16_t);
+		displacementMapData.SlicePitch = displacementMapData.RowPitch * m_height;
+		map.decodedData.reset();
+	}
+
+	// Heights box filtered in their own units.
+	start = steady_clock::now();
+	MipChain::Generate(displacementMapData.pData, displacementMapData.RowPitch, m_width, m_height, MipFormatOf(heightmapFormat),
+		TERRAIN_HEIGHT_MIP_FILTER, texDesc.MipLevels, map.mips);
+	double mipMs = duration<double, std::milli>(steady_clock::now() - start).count();
+	sprintf_s(report, "Displacement mips: %u levels in %.1f ms (%.0f MB/s)\n",
+		texDesc.MipLevels, mipMs, (double)m_width * m_height * texelBytes / (1024.0 * 1024.0) / (mipMs / 1000.0));
+	OutputDebugStringA(report);
+
+	// BC4 heights only on request, and only for maps that are a whole number of blocks.
+	map.subresources = MipSubresources(displacementMapData, map.mips, texelBytes);
+	if (TERRAIN_HEIGHT_BC4 && heightmapFormat != HeightmapFormat::R32_FLOAT)
+	{
+		start = steady_clock::now();
+		if (CompressLevels(displacementMapData, m_width, m_height, MipFormatOf(heightmapFormat), map.mips, BlockFormat::BC4, map.blocks))
+		{
+			double blockMs = duration<double, std::milli>(steady_clock::now() - start).count();
+			ReplaceWithBlockTexture(Renderer, map.texture, BlockFormat::BC4);
+			map.subresources = BlockSubresources(map.blocks, m_width, BlockFormat::BC4);
+			sprintf_s(report, "Displacement map: BC4 in %.1f ms, %.1f dB PSNR\n", blockMs,
+				BlockCompressor::Psnr(displacementMapData.pData, displacementMapData.RowPitch, m_width, m_height, MipFormatOf(heightmapFormat), BlockFormat::BC4, map.blocks[0]));
+			OutputDebugStringA(report);
+		}
+	}
+
+	// Level 0 of an 8-bit or float TIFF map is no longer needed here once the pyramid and mips are
+	// built: the reader decodes it again, band by band, straight into the mapped staging ring at
+	// the footprint's row pitch.
+	if (TERRAIN_HEIGHT_ZERO_COPY && !shareHeights && native && map.blocks.empty() && !reader->GetInfo().signedSamples)
+	{
+		map.writeTop = [reader](UINT, UINT firstRow, UINT rowCount, uint8_t* destination, uint64_t rowPitch)
+		{
+			return reader->ReadRows(destination, (size_t)rowPitch, firstRow, rowCount);
+		};
+		map.decodedData.reset();
+		map.subresources[0].pData = nullptr;
+	}
+
+	// The pyramid keeps a full size copy of the heights either way; kept, level 0 is a second one.
+	const double heightsMB = (double)m_heightPyramid.GetHeights().size() * sizeof(uint16_t) / (1024.0 * 1024.0);
+	const double levelMB = (double)levelBytes / (1024.0 * 1024.0);
+	sprintf_s(report, "Displacement map: level 0 %s; %.1f MB of full size heights held until upload, %.1f MB with level 0 kept; "
+		"working set %.1f MB -> %.1f MB\n", shareHeights ? "uploaded from the height pyramid" : map.writeTop ? "decoded again into the staging ring" : "kept",
+		heightsMB + (map.decodedData ? levelMB : 0.0), heightsMB + levelMB, workingSetMB, WorkingSetMB());
+	OutputDebugStringA(report);
+
+	map.srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	map.srvDesc.Format = map.texture->GetDesc().Format;
+	map.srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	map.srvDesc.Texture2D.MipLevels = texDesc.MipLevels;
+
+	if (m_domainNormalMap)
+	{
+		GenerateNormalMap(Renderer);
+	}
+	if (m_pixelHorizonMap)
+	{
+		GenerateHorizonMap(Renderer);
+	}
+}
+
+// Normals of the heights on the sphere the terrain is drawn on, with a box filtered mip chain for
+// the levels DomainShader samples the heights at, block compressed to BC5 when the map is a whole
+// number of blocks; RGBA8 otherwise.
+void Terrain::GenerateNormalMap(Graphics* Renderer)
+{
+	LoadingTexture& map = m_normalMap;
+	const UINT levels = MipChain::LevelCount(m_width, m_height);
+	D3D12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R8G8B8A8_UNORM, m_width, m_height, 1, (UINT16)levels);
+	Renderer->CreateDefaultBuffer(map.texture, &desc);
+
+	auto start = steady_clock::now();
+	D3D12_SUBRESOURCE_DATA normalMapData;
+	map.decodedData.reset(new uint8_t[(size_t)m_width * m_height * 4]);
+	normalMapData.pData = map.decodedData.get();
+	normalMapData.RowPitch = (LONG_PTR)m_width * 4;
+	normalMapData.SlicePitch = normalMapData.RowPitch * m_height;
+	NormalMap::Generate(m_heightPyramid.GetHeights().data(), m_width, m_height, TERRAIN_RADIUS, TerrainHeightField::HeightScale(m_height),
+		map.decodedData.get());
+	double normalMs = duration<double, std::milli>(steady_clock::now() - start).count();
+
+	start = steady_clock::now();
+	MipChain::Generate(normalMapData.pData, normalMapData.RowPitch, m_width, m_height, MipFormat::R8G8B8A8_UNORM, MipFilter::BOX, levels, map.mips);
+	double mipMs = duration<double, std::milli>(steady_clock::now() - start).count();
+
+	start = steady_clock::now();
+	map.subresources = MipSubresources(normalMapData, map.mips, 4);
+	const bool compressed = CompressLevels(normalMapData, m_width, m_height, MipFormat::R8G8B8A8_UNORM, map.mips, BlockFormat::BC5, map.blocks);
+	if (compressed)
+	{
+		// Only the blocks are uploaded; the RGBA8 levels go now rather than once resident.
+		ReplaceWithBlockTexture(Renderer, map.texture, BlockFormat::BC5);
+		map.subresources = BlockSubresources(map.blocks, m_width, BlockFormat::BC5);
+		map.decodedData.reset();
+		std::vector<MipChain::Level>().swap(map.mips);
+	}
+	double blockMs = duration<double, std::milli>(steady_clock::now() - start).count();
 
-	LoadWICTextureFromFileEx(Renderer->GetDevice(), displacementmap, 0, D3D12_RESOURCE_FLAG_NONE, WIC_LOADER_FORCE_RGBA32, &displacementMap, displacementMapdecodedData, displacementMapData);
+	char report[256];
+	sprintf_s(report, "Normal map: %ux%u in %.1f ms (%.0f Mtexels/s), %u mips in %.1f ms, %s in %.1f ms\n", m_width, m_height, normalMs,
+		(double)m_width * m_height / 1e6 / (normalMs / 1000.0), levels, mipMs, compressed ? "BC5" : "kept as RGBA8", blockMs);
+	OutputDebugStringA(report);
 
+	map.srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	map.srvDesc.Format = map.texture->GetDesc().Format;
+	map.srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	map.srvDesc.Texture2D.MipLevels = levels;
+}
+
+// Horizons of the heights on the sphere, on a grid TERRAIN_HORIZON_LEVEL mips down from them, as
+// a two slice array of four azimuths each. The rays march over the full heights, so the grid
+// only sets how finely the shadows follow the terrain, not where its ridges are.
+void Terrain::GenerateHorizonMap(Graphics* Renderer)
+{
+	LoadingTexture& map = m_horizonMap;
+	const UINT width = std::max(m_width >> TERRAIN_HORIZON_LEVEL, 1u);
+	const UINT height = std::max(m_height >> TERRAIN_HORIZON_LEVEL, 1u);
+	D3D12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R8G8B8A8_UNORM, width, height, HorizonMap::AZIMUTHS / 4, 1);
+	Renderer->CreateDefaultBuffer(map.texture, &desc);
+
+	auto start = steady_clock::now();
+	HorizonMap::Stats stats;
+	map.decodedData.reset(new uint8_t[HorizonMap::Size(m_width, m_height, TERRAIN_HORIZON_LEVEL)]);
+	HorizonMap::Generate(m_heightPyramid, TERRAIN_RADIUS, TerrainHeightField::HeightScale(m_height), TERRAIN_HORIZON_LEVEL, map.decodedData.get(), &stats);
+	double horizonMs = duration<double, std::milli>(steady_clock::now() - start).count();
+
+	for (UINT slice = 0; slice < desc.DepthOrArraySize; ++slice)
+	{
+		D3D12_SUBRESOURCE_DATA sliceData;
+		sliceData.pData = map.decodedData.get() + (size_t)slice * width * height * 4;
+		sliceData.RowPitch = (LONG_PTR)width * 4;
+		sliceData.SlicePitch = sliceData.RowPitch * height;
+		map.subresources.push_back(sliceData);
+	}
+
+	char report[256];
+	sprintf_s(report, "Horizon map: %ux%u, %u azimuths in %.1f ms (%.2f Mrays/s); %.1f steps and %.1f bounds a ray, %.1f marching every step\n",
+		width, height, HorizonMap::AZIMUTHS, horizonMs, stats.rays / 1e6 / (horizonMs / 1000.0), (double)stats.steps / stats.rays,
+		(double)stats.bounds / stats.rays, (double)stats.bruteForceSteps / stats.rays);
+	OutputDebugStringA(report);
+
+	map.srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	map.srvDesc.Format = desc.Format;
+	map.srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
+	map.srvDesc.Texture2DArray.MipLevels = 1;
+	map.srvDesc.Texture2DArray.ArraySize = desc.DepthOrArraySize;
+}
+
+void Terrain::DecodeColorMap(Graphics* Renderer, const wchar_t* colormap)
+{
 	// Color Map Ҵ
-	std::unique_ptr<uint8_t[]> colorMapdecodedData;
-	ID3D12Resource* colorMap;
+	LoadingTexture& map = m_colorMap;
 	D3D12_SUBRESOURCE_DATA colorMapData;
 
-	D3D12_SHADER_RESOURCE_VIEW_DESC colorsrvDesc = {};
-	colorsrvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
-	colorsrvDesc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-	colorsrvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
-	colorsrvDesc.Texture2D.MipLevels = 1;
+	// A color map TileBaker block compressed with its mips is uploaded as it is.
+	const std::wstring bakedColormap = std::wstring(colormap).substr(0, std::wstring(colormap).rfind(L'.')) + L".dds";
+	const bool bakedColor = TERRAIN_COLOR_BLOCK_COMPRESSION &&
+		SUCCEEDED(LoadDDSTextureFromFile(Renderer->GetDevice(), bakedColormap.c_str(), &map.texture, map.decodedData, map.subresources));
+	if (!bakedColor &&
+		FAILED(LoadWICTextureFromFileEx(Renderer->GetDevice(), colormap, 0, D3D12_RESOURCE_FLAG_NONE, WIC_LOADER_FORCE_RGBA32 | WIC_LOADER_MIP_RESERVE, &map.texture, map.decodedData, colorMapData)))
+	{
+		throw (GFX_Exception("Failed to load the color map."));
+	}
+	const D3D12_RESOURCE_DESC colorDesc = map.texture->GetDesc();
 
-	LoadWICTextureFromFileEx(Renderer->GetDevice(), colormap, 0, D3D12_RESOURCE_FLAG_NONE, WIC_LOADER_FORCE_RGBA32, &colorMap, colorMapdecodedData, colorMapData);
+	char report[256];
+	if (bakedColor)
+	{
+		sprintf_s(report, "Color mips: %u levels baked into %ls\n", colorDesc.MipLevels, bakedColormap.c_str());
+		OutputDebugStringA(report);
+	}
+	else
+	{
+		// Colors filtered in linear light.
+		auto start = steady_clock::now();
+		MipChain::Generate(colorMapData.pData, colorMapData.RowPitch, (uint32_t)colorDesc.Width, colorDesc.Height, MipFormat::R8G8B8A8_SRGB,
+			TERRAIN_COLOR_MIP_FILTER, colorDesc.MipLevels, map.mips);
+		double mipMs = duration<double, std::milli>(steady_clock::now() - start).count();
+		sprintf_s(report, "Color mips: %u levels in %.1f ms (%.0f MB/s)\n",
+			colorDesc.MipLevels, mipMs, (double)colorDesc.Width * colorDesc.Height * 4 / (1024.0 * 1024.0) / (mipMs / 1000.0));
+		OutputDebugStringA(report);
+
+		// Every level block compressed, unless the map is not a whole number of blocks.
+		map.subresources = MipSubresources(colorMapData, map.mips, 4);
+		start = steady_clock::now();
+		if (TERRAIN_COLOR_BLOCK_COMPRESSION &&
+			CompressLevels(colorMapData, (UINT)colorDesc.Width, colorDesc.Height, MipFormat::R8G8B8A8_UNORM, map.mips, TERRAIN_COLOR_BLOCK_FORMAT, map.blocks))
+		{
+			double blockMs = duration<double, std::milli>(steady_clock::now() - start).count();
+			size_t rawBytes = (size_t)colorDesc.Width * colorDesc.Height * 4;
+			size_t blockBytes = map.blocks[0].size();
+			for (size_t level = 0; level < map.mips.size(); ++level)
+			{
+				rawBytes += map.mips[level].texels.size();
+				blockBytes += map.blocks[level + 1].size();
+			}
+			ReplaceWithBlockTexture(Renderer, map.texture, TERRAIN_COLOR_BLOCK_FORMAT);
+			map.subresources = BlockSubresources(map.blocks, (UINT)colorDesc.Width, TERRAIN_COLOR_BLOCK_FORMAT);
+			sprintf_s(report, "Color map: %s in %.1f ms, %.1f MB instead of %.1f MB, %.1f dB PSNR; bake %ls with TileBaker to skip this\n",
+				TERRAIN_COLOR_BLOCK_FORMAT == BlockFormat::BC1 ? "BC1" : "BC7", blockMs, blockBytes / (1024.0 * 1024.0), rawBytes / (1024.0 * 1024.0),
+				BlockCompressor::Psnr(colorMapData.pData, colorMapData.RowPitch, (UINT)colorDesc.Width, colorDesc.Height, MipFormat::R8G8B8A8_UNORM,
+				TERRAIN_COLOR_BLOCK_FORMAT, map.blocks[0]), bakedColormap.c_str());
+			OutputDebugStringA(report);
+
+			// The RGBA8 levels are no longer needed once encoded.
+			map.decodedData.reset();
+			std::vector<MipChain::Level>().swap(map.mips);
+		}
+	}
 
-	D3D12_RESOURCE_DESC texDesc = displacementMap->GetDesc();
-	m_width = texDesc.Width;
-	m_height = texDesc.Height;
+	map.srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	map.srvDesc.Format = map.texture->GetDesc().Format;
+	map.srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	map.srvDesc.Texture2D.MipLevels = colorDesc.MipLevels;
+}
 
-	const UINT64 displacementMapSize = GetRequiredIntermediateSize(displacementMap, 0, 1);
-	const UINT64 colorMapSize = GetRequiredIntermediateSize(colorMap, 0, 1);
-		
-	Renderer->GetDevice()->CreateCommittedResource(&CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD), D3D12_HEAP_FLAG_NONE,
-		&CD3DX12_RESOURCE_DESC::Buffer(displacementMapSize + colorMapSize), D3D12_RESOURCE_STATE_GENERIC_READ,
-		NULL, IID_PPV_ARGS(&m_uploadHeap));
+bool Terrain::StageDisplacementMap(Graphics* Renderer, UploadRing& ring, size_t& bytes)
+{
+	if (!m_displacementMap.Stage(Renderer, ring, bytes) || (m_normalMap.texture && !m_normalMap.Stage(Renderer, ring, bytes)) ||
+		(m_horizonMap.texture && !m_horizonMap.Stage(Renderer, ring, bytes)))
+	{
+		return false;
+	}
+	if (!m_virtualTexture)
+	{
+		CD3DX12_CPU_DESCRIPTOR_HANDLE handleSRV(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), 0, m_srvDescSize);
+		Renderer->CreateSRV(m_displacementMap.texture, &m_displacementMap.srvDesc, handleSRV);
+	}
+	if (m_normalMap.texture)
+	{
+		CD3DX12_CPU_DESCRIPTOR_HANDLE normalHandle(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), 3, m_srvDescSize);
+		Renderer->CreateSRV(m_normalMap.texture, &m_normalMap.srvDesc, normalHandle);
+	}
+	if (m_horizonMap.texture)
+	{
+		CD3DX12_CPU_DESCRIPTOR_HANDLE horizonHandle(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), 4, m_srvDescSize);
+		Renderer->CreateSRV(m_horizonMap.texture, &m_horizonMap.srvDesc, horizonHandle);
+	}
 
-	//const unsigned int subresourceCount = texDesc.DepthOrArraySize * texDesc.MipLevels;
-	UpdateSubresources(Renderer->GetCommandList(), displacementMap, m_uploadHeap, 0, 0, 1, &displacementMapData);
-	Renderer->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(displacementMap, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
-	CD3DX12_CPU_DESCRIPTOR_HANDLE handleSRV(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), 0, m_srvDescSize);
-	Renderer->CreateSRV(displacementMap, &srvDesc, handleSRV);
+	// The heights under the camera, on the sphere every terrain mesh below is made on.
+	m_heightField.Bind(&m_heightPyramid, TERRAIN_RADIUS, TerrainHeightField::HeightScale(m_height));
 
-	UpdateSubresources(Renderer->GetCommandList(), colorMap, m_uploadHeap, displacementMapSize, 0, 1, &colorMapData);
-	Renderer->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(colorMap, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE));
-	CD3DX12_CPU_DESCRIPTOR_HANDLE colorhandle(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), 2, m_srvDescSize);
-	Renderer->CreateSRV(colorMap, &colorsrvDesc, colorhandle);
+	if (STATIC_TERRAIN)
+	{
+		CreateStaticTerrain(Renderer, TERRAIN_RADIUS, STATIC_TERRAIN_SUBDIVISIONS);
+	}
+	else if (TERRAIN_QUADTREE)
+	{
+		CreatePatchGrid(Renderer, TERRAIN_RADIUS);
+	}
+	else
+	{
+		CreateGeosphere(Renderer, TERRAIN_RADIUS, 5);
+	}
+	//CreateGeosphere(Renderer, 17374, 5);
+	bytes += m_geometry->bytes;
+	return true;
 }
 
 void Terrain::CreateSphere(Graphics* Renderer, float radius, UINT slice, UINT stack)
@@ -727,22 +1410,6 @@ void Terrain::CreateSphere(Graphics* Renderer, float radius, UINT slice, UINT st
 
 	//vertices.push_back(bottomVertex);
 
-	int bufferSize = sizeof(Vertex) * vertices.size();
-
-	Renderer->CreateCommittedBuffer(m_vertexBuffer, m_vertexBufferUpload, &CD3DX12_RESOURCE_DESC::Buffer(bufferSize));
-
-	D3D12_SUBRESOURCE_DATA vertexData = {};
-	vertexData.pData = &vertices[0];
-	vertexData.RowPitch = bufferSize;
-	vertexData.SlicePitch = bufferSize;
-
-	UpdateSubresources(Renderer->GetCommandList(), m_vertexBuffer, m_vertexBufferUpload, 0, 0, 1, &vertexData);
-	Renderer->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_vertexBuffer, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER));
-
-	m_vertexBufferView.BufferLocation = m_vertexBuffer->GetGPUVirtualAddress();
-	m_vertexBufferView.StrideInBytes = sizeof(Vertex);
-	m_vertexBufferView.SizeInBytes = bufferSize;
-
 	std::vector<UINT> indices;
 
 	for (int i = 1; i <= slice; ++i)
@@ -777,207 +1444,464 @@ void Terrain::CreateSphere(Graphics* Renderer, float radius, UINT slice, UINT st
 		indices.push_back(baseIndex + i + 1);
 	}
 
-	bufferSize = sizeof(UINT) * indices.size();
-
-	Renderer->CreateCommittedBuffer(m_indexBuffer, m_indexBufferUpload, &CD3DX12_RESOURCE_DESC::Buffer(bufferSize));
-
-	D3D12_SUBRESOURCE_DATA indexData = {};
-	indexData.pData = &indices[0];
-	indexData.RowPitch = bufferSize;
-	indexData.SlicePitch = bufferSize;
-
-	UpdateSubresources(Renderer->GetCommandList(), m_indexBuffer, m_indexBufferUpload, 0, 0, 1, &indexData);
-	Renderer->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_indexBuffer, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_INDEX_BUFFER));
+	std::vector<XMFLOAT3> positions(vertices.size());
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		positions[i] = vertices[i].Position;
+	}
 
-	m_indexBufferView.BufferLocation = m_indexBuffer->GetGPUVirtualAddress();
-	m_indexBufferView.Format = DXGI_FORMAT_R32_UINT;
-	m_indexBufferView.SizeInBytes = bufferSize;
+	MeshChunker::ChunkedMesh chunked;
+	MeshChunker::Build(positions, indices, TERRAIN_CHUNK_VERTICES, chunked);
+	std::vector<Vertex> chunkedVertices = MeshChunker::GatherVertices(vertices, chunked);
 
-	m_indexcount = indices.size();
+	const MeshCache::Key key = { "UV sphere", radius, slice, TERRAIN_CHUNK_VERTICES, sizeof(Vertex), stack };
+	UseGeometry(m_geometryCache->Add(Renderer, key, MeshCache::MakeBlob(&chunkedVertices[0], sizeof(Vertex), chunkedVertices.size(), chunked), false), 1.0f);
 }
 
 void Terrain::CreateGeosphere(Graphics* Renderer, float radius, UINT numSubdivisions)
 {
-	numSubdivisions = min(numSubdivisions, 5u);
-
-	const float X = 0.525731f;
-	const float Z = 0.850651f;
+	// A unit sphere scaled in VertexShaderTes, the same mesh as the sky's unless the vertices are packed.
+	UseGeometry(m_geometryCache->AcquireGeosphere(Renderer, numSubdivisions, TERRAIN_CHUNK_VERTICES, PACKED_TERRAIN_VERTEX, TERRAIN_MESHLETS), radius);
+}
 
-	XMFLOAT3 pos[12] =
+void Terrain::CreateStaticTerrain(Graphics* Renderer, float radius, UINT numSubdivisions)
+{
+	// Displaced by the heightmap, so its hash is part of the key.
+	const std::wstring cachePath = L"TerrainStatic.meshcache";
+	const MeshCache::Key key = { "Static terrain", radius, numSubdivisions, MeshChunker::MAX_CHUNK_VERTICES, sizeof(Vertex), m_heightPyramid.GetHash() };
+	if (const SharedGeometry* geometry = m_geometryCache->Load(Renderer, cachePath, key, TERRAIN_MESHLETS))
 	{
-		XMFLOAT3(-X, 0.0f, Z),  XMFLOAT3(X, 0.0f, Z),
-		XMFLOAT3(-X, 0.0f, -Z), XMFLOAT3(X, 0.0f, -Z),
-		XMFLOAT3(0.0f, Z, X),   XMFLOAT3(0.0f, Z, -X),
-		XMFLOAT3(0.0f, -Z, X),  XMFLOAT3(0.0f, -Z, -X),
-		XMFLOAT3(Z, X, 0.0f),   XMFLOAT3(-Z, X, 0.0f),
-		XMFLOAT3(Z, -X, 0.0f),  XMFLOAT3(-Z, -X, 0.0f)
-	};
+		UseGeometry(geometry, 1.0f);
+		return;
+	}
 
-	DWORD k[60] =
-	{
-		1,4,0,  4,9,0,  4,5,9,  8,5,4,  1,8,4,
-		1,10,8, 10,3,8, 8,3,5,  3,2,5,  3,7,2,
-		3,10,7, 10,6,7, 6,11,7, 6,0,11, 6,1,0,
-		10,1,6, 11,0,9, 2,11,9, 5,2,9,  11,2,7
-	};
+	auto start = steady_clock::now();
 
-	std::vector<Vertex> vertices;
-	std::vector<UINT> indices;
+	GeometryGenerator::MeshData mesh;
+	GeometryGenerator::CreateGeosphere(radius, numSubdivisions, mesh);
 
-	vertices.resize(12);
-	indices.resize(60);
-	
-	for (UINT i = 0; i < 12; ++i)
+	double subdivideMs = duration<double, std::milli>(steady_clock::now() - start).count();
+
+	start = steady_clock::now();
+	const float heightScale = TerrainHeightField::HeightScale(m_height);
+	TerrainDisplacement::Displace(m_heightPyramid, radius, heightScale, mesh.Vertices);
+	double displaceMs = duration<double, std::milli>(steady_clock::now() - start).count();
+
+	// Nothing is culled per chunk here, so the chunks are as large as 16-bit indices allow.
+	std::vector<XMFLOAT3> positions(mesh.Vertices.size());
+	for (size_t i = 0; i < mesh.Vertices.size(); ++i)
 	{
-		vertices[i].Position = pos[i];
+		positions[i] = mesh.Vertices[i].Position;
 	}
 
-	for (UINT i = 0; i < 60; ++i)
+	start = steady_clock::now();
+	MeshChunker::ChunkedMesh chunked;
+	MeshChunker::Build(positions, mesh.Indices32, MeshChunker::MAX_CHUNK_VERTICES, chunked);
+	double chunkMs = duration<double, std::milli>(steady_clock::now() - start).count();
+
+	std::vector<Vertex> vertices = MeshChunker::GatherVertices(mesh.Vertices, chunked);
+
+	// The tessellated path keeps a level 5 control mesh and rebuilds the rest every frame.
+	const size_t controlVertices = 10 * ((size_t)1 << (2 * 5)) + 2;
+	const size_t controlTriangles = 20 * ((size_t)1 << (2 * 5));
+	const size_t controlBytes = controlVertices * sizeof(Vertex) + controlTriangles * 3 * sizeof(uint16_t);
+
+	char report[256];
+	sprintf_s(report, "Static terrain: %u subdivisions, %zu vertices, %zu triangles, subdivide %.1f ms, displace %.1f ms, chunk %.1f ms\n",
+		numSubdivisions, vertices.size(), mesh.Indices32.size() / 3, subdivideMs, displaceMs, chunkMs);
+	OutputDebugStringA(report);
+	sprintf_s(report, "Static terrain: %zu bytes in %zu chunks, tessellated control mesh %zu bytes for %zu triangles per frame\n",
+		vertices.size() * sizeof(Vertex) + chunked.IndexBytes(), chunked.Chunks.size(), controlBytes, controlTriangles * 81);
+	OutputDebugStringA(report);
+
+	MeshBlob blob = MeshCache::MakeBlob(&vertices[0], sizeof(Vertex), vertices.size(), chunked);
+	GeometryCache::Store(cachePath, key, blob);
+
+	UseGeometry(m_geometryCache->Add(Renderer, key, blob, TERRAIN_MESHLETS), 1.0f);
+}
+
+void Terrain::UseGeometry(const SharedGeometry* geometry, float scale)
+{
+	m_geometry = geometry;
+	m_constantBufferData.meshOrigin = XMFLOAT3(geometry->meshOrigin.x * scale, geometry->meshOrigin.y * scale, geometry->meshOrigin.z * scale);
+	m_constantBufferData.meshScale = geometry->meshScale * scale;
+}
+
+void Terrain::DrawChunks(ID3D12GraphicsCommandList* m_commandList)
+{
+	for (const MeshChunk& chunk : m_geometry->chunks)
 	{
-		indices[i] = k[i];
+		m_commandList->DrawIndexedInstanced(chunk.indexCount, 1, chunk.indexStart, chunk.baseVertex, 0);
 	}
+}
 
-	for (UINT i = 0; i < numSubdivisions; ++i)
+void Terrain::CreatePatchGrid(Graphics* Renderer, float radius)
+{
+	// Deepest level at which a tessellated leaf quad is still larger than a heightmap texel;
+	// HullShader splits every patch edge 9 times.
+	float texel = XM_2PI * radius / (float)(m_virtualTexture ? m_streamedHeight.texture.GetWidth() : m_width);
+	float rootQuad = radius * XM_PIDIV2 / (float)TERRAIN_PATCH_GRID / 9.0f;
+	UINT maxLevel = 0;
+	while (maxLevel < 12 && rootQuad / (float)(1u << (maxLevel + 1)) >= texel)
 	{
-		std::vector<Vertex> tempvertices = vertices;
-		std::vector<UINT> tempindices = indices;
+		++maxLevel;
+	}
 
-		vertices.resize(0);
-		indices.resize(0);
+	TerrainQuadtree::Settings settings;
+	settings.radius = radius;
+	settings.maxDisplacement = TerrainHeightField::HeightScale(m_height) * 65535.0f;
+	settings.maxLevel = maxLevel;
+	settings.gridSize = TERRAIN_PATCH_GRID;
+	settings.lodDistanceRatio = TERRAIN_LOD_DISTANCE_RATIO;
+	settings.morphStartRatio = 0.66f;
+	m_quadtree = TerrainQuadtree(settings);
+
+	auto start = steady_clock::now();
+	m_quadtree.BuildBounds([this](float thetaMin, float thetaMax, float phiMin, float phiMax, float& minHeight, float& maxHeight)
+	{
+		HeightRange(thetaMin, thetaMax, phiMin, phiMax, minHeight, maxHeight);
+	});
+	double boundsMs = duration<double, std::milli>(steady_clock::now() - start).count();
+
+	m_constantBufferData.planetRadius = radius;
+	m_constantBufferData.patchGridSize = TERRAIN_PATCH_GRID;
+	m_constantBufferData.virtualHeightWidth = m_streamedHeight.texture.GetWidth();
+	m_constantBufferData.virtualHeightHeight = m_streamedHeight.texture.GetHeight();
+	m_constantBufferData.virtualColorWidth = m_streamedColor.texture.GetWidth();
+	m_constantBufferData.virtualColorHeight = m_streamedColor.texture.GetHeight();
+
+	// (N + 1)^2 grid vertices in [0, 1]^2.
+	const UINT n = TERRAIN_PATCH_GRID;
+	std::vector<XMFLOAT2> vertices;
+	for (UINT y = 0; y <= n; ++y)
+	{
+		for (UINT x = 0; x <= n; ++x)
+		{
+			vertices.push_back(XMFLOAT2((float)x / n, (float)y / n));
+		}
+	}
 
-		//       v1
-		//       *
-		//      / \
-		//     /   \
-		//  m0*-----*m1
-		//   / \   / \
-		//  /   \ /   \
-		// *-----*-----*
-		// v0    m2     v2
+	// Indices grouped by quadrant, so a node whose children cover part of it can draw just
+	// the rest. Each quadrant is one chunk sharing all the grid vertices.
+	MeshChunker::ChunkedMesh grid;
+	for (UINT q = 0; q < 4; ++q)
+	{
+		UINT x0 = (q & 1) * n / 2;
+		UINT y0 = (q >> 1) * n / 2;
 
-		UINT numTris = tempindices.size() / 3;
-		for (UINT i = 0; i < numTris; ++i)
+		std::vector<uint32_t> indices;
+		for (UINT y = y0; y < y0 + n / 2; ++y)
 		{
-			Vertex v0 = tempvertices[tempindices[i * 3 + 0]];
-			Vertex v1 = tempvertices[tempindices[i * 3 + 1]];
-			Vertex v2 = tempvertices[tempindices[i * 3 + 2]];
+			for (UINT x = x0; x < x0 + n / 2; ++x)
+			{
+				indices.push_back(x + y * (n + 1));
+				indices.push_back(x + 1 + y * (n + 1));
+				indices.push_back(x + (y + 1) * (n + 1));
+
+				indices.push_back(x + 1 + y * (n + 1));
+				indices.push_back(x + 1 + (y + 1) * (n + 1));
+				indices.push_back(x + (y + 1) * (n + 1));
+			}
+		}
+		MeshOptimizer::OptimizeVertexCache(indices, vertices.size());
+
+		MeshChunk chunk = {};
+		chunk.indexStart = (uint32_t)grid.Indices16.size();
+		chunk.indexCount = (uint32_t)indices.size();
+		chunk.baseVertex = 0;
+		chunk.vertexCount = (uint32_t)vertices.size();
+		grid.Chunks.push_back(chunk);
 
-			//
-			// Generate the midpoints.
-			//
+		for (uint32_t index : indices)
+		{
+			grid.Indices16.push_back((uint16_t)index);
+		}
+	}
 
-			Vertex m0, m1, m2;
+	const MeshCache::Key key = { "Patch grid", 1.0f, n, (UINT)vertices.size(), sizeof(XMFLOAT2), 0 };
+	UseGeometry(m_geometryCache->Add(Renderer, key, MeshCache::MakeBlob(&vertices[0], sizeof(XMFLOAT2), vertices.size(), grid), false), 1.0f);
 
-			// For subdivision, we just care about the position component.  We derive the other
-			// vertex components in CreateGeosphere.
+	// Every selected patch covers at least one leaf, so there can't be more than the leaves.
+	// One region per frame in flight, written round robin.
+	m_instanceCapacity = 6u << (2 * maxLevel);
+	UINT64 bufferSize = (UINT64)m_instanceCapacity * sizeof(PatchInstance) * FRAME_BUFFER_COUNT;
+	Renderer->CreateBuffer(m_instanceBuffer, &CD3DX12_RESOURCE_DESC::Buffer(bufferSize));
+	m_instanceBuffer->SetName(L"Terrain patch instances");
 
-			m0.Position = XMFLOAT3(
-				0.5f * (v0.Position.x + v1.Position.x),
-				0.5f * (v0.Position.y + v1.Position.y),
-				0.5f * (v0.Position.z + v1.Position.z));
+	CD3DX12_RANGE readRange(0, 0);
+	if (FAILED(m_instanceBuffer->Map(0, &readRange, reinterpret_cast<void**>(&m_instanceDataBegin))))
+	{
+		throw (GFX_Exception("Failed to map patch instance buffer in Terrain."));
+	}
 
-			m1.Position = XMFLOAT3(
-				0.5f * (v1.Position.x + v2.Position.x),
-				0.5f * (v1.Position.y + v2.Position.y),
-				0.5f * (v1.Position.z + v2.Position.z));
+	char report[256];
+	sprintf_s(report, "Terrain quadtree: %u levels, %u x %u patch grid, leaf range %.1f, %u instances per frame, bounds in %.1f ms, occluder radius %.2f\n",
+		maxLevel + 1, n, n, m_quadtree.LodRange(maxLevel), m_instanceCapacity, boundsMs, m_quadtree.OccluderRadius());
+	OutputDebugStringA(report);
+}
 
-			m2.Position = XMFLOAT3(
-				0.5f * (v0.Position.x + v2.Position.x),
-				0.5f * (v0.Position.y + v2.Position.y),
-				0.5f * (v0.Position.z + v2.Position.z));
+void Terrain::HeightRange(float thetaMin, float thetaMax, float phiMin, float phiMax, float& minHeight, float& maxHeight) const
+{
+	uint16_t lowest, highest;
+	m_heightPyramid.Query(thetaMin, thetaMax, phiMin, phiMax, lowest, highest);
 
-			//
-			// Add new geometry.
-			//
+	const float scale = TerrainHeightField::HeightScale(m_height);
+	minHeight = lowest * scale;
+	maxHeight = highest * scale;
+}
 
-			vertices.push_back(v0); // 0
-			vertices.push_back(v1); // 1
-			vertices.push_back(v2); // 2
-			vertices.push_back(m0); // 3
-			vertices.push_back(m1); // 4
-			vertices.push_back(m2); // 5
+void Terrain::DrawPatches(ID3D12GraphicsCommandList* m_commandList, XMFLOAT4X4 viewproj, XMFLOAT4 eye)
+{
+	auto start = steady_clock::now();
 
-			indices.push_back(i * 6 + 0);
-			indices.push_back(i * 6 + 3);
-			indices.push_back(i * 6 + 5);
+	XMFLOAT3 eyePosition(eye.x, eye.y, eye.z);
+	TerrainCulling::View view = TerrainCulling::MakeView(viewproj, eyePosition, m_quadtree.OccluderRadius());
 
-			indices.push_back(i * 6 + 3);
-			indices.push_back(i * 6 + 4);
-			indices.push_back(i * 6 + 5);
+	TerrainQuadtree::Statistics stats;
+	m_quadtree.Select(eyePosition, m_selection, &stats, &view);
 
-			indices.push_back(i * 6 + 5);
-			indices.push_back(i * 6 + 4);
-			indices.push_back(i * 6 + 2);
+	m_lodSelectMs += duration<double, std::milli>(steady_clock::now() - start).count();
 
-			indices.push_back(i * 6 + 3);
-			indices.push_back(i * 6 + 1);
-			indices.push_back(i * 6 + 4);
+	// Whole nodes first, then the nodes drawing only some quadrants, grouped per quadrant.
+	UINT groupStart[5];
+	UINT groupCount[5];
+	m_instances.clear();
+	for (UINT group = 0; group < 5; ++group)
+	{
+		groupStart[group] = (UINT)m_instances.size();
+		for (const SelectedPatch& patch : m_selection)
+		{
+			bool whole = patch.quadrantMask == 0xF;
+			if (group == 0 ? whole : !whole && (patch.quadrantMask & (1u << (group - 1))))
+			{
+				m_instances.push_back(TerrainQuadtree::MakeInstance(patch));
+			}
 		}
+		groupCount[group] = (UINT)m_instances.size() - groupStart[group];
 	}
 
-	// Project vertices onto sphere and scale.
-	for (UINT i = 0; i < vertices.size(); ++i)
+	if (m_instances.size() > m_instanceCapacity)
 	{
-		// Project onto unit sphere.
-		XMVECTOR n = XMVector3Normalize(XMLoadFloat3(&vertices[i].Position));
-
-		// Project onto sphere.
-		XMVECTOR p = radius * n;
+		throw (GFX_Exception("Too many terrain patches for the instance buffer."));
+	}
 
-		XMStoreFloat3(&vertices[i].Position, p);
-		XMStoreFloat3(&vertices[i].Normal, n);
+	UINT frame = m_instanceFrame++ % FRAME_BUFFER_COUNT;
+	UINT64 offset = (UINT64)frame * m_instanceCapacity * sizeof(PatchInstance);
+	memcpy(m_instanceDataBegin + offset, m_instances.data(), m_instances.size() * sizeof(PatchInstance));
 
-		// Derive texture coordinates from spherical coordinates.
-		float theta = MathHelper::AngleFromXY(
-			vertices[i].Position.x,
-			vertices[i].Position.z);
-		
+	D3D12_VERTEX_BUFFER_VIEW views[2] = { m_geometry->vertexBufferView, {} };
+	views[1].BufferLocation = m_instanceBuffer->GetGPUVirtualAddress() + offset;
+	views[1].StrideInBytes = sizeof(PatchInstance);
+	views[1].SizeInBytes = m_instanceCapacity * sizeof(PatchInstance);
 
-		float phi = acosf(vertices[i].Position.y / radius);
+	m_commandList->IASetVertexBuffers(0, 2, views);
+	m_commandList->IASetIndexBuffer(&m_geometry->indexBufferView);
 
-		vertices[i].TexC.x = theta / XM_2PI;
-		vertices[i].TexC.y = phi / XM_PI;
+	if (groupCount[0] > 0)
+	{
+		m_commandList->DrawIndexedInstanced((UINT)(m_geometry->chunks.size() * m_geometry->chunks[0].indexCount), groupCount[0], 0, 0, groupStart[0]);
+	}
+	for (UINT q = 0; q < 4; ++q)
+	{
+		if (groupCount[q + 1] > 0)
+		{
+			m_commandList->DrawIndexedInstanced(m_geometry->chunks[q].indexCount, groupCount[q + 1], m_geometry->chunks[q].indexStart, 0, groupStart[q + 1]);
+		}
+	}
 
-		// Partial derivative of P with respect to theta
-		vertices[i].TangentU.x = -radius * sinf(phi) * sinf(theta);
-		vertices[i].TangentU.y = 0.0f;
-		vertices[i].TangentU.z = +radius * sinf(phi) * cosf(theta);
+	m_lodTotals.nodesVisited += stats.nodesVisited;
+	m_lodTotals.nodesCulled += stats.nodesCulled;
+	m_lodTotals.patchesSelected += stats.patchesSelected;
+	m_lodTotals.quadrantsSelected += stats.quadrantsSelected;
+	if (++m_lodFrames == 1000)
+	{
+		char report[256];
+		sprintf_s(report, "Terrain LOD: %.1f nodes visited, %.1f culled, %.1f patches, %.1f quadrants, %.4f ms per frame\n",
+			m_lodTotals.nodesVisited / (double)m_lodFrames, m_lodTotals.nodesCulled / (double)m_lodFrames,
+			m_lodTotals.patchesSelected / (double)m_lodFrames,
+			m_lodTotals.quadrantsSelected / (double)m_lodFrames, m_lodSelectMs / m_lodFrames);
+		OutputDebugStringA(report);
+
+		m_lodTotals = {};
+		m_lodSelectMs = 0.0;
+		m_lodFrames = 0;
+	}
+}
 
-		XMVECTOR T = XMLoadFloat3(&vertices[i].TangentU);
-		XMStoreFloat3(&vertices[i].TangentU, XMVector3Normalize(T));
+// Both streamed maps come from one tile archive, which only TileBaker bakes. False if it is
+// missing or lacks either map.
+bool Terrain::OpenTileArchive(const char* archive)
+{
+	auto start = steady_clock::now();
+	UINT heightMap, colorMap;
+	const bool opened = m_tileArchive.Open(archive) &&
+		m_tileArchive.FindMap("height", heightMap) && m_tileArchive.GetMap(heightMap).format == TileFormat::R16_UNORM &&
+		m_tileArchive.FindMap("color", colorMap) && m_tileArchive.GetMap(colorMap).format == TileFormat::R8G8B8A8_UNORM;
+
+	char report[256];
+	if (!opened)
+	{
+		m_tileArchive.Close();
+		sprintf_s(report, "Tile archive %s is missing or has no R16 height and RGBA8 color maps, loading the whole maps instead. "
+			"Bake it with: TileBaker %s --height height=ldem_64.tif --color color=lroc_color_poles.tif\n", archive, archive);
+		OutputDebugStringA(report);
+		return false;
 	}
+	sprintf_s(report, "Tile archive %s: %.1f MB opened in %.1f ms\n", archive, m_tileArchive.GetFileBytes() / (1024.0 * 1024.0),
+		duration<double, std::milli>(steady_clock::now() - start).count());
+	OutputDebugStringA(report);
+	return true;
+}
 
-	int bufferSize = sizeof(Vertex) * vertices.size();
+void Terrain::LoadStreamedTextures(Graphics* Renderer)
+{
+	// The physical caches take the descriptors of the whole maps, which are then never made, so t0 and t1 read them.
+	UINT heightMap, colorMap;
+	m_tileArchive.FindMap("height", heightMap);
+	m_tileArchive.FindMap("color", colorMap);
+	LoadStreamedTexture(Renderer, m_streamedHeight, heightMap, 0, 3);
+	LoadStreamedTexture(Renderer, m_streamedColor, colorMap, 2, 4);
+}
 
-	Renderer->CreateCommittedBuffer(m_vertexBuffer, m_vertexBufferUpload, &CD3DX12_RESOURCE_DESC::Buffer(bufferSize));
+void Terrain::LoadStreamedTexture(Graphics* Renderer, StreamedTexture& streamed, UINT map, UINT physicalSlot, UINT indirectionSlot)
+{
+	const TileFormat format = m_tileArchive.GetMap(map).format;
+	auto start = steady_clock::now();
+	streamed.texture.Open(m_tileArchive, map, VIRTUAL_TEXTURE_SLOTS);
+	double openMs = duration<double, std::milli>(steady_clock::now() - start).count();
+
+	// Physical cache of SLOTS x SLOTS padded tiles and one indirection texel per level 0 tile,
+	// both filled by UpdateStreamedTexture.
+	const UINT padded = TilePyramid::PaddedSize();
+	const DXGI_FORMAT texelFormat = format == TileFormat::R16_UNORM ? DXGI_FORMAT_R16_UNORM : DXGI_FORMAT_R8G8B8A8_UNORM;
+	const VirtualPageTable& pageTable = streamed.texture.GetPageTable();
+	D3D12_RESOURCE_DESC physicalDesc = CD3DX12_RESOURCE_DESC::Tex2D(texelFormat, VIRTUAL_TEXTURE_SLOTS * padded, VIRTUAL_TEXTURE_SLOTS * padded, 1, 1);
+	D3D12_RESOURCE_DESC indirectionDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R8G8B8A8_UINT, pageTable.GetIndirectionWidth(), pageTable.GetIndirectionHeight(), 1, 1);
+	Renderer->CreateDefaultBuffer(streamed.physical, &physicalDesc);
+	Renderer->CreateDefaultBuffer(streamed.indirection, &indirectionDesc);
+	streamed.physical->SetName(L"Virtual texture cache");
+	streamed.indirection->SetName(L"Virtual texture indirection");
+
+	D3D12_RESOURCE_BARRIER toShader[2] = {
+		CD3DX12_RESOURCE_BARRIER::Transition(streamed.physical, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE),
+		CD3DX12_RESOURCE_BARRIER::Transition(streamed.indirection, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE) };
+	Renderer->GetCommandList()->ResourceBarrier(2, toShader);
+
+	// One region per frame in flight, written round robin: the pinned tiles of the first frame or
+	// the uploads of a later one, then the indirection texture.
+	UINT64 tileBytes, indirectionBytes;
+	D3D12_RESOURCE_DESC tileDesc = CD3DX12_RESOURCE_DESC::Tex2D(texelFormat, padded, padded, 1, 1);
+	Renderer->GetDevice()->GetCopyableFootprints(&tileDesc, 0, 1, 0, &streamed.tileFootprint, nullptr, nullptr, &tileBytes);
+	Renderer->GetDevice()->GetCopyableFootprints(&indirectionDesc, 0, 1, 0, &streamed.indirectionFootprint, nullptr, nullptr, &indirectionBytes);
+	streamed.regionTiles = VIRTUAL_TEXTURE_SLOTS * VIRTUAL_TEXTURE_SLOTS / 8 + VIRTUAL_TEXTURE_UPLOADS;
+	streamed.tileStride = AlignPlacement(tileBytes);
+	streamed.indirectionFootprint.Offset = streamed.tileStride * streamed.regionTiles;
+	streamed.regionSize = AlignPlacement(streamed.indirectionFootprint.Offset + indirectionBytes);
+	Renderer->CreateBuffer(streamed.upload, &CD3DX12_RESOURCE_DESC::Buffer(streamed.regionSize * FRAME_BUFFER_COUNT));
+	streamed.upload->SetName(L"Virtual texture uploads");
+
+	CD3DX12_RANGE readRange(0, 0);
+	if (FAILED(streamed.upload->Map(0, &readRange, reinterpret_cast<void**>(&streamed.uploadBegin))))
+	{
+		throw (GFX_Exception("Failed to map virtual texture upload buffer in Terrain."));
+	}
 
-	D3D12_SUBRESOURCE_DATA vertexData = {};
-	vertexData.pData = &vertices[0];
-	vertexData.RowPitch = bufferSize;
-	vertexData.SlicePitch = bufferSize;
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+	srvDesc.Format = texelFormat;
+	srvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2D;
+	srvDesc.Texture2D.MipLevels = 1;
+	CD3DX12_CPU_DESCRIPTOR_HANDLE physicalHandle(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), physicalSlot, m_srvDescSize);
+	Renderer->CreateSRV(streamed.physical, &srvDesc, physicalHandle);
+
+	srvDesc.Format = DXGI_FORMAT_R8G8B8A8_UINT;
+	CD3DX12_CPU_DESCRIPTOR_HANDLE indirectionHandle(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), indirectionSlot, m_srvDescSize);
+	Renderer->CreateSRV(streamed.indirection, &srvDesc, indirectionHandle);
+
+	char report[256];
+	sprintf_s(report, "Virtual texture %s: %ux%u, %zu levels, pinned tiles read in %.1f ms, %.1f MB cache, %.1f MB uploads\n",
+		m_tileArchive.GetMap(map).name, streamed.texture.GetWidth(), streamed.texture.GetHeight(), streamed.texture.GetLevels().size(), openMs,
+		(double)VIRTUAL_TEXTURE_SLOTS * VIRTUAL_TEXTURE_SLOTS * TilePyramid::TileBytes(format) / (1024.0 * 1024.0),
+		(double)streamed.regionSize * FRAME_BUFFER_COUNT / (1024.0 * 1024.0));
+	OutputDebugStringA(report);
+}
 
-	UpdateSubresources(Renderer->GetCommandList(), m_vertexBuffer, m_vertexBufferUpload, 0, 0, 1, &vertexData);
-	Renderer->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_vertexBuffer, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER));
+void Terrain::UpdateStreamedTexture(ID3D12GraphicsCommandList* m_commandList, StreamedTexture& streamed)
+{
+	// Tiles that the patches of the previous frame sample; this frame's are selected while drawing.
+	streamed.wanted.clear();
+	AddSelectionFootprint(streamed.texture, m_selection, streamed.wanted);
+	if (!streamed.texture.Update(streamed.wanted, VIRTUAL_TEXTURE_UPLOADS, streamed.uploads))
+	{
+		return;
+	}
+	if (streamed.uploads.size() > streamed.regionTiles)
+	{
+		throw (GFX_Exception("Too many virtual texture tiles for the upload buffer."));
+	}
 
-	m_vertexBufferView.BufferLocation = m_vertexBuffer->GetGPUVirtualAddress();
-	m_vertexBufferView.StrideInBytes = sizeof(Vertex);
-	m_vertexBufferView.SizeInBytes = bufferSize;
+	const UINT64 region = (UINT64)(m_streamFrame % FRAME_BUFFER_COUNT) * streamed.regionSize;
+	const UINT padded = TilePyramid::PaddedSize();
+	const UINT slotsPerRow = streamed.texture.GetSlotsPerRow();
+	const size_t rowBytes = padded * TilePyramid::TexelBytes(streamed.texture.GetFormat());
 
-	bufferSize = sizeof(UINT) * indices.size();
+	D3D12_RESOURCE_BARRIER barriers[2] = {
+		CD3DX12_RESOURCE_BARRIER::Transition(streamed.physical, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST),
+		CD3DX12_RESOURCE_BARRIER::Transition(streamed.indirection, D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE | D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST) };
+	m_commandList->ResourceBarrier(2, barriers);
 
-	Renderer->CreateCommittedBuffer(m_indexBuffer, m_indexBufferUpload, &CD3DX12_RESOURCE_DESC::Buffer(bufferSize));
+	for (size_t i = 0; i < streamed.uploads.size(); ++i)
+	{
+		const VirtualTexture::Upload& upload = streamed.uploads[i];
+		D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = streamed.tileFootprint;
+		footprint.Offset = region + i * streamed.tileStride;
+		for (UINT y = 0; y < padded; ++y)
+		{
+			memcpy(streamed.uploadBegin + footprint.Offset + (UINT64)y * footprint.Footprint.RowPitch, &upload.texels[y * rowBytes], rowBytes);
+		}
 
-	D3D12_SUBRESOURCE_DATA indexData = {};
-	indexData.pData = &indices[0];
-	indexData.RowPitch = bufferSize;
-	indexData.SlicePitch = bufferSize;
+		CD3DX12_TEXTURE_COPY_LOCATION dst(streamed.physical, 0);
+		CD3DX12_TEXTURE_COPY_LOCATION src(streamed.upload, footprint);
+		m_commandList->CopyTextureRegion(&dst, upload.slot % slotsPerRow * padded, upload.slot / slotsPerRow * padded, 0, &src, nullptr);
+	}
 
-	UpdateSubresources(Renderer->GetCommandList(), m_indexBuffer, m_indexBufferUpload, 0, 0, 1, &indexData);
-	Renderer->GetCommandList()->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_indexBuffer, D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_INDEX_BUFFER));
+	// The whole indirection texture, a few kilobytes even for the full resolution maps.
+	streamed.texture.GetPageTable().WriteIndirection(slotsPerRow, streamed.indirectionTexels);
+	D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = streamed.indirectionFootprint;
+	footprint.Offset += region;
+	const UINT width = footprint.Footprint.Width;
+	for (UINT y = 0; y < footprint.Footprint.Height; ++y)
+	{
+		memcpy(streamed.uploadBegin + footprint.Offset + (UINT64)y * footprint.Footprint.RowPitch, &streamed.indirectionTexels[(size_t)y * width], width * sizeof(uint32_t));
+	}
+	CD3DX12_TEXTURE_COPY_LOCATION dst(streamed.indirection, 0);
+	CD3DX12_TEXTURE_COPY_LOCATION src(streamed.upload, footprint);
+	m_commandList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
 
-	m_indexBufferView.BufferLocation = m_indexBuffer->GetGPUVirtualAddress();
-	m_indexBufferView.Format = DXGI_FORMAT_R32_UINT;
-	m_indexBufferView.SizeInBytes = bufferSize;
+	for (D3D12_RESOURCE_BARRIER& barrier : barriers)
+	{
+		std::swap(barrier.Transition.StateBefore, barrier.Transition.StateAfter);
+	}
+	m_commandList->ResourceBarrier(2, barriers);
+}
 
-	m_indexcount = indices.size();
+void Terrain::ReleaseStreamedTexture(StreamedTexture& streamed)
+{
+	if (streamed.upload)
+	{
+		streamed.upload->Unmap(0, nullptr);
+		streamed.uploadBegin = nullptr;
+		streamed.upload->Release();
+		streamed.upload = nullptr;
+	}
+	if (streamed.physical)
+	{
+		streamed.physical->Release();
+		streamed.physical = nullptr;
+	}
+	if (streamed.indirection)
+	{
+		streamed.indirection->Release();
+		streamed.indirection = nullptr;
+	}
 }
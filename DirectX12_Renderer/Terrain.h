@@ -2,13 +2,56 @@
 
 #include "Renderer.h"
 #include "WICTextureLoader.h"
+#include "DDSTextureLoader.h"
 #include "MathHelper.h"
+#include "GeometryGenerator.h"
+#include "GeometryCache.h"
+#include "MeshOptimizer.h"
+#include "MeshCache.h"
+#include "MeshChunker.h"
+#include "MeshletBuilder.h"
+#include "Heightmap.h"
+#include "MipChain.h"
+#include "BlockCompressor.h"
+#include "HorizonMap.h"
+#include "NormalMap.h"
+#include "HeightPyramid.h"
+#include "TerrainDisplacement.h"
+#include "TerrainHeightField.h"
+#include "TerrainQuadtree.h"
+#include "VertexPacking.h"
+#include "VirtualTexture.h"
+#include "AssetLoader.h"
+#include "UploadRing.h"
 #include <iostream>
 #include <vector>
 #include "OrbitCycle.h"
 
 using namespace graphics;
 
+static const float TERRAIN_RADIUS = 1737.0f; // of the moon's sphere, in world units.
+static const bool STATIC_TERRAIN = false; // displace a finely subdivided geosphere once on the CPU and draw it without tessellation; overrides TERRAIN_QUADTREE.
+static const UINT STATIC_TERRAIN_SUBDIVISIONS = 8; // about as many triangles as the tessellated level 5 geosphere.
+static const bool TERRAIN_QUADTREE = true; // draw the moon as CDLOD patches selected every frame instead of one geosphere.
+static const UINT TERRAIN_PATCH_GRID = 16; // quads per side of a terrain patch, even.
+static const float TERRAIN_LOD_DISTANCE_RATIO = 2.0f; // LOD range of a quadtree level in units of its node size.
+static const UINT TERRAIN_CHUNK_VERTICES = 2048; // vertex limit of a terrain mesh chunk, i.e. of one draw and one culling unit.
+static const bool PACKED_TERRAIN_VERTEX = false; // true to upload the control mesh as 12 byte PackedVertex instead of 44 byte Vertex.
+static const bool TERRAIN_MESHLETS = false; // split the terrain and sky meshes into meshlets at load time; off until something draws them, TileBaker --benchmark times building and culling them.
+static const bool TERRAIN_VIRTUAL_TEXTURE = false; // stream ldem_64.tif and lroc_color_poles.tif through virtual textures from terrain.vtar, baked by TileBaker; the whole maps are loaded while it is missing. Needs TERRAIN_QUADTREE.
+static const UINT VIRTUAL_TEXTURE_SLOTS = 16; // physical cache tiles per side, 256 tiles of 130 x 130 texels per map.
+static const UINT VIRTUAL_TEXTURE_UPLOADS = 16; // loaded tiles copied into a physical cache per frame.
+static const MipFilter TERRAIN_HEIGHT_MIP_FILTER = MipFilter::BOX; // displacement mips; a box keeps every mip inside the height pyramid bounds the quadtree culls with.
+static const MipFilter TERRAIN_COLOR_MIP_FILTER = MipFilter::KAISER; // color map mips, filtered in linear light.
+static const bool TERRAIN_COLOR_BLOCK_COMPRESSION = true; // upload the color map block compressed, from the .dds TileBaker bakes next to it or encoded at load time.
+static const BlockFormat TERRAIN_COLOR_BLOCK_FORMAT = BlockFormat::BC7; // 1 byte per texel; BC1 takes half that and loses more of the tint.
+static const bool TERRAIN_HEIGHT_BC4 = false; // upload 8 and 16-bit displacement maps as BC4 at half a byte per texel; its heights are only about 8-bit accurate and may leave the height pyramid bounds slightly.
+static const bool TERRAIN_NORMAL_MAP = true; // generate a BC5 normal map from the heights at load time for DomainShader to read, instead of filtering eight height taps per vertex; not with TERRAIN_VIRTUAL_TEXTURE.
+static const bool TERRAIN_HORIZON_MAP = true; // precompute the horizon of the heights in 8 directions at load time for PixelShaderTes to shadow the terrain and occlude its ambient light with; needs TERRAIN_NORMAL_MAP.
+static const UINT TERRAIN_HORIZON_LEVEL = 3; // horizon map size as a mip level of the heightmap; 3 is an eighth of it per side.
+static const bool TERRAIN_HEIGHT_ZERO_COPY = true; // upload level 0 of a 16-bit displacement map from the height pyramid's heights, and decode 8-bit and float TIFF maps a second time straight into the staging ring, instead of holding level 0 in memory until it is uploaded.
+static const UINT64 TERRAIN_HEIGHT_DECODE_FRAME_BYTES = 2 << 20; // of the staging frame budget, rows that TERRAIN_HEIGHT_ZERO_COPY decodes again on the render thread per frame; a few ms of LZW or Deflate.
+
 struct ConstantBuffer
 {
 	XMFLOAT4X4 viewproj;
@@ -16,36 +59,68 @@ struct ConstantBuffer
 	LightSource light;
 	UINT height;
 	UINT width;
+	float heightOffset;	// sampled displacement texel to 0..1 height, Heightmap::Range
+	float heightScale;
+	XMFLOAT3 meshOrigin;	// PackedVertex position = meshOrigin + meshScale * snorm
+	float meshScale;
+	float planetRadius;	// VSPatch
+	UINT patchGridSize;
+	UINT virtualHeightWidth;	// level 0 size of the streamed maps, with VIRTUAL_TEXTURE
+	UINT virtualHeightHeight;
+	UINT virtualColorWidth;
+	UINT virtualColorHeight;
 };
 
-struct Vertex1 
+// GPU side of a VirtualTexture: the physical tile cache, the indirection texture over its level 0
+// tiles, and an upload buffer with one region per frame in flight.
+struct StreamedTexture
 {
-	XMFLOAT3 position;
+	VirtualTexture texture;
+	ID3D12Resource* physical = nullptr;
+	ID3D12Resource* indirection = nullptr;
+	ID3D12Resource* upload = nullptr;
+	UINT8* uploadBegin = nullptr;
+	UINT64 regionSize = 0;
+	UINT regionTiles = 0;		// tiles a region holds
+	UINT64 tileStride = 0;
+	D3D12_PLACED_SUBRESOURCE_FOOTPRINT tileFootprint = {};
+	D3D12_PLACED_SUBRESOURCE_FOOTPRINT indirectionFootprint = {};	// after the tiles of a region
+	std::vector<TileKey> wanted;
+	std::vector<VirtualTexture::Upload> uploads;
+	std::vector<uint32_t> indirectionTexels;
 };
 
-struct Vertex
+// A texture between its decode on an AssetLoader thread and its upload on the render thread:
+// the texture, created empty by the decode, and the texels of every level to copy into it.
+struct LoadingTexture
 {
-	Vertex() {}
-	Vertex(
-		float px, float py, float pz,
-		float nx, float ny, float nz,
-		float tx, float ty, float tz,
-		float u, float v) :
-		Position(px, py, pz),
-		Normal(nx, ny, nz),
-		TangentU(tx, ty, tz),
-		TexC(u, v) {}
-
-	XMFLOAT3 Position;
-	XMFLOAT3 Normal;
-	XMFLOAT3 TangentU;
-	XMFLOAT2 TexC;
+	ID3D12Resource* texture = nullptr;
+	UploadRing::Cursor cursor = {};
+	std::unique_ptr<uint8_t[]> decodedData;	// level 0 as WIC or DDSTextureLoader left it
+	std::vector<MipChain::Level> mips;
+	std::vector<std::vector<uint8_t>> blocks;	// every level, when block compressed
+	std::vector<D3D12_SUBRESOURCE_DATA> subresources;	// into the above
+	UploadRing::RowWriter writeTop;	// when set, writes the rows of level 0 into the ring in place of subresources[0]
+	D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+
+	// Records the copies of the next rows of every level through the staging ring, and after the
+	// last ones the transition to a shader resource. Adds the bytes staged; true once complete.
+	bool Stage(Graphics* renderer, UploadRing& ring, size_t& bytes);
+
+	// Once the copies have run: frees the texels, keeps the texture.
+	void ReleaseStaging();
+	void Release();
+};
+
+struct Vertex1 
+{
+	XMFLOAT3 position;
 };
 
 class Terrain
 {
 public:
-	Terrain(Graphics* renderer);
+	Terrain(Graphics* renderer, GeometryCache& geometryCache);
 	~Terrain();
 
 	void DrawTes(ID3D12GraphicsCommandList* m_commandList, XMFLOAT4X4 viewproj, XMFLOAT4 eye);
@@ -53,7 +128,13 @@ public:
 	void Draw3D(ID3D12GraphicsCommandList* m_commandList, XMFLOAT4X4 viewproj, XMFLOAT4 eye);
 	void Draw2D(ID3D12GraphicsCommandList* m_commandList);
 
-	void ClearUnusedUploadBuffersAfterInit();
+	// Queues the displacement and color maps on loader. The terrain mesh is sized to the
+	// displacement map, so it is made when that is staged; nothing is drawn until both are resident.
+	void QueueLoads(Graphics* renderer, AssetLoader& loader, UploadRing& ring);
+	bool IsResident() const { return m_residentMaps == 2; }
+
+	// Height queries over the displacement map, bound once it is staged.
+	const TerrainHeightField& GetHeightField() const { return m_heightField; }
 
 	OrbitCycle GetOrbitcycle() { return m_orbitCycle; }
 
@@ -65,13 +146,37 @@ private:
 	void InitPipeline2D(Graphics* Renderer);
 	void CreateConstantBuffer(Graphics* Renderer);
 	void CreateMesh3D(Graphics* Renderer);
-	void LoadHeightMap(Graphics* Renderer, const wchar_t* displacementmap, const wchar_t* colormap);
+	void CreateDescriptorHeap(Graphics* Renderer);
+	void DecodeDisplacementMap(Graphics* Renderer, const wchar_t* displacementmap);
+	void DecodeColorMap(Graphics* Renderer, const wchar_t* colormap);
+	void GenerateNormalMap(Graphics* Renderer);
+	void GenerateHorizonMap(Graphics* Renderer);
+	bool StageDisplacementMap(Graphics* Renderer, UploadRing& ring, size_t& bytes);
 	void CreateSphere(Graphics* Renderer, float radius, UINT slice, UINT stack);
 	void CreateGeosphere(Graphics* Renderer, float radius, UINT numSubdivisions);
+	void CreatePatchGrid(Graphics* Renderer, float radius);
+	void CreateStaticTerrain(Graphics* Renderer, float radius, UINT numSubdivisions);
+	void GetTesInputLayout(D3D12_INPUT_LAYOUT_DESC& inputLayoutDesc);
+	void UseGeometry(const SharedGeometry* geometry, float scale);
+	void DrawChunks(ID3D12GraphicsCommandList* m_commandList);
+	void DrawPatches(ID3D12GraphicsCommandList* m_commandList, XMFLOAT4X4 viewproj, XMFLOAT4 eye);
+	void HeightRange(float thetaMin, float thetaMax, float phiMin, float phiMax, float& minHeight, float& maxHeight) const;
+	bool OpenTileArchive(const char* archive);
+	void LoadStreamedTextures(Graphics* Renderer);
+	void LoadStreamedTexture(Graphics* Renderer, StreamedTexture& streamed, UINT map, UINT physicalSlot, UINT indirectionSlot);
+	void UpdateStreamedTexture(ID3D12GraphicsCommandList* m_commandList, StreamedTexture& streamed);
+	void ReleaseStreamedTexture(StreamedTexture& streamed);
 
 	ID3D12DescriptorHeap* m_srvHeap;
-	ID3D12Resource* m_uploadHeap;
+	LoadingTexture m_displacementMap;	// decoded on a loader thread, then staged on the render thread
+	LoadingTexture m_colorMap;
+	LoadingTexture m_normalMap;	// generated with the displacement map and staged after it
+	LoadingTexture m_horizonMap;	// likewise, after the normal map
+	UINT m_residentMaps;
 	std::vector<unsigned char> m_image;
+	HeightPyramid m_heightPyramid;	// displacement map first channel, 0..65535, kept for the CPU side
+	Heightmap::Range m_heightRange;
+	TerrainHeightField m_heightField;	// over m_heightPyramid
 	UINT m_width;
 	UINT m_height;
 
@@ -88,12 +193,26 @@ private:
 	UINT8* m_cbvDataBegin;
 	UINT m_srvDescSize;
 
-	ID3D12Resource* m_vertexBuffer;
-	ID3D12Resource* m_vertexBufferUpload;
-	ID3D12Resource* m_indexBuffer;
-	ID3D12Resource* m_indexBufferUpload;
-	D3D12_VERTEX_BUFFER_VIEW m_vertexBufferView;
-	D3D12_INDEX_BUFFER_VIEW	m_indexBufferView;
-	UINT m_indexcount;
+	GeometryCache* m_geometryCache;
+	const SharedGeometry* m_geometry;
+
+	TerrainQuadtree m_quadtree;
+	std::vector<SelectedPatch> m_selection;
+	std::vector<PatchInstance> m_instances;
+	ID3D12Resource* m_instanceBuffer;
+	UINT8* m_instanceDataBegin;
+	UINT m_instanceCapacity;	// instances per frame
+	UINT m_instanceFrame;
+	TerrainQuadtree::Statistics m_lodTotals;
+	double m_lodSelectMs;
+	UINT m_lodFrames;
 	OrbitCycle m_orbitCycle;
+
+	bool m_virtualTexture;	// TERRAIN_VIRTUAL_TEXTURE and its tile archive opened
+	bool m_domainNormalMap;
+	bool m_pixelHorizonMap;
+	TileArchive m_tileArchive;		// read by the loader threads of the streamed textures
+	StreamedTexture m_streamedHeight;
+	StreamedTexture m_streamedColor;
+	UINT m_streamFrame;
 };
\ No newline at end of file
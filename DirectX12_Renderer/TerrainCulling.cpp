@@ -0,0 +1,138 @@
+#include "TerrainCulling.h"
+#include <algorithm>
+#include <cmath>
+#include <xmmintrin.h>
+
+TerrainCulling::View TerrainCulling::MakeView(const XMFLOAT4X4& viewproj, const XMFLOAT3& eye, float occluderRadius)
+{
+	View view = {};
+
+	// Clip space coordinate i is dot(p, row i) of the transposed matrix (Gribb and Hartmann).
+	// D3D clips z against 0 rather than -w, so the near plane is row 2 alone.
+	const float(&m)[4][4] = viewproj.m;
+	const float rowScale[6] = { 1.0f, -1.0f, 1.0f, -1.0f, 1.0f, -1.0f };
+	const int row[6] = { 0, 0, 1, 1, 2, 2 };
+	for (int i = 0; i < 6; ++i)
+	{
+		float w = i == 4 ? 0.0f : 1.0f;
+		float a = w * m[3][0] + rowScale[i] * m[row[i]][0];
+		float b = w * m[3][1] + rowScale[i] * m[row[i]][1];
+		float c = w * m[3][2] + rowScale[i] * m[row[i]][2];
+		float d = w * m[3][3] + rowScale[i] * m[row[i]][3];
+		float length = sqrtf(a * a + b * b + c * c);
+		view.planes[i] = XMFLOAT4(a / length, b / length, c / length, d / length);
+	}
+
+	view.eye = eye;
+
+	float distance = sqrtf(eye.x * eye.x + eye.y * eye.y + eye.z * eye.z);
+	view.horizon = distance > occluderRadius;
+	if (view.horizon)
+	{
+		view.horizonAxis = XMFLOAT3(-eye.x / distance, -eye.y / distance, -eye.z / distance);
+		view.horizonSin = occluderRadius / distance;
+		view.horizonCos = sqrtf(distance * distance - occluderRadius * occluderRadius) / distance;
+		view.horizonDistance = (distance * distance - occluderRadius * occluderRadius) / distance;
+	}
+
+	return view;
+}
+
+bool TerrainCulling::IsVisible(const View& view, const XMFLOAT3& center, float radius)
+{
+	uint8_t visible;
+	CullScalar(view, &center.x, &center.y, &center.z, &radius, 1, &visible);
+	return visible != 0;
+}
+
+void TerrainCulling::CullScalar(const View& view, const float* centerX, const float* centerY, const float* centerZ,
+	const float* radius, size_t count, uint8_t* visible)
+{
+	for (size_t i = 0; i < count; ++i)
+	{
+		const float x = centerX[i];
+		const float y = centerY[i];
+		const float z = centerZ[i];
+		const float r = radius[i];
+
+		bool inside = true;
+		for (int p = 0; p < 6; ++p)
+		{
+			const XMFLOAT4& plane = view.planes[p];
+			float d = plane.x * x + plane.y * y + plane.z * z + plane.w;
+			inside = inside && d >= -r;
+		}
+
+		// Hidden if the sphere is inside the cone of the horizon and past the horizon circle.
+		if (inside && view.horizon)
+		{
+			float vx = x - view.eye.x;
+			float vy = y - view.eye.y;
+			float vz = z - view.eye.z;
+			float a = vx * view.horizonAxis.x + vy * view.horizonAxis.y + vz * view.horizonAxis.z;
+			float l2 = vx * vx + vy * vy + vz * vz;
+			float perpendicular = sqrtf(std::max(l2 - a * a, 0.0f));
+			float coneDistance = a * view.horizonSin - perpendicular * view.horizonCos;
+			bool occluded = coneDistance >= r && a - r >= view.horizonDistance;
+			inside = !occluded;
+		}
+
+		visible[i] = inside ? 1 : 0;
+	}
+}
+
+void TerrainCulling::CullBatch(const View& view, const float* centerX, const float* centerY, const float* centerZ,
+	const float* radius, size_t count, uint8_t* visible)
+{
+	const __m128 zero = _mm_setzero_ps();
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		const __m128 x = _mm_loadu_ps(centerX + i);
+		const __m128 y = _mm_loadu_ps(centerY + i);
+		const __m128 z = _mm_loadu_ps(centerZ + i);
+		const __m128 r = _mm_loadu_ps(radius + i);
+		const __m128 negR = _mm_sub_ps(zero, r);
+
+		__m128 inside = _mm_cmpeq_ps(zero, zero);
+		for (int p = 0; p < 6; ++p)
+		{
+			const XMFLOAT4& plane = view.planes[p];
+			__m128 d = _mm_mul_ps(_mm_set1_ps(plane.x), x);
+			d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane.y), y));
+			d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane.z), z));
+			d = _mm_add_ps(d, _mm_set1_ps(plane.w));
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(d, negR));
+		}
+
+		if (view.horizon)
+		{
+			const __m128 vx = _mm_sub_ps(x, _mm_set1_ps(view.eye.x));
+			const __m128 vy = _mm_sub_ps(y, _mm_set1_ps(view.eye.y));
+			const __m128 vz = _mm_sub_ps(z, _mm_set1_ps(view.eye.z));
+
+			__m128 a = _mm_mul_ps(vx, _mm_set1_ps(view.horizonAxis.x));
+			a = _mm_add_ps(a, _mm_mul_ps(vy, _mm_set1_ps(view.horizonAxis.y)));
+			a = _mm_add_ps(a, _mm_mul_ps(vz, _mm_set1_ps(view.horizonAxis.z)));
+
+			__m128 l2 = _mm_mul_ps(vx, vx);
+			l2 = _mm_add_ps(l2, _mm_mul_ps(vy, vy));
+			l2 = _mm_add_ps(l2, _mm_mul_ps(vz, vz));
+
+			const __m128 perpendicular = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(l2, _mm_mul_ps(a, a)), zero));
+			const __m128 coneDistance = _mm_sub_ps(_mm_mul_ps(a, _mm_set1_ps(view.horizonSin)), _mm_mul_ps(perpendicular, _mm_set1_ps(view.horizonCos)));
+
+			const __m128 occluded = _mm_and_ps(_mm_cmpge_ps(coneDistance, r), _mm_cmpge_ps(_mm_sub_ps(a, r), _mm_set1_ps(view.horizonDistance)));
+			inside = _mm_andnot_ps(occluded, inside);
+		}
+
+		const int mask = _mm_movemask_ps(inside);
+		visible[i + 0] = (uint8_t)(mask & 1);
+		visible[i + 1] = (uint8_t)((mask >> 1) & 1);
+		visible[i + 2] = (uint8_t)((mask >> 2) & 1);
+		visible[i + 3] = (uint8_t)((mask >> 3) & 1);
+	}
+
+	CullScalar(view, centerX + i, centerY + i, centerZ + i, radius + i, count - i, visible + i);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <DirectXMath.h>
+#include <cstddef>
+#include <cstdint>
+
+using namespace DirectX;
+
+// Bounds of a displaced terrain patch.
+struct PatchBounds
+{
+	XMFLOAT3 center;	// bounding sphere
+	float radius;
+	float minRadius;	// distance of the lowest and highest surface point from the planet center
+	float maxRadius;
+};
+
+// Frustum and horizon culling of bounding spheres around a planet at the origin. CPU only.
+class TerrainCulling
+{
+public:
+	struct View
+	{
+		XMFLOAT4 planes[6];		// left, right, bottom, top, near, far; inside is dot(plane, p) + w >= 0
+		XMFLOAT3 eye;
+		bool horizon;			// false while the eye is inside the occluder
+		XMFLOAT3 horizonAxis;	// unit vector from the eye to the planet center
+		float horizonSin;		// half angle of the cone from the eye tangent to the occluder
+		float horizonCos;
+		float horizonDistance;	// distance along the axis to the plane of the horizon circle
+	};
+
+	// viewproj is transposed for the shaders, as Camera::GetViewProjectionMatrixTransposed returns it.
+	// occluderRadius is the radius of a sphere that lies entirely inside the terrain.
+	static View MakeView(const XMFLOAT4X4& viewproj, const XMFLOAT3& eye, float occluderRadius);
+
+	static bool IsVisible(const View& view, const XMFLOAT3& center, float radius);
+
+	// Visibility of count spheres stored as separate x, y, z, radius arrays; 4 at a time with SSE.
+	static void CullBatch(const View& view, const float* centerX, const float* centerY, const float* centerZ,
+		const float* radius, size_t count, uint8_t* visible);
+
+	// Same as CullBatch, one sphere at a time.
+	static void CullScalar(const View& view, const float* centerX, const float* centerY, const float* centerZ,
+		const float* radius, size_t count, uint8_t* visible);
+};
@@ -0,0 +1,187 @@
+#include "TerrainDisplacement.h"
+#include "Parallel.h"
+#include "TerrainHeightField.h"
+#include <algorithm>
+#include <cmath>
+#include <emmintrin.h>
+
+namespace
+{
+	const size_t PATCH_VERTICES = 4096;	// vertices per parallel work item
+	const int SAMPLE_COUNT = 5;			// center, theta + and -, phi + and -
+
+	// Surface of P(theta, phi) = (radius + h) * n(theta, phi). The partial derivatives of n are
+	// sin(phi) * east and south, so the normal leans against the slope along both.
+	void Finish(Vertex& vertex, const XMFLOAT3& n, float theta, float phi, const float* samples,
+		float radius, float heightScale, const HeightPyramid& heights)
+	{
+		const float thetaStep = XM_2PI / heights.GetWidth();
+		const float phiStep = XM_PI / heights.GetHeight();
+
+		float r = radius + samples[0] * heightScale;
+		float dTheta = (samples[1] - samples[2]) * heightScale / (2.0f * thetaStep);
+		float dPhi = (samples[3] - samples[4]) * heightScale / (2.0f * phiStep);
+
+		float sinTheta = sinf(theta);
+		float cosTheta = cosf(theta);
+		float sinPhi = sinf(phi);
+		float cosPhi = cosf(phi);
+		XMFLOAT3 east(-sinTheta, 0.0f, cosTheta);
+		XMFLOAT3 south(cosPhi * cosTheta, -sinPhi, cosPhi * sinTheta);
+
+		// East is undefined at the poles; a texel there is the whole ring.
+		float a = dTheta / (r * std::max(sinPhi, phiStep));
+		float b = dPhi / r;
+		XMFLOAT3 normal(n.x - a * east.x - b * south.x, n.y - a * east.y - b * south.y, n.z - a * east.z - b * south.z);
+		float length = sqrtf(normal.x * normal.x + normal.y * normal.y + normal.z * normal.z);
+		normal = XMFLOAT3(normal.x / length, normal.y / length, normal.z / length);
+
+		float d = east.x * normal.x + east.z * normal.z;
+		XMFLOAT3 tangent(east.x - d * normal.x, -d * normal.y, east.z - d * normal.z);
+		length = sqrtf(tangent.x * tangent.x + tangent.y * tangent.y + tangent.z * tangent.z);
+
+		vertex.Position = XMFLOAT3(n.x * r, n.y * r, n.z * r);
+		vertex.Normal = normal;
+		vertex.TangentU = XMFLOAT3(tangent.x / length, tangent.y / length, tangent.z / length);
+		vertex.TexC = XMFLOAT2(theta / XM_2PI, phi / XM_PI);
+	}
+}
+
+void TerrainDisplacement::DisplaceRange(const HeightPyramid& heights, float radius, float heightScale, Vertex* vertices, size_t count, bool simd)
+{
+	const float du = 1.0f / heights.GetWidth();
+	const float dv = 1.0f / heights.GetHeight();
+	const float offsetU[SAMPLE_COUNT] = { 0.0f, du, -du, 0.0f, 0.0f };
+	const float offsetV[SAMPLE_COUNT] = { 0.0f, 0.0f, 0.0f, dv, -dv };
+
+	size_t i = 0;
+	while (i < count)
+	{
+		const size_t lanes = simd && i + 4 <= count ? 4 : 1;
+
+		XMFLOAT3 n[4];
+		float theta[4];
+		float phi[4];
+		float u[SAMPLE_COUNT][4];
+		float v[SAMPLE_COUNT][4];
+		for (size_t lane = 0; lane < lanes; ++lane)
+		{
+			const XMFLOAT3& p = vertices[i + lane].Position;
+			float length = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+			n[lane] = XMFLOAT3(p.x / length, p.y / length, p.z / length);
+			theta[lane] = atan2f(n[lane].z, n[lane].x);
+			phi[lane] = acosf(std::max(-1.0f, std::min(1.0f, n[lane].y)));
+			for (int s = 0; s < SAMPLE_COUNT; ++s)
+			{
+				u[s][lane] = theta[lane] / XM_2PI + offsetU[s];
+				v[s][lane] = phi[lane] / XM_PI + offsetV[s];
+			}
+		}
+
+		float samples[4][SAMPLE_COUNT];
+		for (int s = 0; s < SAMPLE_COUNT; ++s)
+		{
+			if (lanes == 4)
+			{
+				alignas(16) float h[4];
+				_mm_store_ps(h, TerrainHeightField::Sample4(heights, u[s], v[s]));
+				for (int lane = 0; lane < 4; ++lane)
+				{
+					samples[lane][s] = h[lane];
+				}
+			}
+			else
+			{
+				samples[0][s] = TerrainHeightField::Sample(heights, u[s][0], v[s][0]);
+			}
+		}
+
+		for (size_t lane = 0; lane < lanes; ++lane)
+		{
+			Finish(vertices[i + lane], n[lane], theta[lane], phi[lane], samples[lane], radius, heightScale, heights);
+		}
+		i += lanes;
+	}
+}
+
+void TerrainDisplacement::Displace(const HeightPyramid& heights, float radius, float heightScale, std::vector<Vertex>& vertices)
+{
+	const size_t count = vertices.size();
+	const uint32_t patches = (uint32_t)((count + PATCH_VERTICES - 1) / PATCH_VERTICES);
+	Vertex* data = vertices.data();
+
+	ParallelFor(patches, [&heights, radius, heightScale, data, count](uint32_t begin, uint32_t end)
+	{
+		for (uint32_t patch = begin; patch < end; ++patch)
+		{
+			size_t first = patch * PATCH_VERTICES;
+			DisplaceRange(heights, radius, heightScale, data + first, std::min(PATCH_VERTICES, count - first), true);
+		}
+	});
+}
+
+void TerrainDisplacement::DisplaceScalar(const HeightPyramid& heights, float radius, float heightScale, std::vector<Vertex>& vertices)
+{
+	DisplaceRange(heights, radius, heightScale, vertices.data(), vertices.size(), false);
+}
+
+TerrainDisplacement::Comparison TerrainDisplacement::Compare(const std::vector<Vertex>& a, const std::vector<Vertex>& b)
+{
+	Comparison comparison = {};
+	for (size_t i = 0; i < std::min(a.size(), b.size()); ++i)
+	{
+		const XMFLOAT3& pa = a[i].Position;
+		const XMFLOAT3& pb = b[i].Position;
+		float dx = pa.x - pb.x;
+		float dy = pa.y - pb.y;
+		float dz = pa.z - pb.z;
+		comparison.maxPositionError = std::max(comparison.maxPositionError, sqrtf(dx * dx + dy * dy + dz * dz));
+
+		const XMFLOAT3& na = a[i].Normal;
+		const XMFLOAT3& nb = b[i].Normal;
+		float cosine = std::max(-1.0f, std::min(1.0f, na.x * nb.x + na.y * nb.y + na.z * nb.z));
+		comparison.maxNormalErrorDegrees = std::max(comparison.maxNormalErrorDegrees, XMConvertToDegrees(acosf(cosine)));
+	}
+	return comparison;
+}
+
+bool TerrainDisplacement::Validate()
+{
+	const uint32_t width = 512;
+	const uint32_t height = 256;
+	std::vector<uint16_t> texels((size_t)width * height);
+	uint32_t seed = 1;
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			seed = seed * 1664525u + 1013904223u;
+			texels[(size_t)y * width + x] = (uint16_t)((x * 97 + y * 31) % 30000 + (seed >> 20) + (x > width / 3 ? 20000 : 0));
+		}
+	}
+	HeightPyramid heights;
+	heights.Build(texels, width, height);
+
+	const float radius = 1737.0f;
+	const float heightScale = TerrainHeightField::HeightScale(11520);	// relief of the 64 texels per degree map
+	GeometryGenerator::MeshData mesh;
+	GeometryGenerator::CreateGeosphere(radius, 5, mesh);
+	std::vector<Vertex> reference = mesh.Vertices;
+	Displace(heights, radius, heightScale, mesh.Vertices);
+	DisplaceScalar(heights, radius, heightScale, reference);
+
+	const uint16_t lowest = *std::min_element(texels.begin(), texels.end());
+	const uint16_t highest = *std::max_element(texels.begin(), texels.end());
+	for (const Vertex& vertex : mesh.Vertices)
+	{
+		const XMFLOAT3& p = vertex.Position;
+		const float distance = sqrtf(p.x * p.x + p.y * p.y + p.z * p.z);
+		if (distance < radius + lowest * heightScale - 1e-2f || distance > radius + highest * heightScale + 1e-2f)
+		{
+			return false;
+		}
+	}
+
+	const Comparison comparison = Compare(mesh.Vertices, reference);
+	return comparison.maxPositionError <= 1e-3f && comparison.maxNormalErrorDegrees <= 0.1f;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "GeometryGenerator.h"
+#include "HeightPyramid.h"
+#include <vector>
+
+// Displaces sphere vertices by the heightmap once on the CPU, for drawing the terrain without
+// tessellation. Heights are sampled like DomainShader does: theta = atan2(z, x), phi = acos(y),
+// bilinear with wrapping, by the samplers of TerrainHeightField. Normals come from central differences of the height one texel apart.
+class TerrainDisplacement
+{
+public:
+	struct Comparison
+	{
+		float maxPositionError;
+		float maxNormalErrorDegrees;
+	};
+
+	// Vertices start on a sphere of the given radius and get position, normal, tangent and
+	// texture coordinates; heightScale turns 0..65535 into world units. Parallel over patches
+	// of vertices, heights sampled 4 vertices at a time with SSE.
+	static void Displace(const HeightPyramid& heights, float radius, float heightScale, std::vector<Vertex>& vertices);
+
+	// Same as Displace, one vertex at a time on the calling thread.
+	static void DisplaceScalar(const HeightPyramid& heights, float radius, float heightScale, std::vector<Vertex>& vertices);
+
+	static Comparison Compare(const std::vector<Vertex>& a, const std::vector<Vertex>& b);
+
+	// True if a level 5 geosphere displaced over synthetic ramps, noise and a cliff at the relief of
+	// the moon's heightmap stays between the lowest and highest height, and Displace matches
+	// DisplaceScalar within 1e-3 units of position and 0.1 degrees of normal.
+	static bool Validate();
+
+private:
+	static void DisplaceRange(const HeightPyramid& heights, float radius, float heightScale, Vertex* vertices, size_t count, bool simd);
+};
@@ -0,0 +1,347 @@
+#include "TerrainHeightField.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+using namespace std::chrono;
+
+namespace
+{
+	int Wrap(int value, int size)
+	{
+		int wrapped = value % size;
+		return wrapped < 0 ? wrapped + size : wrapped;
+	}
+
+	// Unit direction, theta and phi of a point; the north pole for the center itself.
+	void ToSphere(const XMFLOAT3& direction, XMFLOAT3& n, float& u, float& v)
+	{
+		float length = sqrtf(direction.x * direction.x + direction.y * direction.y + direction.z * direction.z);
+		n = length > 0.0f ? XMFLOAT3(direction.x / length, direction.y / length, direction.z / length) : XMFLOAT3(0.0f, 1.0f, 0.0f);
+		u = atan2f(n.z, n.x) * XM_1DIV2PI;
+		v = acosf(std::max(-1.0f, std::min(1.0f, n.y))) * XM_1DIVPI;
+	}
+
+	uint32_t Random(uint32_t& seed, uint32_t range)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	}
+
+	// Bilinear with wrapping in double precision, written out from the texel centers.
+	double ReferenceHeight(const std::vector<uint16_t>& texels, int width, int height, double latitude, double longitude)
+	{
+		const double pi = 3.14159265358979323846;
+		double x = longitude / (2.0 * pi) * width - 0.5;
+		double y = (0.5 - latitude / pi) * height - 0.5;
+		double x0 = floor(x);
+		double y0 = floor(y);
+		auto texel = [&](double tx, double ty)
+		{
+			long long ix = ((long long)tx % width + width) % width;
+			long long iy = ((long long)ty % height + height) % height;
+			return (double)texels[(size_t)(iy * width + ix)];
+		};
+		double fx = x - x0;
+		double fy = y - y0;
+		double top = texel(x0, y0) * (1.0 - fx) + texel(x0 + 1.0, y0) * fx;
+		double bottom = texel(x0, y0 + 1.0) * (1.0 - fx) + texel(x0 + 1.0, y0 + 1.0) * fx;
+		return top * (1.0 - fy) + bottom * fy;
+	}
+}
+
+TerrainHeightField::TerrainHeightField() :
+	m_heights(nullptr),
+	m_radius(0.0f),
+	m_heightScale(0.0f)
+{
+}
+
+void TerrainHeightField::Bind(const HeightPyramid* heights, float radius, float heightScale)
+{
+	m_heights = heights;
+	m_radius = radius;
+	m_heightScale = heightScale;
+}
+
+float TerrainHeightField::GetHeight(float latitude, float longitude) const
+{
+	return Sample(*m_heights, longitude * XM_1DIV2PI, 0.5f - latitude * XM_1DIVPI) * m_heightScale;
+}
+
+XMFLOAT3 TerrainHeightField::GetSurfacePoint(const XMFLOAT3& direction) const
+{
+	XMFLOAT3 n;
+	float u, v;
+	ToSphere(direction, n, u, v);
+	float r = m_radius + Sample(*m_heights, u, v) * m_heightScale;
+	return XMFLOAT3(n.x * r, n.y * r, n.z * r);
+}
+
+void TerrainHeightField::GetHeights(const float* latitudes, const float* longitudes, float* heights, size_t count) const
+{
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 toU = _mm_set1_ps(XM_1DIV2PI);
+	const __m128 toV = _mm_set1_ps(XM_1DIVPI);
+	const __m128 scale = _mm_set1_ps(m_heightScale);
+
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		alignas(16) float u[4];
+		alignas(16) float v[4];
+		_mm_store_ps(u, _mm_mul_ps(_mm_loadu_ps(longitudes + i), toU));
+		_mm_store_ps(v, _mm_sub_ps(half, _mm_mul_ps(_mm_loadu_ps(latitudes + i), toV)));
+		_mm_storeu_ps(heights + i, _mm_mul_ps(Sample4(*m_heights, u, v), scale));
+	}
+	for (; i < count; ++i)
+	{
+		heights[i] = GetHeight(latitudes[i], longitudes[i]);
+	}
+}
+
+void TerrainHeightField::GetSurfacePoints(const XMFLOAT3* directions, XMFLOAT3* points, size_t count) const
+{
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4)
+	{
+		XMFLOAT3 n[4];
+		alignas(16) float u[4];
+		alignas(16) float v[4];
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			ToSphere(directions[i + lane], n[lane], u[lane], v[lane]);
+		}
+
+		alignas(16) float r[4];
+		_mm_store_ps(r, _mm_add_ps(_mm_set1_ps(m_radius), _mm_mul_ps(Sample4(*m_heights, u, v), _mm_set1_ps(m_heightScale))));
+		for (int lane = 0; lane < 4; ++lane)
+		{
+			points[i + lane] = XMFLOAT3(n[lane].x * r[lane], n[lane].y * r[lane], n[lane].z * r[lane]);
+		}
+	}
+	for (; i < count; ++i)
+	{
+		points[i] = GetSurfacePoint(directions[i]);
+	}
+}
+
+TerrainHeightField::Throughput TerrainHeightField::Measure(uint32_t queries) const
+{
+	std::vector<float> latitudes(queries);
+	std::vector<float> longitudes(queries);
+	std::vector<XMFLOAT3> directions(queries);
+	uint32_t seed = 17;
+	for (uint32_t i = 0; i < queries; ++i)
+	{
+		latitudes[i] = (Random(seed, 65536) / 65535.0f - 0.5f) * XM_PI;
+		longitudes[i] = (Random(seed, 65536) / 65535.0f - 0.5f) * XM_2PI;
+		directions[i] = XMFLOAT3(cosf(latitudes[i]) * cosf(longitudes[i]), sinf(latitudes[i]), cosf(latitudes[i]) * sinf(longitudes[i]));
+	}
+	std::vector<float> heights(queries);
+	std::vector<XMFLOAT3> points(queries);
+	auto perSecond = [queries](steady_clock::time_point start)
+	{
+		return queries / std::max(duration<double>(steady_clock::now() - start).count(), 1e-9);
+	};
+
+	Throughput throughput;
+	auto start = steady_clock::now();
+	for (uint32_t i = 0; i < queries; ++i)
+	{
+		heights[i] = GetHeight(latitudes[i], longitudes[i]);
+	}
+	throughput.scalar = perSecond(start);
+
+	start = steady_clock::now();
+	GetHeights(latitudes.data(), longitudes.data(), heights.data(), queries);
+	throughput.batched = perSecond(start);
+
+	start = steady_clock::now();
+	GetSurfacePoints(directions.data(), points.data(), queries);
+	throughput.surface = perSecond(start);
+	return throughput;
+}
+
+float TerrainHeightField::HeightScale(uint32_t mapHeight)
+{
+	return (float)(mapHeight / 150) / 65535.0f;
+}
+
+float TerrainHeightField::Sample(const HeightPyramid& heights, float u, float v)
+{
+	const int width = (int)heights.GetWidth();
+	const int height = (int)heights.GetHeight();
+	const uint16_t* texels = heights.GetHeights().data();
+
+	float x = u * width - 0.5f;
+	float y = v * height - 0.5f;
+	float x0 = floorf(x);
+	float y0 = floorf(y);
+	float fx = x - x0;
+	float fy = y - y0;
+
+	int xa = Wrap((int)x0, width);
+	int xb = Wrap((int)x0 + 1, width);
+	const uint16_t* rowA = texels + (size_t)Wrap((int)y0, height) * width;
+	const uint16_t* rowB = texels + (size_t)Wrap((int)y0 + 1, height) * width;
+
+	float top = rowA[xa] + fx * ((float)rowA[xb] - (float)rowA[xa]);
+	float bottom = rowB[xa] + fx * ((float)rowB[xb] - (float)rowB[xa]);
+	return top + fy * (bottom - top);
+}
+
+__m128 TerrainHeightField::Sample4(const HeightPyramid& heights, const float* u, const float* v)
+{
+	const int width = (int)heights.GetWidth();
+	const int height = (int)heights.GetHeight();
+	const uint16_t* texels = heights.GetHeights().data();
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 one = _mm_set1_ps(1.0f);
+
+	__m128 x = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(u), _mm_set1_ps((float)width)), half);
+	__m128 y = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(v), _mm_set1_ps((float)height)), half);
+
+	// SSE2 has no floor; truncate and step down where that rounded up.
+	__m128 x0 = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+	__m128 y0 = _mm_cvtepi32_ps(_mm_cvttps_epi32(y));
+	x0 = _mm_sub_ps(x0, _mm_and_ps(_mm_cmplt_ps(x, x0), one));
+	y0 = _mm_sub_ps(y0, _mm_and_ps(_mm_cmplt_ps(y, y0), one));
+	__m128 fx = _mm_sub_ps(x, x0);
+	__m128 fy = _mm_sub_ps(y, y0);
+
+	alignas(16) int32_t xi[4];
+	alignas(16) int32_t yi[4];
+	_mm_store_si128(reinterpret_cast<__m128i*>(xi), _mm_cvttps_epi32(x0));
+	_mm_store_si128(reinterpret_cast<__m128i*>(yi), _mm_cvttps_epi32(y0));
+
+	alignas(16) float h00[4], h10[4], h01[4], h11[4];
+	for (int lane = 0; lane < 4; ++lane)
+	{
+		int xa = Wrap(xi[lane], width);
+		int xb = Wrap(xi[lane] + 1, width);
+		const uint16_t* rowA = texels + (size_t)Wrap(yi[lane], height) * width;
+		const uint16_t* rowB = texels + (size_t)Wrap(yi[lane] + 1, height) * width;
+		h00[lane] = rowA[xa];
+		h10[lane] = rowA[xb];
+		h01[lane] = rowB[xa];
+		h11[lane] = rowB[xb];
+	}
+
+	__m128 a = _mm_load_ps(h00);
+	__m128 b = _mm_load_ps(h01);
+	__m128 top = _mm_add_ps(a, _mm_mul_ps(fx, _mm_sub_ps(_mm_load_ps(h10), a)));
+	__m128 bottom = _mm_add_ps(b, _mm_mul_ps(fx, _mm_sub_ps(_mm_load_ps(h11), b)));
+	return _mm_add_ps(top, _mm_mul_ps(fy, _mm_sub_ps(bottom, top)));
+}
+
+bool TerrainHeightField::Validate()
+{
+	// A power of two map and one that is not, of random heights.
+	const uint32_t sizes[2][2] = { { 64, 32 }, { 37, 19 } };
+	uint32_t seed = 1;
+	for (const uint32_t* size : sizes)
+	{
+		const int width = (int)size[0];
+		const int height = (int)size[1];
+		std::vector<uint16_t> texels((size_t)width * height);
+		for (uint16_t& texel : texels)
+		{
+			texel = (uint16_t)Random(seed, 65536);
+		}
+		HeightPyramid pyramid;
+		pyramid.Build(texels, width, height);
+
+		TerrainHeightField field;
+		const float radius = 100.0f;
+		const float scale = 0.001f;
+		field.Bind(&pyramid, radius, scale);
+
+		// Texel centers return their texel.
+		for (int y = 0; y < height; ++y)
+		{
+			for (int x = 0; x < width; ++x)
+			{
+				float longitude = (x + 0.5f) / width * XM_2PI;
+				float latitude = (0.5f - (y + 0.5f) / height) * XM_PI;
+				if (fabsf(field.GetHeight(latitude, longitude) - texels[(size_t)y * width + x] * scale) > 0.5f * scale)
+				{
+					return false;
+				}
+			}
+		}
+
+		// Random queries, longitudes beyond a turn either way included, against the reference.
+		const size_t queries = 2000;
+		std::vector<float> latitudes(queries);
+		std::vector<float> longitudes(queries);
+		for (size_t i = 0; i < queries; ++i)
+		{
+			latitudes[i] = (Random(seed, 65536) / 65535.0f - 0.5f) * XM_PI;
+			longitudes[i] = (Random(seed, 65536) / 65535.0f - 0.5f) * 3.0f * XM_2PI;
+			double expected = ReferenceHeight(texels, width, height, latitudes[i], longitudes[i]) * scale;
+			if (fabs(field.GetHeight(latitudes[i], longitudes[i]) - expected) > 1.0 * scale)
+			{
+				return false;
+			}
+		}
+
+		// Batches of every length around the SSE width match the scalar queries.
+		std::vector<float> batched(queries);
+		for (size_t count : { (size_t)0, (size_t)1, (size_t)3, (size_t)4, (size_t)5, (size_t)17, queries })
+		{
+			std::fill(batched.begin(), batched.end(), -1.0f);
+			field.GetHeights(latitudes.data(), longitudes.data(), batched.data(), count);
+			for (size_t i = 0; i < queries; ++i)
+			{
+				float expected = i < count ? field.GetHeight(latitudes[i], longitudes[i]) : -1.0f;
+				if (fabsf(batched[i] - expected) > 0.01f * scale)
+				{
+					return false;
+				}
+			}
+		}
+
+		// Surface points lie along their direction, at the radius plus the height there, and the
+		// batched ones where the scalar ones are.
+		std::vector<XMFLOAT3> directions(queries);
+		for (size_t i = 0; i < queries; ++i)
+		{
+			float length = 0.5f + Random(seed, 1000) * 0.01f;
+			float x = Random(seed, 2001) / 1000.0f - 1.0f;
+			float y = Random(seed, 2001) / 1000.0f - 1.0f;
+			float z = Random(seed, 2001) / 1000.0f - 1.0f;
+			directions[i] = i == 0 ? XMFLOAT3(0.0f, 0.0f, 0.0f) : XMFLOAT3(x * length, y * length, z * length);
+		}
+		std::vector<XMFLOAT3> points(queries);
+		field.GetSurfacePoints(directions.data(), points.data(), queries);
+		for (size_t i = 0; i < queries; ++i)
+		{
+			const XMFLOAT3 d = directions[i];
+			const XMFLOAT3 p = field.GetSurfacePoint(d);
+			double dLength = sqrt((double)d.x * d.x + (double)d.y * d.y + (double)d.z * d.z);
+			double pLength = sqrt((double)p.x * p.x + (double)p.y * p.y + (double)p.z * p.z);
+			if (dLength > 0.0)
+			{
+				double ny = d.y / dLength;
+				double latitude = asin(std::max(-1.0, std::min(1.0, ny)));
+				double longitude = atan2((double)d.z, (double)d.x);
+				double expected = radius + ReferenceHeight(texels, width, height, latitude, longitude) * scale;
+				double alongX = p.x - d.x / dLength * pLength;
+				double alongY = p.y - d.y / dLength * pLength;
+				double alongZ = p.z - d.z / dLength * pLength;
+				if (fabs(pLength - expected) > 1.0 * scale + 1e-4 || sqrt(alongX * alongX + alongY * alongY + alongZ * alongZ) > 1e-3)
+				{
+					return false;
+				}
+			}
+			const XMFLOAT3 q = points[i];
+			if (fabsf(q.x - p.x) > 1e-4f || fabsf(q.y - p.y) > 1e-4f || fabsf(q.z - p.z) > 1e-4f)
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "HeightPyramid.h"
+#include <DirectXMath.h>
+#include <cstddef>
+#include <emmintrin.h>
+
+using namespace DirectX;
+
+// Height of the terrain under a point, on the CPU, for the application rather than the shaders:
+// camera collision, altitude readouts. Level 0 of the HeightPyramid is sampled bilinearly with
+// wrapping and scaled as DomainShader does, so the surface is where the tessellated terrain puts
+// it at its finest level. Latitude is north positive and longitude is theta = atan2(z, x), both
+// in radians; phi = acos(y) is pi / 2 - latitude. Batches are sampled 4 at a time with SSE.
+class TerrainHeightField
+{
+public:
+	// Times of a batch of random queries, in queries per second.
+	struct Throughput
+	{
+		double scalar;		// GetHeight one at a time
+		double batched;		// GetHeights
+		double surface;		// GetSurfacePoints
+	};
+
+	TerrainHeightField();
+
+	// Answers queries over heights, which must outlive them, on a sphere of radius; heightScale
+	// turns 0..65535 into world units.
+	void Bind(const HeightPyramid* heights, float radius, float heightScale);
+	bool IsBound() const { return m_heights != nullptr; }
+	float GetRadius() const { return m_radius; }
+
+	// World units above the sphere.
+	float GetHeight(float latitude, float longitude) const;
+
+	// The displaced surface along direction from the center; direction need not be unit length.
+	XMFLOAT3 GetSurfacePoint(const XMFLOAT3& direction) const;
+
+	// The same for count queries at once; the results match the scalar ones to float rounding.
+	void GetHeights(const float* latitudes, const float* longitudes, float* heights, size_t count) const;
+	void GetSurfacePoints(const XMFLOAT3* directions, XMFLOAT3* points, size_t count) const;
+
+	Throughput Measure(uint32_t queries) const;
+
+	// World units of a 0..65535 height on a map of mapHeight rows: DomainShader's scale, in
+	// integer texels / 150 like the shader.
+	static float HeightScale(uint32_t mapHeight);
+
+	// Bilinear 0..65535 height at texture coordinates u, v, wrapping like the WRAP sampler; and
+	// at four of them, the texel fetches scalar and the filtering not.
+	static float Sample(const HeightPyramid& heights, float u, float v);
+	static __m128 Sample4(const HeightPyramid& heights, const float* u, const float* v);
+
+	// True if random queries on generated maps match a double precision reference, batches of
+	// any length match the scalar queries, texel centers return their texel, and surface points
+	// lie along their direction at the radius plus the height.
+	static bool Validate();
+
+private:
+	const HeightPyramid* m_heights;
+	float m_radius;
+	float m_heightScale;
+};
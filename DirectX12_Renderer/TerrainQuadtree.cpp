@@ -0,0 +1,592 @@
+#include "TerrainQuadtree.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <unordered_set>
+
+namespace
+{
+	// Normal, u and v axis of each face. cross(u, v) == normal, so (u, v) is counter clockwise
+	// seen from outside, the same winding as the geosphere.
+	const float FACE_AXES[6][3][3] =
+	{
+		{ { +1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } },
+		{ { -1, 0, 0 }, { 0, 0, 1 }, { 0, 1, 0 } },
+		{ { 0, +1, 0 }, { 0, 0, 1 }, { 1, 0, 0 } },
+		{ { 0, -1, 0 }, { 1, 0, 0 }, { 0, 0, 1 } },
+		{ { 0, 0, +1 }, { 1, 0, 0 }, { 0, 1, 0 } },
+		{ { 0, 0, -1 }, { 0, 1, 0 }, { 1, 0, 0 } },
+	};
+
+	const float NO_MORPH = 1e30f;
+
+	// Spreads the low 16 bits of v to the even bits.
+	uint32_t Part1By1(uint32_t v)
+	{
+		v &= 0x0000ffff;
+		v = (v ^ (v << 8)) & 0x00ff00ff;
+		v = (v ^ (v << 4)) & 0x0f0f0f0f;
+		v = (v ^ (v << 2)) & 0x33333333;
+		v = (v ^ (v << 1)) & 0x55555555;
+		return v;
+	}
+
+	void ToAngles(const XMFLOAT3& p, float& theta, float& phi)
+	{
+		theta = atan2f(p.z, p.x);
+		phi = acosf(std::max(-1.0f, std::min(1.0f, p.y)));
+	}
+
+	uint64_t CellKey(uint32_t face, uint32_t level, uint32_t x, uint32_t y)
+	{
+		return ((uint64_t)face << 61) | ((uint64_t)level << 56) | ((uint64_t)y << 28) | (uint64_t)x;
+	}
+}
+
+TerrainQuadtree::TerrainQuadtree() :
+	m_settings(),
+	m_ranges(),
+	m_bounds(),
+	m_minHeight(0.0f)
+{
+}
+
+TerrainQuadtree::TerrainQuadtree(const Settings& settings) :
+	m_settings(settings),
+	m_ranges(),
+	m_bounds(),
+	m_minHeight(0.0f)
+{
+	m_settings.gridSize = std::max(2u, m_settings.gridSize & ~1u);
+	m_settings.maxLevel = std::min(m_settings.maxLevel, 12u);
+	m_ranges.resize(m_settings.maxLevel + 1);
+
+	// Arc length of a leaf along a face edge, as a measure of node size.
+	float leafSize = m_settings.radius * (XM_PI / 2.0f) / (float)(1u << m_settings.maxLevel);
+	float range = m_settings.lodDistanceRatio * leafSize;
+	for (int level = (int)m_settings.maxLevel; level >= 0; --level)
+	{
+		m_ranges[level] = range;
+		range *= 2.0f;
+	}
+
+	const float maxDisplacement = m_settings.maxDisplacement;
+	BuildBounds([maxDisplacement](float, float, float, float, float& minHeight, float& maxHeight)
+	{
+		minHeight = 0.0f;
+		maxHeight = maxDisplacement;
+	});
+}
+
+XMFLOAT3 TerrainQuadtree::FaceToSphere(uint32_t face, float u, float v)
+{
+	const float(&axes)[3][3] = FACE_AXES[face];
+	float a = 2.0f * u - 1.0f;
+	float b = 2.0f * v - 1.0f;
+	float x = axes[0][0] + a * axes[1][0] + b * axes[2][0];
+	float y = axes[0][1] + a * axes[1][1] + b * axes[2][1];
+	float z = axes[0][2] + a * axes[1][2] + b * axes[2][2];
+
+	// Cube to sphere mapping that spreads the area more evenly than normalizing.
+	float x2 = x * x;
+	float y2 = y * y;
+	float z2 = z * z;
+	return XMFLOAT3(
+		x * sqrtf(std::max(0.0f, 1.0f - y2 / 2.0f - z2 / 2.0f + y2 * z2 / 3.0f)),
+		y * sqrtf(std::max(0.0f, 1.0f - z2 / 2.0f - x2 / 2.0f + z2 * x2 / 3.0f)),
+		z * sqrtf(std::max(0.0f, 1.0f - x2 / 2.0f - y2 / 2.0f + x2 * y2 / 3.0f)));
+}
+
+uint32_t TerrainQuadtree::NodeIndex(uint32_t face, uint32_t level, uint32_t x, uint32_t y)
+{
+	return (face << (2 * level)) + (Part1By1(y) << 1) + Part1By1(x);
+}
+
+void TerrainQuadtree::NodeAngularBounds(uint32_t face, uint32_t level, uint32_t x, uint32_t y,
+	float& thetaMin, float& thetaMax, float& phiMin, float& phiMax)
+{
+	const int SEGMENTS = 16;
+	const float size = 1.0f / (float)(1u << level);
+
+	// Latitude and longitude only have their extremes on the border of a node, unless it
+	// contains a pole, so walking the border is enough.
+	float thetas[4 * SEGMENTS];
+	float phis[4 * SEGMENTS];
+	for (int i = 0; i < 4 * SEGMENTS; ++i)
+	{
+		int edge = i / SEGMENTS;
+		float t = (float)(i % SEGMENTS) / SEGMENTS;
+		float u = edge == 0 ? t : edge == 1 ? 1.0f : edge == 2 ? 1.0f - t : 0.0f;
+		float v = edge == 0 ? 0.0f : edge == 1 ? t : edge == 2 ? 1.0f : 1.0f - t;
+		ToAngles(FaceToSphere(face, (x + u) * size, (y + v) * size), thetas[i], phis[i]);
+	}
+
+	// Between two border samples the angles can overshoot by about one step.
+	float thetaStep = 0.0f;
+	float phiStep = 0.0f;
+	for (int i = 0; i < 4 * SEGMENTS; ++i)
+	{
+		int next = (i + 1) % (4 * SEGMENTS);
+		float dTheta = fabsf(thetas[next] - thetas[i]);
+		thetaStep = std::max(thetaStep, std::min(dTheta, XM_2PI - dTheta));
+		phiStep = std::max(phiStep, fabsf(phis[next] - phis[i]));
+	}
+
+	phiMin = std::max(0.0f, *std::min_element(phis, phis + 4 * SEGMENTS) - phiStep);
+	phiMax = std::min(XM_PI, *std::max_element(phis, phis + 4 * SEGMENTS) + phiStep);
+
+	// The poles are the centers of the +Y and -Y faces.
+	bool containsPole = (face == 2 || face == 3) &&
+		x * size <= 0.5f && 0.5f <= (x + 1) * size &&
+		y * size <= 0.5f && 0.5f <= (y + 1) * size;
+	if (containsPole)
+	{
+		thetaMin = -XM_PI;
+		thetaMax = XM_PI;
+		if (face == 2)
+		{
+			phiMin = 0.0f;
+		}
+		else
+		{
+			phiMax = XM_PI;
+		}
+		return;
+	}
+
+	// The smallest arc holding every sample is the circle minus the largest gap between them.
+	std::sort(thetas, thetas + 4 * SEGMENTS);
+	int gapEnd = 0;
+	float largestGap = thetas[0] + XM_2PI - thetas[4 * SEGMENTS - 1];
+	for (int i = 1; i < 4 * SEGMENTS; ++i)
+	{
+		if (thetas[i] - thetas[i - 1] > largestGap)
+		{
+			largestGap = thetas[i] - thetas[i - 1];
+			gapEnd = i;
+		}
+	}
+
+	thetaMin = thetas[gapEnd] - thetaStep;
+	thetaMax = thetas[(gapEnd + 4 * SEGMENTS - 1) % (4 * SEGMENTS)] + thetaStep;
+	if (thetaMax < thetaMin)
+	{
+		thetaMax += XM_2PI;
+	}
+	if (thetaMax - thetaMin >= XM_2PI)
+	{
+		thetaMin = -XM_PI;
+		thetaMax = XM_PI;
+	}
+}
+
+PatchBounds TerrainQuadtree::ComputeBounds(uint32_t face, uint32_t level, uint32_t x, uint32_t y, float minHeight, float maxHeight) const
+{
+	const float size = 1.0f / (float)(1u << level);
+	const float innerRadius = m_settings.radius + minHeight;
+	const float outerRadius = m_settings.radius + maxHeight;
+
+	// A 5x5 grid over the node, at the lowest and the highest height.
+	XMFLOAT3 points[25];
+	for (int j = 0; j < 5; ++j)
+	{
+		for (int i = 0; i < 5; ++i)
+		{
+			points[j * 5 + i] = FaceToSphere(face, (x + 0.25f * i) * size, (y + 0.25f * j) * size);
+		}
+	}
+
+	XMFLOAT3 minimum(FLT_MAX, FLT_MAX, FLT_MAX);
+	XMFLOAT3 maximum(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for (const XMFLOAT3& p : points)
+	{
+		for (float r : { innerRadius, outerRadius })
+		{
+			minimum = XMFLOAT3(std::min(minimum.x, p.x * r), std::min(minimum.y, p.y * r), std::min(minimum.z, p.z * r));
+			maximum = XMFLOAT3(std::max(maximum.x, p.x * r), std::max(maximum.y, p.y * r), std::max(maximum.z, p.z * r));
+		}
+	}
+
+	PatchBounds bounds;
+	bounds.center = XMFLOAT3(0.5f * (minimum.x + maximum.x), 0.5f * (minimum.y + maximum.y), 0.5f * (minimum.z + maximum.z));
+	bounds.minRadius = innerRadius;
+	bounds.maxRadius = outerRadius;
+
+	float radiusSq = 0.0f;
+	float chordSq = 0.0f;
+	for (int i = 0; i < 25; ++i)
+	{
+		const XMFLOAT3& p = points[i];
+		for (float r : { innerRadius, outerRadius })
+		{
+			float dx = p.x * r - bounds.center.x;
+			float dy = p.y * r - bounds.center.y;
+			float dz = p.z * r - bounds.center.z;
+			radiusSq = std::max(radiusSq, dx * dx + dy * dy + dz * dz);
+		}
+		if (i % 5 != 4)
+		{
+			const XMFLOAT3& q = points[i + 1];
+			chordSq = std::max(chordSq, (p.x - q.x) * (p.x - q.x) + (p.y - q.y) * (p.y - q.y) + (p.z - q.z) * (p.z - q.z));
+		}
+		if (i < 20)
+		{
+			const XMFLOAT3& q = points[i + 5];
+			chordSq = std::max(chordSq, (p.x - q.x) * (p.x - q.x) + (p.y - q.y) * (p.y - q.y) + (p.z - q.z) * (p.z - q.z));
+		}
+	}
+
+	// Between the samples the surface bulges out by at most the sagitta of the longest chord
+	// between neighbouring samples.
+	float sagitta = 1.0f - sqrtf(std::max(0.0f, 1.0f - chordSq / 4.0f));
+	bounds.radius = sqrtf(radiusSq) + sagitta * outerRadius;
+	return bounds;
+}
+
+void TerrainQuadtree::BuildBounds(const HeightRangeQuery& query)
+{
+	m_bounds.assign(m_settings.maxLevel + 1, LevelBounds());
+	m_minHeight = FLT_MAX;
+
+	for (uint32_t level = 0; level <= m_settings.maxLevel; ++level)
+	{
+		const uint32_t dim = 1u << level;
+		const size_t count = (size_t)6 * dim * dim;
+
+		LevelBounds& bounds = m_bounds[level];
+		bounds.centerX.resize(count);
+		bounds.centerY.resize(count);
+		bounds.centerZ.resize(count);
+		bounds.radius.resize(count);
+		bounds.minRadius.resize(count);
+		bounds.maxRadius.resize(count);
+
+		for (uint32_t face = 0; face < 6; ++face)
+		{
+			for (uint32_t y = 0; y < dim; ++y)
+			{
+				for (uint32_t x = 0; x < dim; ++x)
+				{
+					float thetaMin, thetaMax, phiMin, phiMax;
+					NodeAngularBounds(face, level, x, y, thetaMin, thetaMax, phiMin, phiMax);
+
+					float minHeight = 0.0f;
+					float maxHeight = m_settings.maxDisplacement;
+					query(thetaMin, thetaMax, phiMin, phiMax, minHeight, maxHeight);
+					if (level == 0)
+					{
+						m_minHeight = std::min(m_minHeight, minHeight);
+					}
+
+					PatchBounds b = ComputeBounds(face, level, x, y, minHeight, maxHeight);
+					uint32_t index = NodeIndex(face, level, x, y);
+					bounds.centerX[index] = b.center.x;
+					bounds.centerY[index] = b.center.y;
+					bounds.centerZ[index] = b.center.z;
+					bounds.radius[index] = b.radius;
+					bounds.minRadius[index] = b.minRadius;
+					bounds.maxRadius[index] = b.maxRadius;
+				}
+			}
+		}
+	}
+}
+
+PatchBounds TerrainQuadtree::GetBounds(uint32_t face, uint32_t level, uint32_t x, uint32_t y) const
+{
+	const LevelBounds& bounds = m_bounds[level];
+	uint32_t index = NodeIndex(face, level, x, y);
+
+	PatchBounds b;
+	b.center = XMFLOAT3(bounds.centerX[index], bounds.centerY[index], bounds.centerZ[index]);
+	b.radius = bounds.radius[index];
+	b.minRadius = bounds.minRadius[index];
+	b.maxRadius = bounds.maxRadius[index];
+	return b;
+}
+
+bool TerrainQuadtree::ValidateCulling(const TerrainCulling::View& view) const
+{
+	std::vector<uint8_t> batch;
+	std::vector<uint8_t> scalar;
+	for (const LevelBounds& bounds : m_bounds)
+	{
+		size_t count = bounds.radius.size();
+		batch.resize(count);
+		scalar.resize(count);
+		TerrainCulling::CullBatch(view, bounds.centerX.data(), bounds.centerY.data(), bounds.centerZ.data(), bounds.radius.data(), count, batch.data());
+		TerrainCulling::CullScalar(view, bounds.centerX.data(), bounds.centerY.data(), bounds.centerZ.data(), bounds.radius.data(), count, scalar.data());
+		if (batch != scalar)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+PatchInstance TerrainQuadtree::MakeInstance(const SelectedPatch& patch)
+{
+	float size = 1.0f / (float)(1u << patch.level);
+
+	PatchInstance instance;
+	instance.patch = XMFLOAT4(patch.x * size, patch.y * size, size, (float)patch.face);
+	instance.morph = XMFLOAT2(patch.morphStart, patch.morphEnd);
+	return instance;
+}
+
+void TerrainQuadtree::AddPatch(uint32_t face, uint32_t level, uint32_t x, uint32_t y, uint8_t quadrantMask,
+	std::vector<SelectedPatch>& selection, Statistics& stats) const
+{
+	SelectedPatch patch;
+	patch.face = (uint8_t)face;
+	patch.level = (uint8_t)level;
+	patch.quadrantMask = quadrantMask;
+	patch.x = x;
+	patch.y = y;
+
+	// A node fades into its parent's grid over the last part of its own range.
+	if (level == 0)
+	{
+		patch.morphStart = NO_MORPH;
+		patch.morphEnd = 2.0f * NO_MORPH;
+	}
+	else
+	{
+		float previous = level == m_settings.maxLevel ? 0.0f : m_ranges[level + 1];
+		patch.morphEnd = m_ranges[level];
+		patch.morphStart = previous + (patch.morphEnd - previous) * m_settings.morphStartRatio;
+	}
+
+	selection.push_back(patch);
+	++stats.patchesSelected;
+	for (int q = 0; q < 4; ++q)
+	{
+		stats.quadrantsSelected += (quadrantMask >> q) & 1;
+	}
+}
+
+bool TerrainQuadtree::SelectNode(uint32_t face, uint32_t level, uint32_t x, uint32_t y, const XMFLOAT3& eye,
+	const TerrainCulling::View* view, std::vector<SelectedPatch>& selection, Statistics& stats) const
+{
+	++stats.nodesVisited;
+
+	const LevelBounds& bounds = m_bounds[level];
+	const uint32_t index = NodeIndex(face, level, x, y);
+
+	float dx = eye.x - bounds.centerX[index];
+	float dy = eye.y - bounds.centerY[index];
+	float dz = eye.z - bounds.centerZ[index];
+	float distance = std::max(0.0f, sqrtf(dx * dx + dy * dy + dz * dz) - bounds.radius[index]);
+
+	// Out of this level's range: the parent draws the area instead.
+	if (distance > m_ranges[level])
+	{
+		return false;
+	}
+
+	if (level == m_settings.maxLevel || distance > m_ranges[level + 1])
+	{
+		AddPatch(face, level, x, y, 0xF, selection, stats);
+		return true;
+	}
+
+	// The four children are next to each other in the next level's arrays.
+	uint8_t visible[4] = { 1, 1, 1, 1 };
+	if (view)
+	{
+		const LevelBounds& children = m_bounds[level + 1];
+		const size_t first = (size_t)index * 4;
+		TerrainCulling::CullBatch(*view, &children.centerX[first], &children.centerY[first], &children.centerZ[first],
+			&children.radius[first], 4, visible);
+	}
+
+	uint8_t mask = 0;
+	for (uint32_t q = 0; q < 4; ++q)
+	{
+		// A culled child needs nothing drawn, by it or by this node.
+		if (!visible[q])
+		{
+			++stats.nodesCulled;
+			continue;
+		}
+
+		uint32_t qx = q & 1;
+		uint32_t qy = q >> 1;
+		if (!SelectNode(face, level + 1, x * 2 + qx, y * 2 + qy, eye, view, selection, stats))
+		{
+			mask |= (uint8_t)(1u << q);
+		}
+	}
+
+	if (mask)
+	{
+		AddPatch(face, level, x, y, mask, selection, stats);
+	}
+	return true;
+}
+
+void TerrainQuadtree::Select(const XMFLOAT3& eye, std::vector<SelectedPatch>& selection, Statistics* stats,
+	const TerrainCulling::View* view) const
+{
+	selection.clear();
+
+	Statistics local = {};
+
+	uint8_t visible[6] = { 1, 1, 1, 1, 1, 1 };
+	if (view)
+	{
+		const LevelBounds& roots = m_bounds[0];
+		TerrainCulling::CullBatch(*view, roots.centerX.data(), roots.centerY.data(), roots.centerZ.data(), roots.radius.data(), 6, visible);
+	}
+
+	for (uint32_t face = 0; face < 6; ++face)
+	{
+		if (!visible[face])
+		{
+			++local.nodesCulled;
+			continue;
+		}
+
+		// Faces are always drawn, at least at their coarsest level.
+		if (!SelectNode(face, 0, 0, 0, eye, view, selection, local))
+		{
+			AddPatch(face, 0, 0, 0, 0xF, selection, local);
+		}
+	}
+
+	if (stats)
+	{
+		*stats = local;
+	}
+}
+
+bool TerrainQuadtree::ValidateCoverage(const std::vector<SelectedPatch>& selection, uint32_t maxLevel)
+{
+	// Every drawn region is a quadtree cell. The cells cover the faces exactly once if no
+	// cell lies inside another one and their areas add up to six faces.
+	std::vector<uint64_t> cells;
+	for (const SelectedPatch& patch : selection)
+	{
+		if (patch.face >= 6 || patch.level > maxLevel || patch.quadrantMask == 0 || patch.quadrantMask > 0xF)
+		{
+			return false;
+		}
+		if (patch.quadrantMask == 0xF)
+		{
+			cells.push_back(CellKey(patch.face, patch.level, patch.x, patch.y));
+			continue;
+		}
+		if (patch.level == maxLevel)
+		{
+			return false;
+		}
+		for (uint32_t q = 0; q < 4; ++q)
+		{
+			if (patch.quadrantMask & (1u << q))
+			{
+				cells.push_back(CellKey(patch.face, patch.level + 1, patch.x * 2 + (q & 1), patch.y * 2 + (q >> 1)));
+			}
+		}
+	}
+
+	std::unordered_set<uint64_t> cellSet(cells.begin(), cells.end());
+	if (cellSet.size() != cells.size())
+	{
+		return false;
+	}
+
+	uint64_t area = 0;
+	for (uint64_t key : cells)
+	{
+		uint32_t face = (uint32_t)(key >> 61);
+		uint32_t level = (uint32_t)(key >> 56) & 0x1f;
+		uint32_t y = (uint32_t)(key >> 28) & 0xfffffff;
+		uint32_t x = (uint32_t)key & 0xfffffff;
+
+		area += 1ull << (2 * (maxLevel - level));
+		while (level > 0)
+		{
+			--level;
+			x >>= 1;
+			y >>= 1;
+			if (cellSet.count(CellKey(face, level, x, y)))
+			{
+				return false;
+			}
+		}
+	}
+
+	return area == 6ull << (2 * maxLevel);
+}
+
+bool TerrainQuadtree::Validate()
+{
+	Settings settings;
+	settings.radius = 1737.0f;
+	settings.maxDisplacement = 27.0f;
+	settings.maxLevel = 6;
+	settings.gridSize = 16;
+	settings.lodDistanceRatio = 2.0f;
+	settings.morphStartRatio = 0.66f;
+	const TerrainQuadtree quadtree(settings);
+
+	// Far out at the sky's radius, where only the far face hides, where the starting camera
+	// orbits, skimming the surface, over a corner of the cube, and low above the terrain looking
+	// ahead.
+	struct Camera
+	{
+		XMFLOAT3 eye;
+		XMFLOAT3 target;
+		uint32_t patches;
+		uint32_t visiblePatches;
+	};
+	const Camera cameras[5] = {
+		{ XMFLOAT3(0.0f, 0.0f, -20000.0f), XMFLOAT3(0.0f, 0.0f, 0.0f), 6, 5 },
+		{ XMFLOAT3(2000.0f, 0.0f, 0.0f), XMFLOAT3(0.0f, 0.0f, 0.0f), 76, 24 },
+		{ XMFLOAT3(1767.0f, 0.0f, 0.0f), XMFLOAT3(1767.0f, 0.0f, 100.0f), 156, 30 },
+		{ XMFLOAT3(1062.0f, 1062.0f, 1062.0f), XMFLOAT3(0.0f, 0.0f, 0.0f), 117, 22 },
+		{ XMFLOAT3(1700.0f, 300.0f, 250.0f), XMFLOAT3(1600.0f, 320.0f, 900.0f), 137, 29 } };
+
+	// Same projection as Camera.
+	const XMMATRIX projection = XMMatrixPerspectiveFovLH(XMConvertToRadians(45.0f), 16.0f / 9.0f, 0.1f, 100000.0f);
+	std::vector<SelectedPatch> all;
+	std::vector<SelectedPatch> visible;
+	for (const Camera& camera : cameras)
+	{
+		XMFLOAT4X4 viewproj;
+		XMStoreFloat4x4(&viewproj, XMMatrixTranspose(XMMatrixMultiply(XMMatrixLookAtLH(XMVectorSet(camera.eye.x, camera.eye.y, camera.eye.z, 1.0f),
+			XMVectorSet(camera.target.x, camera.target.y, camera.target.z, 1.0f), XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f)), projection)));
+		const TerrainCulling::View view = TerrainCulling::MakeView(viewproj, camera.eye, quadtree.OccluderRadius());
+		quadtree.Select(camera.eye, all);
+		quadtree.Select(camera.eye, visible, nullptr, &view);
+		if (all.size() != camera.patches || visible.size() != camera.visiblePatches ||
+			!ValidateCoverage(all, settings.maxLevel) || !quadtree.ValidateCulling(view))
+		{
+			return false;
+		}
+		for (const SelectedPatch& patch : visible)
+		{
+			auto same = std::find_if(all.begin(), all.end(), [&patch](const SelectedPatch& other)
+			{
+				return other.face == patch.face && other.level == patch.level && other.x == patch.x && other.y == patch.y;
+			});
+			if (same == all.end() || (patch.quadrantMask & ~same->quadrantMask) != 0)
+			{
+				return false;
+			}
+		}
+	}
+
+	// The faces are alike, so the eye above the center of any of them splits as many nodes.
+	for (uint32_t face = 0; face < 6; ++face)
+	{
+		const float sign = face % 2 == 0 ? 2000.0f : -2000.0f;
+		const XMFLOAT3 eye(face / 2 == 0 ? sign : 0.0f, face / 2 == 1 ? sign : 0.0f, face / 2 == 2 ? sign : 0.0f);
+		quadtree.Select(eye, all);
+		if (all.size() != cameras[1].patches)
+		{
+			return false;
+		}
+	}
+	return true;
+}
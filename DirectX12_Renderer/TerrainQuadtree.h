@@ -0,0 +1,126 @@
+#pragma once
+
+#include "TerrainCulling.h"
+#include <DirectXMath.h>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+using namespace DirectX;
+
+// A quadtree node picked for drawing this frame.
+struct SelectedPatch
+{
+	uint8_t face;			// cube face, 0..5 = +X -X +Y -Y +Z -Z
+	uint8_t level;			// 0 is the whole face
+	uint8_t quadrantMask;	// quadrants to draw, bit (qy * 2 + qx); 0xF is the whole node
+	uint32_t x;				// node coordinates at its level, 0 .. 2^level - 1
+	uint32_t y;
+	float morphStart;		// the grid morphs to the parent's grid between these distances
+	float morphEnd;
+};
+
+// Per-instance data of a terrain patch draw, read as PATCH and MORPH by VSPatch.
+struct PatchInstance
+{
+	XMFLOAT4 patch;			// u, v of the node corner on its face, node size, face
+	XMFLOAT2 morph;			// morphStart, morphEnd
+};
+
+// Six cube faces with a quadtree each, projected onto a sphere. Nodes are selected by
+// distance with CDLOD ranges (Strugar, "Continuous Distance-Dependent Level of Detail").
+// CPU only; Terrain turns the selection into instanced grid patch draws.
+class TerrainQuadtree
+{
+public:
+	struct Settings
+	{
+		float radius;				// sphere radius
+		float maxDisplacement;		// largest height above radius, used until BuildBounds gets real ranges
+		uint32_t maxLevel;			// depth of the leaves
+		uint32_t gridSize;			// quads per patch side, even
+		float lodDistanceRatio;		// range of a level in units of its node size
+		float morphStartRatio;		// where in its range a node starts to morph, 0..1
+	};
+
+	struct Statistics
+	{
+		uint32_t nodesVisited;
+		uint32_t nodesCulled;
+		uint32_t patchesSelected;
+		uint32_t quadrantsSelected;
+	};
+
+	// Lowest and highest terrain height inside an angular rectangle, with theta = atan2(z, x)
+	// and phi = acos(y) as in DomainShader. thetaMax may exceed pi when the rectangle wraps.
+	typedef std::function<void(float thetaMin, float thetaMax, float phiMin, float phiMax, float& minHeight, float& maxHeight)> HeightRangeQuery;
+
+	TerrainQuadtree();
+	TerrainQuadtree(const Settings& settings);
+
+	const Settings& GetSettings() const { return m_settings; }
+
+	// Visibility range of a level: a node is split while the eye is closer than the range
+	// of its children.
+	float LodRange(uint32_t level) const { return m_ranges[level]; }
+
+	// Recomputes the bounds of every node from the height ranges the query returns.
+	void BuildBounds(const HeightRangeQuery& query);
+
+	// Nodes outside the view's frustum or behind the horizon are skipped when a view is given.
+	void Select(const XMFLOAT3& eye, std::vector<SelectedPatch>& selection, Statistics* stats = nullptr,
+		const TerrainCulling::View* view = nullptr) const;
+
+	PatchBounds GetBounds(uint32_t face, uint32_t level, uint32_t x, uint32_t y) const;
+
+	// Radius of a sphere that lies entirely inside the terrain, for horizon culling.
+	float OccluderRadius() const { return m_settings.radius + m_minHeight; }
+
+	// Compares the SSE culling path with the scalar one on every node.
+	bool ValidateCulling(const TerrainCulling::View& view) const;
+
+	// Angular rectangle around a node, padded so that it contains the whole node.
+	static void NodeAngularBounds(uint32_t face, uint32_t level, uint32_t x, uint32_t y,
+		float& thetaMin, float& thetaMax, float& phiMin, float& phiMax);
+
+	static PatchInstance MakeInstance(const SelectedPatch& patch);
+
+	// Unit sphere point of (u, v) in [0, 1] on a cube face. Mirrors FaceToSphere in VertexShaderPatch.hlsl.
+	static XMFLOAT3 FaceToSphere(uint32_t face, float u, float v);
+
+	// True if the selection covers every face exactly once.
+	static bool ValidateCoverage(const std::vector<SelectedPatch>& selection, uint32_t maxLevel);
+
+	// True if fixed cameras around a 6 level quadtree on the moon's sphere select the expected
+	// number of patches with and without culling, the unculled selections cover the sphere, the
+	// culled ones keep only patches and quadrants of the unculled ones, both culling paths agree,
+	// and cameras facing each of the six faces alike select alike.
+	static bool Validate();
+
+private:
+	// Structure of arrays per level, nodes in quadtree order: face * 4^level + interleaved (x, y),
+	// so the children of node i are 4i .. 4i + 3 on the next level.
+	struct LevelBounds
+	{
+		std::vector<float> centerX;
+		std::vector<float> centerY;
+		std::vector<float> centerZ;
+		std::vector<float> radius;
+		std::vector<float> minRadius;
+		std::vector<float> maxRadius;
+	};
+
+	static uint32_t NodeIndex(uint32_t face, uint32_t level, uint32_t x, uint32_t y);
+	PatchBounds ComputeBounds(uint32_t face, uint32_t level, uint32_t x, uint32_t y, float minHeight, float maxHeight) const;
+
+	bool SelectNode(uint32_t face, uint32_t level, uint32_t x, uint32_t y, const XMFLOAT3& eye,
+		const TerrainCulling::View* view, std::vector<SelectedPatch>& selection, Statistics& stats) const;
+	void AddPatch(uint32_t face, uint32_t level, uint32_t x, uint32_t y, uint8_t quadrantMask,
+		std::vector<SelectedPatch>& selection, Statistics& stats) const;
+
+	Settings m_settings;
+	std::vector<float> m_ranges;
+	std::vector<LevelBounds> m_bounds;
+	float m_minHeight;
+};
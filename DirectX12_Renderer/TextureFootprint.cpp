@@ -0,0 +1,115 @@
+#include "TextureFootprint.h"
+#include <algorithm>
+
+namespace
+{
+	uint64_t AlignUp(uint64_t value, uint64_t alignment)
+	{
+		return (value + alignment - 1) & ~(alignment - 1);
+	}
+}
+
+uint64_t TextureFootprint::Compute(uint32_t width, uint32_t height, uint32_t texelBytes, uint32_t blockBytes, uint32_t firstMip, uint32_t count,
+	std::vector<SubresourceFootprint>& footprints)
+{
+	footprints.clear();
+	uint64_t end = 0;
+	for (uint32_t mip = firstMip; mip < firstMip + count; ++mip)
+	{
+		SubresourceFootprint footprint;
+		footprint.offset = AlignUp(end, PLACEMENT_ALIGNMENT);
+		footprint.width = std::max(1u, width >> mip);
+		footprint.height = std::max(1u, height >> mip);
+		if (blockBytes != 0)
+		{
+			footprint.width = (footprint.width + 3) & ~3u;
+			footprint.height = (footprint.height + 3) & ~3u;
+			footprint.rows = footprint.height / 4;
+			footprint.rowBytes = footprint.width / 4 * blockBytes;
+		}
+		else
+		{
+			footprint.rows = footprint.height;
+			footprint.rowBytes = footprint.width * texelBytes;
+		}
+		footprint.rowPitch = (uint32_t)AlignUp(footprint.rowBytes, ROW_PITCH_ALIGNMENT);
+		end = footprint.offset + (uint64_t)footprint.rowPitch * (footprint.rows - 1) + footprint.rowBytes;
+		footprints.push_back(footprint);
+	}
+	return end;
+}
+
+bool TextureFootprint::Validate()
+{
+	std::vector<SubresourceFootprint> footprints;
+
+	// A 16-bit heightmap at 16 texels a degree: rows already a multiple of 256 bytes.
+	if (Compute(5760, 2880, 2, 0, 0, 1, footprints) != 33177600 || footprints[0].rowPitch != 11520 || footprints[0].rows != 2880)
+	{
+		return false;
+	}
+
+	// R8 100x37 with its mips: 100 bytes in 256-byte rows, 256 * 36 + 100 = 9316 bytes, so mip 1
+	// starts at 9728; mip 6 is a single texel.
+	uint64_t bytes = Compute(100, 37, 1, 0, 0, 7, footprints);
+	if (footprints[0].rowPitch != 256 || footprints[1].offset != 9728 || footprints[1].width != 50 || footprints[1].rows != 18 ||
+		footprints[6].width != 1 || footprints[6].height != 1 || bytes != footprints[6].offset + 1)
+	{
+		return false;
+	}
+
+	// BC7 4096x2048: 1024 blocks of 16 bytes a row, 512 rows; its 2x1 mip is one whole block.
+	Compute(4096, 2048, 0, 16, 0, 12, footprints);
+	if (footprints[0].rowBytes != 16384 || footprints[0].rows != 512 || footprints[11].width != 4 || footprints[11].height != 4 ||
+		footprints[11].rows != 1 || footprints[11].rowBytes != 16 || footprints[11].rowPitch != 256)
+	{
+		return false;
+	}
+
+	// The mips of BC1 6x6 alone, from mip 1: 3x3 rounds up to one block.
+	bytes = Compute(6, 6, 0, 8, 1, 2, footprints);
+	if (footprints[0].offset != 0 || footprints[0].width != 4 || footprints[0].rowBytes != 8 || footprints[1].offset != 512 || bytes != 520)
+	{
+		return false;
+	}
+
+	// Every chain of random sizes and formats aligned, padded and in order.
+	uint32_t seed = 12345;
+	auto random = [&seed](uint32_t range)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	};
+	const uint32_t texelSizes[4] = { 1, 2, 4, 16 };
+	for (int i = 0; i < 1000; ++i)
+	{
+		const uint32_t width = 1 + random(5000), height = 1 + random(5000);
+		const bool blocks = random(2) == 0;
+		const uint32_t texelBytes = blocks ? 0 : texelSizes[random(4)];
+		const uint32_t blockBytes = blocks ? 8u << random(2) : 0;
+		uint32_t levels = 1;
+		while ((width >> levels) != 0 || (height >> levels) != 0)
+		{
+			++levels;
+		}
+		const uint32_t first = random(levels);
+		bytes = Compute(width, height, texelBytes, blockBytes, first, levels - first, footprints);
+		uint64_t end = 0;
+		for (const SubresourceFootprint& footprint : footprints)
+		{
+			if (footprint.offset % PLACEMENT_ALIGNMENT != 0 || footprint.offset < end || footprint.rowPitch % ROW_PITCH_ALIGNMENT != 0 ||
+				footprint.rowPitch < footprint.rowBytes || footprint.rowPitch >= footprint.rowBytes + ROW_PITCH_ALIGNMENT ||
+				(blocks && (footprint.width % 4 != 0 || footprint.rows * 4 != footprint.height)))
+			{
+				return false;
+			}
+			end = footprint.offset + (uint64_t)footprint.rowPitch * (footprint.rows - 1) + footprint.rowBytes;
+		}
+		// The last mip of a whole chain is a single texel, or block.
+		if (bytes != end || footprints.back().width != (blocks ? 4u : 1u) || footprints.back().height != (blocks ? 4u : 1u))
+		{
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Layout of one subresource of a texture in an upload buffer.
+struct SubresourceFootprint
+{
+	uint64_t offset;	// from the start of the first subresource laid out
+	uint32_t width;		// texels, a whole number of 4x4 blocks in block formats
+	uint32_t height;
+	uint32_t rowPitch;
+	uint32_t rows;		// of texels, or of 4x4 blocks
+	uint32_t rowBytes;	// that hold data, the rest of the pitch is padding
+};
+
+// Where the mips of a texture go in an upload buffer, as ID3D12Device::GetCopyableFootprints lays
+// them out: every subresource 512-byte aligned, every row 256-byte aligned, block compressed
+// formats in rows of 4x4 blocks. Portable, so the layout that UploadRing writes rows into can be
+// checked on the CPU; in debug builds UploadRing checks it against the device.
+class TextureFootprint
+{
+public:
+	static const uint32_t ROW_PITCH_ALIGNMENT = 256;	// D3D12_TEXTURE_DATA_PITCH_ALIGNMENT
+	static const uint32_t PLACEMENT_ALIGNMENT = 512;	// D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT
+
+	// Footprints of mips firstMip .. firstMip + count - 1 of a width x height texture of texelBytes
+	// per texel, or of blockBytes per 4x4 block when that is not 0. Returns the bytes they span,
+	// the last row without its padding.
+	static uint64_t Compute(uint32_t width, uint32_t height, uint32_t texelBytes, uint32_t blockBytes, uint32_t firstMip, uint32_t count,
+		std::vector<SubresourceFootprint>& footprints);
+
+	// True if hand worked layouts of a heightmap, odd sized and block compressed mip chains come
+	// out, and every chain has aligned, padded, non-overlapping subresources.
+	static bool Validate();
+};
@@ -0,0 +1,901 @@
+#include "TiffCodec.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	const uint32_t LZW_CLEAR = 256;
+	const uint32_t LZW_END = 257;
+	const uint32_t LZW_FIRST = 258;
+	const uint32_t LZW_MAX_BITS = 12;
+	const uint32_t LZW_TABLE = 1 << LZW_MAX_BITS;
+	const uint32_t LZW_HASH = 8192;		// twice the table, for short probes
+
+	// Deflate lengths 3 .. 258 and distances 1 .. 32768 by symbol, RFC 1951 3.2.5.
+	const uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	const uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	const uint16_t DISTANCE_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073,
+		4097, 6145, 8193, 12289, 16385, 24577 };
+	const uint8_t DISTANCE_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+	const uint8_t CODE_LENGTH_ORDER[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+	const uint32_t MAX_CODE_BITS = 15;
+	const uint32_t FAST_BITS = 10;		// codes up to this long decode with one table lookup
+	const uint32_t DEFLATE_BLOCK = 65535;	// the most a stored block holds
+	const uint32_t DEFLATE_WINDOW = 32768;
+	const uint32_t DEFLATE_HASH_BITS = 15;
+	const uint32_t DEFLATE_CHAIN = 16;	// candidates tried per position
+
+	uint32_t Adler32(const uint8_t* bytes, size_t count)
+	{
+		uint32_t a = 1, b = 0;
+		while (count > 0)
+		{
+			// The most bytes that can be summed before b overflows.
+			const size_t run = std::min<size_t>(count, 5552);
+			for (size_t i = 0; i < run; ++i)
+			{
+				a += bytes[i];
+				b += a;
+			}
+			a %= 65521;
+			b %= 65521;
+			bytes += run;
+			count -= run;
+		}
+		return b << 16 | a;
+	}
+
+	uint32_t Reverse(uint32_t code, uint32_t bits)
+	{
+		uint32_t reversed = 0;
+		for (uint32_t i = 0; i < bits; ++i)
+		{
+			reversed = reversed << 1 | (code & 1);
+			code >>= 1;
+		}
+		return reversed;
+	}
+
+	// Deflate's bit stream, least significant bit first. Past the end of the input it reads
+	// zeros and remembers that it did.
+	class BitReader
+	{
+	public:
+		BitReader(const uint8_t* input, size_t size) : m_input(input), m_size(size), m_position(0), m_buffer(0), m_count(0), m_padding(0) {}
+
+		uint64_t Peek()
+		{
+			while (m_count <= 56)
+			{
+				if (m_position < m_size)
+				{
+					m_buffer |= (uint64_t)m_input[m_position++] << m_count;
+				}
+				else
+				{
+					++m_padding;
+				}
+				m_count += 8;
+			}
+			return m_buffer;
+		}
+
+		void Consume(uint32_t bits)
+		{
+			m_buffer >>= bits;
+			m_count -= bits;
+		}
+
+		uint32_t Bits(uint32_t bits)
+		{
+			const uint32_t value = (uint32_t)(Peek() & ((1ull << bits) - 1));
+			Consume(bits);
+			return value;
+		}
+
+		bool Overrun() const { return m_count < m_padding * 8; }
+
+		// Up to count whole bytes from the next byte on; how many there were.
+		size_t TakeBytes(uint8_t* output, size_t count)
+		{
+			AlignToByte();
+			count = std::min(count, m_size - m_position);
+			memcpy(output, m_input + m_position, count);
+			m_position += count;
+			return count;
+		}
+
+		// The header and bytes of a stored block, which starts at the next byte.
+		bool CopyStored(uint8_t* output, size_t outputBytes, size_t& written)
+		{
+			AlignToByte();
+			if (m_size - m_position < 4)
+			{
+				return false;
+			}
+			const uint32_t length = m_input[m_position] | m_input[m_position + 1] << 8;
+			const uint32_t complement = m_input[m_position + 2] | m_input[m_position + 3] << 8;
+			m_position += 4;
+			if ((length ^ 0xFFFF) != complement || m_size - m_position < length)
+			{
+				return false;
+			}
+			const size_t copied = std::min<size_t>(length, outputBytes - written);
+			memcpy(output + written, m_input + m_position, copied);
+			written += copied;
+			m_position += length;
+			return true;
+		}
+
+	private:
+		// Hands the whole bytes still in the buffer back to the input.
+		void AlignToByte()
+		{
+			Consume(m_count % 8);
+			m_position -= m_count / 8 - m_padding;
+			m_buffer = 0;
+			m_count = 0;
+			m_padding = 0;
+		}
+
+		const uint8_t* m_input;
+		size_t m_size;
+		size_t m_position;
+		uint64_t m_buffer;
+		uint32_t m_count;
+		uint32_t m_padding;		// zero bytes read past the end
+	};
+
+	struct Huffman
+	{
+		uint16_t counts[MAX_CODE_BITS + 1];
+		uint16_t symbols[288];
+		uint16_t fast[1 << FAST_BITS];	// symbol << 4 | length, 0 for longer codes
+	};
+
+	// Canonical code of the given lengths. False if they oversubscribe the code space; incomplete
+	// codes are allowed, as a block with a single distance has one.
+	bool BuildHuffman(Huffman& huffman, const uint8_t* lengths, uint32_t count)
+	{
+		memset(huffman.counts, 0, sizeof(huffman.counts));
+		memset(huffman.fast, 0, sizeof(huffman.fast));
+		for (uint32_t i = 0; i < count; ++i)
+		{
+			++huffman.counts[lengths[i]];
+		}
+		huffman.counts[0] = 0;
+		int left = 1;
+		for (uint32_t length = 1; length <= MAX_CODE_BITS; ++length)
+		{
+			left = (left << 1) - huffman.counts[length];
+			if (left < 0)
+			{
+				return false;
+			}
+		}
+
+		uint16_t offsets[MAX_CODE_BITS + 2] = {};
+		for (uint32_t length = 1; length <= MAX_CODE_BITS; ++length)
+		{
+			offsets[length + 1] = offsets[length] + huffman.counts[length];
+		}
+		for (uint32_t symbol = 0; symbol < count; ++symbol)
+		{
+			if (lengths[symbol] != 0)
+			{
+				huffman.symbols[offsets[lengths[symbol]]++] = (uint16_t)symbol;
+			}
+		}
+
+		uint32_t code = 0, index = 0;
+		for (uint32_t length = 1; length <= FAST_BITS; ++length, code <<= 1)
+		{
+			for (uint32_t i = 0; i < huffman.counts[length]; ++i, ++code)
+			{
+				const uint16_t entry = (uint16_t)(huffman.symbols[index++] << 4 | length);
+				for (uint32_t fill = Reverse(code, length); fill < (1u << FAST_BITS); fill += 1u << length)
+				{
+					huffman.fast[fill] = entry;
+				}
+			}
+		}
+		return true;
+	}
+
+	// The next symbol, or -1 for a code the lengths do not have.
+	int DecodeSymbol(BitReader& bits, const Huffman& huffman)
+	{
+		const uint64_t buffer = bits.Peek();
+		const uint16_t entry = huffman.fast[buffer & ((1 << FAST_BITS) - 1)];
+		if (entry != 0)
+		{
+			bits.Consume(entry & 15);
+			return entry >> 4;
+		}
+
+		// Longer codes one bit at a time, as canonical codes allow.
+		int code = 0, first = 0, index = 0;
+		for (uint32_t length = 1; length <= MAX_CODE_BITS; ++length)
+		{
+			code |= (int)(buffer >> (length - 1)) & 1;
+			const int count = huffman.counts[length];
+			if (code - count < first)
+			{
+				bits.Consume(length);
+				return huffman.symbols[index + (code - first)];
+			}
+			index += count;
+			first = (first + count) << 1;
+			code <<= 1;
+		}
+		return -1;
+	}
+
+	void BuildFixedHuffman(Huffman& lengths, Huffman& distances)
+	{
+		uint8_t codeLengths[288];
+		std::fill(codeLengths, codeLengths + 144, (uint8_t)8);
+		std::fill(codeLengths + 144, codeLengths + 256, (uint8_t)9);
+		std::fill(codeLengths + 256, codeLengths + 280, (uint8_t)7);
+		std::fill(codeLengths + 280, codeLengths + 288, (uint8_t)8);
+		BuildHuffman(lengths, codeLengths, 288);
+		std::fill(codeLengths, codeLengths + 30, (uint8_t)5);
+		BuildHuffman(distances, codeLengths, 30);
+	}
+
+	// The code lengths of a dynamic block, and the codes built from them.
+	bool ReadDynamicHuffman(BitReader& bits, Huffman& lengths, Huffman& distances)
+	{
+		const uint32_t literalCount = bits.Bits(5) + 257;
+		const uint32_t distanceCount = bits.Bits(5) + 1;
+		const uint32_t codeLengthCount = bits.Bits(4) + 4;
+		if (literalCount > 286 || distanceCount > 30)
+		{
+			return false;
+		}
+
+		uint8_t codeLengths[19] = {};
+		for (uint32_t i = 0; i < codeLengthCount; ++i)
+		{
+			codeLengths[CODE_LENGTH_ORDER[i]] = (uint8_t)bits.Bits(3);
+		}
+		Huffman codeLengthCode;
+		if (!BuildHuffman(codeLengthCode, codeLengths, 19))
+		{
+			return false;
+		}
+
+		uint8_t symbolLengths[286 + 30];
+		const uint32_t total = literalCount + distanceCount;
+		for (uint32_t i = 0; i < total;)
+		{
+			const int symbol = DecodeSymbol(bits, codeLengthCode);
+			if (symbol < 0 || bits.Overrun())
+			{
+				return false;
+			}
+			if (symbol < 16)
+			{
+				symbolLengths[i++] = (uint8_t)symbol;
+				continue;
+			}
+			if (symbol == 16 && i == 0)
+			{
+				return false;
+			}
+			const uint8_t value = symbol == 16 ? symbolLengths[i - 1] : 0;
+			const uint32_t repeat = symbol == 16 ? 3 + bits.Bits(2) : symbol == 17 ? 3 + bits.Bits(3) : 11 + bits.Bits(7);
+			if (i + repeat > total)
+			{
+				return false;
+			}
+			std::fill(symbolLengths + i, symbolLengths + i + repeat, value);
+			i += repeat;
+		}
+		return symbolLengths[256] != 0 && BuildHuffman(lengths, symbolLengths, literalCount) &&
+			BuildHuffman(distances, symbolLengths + literalCount, distanceCount);
+	}
+
+	// Deflate's bit stream for writing. Huffman codes go most significant bit first.
+	class BitWriter
+	{
+	public:
+		explicit BitWriter(std::vector<uint8_t>& output) : m_output(output), m_buffer(0), m_count(0) {}
+
+		void Put(uint32_t value, uint32_t bits)
+		{
+			m_buffer |= (uint64_t)value << m_count;
+			m_count += bits;
+			while (m_count >= 8)
+			{
+				m_output.push_back((uint8_t)m_buffer);
+				m_buffer >>= 8;
+				m_count -= 8;
+			}
+		}
+
+		void PutCode(uint32_t code, uint32_t bits)
+		{
+			Put(Reverse(code, bits), bits);
+		}
+
+		void AlignToByte()
+		{
+			if (m_count > 0)
+			{
+				m_output.push_back((uint8_t)m_buffer);
+			}
+			m_buffer = 0;
+			m_count = 0;
+		}
+
+	private:
+		std::vector<uint8_t>& m_output;
+		uint64_t m_buffer;
+		uint32_t m_count;
+	};
+
+	// Fixed Huffman code of a literal or length symbol, RFC 1951 3.2.6.
+	void FixedLiteralCode(uint32_t symbol, uint32_t& code, uint32_t& bits)
+	{
+		if (symbol < 144)
+		{
+			code = 0x30 + symbol;
+			bits = 8;
+		}
+		else if (symbol < 256)
+		{
+			code = 0x190 + symbol - 144;
+			bits = 9;
+		}
+		else if (symbol < 280)
+		{
+			code = symbol - 256;
+			bits = 7;
+		}
+		else
+		{
+			code = 0xC0 + symbol - 280;
+			bits = 8;
+		}
+	}
+
+	uint32_t LengthSymbol(uint32_t length)
+	{
+		return (uint32_t)(std::upper_bound(LENGTH_BASE, LENGTH_BASE + 29, length) - LENGTH_BASE) - 1;
+	}
+
+	uint32_t DistanceSymbol(uint32_t distance)
+	{
+		return (uint32_t)(std::upper_bound(DISTANCE_BASE, DISTANCE_BASE + 30, distance) - DISTANCE_BASE) - 1;
+	}
+
+	struct Token
+	{
+		uint16_t length;	// 0 for a literal
+		uint16_t distance;
+		uint8_t literal;
+	};
+
+	// Inserts positions into hash chains of the three bytes starting there.
+	class MatchFinder
+	{
+	public:
+		explicit MatchFinder(const uint8_t* input) : m_input(input), m_head(1 << DEFLATE_HASH_BITS, -1), m_previous(DEFLATE_WINDOW, -1) {}
+
+		void Insert(size_t position)
+		{
+			const uint32_t hash = Hash(position);
+			m_previous[position & (DEFLATE_WINDOW - 1)] = m_head[hash];
+			m_head[hash] = (int32_t)position;
+		}
+
+		// The longest match of up to maxLength bytes at position in the window before it.
+		uint32_t Find(size_t position, uint32_t maxLength, uint32_t& distance) const
+		{
+			uint32_t best = 0;
+			int32_t candidate = m_head[Hash(position)];
+			for (uint32_t chain = 0; chain < DEFLATE_CHAIN && candidate >= 0 && position - candidate <= DEFLATE_WINDOW; ++chain)
+			{
+				uint32_t length = 0;
+				while (length < maxLength && m_input[candidate + length] == m_input[position + length])
+				{
+					++length;
+				}
+				if (length > best)
+				{
+					best = length;
+					distance = (uint32_t)(position - candidate);
+					if (length == maxLength)
+					{
+						break;
+					}
+				}
+				candidate = m_previous[candidate & (DEFLATE_WINDOW - 1)];
+			}
+			return best;
+		}
+
+	private:
+		uint32_t Hash(size_t position) const
+		{
+			const uint32_t bytes = (uint32_t)m_input[position] << 16 | (uint32_t)m_input[position + 1] << 8 | m_input[position + 2];
+			return (bytes * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+		}
+
+		const uint8_t* m_input;
+		std::vector<int32_t> m_head;
+		std::vector<int32_t> m_previous;
+	};
+
+	// Width of the LZW codes that follow once next is the next free table entry. The encoder
+	// widens as soon as next no longer fits; the decoder, a code behind, one entry earlier.
+	uint32_t LzwWidth(uint32_t next)
+	{
+		return next < 512 ? 9 : next < 1024 ? 10 : next < 2048 ? 11 : 12;
+	}
+}
+
+bool TiffCodec::LzwDecode(const uint8_t* input, size_t inputBytes, uint8_t* output, size_t outputBytes)
+{
+	// Strings as the entry they extend and their last byte.
+	uint16_t prefix[LZW_TABLE];
+	uint8_t suffix[LZW_TABLE];
+	uint8_t first[LZW_TABLE];
+	uint16_t length[LZW_TABLE];
+	for (uint32_t i = 0; i < 256; ++i)
+	{
+		prefix[i] = 0;
+		suffix[i] = first[i] = (uint8_t)i;
+		length[i] = 1;
+	}
+
+	uint32_t next = LZW_FIRST;
+	uint32_t width = 9;
+	int32_t previous = -1;
+	uint32_t buffer = 0, bits = 0;
+	size_t position = 0, written = 0;
+	while (written < outputBytes)
+	{
+		while (bits < width)
+		{
+			if (position == inputBytes)
+			{
+				return false;
+			}
+			buffer = buffer << 8 | input[position++];
+			bits += 8;
+		}
+		const uint32_t code = (buffer >> (bits - width)) & ((1u << width) - 1);
+		bits -= width;
+
+		if (code == LZW_CLEAR)
+		{
+			next = LZW_FIRST;
+			width = 9;
+			previous = -1;
+			continue;
+		}
+		if (code == LZW_END)
+		{
+			return false;
+		}
+		if (previous < 0)
+		{
+			if (code > 255)
+			{
+				return false;
+			}
+			output[written++] = (uint8_t)code;
+			previous = (int32_t)code;
+			continue;
+		}
+		if (code > next || (code == next && next == LZW_TABLE))
+		{
+			return false;
+		}
+
+		// The previous string and the first byte of this one, which is also the first of the
+		// previous when this code is the entry being added.
+		if (next < LZW_TABLE)
+		{
+			prefix[next] = (uint16_t)previous;
+			suffix[next] = first[code == next ? previous : code];
+			first[next] = first[previous];
+			length[next] = length[previous] + 1;
+			++next;
+		}
+		width = LzwWidth(next + 1);
+
+		// Written back to front, as far as the output goes.
+		const uint32_t count = length[code];
+		uint32_t entry = code;
+		uint32_t i = count;
+		for (; written + i > outputBytes; --i)
+		{
+			entry = prefix[entry];
+		}
+		while (i-- > 0)
+		{
+			output[written + i] = suffix[entry];
+			entry = prefix[entry];
+		}
+		written += std::min<size_t>(count, outputBytes - written);
+		previous = (int32_t)code;
+	}
+	return true;
+}
+
+void TiffCodec::LzwEncode(const uint8_t* input, size_t inputBytes, std::vector<uint8_t>& output)
+{
+	// Codes MSB first.
+	uint32_t buffer = 0, bits = 0;
+	auto put = [&](uint32_t code, uint32_t width)
+	{
+		buffer = buffer << width | code;
+		bits += width;
+		while (bits >= 8)
+		{
+			output.push_back((uint8_t)(buffer >> (bits - 8)));
+			bits -= 8;
+		}
+	};
+
+	// Entries keyed by the string they extend and the byte that extends it.
+	std::vector<uint32_t> keys(LZW_HASH, 0);
+	std::vector<uint16_t> codes(LZW_HASH, 0);
+	uint32_t next = LZW_FIRST;
+	uint32_t width = 9;
+	put(LZW_CLEAR, width);
+	if (inputBytes > 0)
+	{
+		uint32_t string = input[0];
+		for (size_t i = 1; i < inputBytes; ++i)
+		{
+			const uint32_t key = (string << 8 | input[i]) + 1;
+			uint32_t slot = (key * 2654435761u) >> 19;
+			while (keys[slot] != 0 && keys[slot] != key)
+			{
+				slot = (slot + 1) & (LZW_HASH - 1);
+			}
+			if (keys[slot] == key)
+			{
+				string = codes[slot];
+				continue;
+			}
+
+			put(string, width);
+			keys[slot] = key;
+			codes[slot] = (uint16_t)next++;
+			if (next == LZW_TABLE - 2)
+			{
+				put(LZW_CLEAR, width);
+				std::fill(keys.begin(), keys.end(), 0);
+				next = LZW_FIRST;
+			}
+			width = LzwWidth(next);
+			string = input[i];
+		}
+		// The decoder adds an entry for the last code too.
+		put(string, width);
+		if (++next == LZW_TABLE - 2)
+		{
+			put(LZW_CLEAR, width);
+			next = LZW_FIRST;
+		}
+		width = LzwWidth(next);
+	}
+	put(LZW_END, width);
+	if (bits > 0)
+	{
+		output.push_back((uint8_t)(buffer << (8 - bits)));
+	}
+}
+
+bool TiffCodec::Inflate(const uint8_t* input, size_t inputBytes, uint8_t* output, size_t outputBytes)
+{
+	// zlib header: deflate with a window of at most 32K and no preset dictionary.
+	if (inputBytes < 2 || (input[0] & 0x0F) != 8 || (input[0] >> 4) > 7 || (input[0] << 8 | input[1]) % 31 != 0 || (input[1] & 0x20) != 0)
+	{
+		return false;
+	}
+
+	BitReader bits(input + 2, inputBytes - 2);
+	Huffman lengths, distances;
+	size_t written = 0;
+	bool last = false;
+	while (!last)
+	{
+		last = bits.Bits(1) != 0;
+		const uint32_t type = bits.Bits(2);
+		if (type == 0)
+		{
+			if (!bits.CopyStored(output, outputBytes, written))
+			{
+				return false;
+			}
+			continue;
+		}
+		if (type == 1)
+		{
+			BuildFixedHuffman(lengths, distances);
+		}
+		else if (type != 2 || !ReadDynamicHuffman(bits, lengths, distances))
+		{
+			return false;
+		}
+
+		for (;;)
+		{
+			const int symbol = DecodeSymbol(bits, lengths);
+			if (symbol < 0 || bits.Overrun())
+			{
+				return false;
+			}
+			if (symbol < 256)
+			{
+				if (written == outputBytes)
+				{
+					return true;
+				}
+				output[written++] = (uint8_t)symbol;
+				continue;
+			}
+			if (symbol == 256)
+			{
+				break;
+			}
+			if (symbol > 285)
+			{
+				return false;
+			}
+
+			size_t length = LENGTH_BASE[symbol - 257] + bits.Bits(LENGTH_EXTRA[symbol - 257]);
+			const int distanceSymbol = DecodeSymbol(bits, distances);
+			if (distanceSymbol < 0 || distanceSymbol >= 30)
+			{
+				return false;
+			}
+			const size_t distance = DISTANCE_BASE[distanceSymbol] + bits.Bits(DISTANCE_EXTRA[distanceSymbol]);
+			if (bits.Overrun() || distance > written)
+			{
+				return false;
+			}
+			if (written == outputBytes)
+			{
+				return true;
+			}
+			length = std::min(length, outputBytes - written);
+			if (distance >= length)
+			{
+				memcpy(output + written, output + written - distance, length);
+			}
+			else
+			{
+				for (size_t i = 0; i < length; ++i)
+				{
+					output[written + i] = output[written + i - distance];
+				}
+			}
+			written += length;
+		}
+	}
+	if (written != outputBytes)
+	{
+		return false;
+	}
+
+	// Adler-32 of the output, big endian, from the next byte on; some writers leave it out.
+	uint8_t trailer[4];
+	if (bits.TakeBytes(trailer, 4) < 4)
+	{
+		return true;
+	}
+	return Adler32(output, outputBytes) == ((uint32_t)trailer[0] << 24 | trailer[1] << 16 | trailer[2] << 8 | trailer[3]);
+}
+
+void TiffCodec::Deflate(const uint8_t* input, size_t inputBytes, std::vector<uint8_t>& output)
+{
+	output.push_back(0x78);
+	output.push_back(0x01);
+	BitWriter writer(output);
+	MatchFinder matches(input);
+	std::vector<Token> tokens;
+
+	size_t blockStart = 0;
+	do
+	{
+		const size_t blockEnd = std::min(inputBytes, blockStart + DEFLATE_BLOCK);
+		const bool last = blockEnd == inputBytes;
+
+		// Greedy matches that stay in the block, costed as fixed codes.
+		tokens.clear();
+		uint64_t fixedBits = 3 + 7;
+		for (size_t position = blockStart; position < blockEnd;)
+		{
+			uint32_t distance = 0;
+			const uint32_t length = position + 3 <= blockEnd ? matches.Find(position, (uint32_t)std::min<size_t>(258, blockEnd - position), distance) : 0;
+			if (length >= 3)
+			{
+				const uint32_t lengthSymbol = LengthSymbol(length);
+				const uint32_t distanceSymbol = DistanceSymbol(distance);
+				Token token = { (uint16_t)length, (uint16_t)distance, 0 };
+				tokens.push_back(token);
+				fixedBits += (lengthSymbol + 257 < 280 ? 7 : 8) + LENGTH_EXTRA[lengthSymbol] + 5 + DISTANCE_EXTRA[distanceSymbol];
+				for (size_t end = position + length; position < end; ++position)
+				{
+					if (position + 3 <= inputBytes)
+					{
+						matches.Insert(position);
+					}
+				}
+				continue;
+			}
+
+			Token token = { 0, 0, input[position] };
+			tokens.push_back(token);
+			fixedBits += input[position] < 144 ? 8 : 9;
+			if (position + 3 <= inputBytes)
+			{
+				matches.Insert(position);
+			}
+			++position;
+		}
+
+		writer.Put(last ? 1 : 0, 1);
+		if (fixedBits >= (blockEnd - blockStart) * 8 + 3 + 7 + 32)
+		{
+			// Stored; the length and its complement start at the next byte.
+			writer.Put(0, 2);
+			writer.AlignToByte();
+			const uint32_t length = (uint32_t)(blockEnd - blockStart);
+			writer.Put(length, 16);
+			writer.Put(length ^ 0xFFFF, 16);
+			output.insert(output.end(), input + blockStart, input + blockEnd);
+		}
+		else
+		{
+			writer.Put(1, 2);
+			uint32_t code, bits;
+			for (const Token& token : tokens)
+			{
+				if (token.length == 0)
+				{
+					FixedLiteralCode(token.literal, code, bits);
+					writer.PutCode(code, bits);
+					continue;
+				}
+				const uint32_t lengthSymbol = LengthSymbol(token.length);
+				const uint32_t distanceSymbol = DistanceSymbol(token.distance);
+				FixedLiteralCode(lengthSymbol + 257, code, bits);
+				writer.PutCode(code, bits);
+				writer.Put(token.length - LENGTH_BASE[lengthSymbol], LENGTH_EXTRA[lengthSymbol]);
+				writer.PutCode(distanceSymbol, 5);
+				writer.Put(token.distance - DISTANCE_BASE[distanceSymbol], DISTANCE_EXTRA[distanceSymbol]);
+			}
+			FixedLiteralCode(256, code, bits);
+			writer.PutCode(code, bits);
+		}
+		blockStart = blockEnd;
+	} while (blockStart < inputBytes);
+	writer.AlignToByte();
+
+	const uint32_t adler = Adler32(input, inputBytes);
+	for (int shift = 24; shift >= 0; shift -= 8)
+	{
+		output.push_back((uint8_t)(adler >> shift));
+	}
+}
+
+bool TiffCodec::Validate()
+{
+	uint32_t seed = 12345;
+	auto random = [&seed](uint32_t range)
+	{
+		seed = seed * 1664525u + 1013904223u;
+		return (seed >> 8) % range;
+	};
+
+	// Empty, one byte, a smooth 16-bit ramp, noise that no match helps (stored blocks), four
+	// symbols at random, which fill the LZW table many times over, and runs longer than a match.
+	std::vector<std::vector<uint8_t>> sources(6);
+	sources[1].push_back(42);
+	for (uint32_t i = 0; i < 50000; ++i)
+	{
+		const uint16_t height = (uint16_t)(30000 + 2000 * sin(i * 0.001) + (i % 7));
+		sources[2].push_back((uint8_t)height);
+		sources[2].push_back((uint8_t)(height >> 8));
+	}
+	for (uint32_t i = 0; i < 70000; ++i)
+	{
+		sources[3].push_back((uint8_t)random(256));
+	}
+	for (uint32_t i = 0; i < 200000; ++i)
+	{
+		sources[4].push_back((uint8_t)random(4));
+	}
+	for (uint32_t run = 0; run < 200; ++run)
+	{
+		sources[5].insert(sources[5].end(), 1 + random(1000), (uint8_t)random(3));
+	}
+
+	std::vector<uint8_t> decoded;
+	for (const std::vector<uint8_t>& source : sources)
+	{
+		std::vector<uint8_t> lzw, deflated;
+		LzwEncode(source.data(), source.size(), lzw);
+		Deflate(source.data(), source.size(), deflated);
+		if (deflated.size() > source.size() + (source.size() / DEFLATE_BLOCK + 1) * 5 + 6)
+		{
+			return false;
+		}
+
+		// Exactly the source, and a byte more than the stream holds refused.
+		decoded.assign(source.size() + 1, 0);
+		if (!LzwDecode(lzw.data(), lzw.size(), decoded.data(), source.size()) || !std::equal(source.begin(), source.end(), decoded.begin()) ||
+			LzwDecode(lzw.data(), lzw.size(), decoded.data(), source.size() + 1))
+		{
+			return false;
+		}
+		decoded.assign(source.size() + 1, 0);
+		if (!Inflate(deflated.data(), deflated.size(), decoded.data(), source.size()) || !std::equal(source.begin(), source.end(), decoded.begin()) ||
+			Inflate(deflated.data(), deflated.size(), decoded.data(), source.size() + 1))
+		{
+			return false;
+		}
+
+		// Truncated streams refused, corrupt ones decoded to something or refused, in bounds.
+		if (!source.empty() && (LzwDecode(lzw.data(), lzw.size() / 2, decoded.data(), source.size()) ||
+			Inflate(deflated.data(), deflated.size() / 2, decoded.data(), source.size())))
+		{
+			return false;
+		}
+		for (uint32_t i = 0; i < 20; ++i)
+		{
+			std::vector<uint8_t> corrupt = i % 2 == 0 ? lzw : deflated;
+			corrupt[random((uint32_t)corrupt.size())] ^= (uint8_t)(1 + random(255));
+			std::vector<uint8_t> exact(source.size());
+			if (i % 2 == 0)
+			{
+				LzwDecode(corrupt.data(), corrupt.size(), exact.data(), exact.size());
+			}
+			else
+			{
+				Inflate(corrupt.data(), corrupt.size(), exact.data(), exact.size());
+			}
+		}
+	}
+	// zlib at level 9, dynamic blocks, of 1500 bytes of a repeating phrase.
+	const uint8_t zlibStream[] = {
+		0x78, 0xDA, 0xB5, 0xD4, 0x37, 0x0E, 0x04, 0x21, 0x10, 0x44, 0xD1, 0xAB, 0x60, 0x2E, 0xB6, 0x06, 0xEF, 0x1A, 0xE8, 0x31, 0xD7, 0xDF,
+		0x6C, 0x12, 0x44, 0xB0, 0xA2, 0xC9, 0x5F, 0xF4, 0x55, 0x2A, 0x3C, 0xBA, 0xAF, 0xC8, 0xDE, 0x45, 0xB1, 0xC3, 0x27, 0x8D, 0x0C, 0x0C,
+		0xCB, 0x00, 0x85, 0x39, 0xED, 0xAD, 0x3B, 0x90, 0xE1, 0x22, 0xE8, 0xBC, 0x9F, 0xE8, 0x5A, 0xE7, 0x2F, 0xD0, 0xFC, 0x74, 0x59, 0x75,
+		0x5E, 0x2C, 0x4F, 0xA5, 0x00, 0xF7, 0xCA, 0x19, 0x7F, 0xAE, 0x82, 0x70, 0x35, 0xD1, 0xAE, 0x1A, 0x7B, 0x13, 0xDF, 0x64, 0xC4, 0x15,
+		0x8B, 0x6D, 0x22, 0x2B, 0x01, 0x39, 0x27, 0x11, 0x6C, 0xD4, 0xAB, 0x20, 0xA8, 0x78, 0x57, 0x59, 0xEF, 0x16, 0xB0, 0xCA, 0x4F, 0xB6,
+		0xF2, 0x0E, 0x60, 0xAA, 0x4C, 0x5A, 0x96, 0x94, 0xB2, 0x8C, 0x66, 0x15, 0x50, 0xA5, 0x9E, 0x02, 0xAA, 0xD4, 0x53, 0x40, 0x95, 0x7A,
+		0x0A, 0xA8, 0x52, 0x4F, 0x01, 0xF5, 0xEC, 0x07, 0x40, 0x3D, 0xFB, 0x01, 0x50, 0xCF, 0x7E, 0x00, 0xD4, 0xB3, 0x1F, 0xC0, 0xAE, 0x0B,
+		0x7A, 0xC0, 0xAE, 0x0B, 0x7A, 0xC0, 0xAE, 0x0B, 0x7A, 0xC0, 0x5F, 0xA9, 0x7F, 0x87, 0xCA, 0x2C, 0xAA };
+	const char phrase[] = "strips and tiles of moon heights ";
+	std::vector<uint8_t> expected(1500);
+	for (uint32_t i = 0; i < 1500; ++i)
+	{
+		expected[i] = (uint8_t)(phrase[i % 33] ^ ((i / 97) & 3));
+	}
+	decoded.assign(1500, 0);
+	if (!Inflate(zlibStream, sizeof(zlibStream), decoded.data(), decoded.size()) || decoded != expected)
+	{
+		return false;
+	}
+
+	// A wrong checksum, and noise from the start, refused.
+	std::vector<uint8_t> badChecksum(zlibStream, zlibStream + sizeof(zlibStream));
+	badChecksum.back() ^= 1;
+	if (Inflate(badChecksum.data(), badChecksum.size(), decoded.data(), decoded.size()) ||
+		Inflate(sources[3].data(), 4096, decoded.data(), decoded.size()))
+	{
+		return false;
+	}
+	return true;
+}
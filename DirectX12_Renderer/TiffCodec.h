@@ -0,0 +1,26 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The compression schemes of TIFF strips and tiles: LZW as TIFF 6.0 has it, codes MSB first with
+// the code width growing one code early, and Deflate, the zlib streams libtiff and GDAL write.
+// Decoders fill exactly the bytes a strip or tile decodes to and return false on corrupt or short
+// streams. The encoders are for TiffWriter: LZW as every encoder writes it, Deflate with greedy
+// matches and fixed Huffman codes, or stored blocks where those do not pay. Portable, CPU only.
+class TiffCodec
+{
+public:
+	static bool LzwDecode(const uint8_t* input, size_t inputBytes, uint8_t* output, size_t outputBytes);
+	static void LzwEncode(const uint8_t* input, size_t inputBytes, std::vector<uint8_t>& output);
+
+	// Stored, fixed and dynamic Huffman blocks; the Adler-32 is checked when the stream has one.
+	static bool Inflate(const uint8_t* input, size_t inputBytes, uint8_t* output, size_t outputBytes);
+	static void Deflate(const uint8_t* input, size_t inputBytes, std::vector<uint8_t>& output);
+
+	// True if both round trip empty, short, repetitive and random data, LZW through its table
+	// resets, a zlib stream of dynamic blocks inflates to its source, and corrupt or truncated
+	// streams are refused without reading or writing out of bounds.
+	static bool Validate();
+};
@@ -0,0 +1,856 @@
+#include "TiffReader.h"
+#include "TiffCodec.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <utility>
+
+namespace
+{
+	enum TiffTag : uint16_t
+	{
+		IMAGE_WIDTH = 256,
+		IMAGE_LENGTH = 257,
+		BITS_PER_SAMPLE = 258,
+		COMPRESSION = 259,
+		STRIP_OFFSETS = 273,
+		SAMPLES_PER_PIXEL = 277,
+		ROWS_PER_STRIP = 278,
+		STRIP_BYTE_COUNTS = 279,
+		PLANAR_CONFIGURATION = 284,
+		PREDICTOR = 317,
+		TILE_WIDTH = 322,
+		TILE_LENGTH = 323,
+		TILE_OFFSETS = 324,
+		TILE_BYTE_COUNTS = 325,
+		SAMPLE_FORMAT = 339,
+		MODEL_PIXEL_SCALE = 33550,
+		MODEL_TIEPOINT = 33922,
+	};
+
+	enum TiffType : uint16_t
+	{
+		BYTE = 1,
+		SHORT = 3,
+		LONG = 4,
+		DOUBLE = 12,
+	};
+
+	const uint16_t COMPRESSION_NONE = 1;
+	const uint16_t COMPRESSION_LZW = 5;
+	const uint16_t COMPRESSION_DEFLATE = 8;
+	const uint16_t COMPRESSION_DEFLATE_OLD = 32946;
+	const uint16_t PLANAR_CHUNKY = 1;
+	const uint16_t PREDICTOR_NONE = 1;
+	const uint16_t PREDICTOR_HORIZONTAL = 2;
+	const uint16_t PREDICTOR_FLOAT = 3;
+	const uint16_t SAMPLE_UINT = 1;
+	const uint16_t SAMPLE_INT = 2;
+	const uint16_t SAMPLE_FLOAT = 3;
+
+	void SwapBytes(uint8_t* samples, size_t count, uint32_t bytesPerSample)
+	{
+		for (size_t i = 0; i < count; ++i)
+		{
+			std::reverse(samples + i * bytesPerSample, samples + (i + 1) * bytesPerSample);
+		}
+	}
+
+	// Horizontal differencing of a row of pixels, and its undoing, per sample of a pixel.
+	template<typename T>
+	void AccumulateRow(uint8_t* row, size_t sampleCount, uint32_t samplesPerPixel)
+	{
+		T* samples = reinterpret_cast<T*>(row);
+		for (size_t i = samplesPerPixel; i < sampleCount; ++i)
+		{
+			samples[i] = (T)(samples[i] + samples[i - samplesPerPixel]);
+		}
+	}
+
+	template<typename T>
+	void DifferenceRow(uint8_t* row, size_t sampleCount, uint32_t samplesPerPixel)
+	{
+		T* samples = reinterpret_cast<T*>(row);
+		for (size_t i = sampleCount; i-- > samplesPerPixel;)
+		{
+			samples[i] = (T)(samples[i] - samples[i - samplesPerPixel]);
+		}
+	}
+
+	void AccumulateRow(uint8_t* row, size_t sampleCount, uint32_t samplesPerPixel, uint32_t bytesPerSample)
+	{
+		switch (bytesPerSample)
+		{
+		case 1: AccumulateRow<uint8_t>(row, sampleCount, samplesPerPixel); break;
+		case 2: AccumulateRow<uint16_t>(row, sampleCount, samplesPerPixel); break;
+		default: AccumulateRow<uint32_t>(row, sampleCount, samplesPerPixel); break;
+		}
+	}
+
+	void DifferenceRow(uint8_t* row, size_t sampleCount, uint32_t samplesPerPixel, uint32_t bytesPerSample)
+	{
+		switch (bytesPerSample)
+		{
+		case 1: DifferenceRow<uint8_t>(row, sampleCount, samplesPerPixel); break;
+		case 2: DifferenceRow<uint16_t>(row, sampleCount, samplesPerPixel); break;
+		default: DifferenceRow<uint32_t>(row, sampleCount, samplesPerPixel); break;
+		}
+	}
+
+	// The floating point predictor stores a row as planes of the samples' bytes, most significant
+	// first, each byte differenced to the one a pixel before. Undone into native samples.
+	void AccumulateFloatRow(uint8_t* row, size_t sampleCount, uint32_t samplesPerPixel, std::vector<uint8_t>& planes)
+	{
+		const size_t bytes = sampleCount * 4;
+		planes.assign(row, row + bytes);
+		for (size_t i = samplesPerPixel; i < bytes; ++i)
+		{
+			planes[i] = (uint8_t)(planes[i] + planes[i - samplesPerPixel]);
+		}
+		for (size_t i = 0; i < sampleCount; ++i)
+		{
+			const uint32_t value = (uint32_t)planes[i] << 24 | (uint32_t)planes[sampleCount + i] << 16 |
+				(uint32_t)planes[2 * sampleCount + i] << 8 | planes[3 * sampleCount + i];
+			memcpy(row + i * 4, &value, 4);
+		}
+	}
+
+	void DifferenceFloatRow(uint8_t* row, size_t sampleCount, uint32_t samplesPerPixel, std::vector<uint8_t>& planes)
+	{
+		const size_t bytes = sampleCount * 4;
+		planes.resize(bytes);
+		for (size_t i = 0; i < sampleCount; ++i)
+		{
+			uint32_t value;
+			memcpy(&value, row + i * 4, 4);
+			for (uint32_t plane = 0; plane < 4; ++plane)
+			{
+				planes[plane * sampleCount + i] = (uint8_t)(value >> (24 - 8 * plane));
+			}
+		}
+		for (size_t i = bytes; i-- > samplesPerPixel;)
+		{
+			planes[i] = (uint8_t)(planes[i] - planes[i - samplesPerPixel]);
+		}
+		memcpy(row, planes.data(), bytes);
+	}
+
+	// A tag as it is written: integers of a type, or doubles.
+	struct Tag
+	{
+		Tag(uint16_t tag, uint16_t type, std::vector<uint32_t> values, std::vector<double> doubles = {})
+			: tag(tag), type(type), values(std::move(values)), doubles(std::move(doubles))
+		{
+		}
+
+		uint16_t tag;
+		uint16_t type;
+		std::vector<uint32_t> values;
+		std::vector<double> doubles;
+	};
+
+	// Extra tags of one SHORT value, which Validate writes over or besides those of the info.
+	struct TestTag
+	{
+		uint16_t tag;
+		uint32_t value;
+	};
+
+	// Integer or float samples, uncompressed in strips, as Validate varies them.
+	TiffInfo TestInfo(uint32_t width, uint32_t height, uint32_t samplesPerPixel, uint32_t bitsPerSample, bool floatSamples, bool signedSamples = false)
+	{
+		TiffInfo info = {};
+		info.width = width;
+		info.height = height;
+		info.samplesPerPixel = samplesPerPixel;
+		info.bitsPerSample = bitsPerSample;
+		info.floatSamples = floatSamples;
+		info.signedSamples = signedSamples;
+		info.compression = TiffCompression::NONE;
+		info.predictor = 1;
+		return info;
+	}
+
+	// One IFD after the pixels and the arrays the tags point to.
+	bool WriteTiff(const std::string& path, bool bigEndian, const TiffInfo& info, const uint8_t* pixels, const std::vector<TestTag>& extraTags)
+	{
+		std::vector<uint8_t> file;
+		auto put16 = [&](uint16_t value)
+		{
+			uint8_t bytes[2] = { (uint8_t)(value & 0xFF), (uint8_t)(value >> 8) };
+			if (bigEndian)
+			{
+				std::swap(bytes[0], bytes[1]);
+			}
+			file.insert(file.end(), bytes, bytes + 2);
+		};
+		auto put32 = [&](uint32_t value)
+		{
+			uint8_t bytes[4] = { (uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24) };
+			if (bigEndian)
+			{
+				std::reverse(bytes, bytes + 4);
+			}
+			file.insert(file.end(), bytes, bytes + 4);
+		};
+
+		file.push_back(bigEndian ? 'M' : 'I');
+		file.push_back(bigEndian ? 'M' : 'I');
+		put16(42);
+		put32(0);	// IFD offset, patched below
+
+		// Strips or tiles, predicted, in file byte order and compressed. Tiles past the edges of
+		// the image are padded with zeros.
+		const bool tiled = info.tileWidth != 0;
+		const uint32_t bytesPerSample = info.bitsPerSample / 8;
+		const size_t pixelBytes = (size_t)info.samplesPerPixel * bytesPerSample;
+		const size_t rowBytes = info.width * pixelBytes;
+		const uint32_t chunkWidth = tiled ? info.tileWidth : info.width;
+		const uint32_t chunkHeight = std::max(1u, std::min(info.tileHeight == 0 ? info.height : info.tileHeight, tiled ? UINT32_MAX : info.height));
+		const uint32_t across = (info.width + chunkWidth - 1) / chunkWidth;
+		const uint32_t down = (info.height + chunkHeight - 1) / chunkHeight;
+		const uint32_t predictor = info.compression == TiffCompression::NONE || info.predictor < PREDICTOR_HORIZONTAL ? PREDICTOR_NONE : info.predictor;
+		std::vector<uint32_t> offsets, counts;
+		std::vector<uint8_t> chunk, compressed, planes;
+		for (uint32_t chunkY = 0; chunkY < down; ++chunkY)
+		{
+			for (uint32_t chunkX = 0; chunkX < across; ++chunkX)
+			{
+				const uint32_t x0 = chunkX * chunkWidth;
+				const uint32_t y0 = chunkY * chunkHeight;
+				const uint32_t rows = tiled ? chunkHeight : std::min(chunkHeight, info.height - y0);
+				const size_t chunkRowBytes = chunkWidth * pixelBytes;
+				chunk.assign(rows * chunkRowBytes, 0);
+				for (uint32_t row = 0; row < rows && y0 + row < info.height; ++row)
+				{
+					memcpy(&chunk[row * chunkRowBytes], pixels + (y0 + row) * rowBytes + x0 * pixelBytes, std::min(chunkWidth, info.width - x0) * pixelBytes);
+				}
+				for (uint32_t row = 0; row < rows; ++row)
+				{
+					uint8_t* samples = &chunk[row * chunkRowBytes];
+					const size_t sampleCount = (size_t)chunkWidth * info.samplesPerPixel;
+					if (predictor == PREDICTOR_FLOAT)
+					{
+						DifferenceFloatRow(samples, sampleCount, info.samplesPerPixel, planes);
+						continue;
+					}
+					if (predictor == PREDICTOR_HORIZONTAL)
+					{
+						DifferenceRow(samples, sampleCount, info.samplesPerPixel, bytesPerSample);
+					}
+					if (bigEndian && bytesPerSample > 1)
+					{
+						SwapBytes(samples, sampleCount, bytesPerSample);
+					}
+				}
+
+				compressed.clear();
+				if (info.compression == TiffCompression::LZW)
+				{
+					TiffCodec::LzwEncode(chunk.data(), chunk.size(), compressed);
+				}
+				else if (info.compression == TiffCompression::DEFLATE)
+				{
+					TiffCodec::Deflate(chunk.data(), chunk.size(), compressed);
+				}
+				const std::vector<uint8_t>& data = info.compression == TiffCompression::NONE ? chunk : compressed;
+				offsets.push_back((uint32_t)file.size());
+				counts.push_back((uint32_t)data.size());
+				file.insert(file.end(), data.begin(), data.end());
+			}
+		}
+
+		const uint16_t compression = info.compression == TiffCompression::LZW ? COMPRESSION_LZW :
+			info.compression == TiffCompression::DEFLATE ? COMPRESSION_DEFLATE : COMPRESSION_NONE;
+		const uint16_t sampleFormat = info.floatSamples ? SAMPLE_FLOAT : info.signedSamples ? SAMPLE_INT : SAMPLE_UINT;
+		std::vector<Tag> tags = {
+			{ IMAGE_WIDTH, LONG, { info.width } }, { IMAGE_LENGTH, LONG, { info.height } },
+			{ BITS_PER_SAMPLE, SHORT, std::vector<uint32_t>(info.samplesPerPixel, info.bitsPerSample) }, { COMPRESSION, SHORT, { compression } },
+			{ SAMPLES_PER_PIXEL, SHORT, { info.samplesPerPixel } }, { PLANAR_CONFIGURATION, SHORT, { PLANAR_CHUNKY } },
+			{ SAMPLE_FORMAT, SHORT, { sampleFormat } } };
+		if (tiled)
+		{
+			tags.push_back({ TILE_WIDTH, LONG, { info.tileWidth } });
+			tags.push_back({ TILE_LENGTH, LONG, { chunkHeight } });
+			tags.push_back({ TILE_OFFSETS, LONG, offsets });
+			tags.push_back({ TILE_BYTE_COUNTS, LONG, counts });
+		}
+		else
+		{
+			tags.push_back({ ROWS_PER_STRIP, LONG, { chunkHeight } });
+			tags.push_back({ STRIP_OFFSETS, LONG, offsets });
+			tags.push_back({ STRIP_BYTE_COUNTS, LONG, counts });
+		}
+		if (predictor != PREDICTOR_NONE)
+		{
+			tags.push_back({ PREDICTOR, SHORT, { predictor } });
+		}
+		if (info.georeferenced)
+		{
+			tags.push_back({ MODEL_PIXEL_SCALE, DOUBLE, {}, std::vector<double>(info.pixelScale, info.pixelScale + 3) });
+			tags.push_back({ MODEL_TIEPOINT, DOUBLE, {}, std::vector<double>(info.tiepoint, info.tiepoint + 6) });
+		}
+		for (const TestTag& extra : extraTags)
+		{
+			auto same = std::find_if(tags.begin(), tags.end(), [&extra](const Tag& tag) { return tag.tag == extra.tag; });
+			Tag tag = { extra.tag, SHORT, { extra.value } };
+			if (same != tags.end())
+			{
+				*same = tag;
+			}
+			else
+			{
+				tags.push_back(tag);
+			}
+		}
+		std::sort(tags.begin(), tags.end(), [](const Tag& a, const Tag& b) { return a.tag < b.tag; });
+
+		// Values that do not fit in the four bytes of an entry go before the IFD.
+		std::vector<uint32_t> valuesAt(tags.size(), 0);
+		for (size_t t = 0; t < tags.size(); ++t)
+		{
+			const Tag& tag = tags[t];
+			const size_t count = tag.type == DOUBLE ? tag.doubles.size() : tag.values.size();
+			const size_t size = tag.type == DOUBLE ? 8 : tag.type == LONG ? 4 : 2;
+			if (count * size <= 4)
+			{
+				continue;
+			}
+			if (file.size() % 2)
+			{
+				file.push_back(0);
+			}
+			valuesAt[t] = (uint32_t)file.size();
+			for (uint32_t value : tag.values)
+			{
+				tag.type == LONG ? put32(value) : put16((uint16_t)value);
+			}
+			for (double value : tag.doubles)
+			{
+				uint64_t bits;
+				memcpy(&bits, &value, sizeof(bits));
+				const uint32_t low = (uint32_t)bits, high = (uint32_t)(bits >> 32);
+				put32(bigEndian ? high : low);
+				put32(bigEndian ? low : high);
+			}
+		}
+
+		if (file.size() % 2)
+		{
+			file.push_back(0);
+		}
+		const uint32_t ifd = (uint32_t)file.size();
+		put16((uint16_t)tags.size());
+		for (size_t t = 0; t < tags.size(); ++t)
+		{
+			const Tag& tag = tags[t];
+			put16(tag.tag);
+			put16(tag.type);
+			put32((uint32_t)(tag.type == DOUBLE ? tag.doubles.size() : tag.values.size()));
+			if (valuesAt[t] != 0)
+			{
+				put32(valuesAt[t]);
+			}
+			else if (tag.type == LONG)
+			{
+				put32(tag.values[0]);
+			}
+			else
+			{
+				// SHORT values sit in the first bytes of the value field.
+				put16((uint16_t)tag.values[0]);
+				put16(tag.values.size() > 1 ? (uint16_t)tag.values[1] : 0);
+			}
+		}
+		put32(0);
+
+		uint8_t bytes[4] = { (uint8_t)ifd, (uint8_t)(ifd >> 8), (uint8_t)(ifd >> 16), (uint8_t)(ifd >> 24) };
+		if (bigEndian)
+		{
+			std::reverse(bytes, bytes + 4);
+		}
+		std::copy(bytes, bytes + 4, file.begin() + 4);
+		std::ofstream out(path, std::ios::binary | std::ios::trunc);
+		out.write(reinterpret_cast<const char*>(file.data()), (std::streamsize)file.size());
+		return (bool)out;
+	}
+}
+
+TiffReader::TiffReader() :
+	m_info(),
+	m_bigEndian(false),
+	m_threads(0)
+{
+}
+
+uint16_t TiffReader::Read16(const uint8_t* bytes) const
+{
+	return m_bigEndian ? (uint16_t)(bytes[0] << 8 | bytes[1]) : (uint16_t)(bytes[1] << 8 | bytes[0]);
+}
+
+uint32_t TiffReader::Read32(const uint8_t* bytes) const
+{
+	return m_bigEndian ? (uint32_t)bytes[0] << 24 | bytes[1] << 16 | bytes[2] << 8 | bytes[3] :
+		(uint32_t)bytes[3] << 24 | bytes[2] << 16 | bytes[1] << 8 | bytes[0];
+}
+
+bool TiffReader::ReadValues(uint16_t type, uint32_t count, const uint8_t* inlineValue, std::vector<uint64_t>& values)
+{
+	const uint32_t size = type == SHORT ? 2 : type == LONG ? 4 : type == BYTE ? 1 : 0;
+	if (size == 0 || count == 0 || count > (1u << 28))
+	{
+		return false;
+	}
+
+	// Values that fit in the four bytes of the entry are stored there.
+	std::vector<uint8_t> bytes((size_t)count * size);
+	if (bytes.size() <= 4)
+	{
+		memcpy(bytes.data(), inlineValue, bytes.size());
+	}
+	else
+	{
+		const std::streampos resume = m_file.tellg();
+		m_file.seekg(Read32(inlineValue));
+		m_file.read(reinterpret_cast<char*>(bytes.data()), (std::streamsize)bytes.size());
+		m_file.seekg(resume);
+	}
+
+	values.resize(count);
+	for (uint32_t i = 0; i < count; ++i)
+	{
+		const uint8_t* value = &bytes[(size_t)i * size];
+		values[i] = size == 4 ? Read32(value) : size == 2 ? Read16(value) : *value;
+	}
+	return (bool)m_file;
+}
+
+bool TiffReader::ReadDoubles(uint16_t type, uint32_t count, const uint8_t* inlineValue, double* values, uint32_t capacity)
+{
+	// Never inline: a double is larger than the value field.
+	if (type != DOUBLE || count < capacity || count > (1u << 20))
+	{
+		return false;
+	}
+	std::vector<uint8_t> bytes((size_t)capacity * 8);
+	const std::streampos resume = m_file.tellg();
+	m_file.seekg(Read32(inlineValue));
+	m_file.read(reinterpret_cast<char*>(bytes.data()), (std::streamsize)bytes.size());
+	m_file.seekg(resume);
+	for (uint32_t i = 0; i < capacity; ++i)
+	{
+		const uint64_t first = Read32(&bytes[i * 8]), second = Read32(&bytes[i * 8 + 4]);
+		const uint64_t bits = m_bigEndian ? first << 32 | second : second << 32 | first;
+		memcpy(&values[i], &bits, sizeof(double));
+	}
+	return (bool)m_file;
+}
+
+bool TiffReader::Open(const std::string& path)
+{
+	m_file.close();
+	m_file.clear();
+	m_info = {};
+	m_chunkOffsets.clear();
+	m_chunkBytes.clear();
+	m_path = path;
+
+	m_file.open(path, std::ios::binary);
+	uint8_t header[8];
+	if (!m_file.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != header[1] || (header[0] != 'I' && header[0] != 'M'))
+	{
+		return false;
+	}
+	m_bigEndian = header[0] == 'M';
+	if (Read16(header + 2) != 42)	// 43 is BigTIFF
+	{
+		return false;
+	}
+
+	uint8_t countBytes[2];
+	m_file.seekg(Read32(header + 4));
+	if (!m_file.read(reinterpret_cast<char*>(countBytes), sizeof(countBytes)))
+	{
+		return false;
+	}
+
+	uint16_t compression = COMPRESSION_NONE;
+	uint16_t planar = PLANAR_CHUNKY;
+	uint16_t sampleFormat = SAMPLE_UINT;
+	uint32_t rowsPerStrip = 0;
+	bool hasTiepoint = false, hasPixelScale = false;
+	std::vector<uint64_t> stripOffsets, stripBytes, tileOffsets, tileBytes;
+	m_info.samplesPerPixel = 1;
+	m_info.bitsPerSample = 1;
+	m_info.predictor = PREDICTOR_NONE;
+	const uint16_t entries = Read16(countBytes);
+	for (uint16_t e = 0; e < entries; ++e)
+	{
+		uint8_t entry[12];
+		if (!m_file.read(reinterpret_cast<char*>(entry), sizeof(entry)))
+		{
+			return false;
+		}
+		const uint16_t tag = Read16(entry);
+		if (tag == MODEL_TIEPOINT || tag == MODEL_PIXEL_SCALE)
+		{
+			bool& has = tag == MODEL_TIEPOINT ? hasTiepoint : hasPixelScale;
+			has = ReadDoubles(Read16(entry + 2), Read32(entry + 4), entry + 8, tag == MODEL_TIEPOINT ? m_info.tiepoint : m_info.pixelScale,
+				tag == MODEL_TIEPOINT ? 6 : 3);
+			continue;
+		}
+
+		std::vector<uint64_t> values;
+		if (!ReadValues(Read16(entry + 2), Read32(entry + 4), entry + 8, values))
+		{
+			// Tags of other types are not needed.
+			if (!m_file)
+			{
+				return false;
+			}
+			continue;
+		}
+
+		switch (tag)
+		{
+		case IMAGE_WIDTH: m_info.width = (uint32_t)values[0]; break;
+		case IMAGE_LENGTH: m_info.height = (uint32_t)values[0]; break;
+		case BITS_PER_SAMPLE:
+			m_info.bitsPerSample = (uint32_t)values[0];
+			if (std::count(values.begin(), values.end(), values[0]) != (std::ptrdiff_t)values.size())
+			{
+				return false;
+			}
+			break;
+		case COMPRESSION: compression = (uint16_t)values[0]; break;
+		case STRIP_OFFSETS: stripOffsets = values; break;
+		case SAMPLES_PER_PIXEL: m_info.samplesPerPixel = (uint32_t)values[0]; break;
+		case ROWS_PER_STRIP: rowsPerStrip = (uint32_t)values[0]; break;
+		case STRIP_BYTE_COUNTS: stripBytes = values; break;
+		case PLANAR_CONFIGURATION: planar = (uint16_t)values[0]; break;
+		case PREDICTOR: m_info.predictor = (uint32_t)values[0]; break;
+		case TILE_WIDTH: m_info.tileWidth = (uint32_t)values[0]; break;
+		case TILE_LENGTH: m_info.tileHeight = (uint32_t)values[0]; break;
+		case TILE_OFFSETS: tileOffsets = values; break;
+		case TILE_BYTE_COUNTS: tileBytes = values; break;
+		case SAMPLE_FORMAT: sampleFormat = (uint16_t)values[0]; break;
+		}
+	}
+
+	m_info.floatSamples = sampleFormat == SAMPLE_FLOAT;
+	m_info.signedSamples = sampleFormat == SAMPLE_INT;
+	m_info.georeferenced = hasTiepoint && hasPixelScale;
+	m_info.compression = compression == COMPRESSION_LZW ? TiffCompression::LZW :
+		compression == COMPRESSION_DEFLATE || compression == COMPRESSION_DEFLATE_OLD ? TiffCompression::DEFLATE : TiffCompression::NONE;
+	uint64_t chunks;
+	if (m_info.tileWidth != 0)
+	{
+		if (m_info.tileHeight == 0)
+		{
+			return false;
+		}
+		chunks = (uint64_t)((m_info.width + m_info.tileWidth - 1) / m_info.tileWidth) * ((m_info.height + m_info.tileHeight - 1) / m_info.tileHeight);
+		m_chunkOffsets.swap(tileOffsets);
+		m_chunkBytes.swap(tileBytes);
+	}
+	else
+	{
+		m_info.tileHeight = rowsPerStrip == 0 || rowsPerStrip > m_info.height ? m_info.height : rowsPerStrip;
+		chunks = m_info.height == 0 ? 0 : (m_info.height + (uint64_t)m_info.tileHeight - 1) / m_info.tileHeight;
+		m_chunkOffsets.swap(stripOffsets);
+		m_chunkBytes.swap(stripBytes);
+	}
+
+	const bool integerBits = m_info.bitsPerSample == 8 || m_info.bitsPerSample == 16 || m_info.bitsPerSample == 32;
+	const bool supportedSamples = sampleFormat == SAMPLE_UINT || sampleFormat == SAMPLE_INT ? integerBits :
+		sampleFormat == SAMPLE_FLOAT && m_info.bitsPerSample == 32;
+	const bool supportedCompression = compression == COMPRESSION_NONE || m_info.compression != TiffCompression::NONE;
+	const bool supportedPredictor = m_info.predictor == PREDICTOR_NONE || m_info.predictor == PREDICTOR_HORIZONTAL ||
+		(m_info.predictor == PREDICTOR_FLOAT && m_info.floatSamples);
+	return m_info.width > 0 && m_info.height > 0 && m_info.samplesPerPixel >= 1 && m_info.samplesPerPixel <= 4 &&
+		supportedSamples && supportedCompression && supportedPredictor && (planar == PLANAR_CHUNKY || m_info.samplesPerPixel == 1) &&
+		m_chunkOffsets.size() == chunks && m_chunkBytes.size() == chunks;
+}
+
+bool TiffReader::ReadRows(uint8_t* destination, size_t rowPitch)
+{
+	return ReadRows(destination, rowPitch, 0, m_info.height);
+}
+
+bool TiffReader::ReadRows(uint8_t* destination, size_t rowPitch, uint32_t firstRow, uint32_t rowCount)
+{
+	if (rowCount == 0 || firstRow >= m_info.height || rowCount > m_info.height - firstRow || m_chunkOffsets.empty())
+	{
+		return rowCount == 0;
+	}
+
+	// The strips, or the rows of tiles, that hold the band are consecutive chunks.
+	const uint32_t across = m_info.tileWidth != 0 ? (m_info.width + m_info.tileWidth - 1) / m_info.tileWidth : 1;
+	const uint32_t firstChunk = firstRow / m_info.tileHeight * across;
+	const uint32_t endChunk = ((firstRow + rowCount - 1) / m_info.tileHeight + 1) * across;
+	uint32_t threads = m_threads != 0 ? m_threads : std::max(1u, std::thread::hardware_concurrency());
+	threads = std::min(threads, endChunk - firstChunk);
+
+	if (threads == 1)
+	{
+		Scratch scratch;
+		for (uint32_t chunk = firstChunk; chunk < endChunk; ++chunk)
+		{
+			if (!ReadChunk(m_file, chunk, destination, rowPitch, firstRow, rowCount, scratch))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Chunks are taken in order by whichever thread is free, as their sizes vary with what they hold.
+	std::atomic<uint32_t> next(firstChunk);
+	std::atomic<bool> failed(false);
+	auto decode = [&]()
+	{
+		std::ifstream file(m_path, std::ios::binary);
+		Scratch scratch;
+		for (uint32_t chunk = next++; chunk < endChunk && !failed; chunk = next++)
+		{
+			if (!file || !ReadChunk(file, chunk, destination, rowPitch, firstRow, rowCount, scratch))
+			{
+				failed = true;
+			}
+		}
+	};
+	std::vector<std::thread> workers;
+	for (uint32_t t = 0; t < threads; ++t)
+	{
+		workers.emplace_back(decode);
+	}
+	for (std::thread& worker : workers)
+	{
+		worker.join();
+	}
+	return !failed;
+}
+
+bool TiffReader::ReadChunk(std::ifstream& file, uint32_t chunk, uint8_t* destination, size_t rowPitch, uint32_t firstRow, uint32_t rowCount,
+	Scratch& scratch) const
+{
+	const bool tiled = m_info.tileWidth != 0;
+	const uint32_t across = tiled ? (m_info.width + m_info.tileWidth - 1) / m_info.tileWidth : 1;
+	const uint32_t x0 = chunk % across * m_info.tileWidth;
+	const uint32_t y0 = chunk / across * m_info.tileHeight;
+	const uint32_t chunkWidth = tiled ? m_info.tileWidth : m_info.width;
+	const uint32_t chunkRows = tiled ? m_info.tileHeight : std::min(m_info.tileHeight, m_info.height - y0);
+	const uint32_t bytesPerSample = m_info.bitsPerSample / 8;
+	const size_t pixelBytes = (size_t)m_info.samplesPerPixel * bytesPerSample;
+	const size_t chunkRowBytes = chunkWidth * pixelBytes;
+	const size_t chunkBytes = chunkRows * chunkRowBytes;
+	const size_t rowBytes = GetRowBytes();
+
+	// The rows of the chunk in the band, and the columns in the image.
+	const uint32_t rowBegin = std::max(y0, firstRow);
+	const uint32_t rowEnd = std::min(y0 + chunkRows, std::min(firstRow + rowCount, m_info.height));
+	const size_t copyBytes = std::min(chunkWidth, m_info.width - x0) * pixelBytes;
+	auto out = [&](uint32_t row) { return destination + (row - firstRow) * rowPitch + x0 * pixelBytes; };
+
+	if (m_info.compression == TiffCompression::NONE && !tiled)
+	{
+		// Rows of an uncompressed strip are read straight into place, unless they need swapping.
+		if (m_chunkBytes[chunk] < chunkBytes)
+		{
+			return false;
+		}
+		const bool swap = m_bigEndian && bytesPerSample > 1;
+		if (swap)
+		{
+			scratch.decoded.resize(rowBytes);
+		}
+		file.seekg((std::streamoff)(m_chunkOffsets[chunk] + (rowBegin - y0) * rowBytes));
+		for (uint32_t row = rowBegin; row < rowEnd; ++row)
+		{
+			uint8_t* samples = swap ? scratch.decoded.data() : out(row);
+			if (!file.read(reinterpret_cast<char*>(samples), (std::streamsize)rowBytes))
+			{
+				return false;
+			}
+			if (swap)
+			{
+				SwapBytes(samples, rowBytes / bytesPerSample, bytesPerSample);
+				memcpy(out(row), samples, rowBytes);
+			}
+		}
+		return true;
+	}
+
+	// Compressed chunks decode into scratch memory, as inflating reads back what it has written
+	// and the predictors rewrite it, and only the finished rows go to the destination.
+	scratch.decoded.resize(chunkBytes);
+	uint8_t* decoded = scratch.decoded.data();
+
+	if (m_info.compression == TiffCompression::NONE)
+	{
+		file.seekg((std::streamoff)m_chunkOffsets[chunk]);
+		if (m_chunkBytes[chunk] < chunkBytes || !file.read(reinterpret_cast<char*>(decoded), (std::streamsize)chunkBytes))
+		{
+			return false;
+		}
+	}
+	else
+	{
+		if (m_chunkBytes[chunk] > (1u << 31))
+		{
+			return false;
+		}
+		scratch.compressed.resize((size_t)m_chunkBytes[chunk]);
+		file.seekg((std::streamoff)m_chunkOffsets[chunk]);
+		if (!file.read(reinterpret_cast<char*>(scratch.compressed.data()), (std::streamsize)scratch.compressed.size()))
+		{
+			return false;
+		}
+		const bool lzw = m_info.compression == TiffCompression::LZW;
+		if (!(lzw ? TiffCodec::LzwDecode : TiffCodec::Inflate)(scratch.compressed.data(), scratch.compressed.size(), decoded, chunkBytes))
+		{
+			return false;
+		}
+	}
+
+	// Samples to native order, then the predictor undone; the floating point one does both.
+	const size_t sampleCount = (size_t)chunkWidth * m_info.samplesPerPixel;
+	for (uint32_t row = 0; row < chunkRows; ++row)
+	{
+		uint8_t* samples = decoded + row * chunkRowBytes;
+		if (m_info.predictor == PREDICTOR_FLOAT)
+		{
+			AccumulateFloatRow(samples, sampleCount, m_info.samplesPerPixel, scratch.planes);
+			continue;
+		}
+		if (m_bigEndian && bytesPerSample > 1)
+		{
+			SwapBytes(samples, sampleCount, bytesPerSample);
+		}
+		if (m_info.predictor == PREDICTOR_HORIZONTAL)
+		{
+			AccumulateRow(samples, sampleCount, m_info.samplesPerPixel, bytesPerSample);
+		}
+	}
+
+	for (uint32_t row = rowBegin; row < rowEnd; ++row)
+	{
+		memcpy(out(row), decoded + (row - y0) * chunkRowBytes, copyBytes);
+	}
+	return true;
+}
+
+bool TiffWriter::Write(const std::string& path, const TiffInfo& info, const uint8_t* pixels, bool bigEndian)
+{
+	return WriteTiff(path, bigEndian, info, pixels, {});
+}
+
+bool TiffReader::Validate()
+{
+	const std::string path = "TiffReaderValidate.tif";
+
+	// 16-bit gray, RGB8, float, signed 16-bit and two 32-bit samples, uncompressed, LZW and
+	// Deflate, in strips and in tiles that do not divide the image, with and without the
+	// predictors, in both byte orders, read into rows with padding.
+	const TiffInfo layouts[5] = { TestInfo(37, 23, 1, 16, false), TestInfo(29, 11, 3, 8, false), TestInfo(17, 9, 1, 32, true),
+		TestInfo(21, 14, 1, 16, false, true), TestInfo(13, 19, 2, 32, false) };
+	const uint32_t rowsPerStrip[5] = { 5, 11, 4, 3, 19 };
+	struct Storage
+	{
+		TiffCompression compression;
+		uint32_t predictor;
+		bool tiled;
+	};
+	const Storage storages[6] = { { TiffCompression::NONE, 1, false }, { TiffCompression::NONE, 1, true }, { TiffCompression::LZW, 1, false },
+		{ TiffCompression::LZW, 2, true }, { TiffCompression::DEFLATE, 2, false }, { TiffCompression::DEFLATE, 1, true } };
+	bool valid = true;
+	for (int layout = 0; valid && layout < 5; ++layout)
+	{
+		const size_t rowBytes = (size_t)layouts[layout].width * layouts[layout].samplesPerPixel * layouts[layout].bitsPerSample / 8;
+		std::vector<uint8_t> pixels(rowBytes * layouts[layout].height);
+		for (size_t i = 0; i < pixels.size(); ++i)
+		{
+			pixels[i] = (uint8_t)(i * 2654435761u >> 13);
+		}
+		if (layouts[layout].floatSamples)
+		{
+			for (size_t i = 0; i < pixels.size(); i += 4)
+			{
+				float value = -1200.5f + (float)i * 3.25f;
+				memcpy(&pixels[i], &value, sizeof(value));
+			}
+		}
+
+		for (int storage = 0; valid && storage < 6; ++storage)
+		{
+			for (int bigEndian = 0; valid && bigEndian < 2; ++bigEndian)
+			{
+				// Floats take the floating point predictor.
+				TiffInfo info = layouts[layout];
+				info.compression = storages[storage].compression;
+				info.predictor = storages[storage].predictor == 2 && info.floatSamples ? 3 : storages[storage].predictor;
+				info.tileWidth = storages[storage].tiled ? 16 : 0;
+				info.tileHeight = storages[storage].tiled ? 16 : rowsPerStrip[layout];
+				TiffReader reader;
+				valid = TiffWriter::Write(path, info, pixels.data(), bigEndian != 0) && reader.Open(path);
+				const TiffInfo& read = reader.GetInfo();
+				valid = valid && read.width == info.width && read.height == info.height && read.samplesPerPixel == info.samplesPerPixel &&
+					read.bitsPerSample == info.bitsPerSample && read.floatSamples == info.floatSamples && read.signedSamples == info.signedSamples &&
+					read.compression == info.compression && read.tileWidth == info.tileWidth && read.tileHeight == info.tileHeight &&
+					(read.predictor == info.predictor || info.compression == TiffCompression::NONE) && !read.georeferenced;
+
+				// Whole on one thread and on four, then a band that starts and ends inside chunks.
+				const size_t pitch = rowBytes + 12;
+				for (uint32_t threads = 1; valid && threads <= 4; threads += 3)
+				{
+					std::vector<uint8_t> rows(pitch * info.height, 0xCD);
+					reader.SetThreads(threads);
+					valid = reader.ReadRows(rows.data(), pitch);
+					for (uint32_t y = 0; valid && y < info.height; ++y)
+					{
+						valid = memcmp(&rows[y * pitch], &pixels[y * rowBytes], rowBytes) == 0 && rows[y * pitch + rowBytes] == 0xCD;
+					}
+				}
+				const uint32_t firstRow = 2, rowCount = info.height - 4;
+				std::vector<uint8_t> band(rowBytes * rowCount);
+				valid = valid && reader.ReadRows(band.data(), rowBytes, firstRow, rowCount) &&
+					memcmp(band.data(), &pixels[firstRow * rowBytes], band.size()) == 0 &&
+					!reader.ReadRows(band.data(), rowBytes, firstRow, info.height);
+			}
+		}
+	}
+
+	// GeoTIFF tags round trip.
+	TiffInfo geo = TestInfo(8, 8, 1, 32, true);
+	geo.georeferenced = true;
+	const double tiepoint[6] = { 0.0, 0.0, 0.0, -180.0, 90.0, 0.0 };
+	const double pixelScale[3] = { 45.0, 22.5, 0.5 };
+	std::copy(tiepoint, tiepoint + 6, geo.tiepoint);
+	std::copy(pixelScale, pixelScale + 3, geo.pixelScale);
+	std::vector<uint8_t> pixels(8 * 8 * 4);
+	TiffReader reader;
+	for (int bigEndian = 0; bigEndian < 2; ++bigEndian)
+	{
+		valid = valid && WriteTiff(path, bigEndian != 0, geo, pixels.data(), {}) && reader.Open(path) && reader.GetInfo().georeferenced &&
+			std::equal(tiepoint, tiepoint + 6, reader.GetInfo().tiepoint) && std::equal(pixelScale, pixelScale + 3, reader.GetInfo().pixelScale);
+	}
+
+	// JPEG, planar RGB, 12-bit samples and the floating point predictor on integers are refused.
+	const TiffInfo rgb = TestInfo(8, 8, 3, 8, false);
+	WriteTiff(path, false, rgb, pixels.data(), { { COMPRESSION, 7 } });
+	valid = valid && !reader.Open(path);
+	WriteTiff(path, false, rgb, pixels.data(), { { PLANAR_CONFIGURATION, 2 } });
+	valid = valid && !reader.Open(path);
+	WriteTiff(path, false, rgb, pixels.data(), { { BITS_PER_SAMPLE, 12 } });
+	valid = valid && !reader.Open(path);
+	WriteTiff(path, false, rgb, pixels.data(), { { COMPRESSION, COMPRESSION_LZW }, { PREDICTOR, PREDICTOR_FLOAT } });
+	valid = valid && !reader.Open(path);
+	WriteTiff(path, false, rgb, pixels.data(), {});
+	valid = valid && reader.Open(path);
+
+	reader = TiffReader();
+	std::remove(path.c_str());
+	return valid;
+}
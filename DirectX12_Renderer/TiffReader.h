@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// How the strips or tiles of a TIFF file are compressed.
+enum class TiffCompression : uint32_t
+{
+	NONE,
+	LZW,
+	DEFLATE,	// zlib streams, as Adobe Deflate or the older Deflate code
+};
+
+// Sample layout of a TIFF image, and how the file stores it.
+struct TiffInfo
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t samplesPerPixel;
+	uint32_t bitsPerSample;		// 8, 16 or 32
+	bool floatSamples;			// 32-bit IEEE floats, as the elevation maps store them
+	bool signedSamples;			// two's complement integers, as some elevation models store them
+	TiffCompression compression;
+	uint32_t predictor;			// 2 for horizontal differencing, 3 for floating point; none otherwise
+	uint32_t tileWidth;			// 0 for strips
+	uint32_t tileHeight;		// rows of a tile, or of a strip
+	bool georeferenced;			// has the GeoTIFF tiepoint and pixel scale below
+	double tiepoint[6];			// raster I, J, K and the model X, Y, Z there
+	double pixelScale[3];		// model units per pixel along X, Y and Z
+};
+
+// TIFF reader for the maps TileBaker bakes and Terrain loads: the first image of a file, in
+// strips or tiles, uncompressed, LZW or Deflate, with or without a predictor, of interleaved
+// integer or float samples in either byte order. Strips and tiles are decoded in parallel, each
+// thread with its own handle on the file, straight into the caller's rows, which are only
+// written, so they may be mapped upload memory. Portable, unlike the WIC path of the renderer;
+// BigTIFF is not read.
+class TiffReader
+{
+public:
+	TiffReader();
+
+	bool Open(const std::string& path);
+	const TiffInfo& GetInfo() const { return m_info; }
+	size_t GetRowBytes() const { return (size_t)m_info.width * m_info.samplesPerPixel * m_info.bitsPerSample / 8; }
+
+	// Threads ReadRows decodes on; 0, the default, for one per core.
+	void SetThreads(uint32_t threads) { m_threads = threads; }
+
+	// Rows of a strip or of a row of tiles. Bands of a multiple of this many rows, starting on a
+	// multiple of it, decode every strip or tile once.
+	uint32_t GetBandRows() const { return m_info.tileHeight; }
+
+	// Reads every row into destination, rowPitch bytes apart, with samples in native byte order.
+	bool ReadRows(uint8_t* destination, size_t rowPitch);
+
+	// The same for rowCount rows from firstRow; destination holds the first of them.
+	bool ReadRows(uint8_t* destination, size_t rowPitch, uint32_t firstRow, uint32_t rowCount);
+
+	// True if generated files of every layout, compression and predictor, in strips and tiles
+	// and both byte orders, read back whole and in bands on one thread or several, and ones
+	// this reader cannot read are refused.
+	static bool Validate();
+
+private:
+	// Scratch memory of one decoding thread.
+	struct Scratch
+	{
+		std::vector<uint8_t> compressed;
+		std::vector<uint8_t> decoded;
+		std::vector<uint8_t> planes;
+	};
+
+	bool ReadValues(uint16_t type, uint32_t count, const uint8_t* inlineValue, std::vector<uint64_t>& values);
+	bool ReadDoubles(uint16_t type, uint32_t count, const uint8_t* inlineValue, double* values, uint32_t capacity);
+	uint32_t Read32(const uint8_t* bytes) const;
+	uint16_t Read16(const uint8_t* bytes) const;
+
+	// Decodes strip or tile chunk and copies what it holds of rows firstRow .. firstRow + rowCount - 1.
+	bool ReadChunk(std::ifstream& file, uint32_t chunk, uint8_t* destination, size_t rowPitch, uint32_t firstRow, uint32_t rowCount,
+		Scratch& scratch) const;
+
+	std::string m_path;
+	std::ifstream m_file;
+	TiffInfo m_info;
+	bool m_bigEndian;
+	uint32_t m_threads;
+	std::vector<uint64_t> m_chunkOffsets;	// of the strips, or of the tiles row by row
+	std::vector<uint64_t> m_chunkBytes;
+};
+
+// Writes the files TiffReader reads, for tests and benchmarks, and for maps the tools derive.
+class TiffWriter
+{
+public:
+	// pixels holds the rows of the image packed, with samples in native byte order. Strips of
+	// info.tileHeight rows, or tiles when info.tileWidth is set, are compressed and predicted as
+	// info says, and the GeoTIFF tags written when it is georeferenced.
+	static bool Write(const std::string& path, const TiffInfo& info, const uint8_t* pixels, bool bigEndian);
+};
@@ -0,0 +1,633 @@
+#include "TileArchive.h"
+#include "Parallel.h"
+#include <cstdio>
+#include <cstring>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	const char ARCHIVE_MAGIC[4] = { 'V', 'T', 'A', 'R' };
+	const uint32_t ARCHIVE_VERSION = 1;
+
+	// Little endian, as every platform the renderer and TileBaker run on.
+	struct TileArchiveHeader
+	{
+		char magic[4];
+		uint32_t version;
+		uint32_t tileSize;
+		uint32_t border;
+		uint32_t mapCount;
+		uint32_t reserved;
+		uint64_t tileCount;
+		uint64_t mapsOffset;	// MapEntry[mapCount]
+		uint64_t tilesOffset;	// TileEntry[tileCount]
+	};
+
+	uint64_t AlignUp(uint64_t offset, uint64_t alignment)
+	{
+		return (offset + alignment - 1) / alignment * alignment;
+	}
+
+	void PutVarint(uint32_t value, std::vector<uint8_t>& out)
+	{
+		while (value >= 0x80)
+		{
+			out.push_back((uint8_t)(value | 0x80));
+			value >>= 7;
+		}
+		out.push_back((uint8_t)value);
+	}
+
+	bool GetVarint(const uint8_t*& data, const uint8_t* end, uint32_t& value)
+	{
+		value = 0;
+		for (uint32_t shift = 0; shift < 32 && data < end; shift += 7)
+		{
+			uint8_t byte = *data++;
+			value |= (uint32_t)(byte & 0x7F) << shift;
+			if (!(byte & 0x80))
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Small differences either way become small symbols: 0, -1, 1, -2, ... -> 0, 1, 2, 3, ...
+	uint32_t ZigZag(uint32_t difference, uint32_t bits)
+	{
+		const uint32_t mask = (1u << bits) - 1;
+		difference &= mask;
+		return ((difference << 1) ^ (0u - (difference >> (bits - 1)))) & mask;
+	}
+
+	uint32_t UnZigZag(uint32_t symbol)
+	{
+		return (symbol >> 1) ^ (0u - (symbol & 1));
+	}
+
+	// Index of the texel a texel is predicted from: the one to its left, or above it at the
+	// start of a row. The first texel has none.
+	uint32_t PredictorOf(uint32_t texel, uint32_t size)
+	{
+		return texel % size != 0 ? texel - 1 : texel - size;
+	}
+
+	// Nonzero symbols as varints, runs of zero symbols as one varint; the low bit tells them apart.
+	class SymbolWriter
+	{
+	public:
+		explicit SymbolWriter(std::vector<uint8_t>& out) : m_out(out), m_zeros(0) {}
+
+		void Put(uint32_t symbol)
+		{
+			if (symbol == 0)
+			{
+				++m_zeros;
+				return;
+			}
+			Flush();
+			PutVarint(symbol << 1, m_out);
+		}
+
+		void Flush()
+		{
+			if (m_zeros > 0)
+			{
+				PutVarint(m_zeros << 1 | 1, m_out);
+				m_zeros = 0;
+			}
+		}
+
+	private:
+		std::vector<uint8_t>& m_out;
+		uint32_t m_zeros;
+	};
+
+	class SymbolReader
+	{
+	public:
+		SymbolReader(const uint8_t* data, size_t bytes) : m_data(data), m_end(data + bytes), m_zeros(0) {}
+
+		bool Get(uint32_t limit, uint32_t& symbol)
+		{
+			symbol = 0;
+			if (m_zeros > 0)
+			{
+				--m_zeros;
+				return true;
+			}
+			uint32_t token;
+			if (!GetVarint(m_data, m_end, token) || token >> 1 == 0)
+			{
+				return false;
+			}
+			if (token & 1)
+			{
+				m_zeros = (token >> 1) - 1;
+				return true;
+			}
+			symbol = token >> 1;
+			return symbol <= limit;
+		}
+
+		bool AtEnd() const { return m_data == m_end && m_zeros == 0; }
+
+	private:
+		const uint8_t* m_data;
+		const uint8_t* m_end;
+		uint32_t m_zeros;
+	};
+}
+
+const uint32_t TileArchive::TILE_ALIGNMENT;
+
+TileArchive::TileArchive() :
+	m_view(nullptr),
+	m_size(0),
+	m_maps(nullptr),
+	m_tiles(nullptr),
+#ifdef _WIN32
+	m_file(INVALID_HANDLE_VALUE),
+	m_mapping(nullptr)
+#else
+	m_file(-1)
+#endif
+{
+}
+
+TileArchive::~TileArchive()
+{
+	Close();
+}
+
+bool TileArchive::Open(const std::string& path)
+{
+	Close();
+
+#ifdef _WIN32
+	m_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	LARGE_INTEGER size;
+	if (m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_file, &size) || size.QuadPart < (LONGLONG)sizeof(TileArchiveHeader))
+	{
+		Close();
+		return false;
+	}
+	m_size = (uint64_t)size.QuadPart;
+	m_mapping = CreateFileMappingA(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	m_view = m_mapping ? static_cast<const uint8_t*>(MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0)) : nullptr;
+#else
+	m_file = open(path.c_str(), O_RDONLY);
+	struct stat status;
+	if (m_file < 0 || fstat(m_file, &status) != 0 || status.st_size < (off_t)sizeof(TileArchiveHeader))
+	{
+		Close();
+		return false;
+	}
+	m_size = (uint64_t)status.st_size;
+	void* view = mmap(nullptr, (size_t)m_size, PROT_READ, MAP_SHARED, m_file, 0);
+	m_view = view != MAP_FAILED ? static_cast<const uint8_t*>(view) : nullptr;
+#endif
+	if (!m_view)
+	{
+		Close();
+		return false;
+	}
+
+	// Only the header and the map table are checked; tiles are checked as they are read.
+	const TileArchiveHeader& header = *reinterpret_cast<const TileArchiveHeader*>(m_view);
+	if (memcmp(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 || header.version != ARCHIVE_VERSION ||
+		header.tileSize != TilePyramid::TILE_SIZE || header.border != TilePyramid::BORDER ||
+		header.mapsOffset % 8 != 0 || header.mapsOffset > m_size || header.mapCount > (m_size - header.mapsOffset) / sizeof(MapEntry) ||
+		header.tilesOffset % 8 != 0 || header.tilesOffset > m_size || header.tileCount > (m_size - header.tilesOffset) / sizeof(TileEntry))
+	{
+		Close();
+		return false;
+	}
+	m_maps = reinterpret_cast<const MapEntry*>(m_view + header.mapsOffset);
+	m_tiles = reinterpret_cast<const TileEntry*>(m_view + header.tilesOffset);
+
+	m_levels.resize(header.mapCount);
+	for (uint32_t i = 0; i < header.mapCount; ++i)
+	{
+		const MapEntry& map = m_maps[i];
+		if (map.name[sizeof(map.name) - 1] != 0 || map.width == 0 || map.height == 0 || map.format > TileFormat::R8G8B8A8_UNORM)
+		{
+			Close();
+			return false;
+		}
+		TilePyramid::Layout(map.width, map.height, m_levels[i]);
+		const TilePyramid::Level& last = m_levels[i].back();
+		if (m_levels[i].size() != map.levels || map.firstTile > header.tileCount ||
+			last.firstTile + (uint64_t)last.tilesX * last.tilesY > header.tileCount - map.firstTile)
+		{
+			Close();
+			return false;
+		}
+	}
+	return true;
+}
+
+void TileArchive::Close()
+{
+#ifdef _WIN32
+	if (m_view)
+	{
+		UnmapViewOfFile(m_view);
+	}
+	if (m_mapping)
+	{
+		CloseHandle(m_mapping);
+		m_mapping = nullptr;
+	}
+	if (m_file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_file);
+		m_file = INVALID_HANDLE_VALUE;
+	}
+#else
+	if (m_view)
+	{
+		munmap(const_cast<uint8_t*>(m_view), (size_t)m_size);
+	}
+	if (m_file >= 0)
+	{
+		close(m_file);
+		m_file = -1;
+	}
+#endif
+	m_view = nullptr;
+	m_size = 0;
+	m_maps = nullptr;
+	m_tiles = nullptr;
+	m_levels.clear();
+}
+
+bool TileArchive::FindMap(const char* name, uint32_t& map) const
+{
+	for (uint32_t i = 0; i < GetMapCount(); ++i)
+	{
+		if (strcmp(m_maps[i].name, name) == 0)
+		{
+			map = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const TileArchive::TileEntry& TileArchive::GetTile(uint32_t map, uint32_t level, uint32_t x, uint32_t y) const
+{
+	const TilePyramid::Level& current = m_levels[map][level];
+	return m_tiles[m_maps[map].firstTile + current.firstTile + (uint64_t)y * current.tilesX + x];
+}
+
+bool TileArchive::ReadTile(uint32_t map, uint32_t level, uint32_t x, uint32_t y, uint8_t* texels) const
+{
+	if (map >= GetMapCount() || level >= m_levels[map].size() || x >= m_levels[map][level].tilesX || y >= m_levels[map][level].tilesY)
+	{
+		return false;
+	}
+	const TileEntry& tile = GetTile(map, level, x, y);
+	const TileFormat format = m_maps[map].format;
+	if (tile.offset > m_size || tile.bytes > m_size - tile.offset)
+	{
+		return false;
+	}
+	switch (tile.codec)
+	{
+	case TileCodec::RAW:
+		if (tile.bytes != TilePyramid::TileBytes(format))
+		{
+			return false;
+		}
+		memcpy(texels, m_view + tile.offset, tile.bytes);
+		return true;
+	case TileCodec::DELTA:
+		return Decode(m_view + tile.offset, tile.bytes, format, texels);
+	default:
+		return false;
+	}
+}
+
+bool TileArchive::Encode(const uint8_t* texels, TileFormat format, std::vector<uint8_t>& encoded)
+{
+	// One plane of symbols per channel, so that channels which do not change, like the alpha of
+	// a color map or G - R of a gray one, become a few long zero runs.
+	const uint32_t size = TilePyramid::PaddedSize();
+	const uint32_t channels = format == TileFormat::R16_UNORM ? 1 : 4;
+	const size_t rawBytes = TilePyramid::TileBytes(format);
+	encoded.clear();
+	SymbolWriter writer(encoded);
+	for (uint32_t c = 0; c < channels && encoded.size() < rawBytes; ++c)
+	{
+		for (uint32_t y = 0; y < size && encoded.size() < rawBytes; ++y)
+		{
+			for (uint32_t i = y * size; i < (y + 1) * size; ++i)
+			{
+				if (format == TileFormat::R16_UNORM)
+				{
+					const uint16_t* in = reinterpret_cast<const uint16_t*>(texels);
+					const uint32_t predicted = i > 0 ? in[PredictorOf(i, size)] : 0;
+					writer.Put(ZigZag(in[i] - predicted, 16));
+				}
+				else
+				{
+					// G and B are predicted through their difference to the channel before them.
+					const uint8_t* texel = texels + i * 4;
+					const uint8_t none[4] = {};
+					const uint8_t* predicted = i > 0 ? texels + PredictorOf(i, size) * 4 : none;
+					int difference = texel[c] - predicted[c];
+					if (c == 1 || c == 2)
+					{
+						difference -= texel[c - 1] - predicted[c - 1];
+					}
+					writer.Put(ZigZag((uint32_t)difference, 8));
+				}
+			}
+		}
+	}
+	writer.Flush();
+	return encoded.size() < rawBytes;
+}
+
+bool TileArchive::Decode(const uint8_t* data, size_t bytes, TileFormat format, uint8_t* texels)
+{
+	const uint32_t size = TilePyramid::PaddedSize();
+	const uint32_t channels = format == TileFormat::R16_UNORM ? 1 : 4;
+	SymbolReader reader(data, bytes);
+	uint32_t symbol;
+	for (uint32_t c = 0; c < channels; ++c)
+	{
+		for (uint32_t i = 0; i < size * size; ++i)
+		{
+			if (format == TileFormat::R16_UNORM)
+			{
+				uint16_t* out = reinterpret_cast<uint16_t*>(texels);
+				const uint32_t predicted = i > 0 ? out[PredictorOf(i, size)] : 0;
+				if (!reader.Get(0xFFFF, symbol))
+				{
+					return false;
+				}
+				out[i] = (uint16_t)(predicted + UnZigZag(symbol));
+			}
+			else
+			{
+				uint8_t* texel = texels + i * 4;
+				const uint8_t none[4] = {};
+				const uint8_t* predicted = i > 0 ? texels + PredictorOf(i, size) * 4 : none;
+				if (!reader.Get(0xFF, symbol))
+				{
+					return false;
+				}
+				uint32_t value = predicted[c] + UnZigZag(symbol);
+				if (c == 1 || c == 2)
+				{
+					value += texel[c - 1] - predicted[c - 1];
+				}
+				texel[c] = (uint8_t)value;
+			}
+		}
+	}
+	return reader.AtEnd();
+}
+
+bool TileArchive::Validate()
+{
+	const uint32_t size = TilePyramid::PaddedSize();
+	uint32_t random = 12345;
+	auto next = [&random]() { random = random * 1664525u + 1013904223u; return random >> 8; };
+
+	// Codecs: smooth heights and gray colors shrink and round trip, noise is left raw, and
+	// damaged data is refused.
+	std::vector<uint16_t> heights(size * size);
+	std::vector<uint8_t> colors(size * size * 4);
+	for (uint32_t i = 0; i < size * size; ++i)
+	{
+		heights[i] = (uint16_t)(30000 + (i % size) * 40 + (i / size) * 25 + next() % 9);
+		uint8_t gray = (uint8_t)(90 + (i % size) / 3 + next() % 4);
+		colors[i * 4 + 0] = colors[i * 4 + 1] = colors[i * 4 + 2] = gray;
+		colors[i * 4 + 3] = 255;
+	}
+	std::vector<uint8_t> encoded;
+	std::vector<uint8_t> decoded(TilePyramid::TileBytes(TileFormat::R8G8B8A8_UNORM));
+	if (!Encode(reinterpret_cast<const uint8_t*>(heights.data()), TileFormat::R16_UNORM, encoded) ||
+		!Decode(encoded.data(), encoded.size(), TileFormat::R16_UNORM, decoded.data()) ||
+		memcmp(decoded.data(), heights.data(), heights.size() * sizeof(uint16_t)) != 0 ||
+		Decode(encoded.data(), encoded.size() - 1, TileFormat::R16_UNORM, decoded.data()))
+	{
+		return false;
+	}
+	if (!Encode(colors.data(), TileFormat::R8G8B8A8_UNORM, encoded) || encoded.size() > colors.size() / 2 ||
+		!Decode(encoded.data(), encoded.size(), TileFormat::R8G8B8A8_UNORM, decoded.data()) ||
+		memcmp(decoded.data(), colors.data(), colors.size()) != 0)
+	{
+		return false;
+	}
+	std::vector<uint16_t> noise(size * size);
+	for (uint16_t& texel : noise)
+	{
+		texel = (uint16_t)next();
+	}
+	if (Encode(reinterpret_cast<const uint8_t*>(noise.data()), TileFormat::R16_UNORM, encoded))
+	{
+		return false;
+	}
+
+	// An archive of a compressed height map, half smooth and half noise, and a raw color map,
+	// checked tile by tile against the cut pyramids.
+	const uint32_t heightWidth = 3 * TilePyramid::TILE_SIZE + 45;
+	const uint32_t heightHeight = TilePyramid::TILE_SIZE + 42;
+	std::vector<uint16_t> heightMap((size_t)heightWidth * heightHeight);
+	for (uint32_t y = 0; y < heightHeight; ++y)
+	{
+		for (uint32_t x = 0; x < heightWidth; ++x)
+		{
+			heightMap[(size_t)y * heightWidth + x] = (uint16_t)(x < heightWidth / 2 ? x * 70 + y * 13 : next());
+		}
+	}
+	const uint32_t colorWidth = 2 * TilePyramid::TILE_SIZE + 3;
+	const uint32_t colorHeight = TilePyramid::TILE_SIZE + 1;
+	std::vector<uint8_t> colorMap((size_t)colorWidth * colorHeight * 4);
+	for (uint8_t& channel : colorMap)
+	{
+		channel = (uint8_t)next();
+	}
+
+	const std::string path = "TileArchiveValidate.vtar";
+	TileArchiveWriter writer;
+	if (!writer.Create(path) ||
+		!writer.AddMap("height", heightMap.data(), heightWidth, heightHeight, TileFormat::R16_UNORM, true) ||
+		!writer.AddMap("color", colorMap.data(), colorWidth, colorHeight, TileFormat::R8G8B8A8_UNORM, false) ||
+		!writer.Finish())
+	{
+		return false;
+	}
+
+	TileArchive archive;
+	uint32_t heightIndex, colorIndex, skyIndex;
+	bool valid = archive.Open(path) && archive.GetMapCount() == 2 && archive.FindMap("height", heightIndex) &&
+		archive.FindMap("color", colorIndex) && !archive.FindMap("sky", skyIndex) &&
+		archive.GetMap(heightIndex).width == heightWidth && archive.GetMap(colorIndex).format == TileFormat::R8G8B8A8_UNORM;
+
+	uint32_t deltaTiles = 0;
+	for (uint32_t m = 0; valid && m < 2; ++m)
+	{
+		const uint32_t index = m == 0 ? heightIndex : colorIndex;
+		const TileFormat format = archive.GetMap(index).format;
+		const size_t tileBytes = TilePyramid::TileBytes(format);
+		const std::vector<TilePyramid::Level>& levels = archive.GetLevels(index);
+		std::vector<uint8_t> tile(tileBytes);
+		const void* texels = m == 0 ? static_cast<const void*>(heightMap.data()) : colorMap.data();
+		valid = TilePyramid::Cut(texels, archive.GetMap(index).width, archive.GetMap(index).height, format, [&](uint32_t level, uint32_t tileY, const uint8_t* row)
+		{
+			for (uint32_t x = 0; x < levels[level].tilesX; ++x)
+			{
+				if (!archive.ReadTile(index, level, x, tileY, tile.data()) || memcmp(tile.data(), row + x * tileBytes, tileBytes) != 0 ||
+					archive.GetTile(index, level, x, tileY).offset % TILE_ALIGNMENT != 0)
+				{
+					return false;
+				}
+				deltaTiles += archive.GetTile(index, level, x, tileY).codec == TileCodec::DELTA ? 1 : 0;
+			}
+			return true;
+		});
+	}
+	valid = valid && deltaTiles > 0 && !archive.ReadTile(heightIndex, 0, 4, 0, decoded.data());
+	const uint64_t fileBytes = archive.GetFileBytes();
+	archive.Close();
+
+	// Cut short, or never finished.
+	std::vector<char> bytes((size_t)fileBytes);
+	std::ifstream(path, std::ios::binary).read(bytes.data(), (std::streamsize)bytes.size());
+	std::ofstream(path, std::ios::binary | std::ios::trunc).write(bytes.data(), (std::streamsize)bytes.size() - sizeof(TileEntry));
+	valid = valid && !archive.Open(path);
+	{
+		TileArchiveWriter unfinished;
+		valid = valid && unfinished.Create(path) && unfinished.AddMap("height", heightMap.data(), heightWidth, heightHeight, TileFormat::R16_UNORM, false) &&
+			!archive.Open(path);
+	}
+	std::remove(path.c_str());
+	return valid;
+}
+
+TileArchiveWriter::TileArchiveWriter() :
+	m_offset(0),
+	m_texelBytes(0),
+	m_tileBytes(0)
+{
+}
+
+bool TileArchiveWriter::Create(const std::string& path)
+{
+	m_file.close();
+	m_file.clear();
+	m_maps.clear();
+	m_tiles.clear();
+	m_texelBytes = 0;
+	m_tileBytes = 0;
+
+	// A zero header until Finish, so that an archive that was not finished is never opened.
+	m_file.open(path, std::ios::binary | std::ios::trunc);
+	const TileArchiveHeader header = {};
+	m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	m_offset = sizeof(header);
+	return (bool)m_file;
+}
+
+bool TileArchiveWriter::AddMap(const char* name, const void* texels, uint32_t width, uint32_t height, TileFormat format, bool compress)
+{
+	TileArchive::MapEntry map = {};
+	if (!m_file || strlen(name) >= sizeof(map.name))
+	{
+		return false;
+	}
+	std::vector<TilePyramid::Level> levels;
+	TilePyramid::Layout(width, height, levels);
+	memcpy(map.name, name, strlen(name));
+	map.width = width;
+	map.height = height;
+	map.format = format;
+	map.levels = (uint32_t)levels.size();
+	map.firstTile = m_tiles.size();
+
+	const size_t tileBytes = TilePyramid::TileBytes(format);
+	std::vector<std::vector<uint8_t>> encoded;
+	std::vector<uint8_t> smaller;
+	bool written = TilePyramid::Cut(texels, width, height, format, [&](uint32_t level, uint32_t, const uint8_t* row)
+	{
+		const uint32_t tilesX = levels[level].tilesX;
+		encoded.resize(tilesX);
+		smaller.assign(tilesX, 0);
+		if (compress)
+		{
+			ParallelFor(tilesX, [&](uint32_t begin, uint32_t end)
+			{
+				for (uint32_t x = begin; x < end; ++x)
+				{
+					smaller[x] = TileArchive::Encode(row + x * tileBytes, format, encoded[x]) ? 1 : 0;
+				}
+			});
+		}
+		for (uint32_t x = 0; x < tilesX; ++x)
+		{
+			bool ok = smaller[x] ? WriteAligned(encoded[x].data(), encoded[x].size(), TileCodec::DELTA) :
+				WriteAligned(row + x * tileBytes, tileBytes, TileCodec::RAW);
+			if (!ok)
+			{
+				return false;
+			}
+		}
+		m_texelBytes += (uint64_t)tilesX * tileBytes;
+		return true;
+	});
+	if (written)
+	{
+		m_maps.push_back(map);
+	}
+	return written;
+}
+
+bool TileArchiveWriter::WriteAligned(const uint8_t* data, size_t bytes, TileCodec codec)
+{
+	const char padding[TileArchive::TILE_ALIGNMENT] = {};
+	const uint64_t aligned = AlignUp(m_offset, TileArchive::TILE_ALIGNMENT);
+	m_file.write(padding, (std::streamsize)(aligned - m_offset));
+	m_file.write(reinterpret_cast<const char*>(data), (std::streamsize)bytes);
+
+	TileArchive::TileEntry tile = { aligned, (uint32_t)bytes, codec };
+	m_tiles.push_back(tile);
+	m_offset = aligned + bytes;
+	m_tileBytes += bytes;
+	return (bool)m_file;
+}
+
+bool TileArchiveWriter::Finish()
+{
+	const char padding[8] = {};
+	TileArchiveHeader header = {};
+	memcpy(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+	header.version = ARCHIVE_VERSION;
+	header.tileSize = TilePyramid::TILE_SIZE;
+	header.border = TilePyramid::BORDER;
+	header.mapCount = (uint32_t)m_maps.size();
+	header.tileCount = m_tiles.size();
+	header.mapsOffset = AlignUp(m_offset, 8);
+	header.tilesOffset = header.mapsOffset + m_maps.size() * sizeof(TileArchive::MapEntry);
+
+	m_file.write(padding, (std::streamsize)(header.mapsOffset - m_offset));
+	m_file.write(reinterpret_cast<const char*>(m_maps.data()), (std::streamsize)(m_maps.size() * sizeof(TileArchive::MapEntry)));
+	m_file.write(reinterpret_cast<const char*>(m_tiles.data()), (std::streamsize)(m_tiles.size() * sizeof(TileArchive::TileEntry)));
+	m_file.seekp(0);
+	m_file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	m_file.close();
+	return !m_file.fail();
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "TilePyramid.h"
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// How the texels of one tile are stored in a TileArchive.
+enum class TileCodec : uint32_t
+{
+	RAW,	// PaddedSize()^2 texels as they are
+	DELTA,	// lossless: per channel differences to the left texel, G and B through G - R and B - G, zero runs and varints
+};
+
+// The tile pyramids of several maps in one file, read through a memory mapping. The header,
+// the map table and the tile table are stored as the structs below, so an opened archive is
+// used in place: a tile is an index lookup and a pointer into the mapping. Reads are thread safe.
+// Written by TileArchiveWriter, from TileBaker offline.
+class TileArchive
+{
+public:
+	static const uint32_t TILE_ALIGNMENT = 16;	// of every tile in the file
+
+	struct MapEntry
+	{
+		char name[16];		// zero terminated
+		uint32_t width;		// level 0 texels
+		uint32_t height;
+		TileFormat format;
+		uint32_t levels;
+		uint64_t firstTile;	// in the tile table; the map's tiles follow in TilePyramid::Level::firstTile order
+	};
+
+	struct TileEntry
+	{
+		uint64_t offset;	// from the start of the file
+		uint32_t bytes;
+		TileCodec codec;
+	};
+
+	TileArchive();
+	~TileArchive();
+
+	TileArchive(const TileArchive&) = delete;
+	TileArchive& operator=(const TileArchive&) = delete;
+
+	bool Open(const std::string& path);
+	void Close();
+	bool IsOpen() const { return m_view != nullptr; }
+
+	uint32_t GetMapCount() const { return (uint32_t)m_levels.size(); }
+	const MapEntry& GetMap(uint32_t map) const { return m_maps[map]; }
+	const std::vector<TilePyramid::Level>& GetLevels(uint32_t map) const { return m_levels[map]; }
+	bool FindMap(const char* name, uint32_t& map) const;
+	uint64_t GetFileBytes() const { return m_size; }
+
+	const TileEntry& GetTile(uint32_t map, uint32_t level, uint32_t x, uint32_t y) const;
+
+	// Decodes tile (x, y) of a level into PaddedSize()^2 tightly packed texels.
+	bool ReadTile(uint32_t map, uint32_t level, uint32_t x, uint32_t y, uint8_t* texels) const;
+
+	// DELTA encoding of one tile; false if it would not be smaller than the texels.
+	static bool Encode(const uint8_t* texels, TileFormat format, std::vector<uint8_t>& encoded);
+	static bool Decode(const uint8_t* data, size_t bytes, TileFormat format, uint8_t* texels);
+
+	// True if tiles round trip through both codecs, a written archive of two maps reads back
+	// every tile of every level, and damaged archives are refused.
+	static bool Validate();
+
+private:
+	const uint8_t* m_view;
+	uint64_t m_size;
+	const MapEntry* m_maps;
+	const TileEntry* m_tiles;
+	std::vector<std::vector<TilePyramid::Level>> m_levels;	// per map
+#ifdef _WIN32
+	void* m_file;
+	void* m_mapping;
+#else
+	int m_file;
+#endif
+};
+
+// Writes a TileArchive: the tiles of each map as they are cut, then the tables and the header.
+class TileArchiveWriter
+{
+public:
+	TileArchiveWriter();
+
+	bool Create(const std::string& path);
+
+	// Builds the tile pyramid of tightly packed level 0 texels and appends its tiles, DELTA
+	// encoded where that is smaller if compress is set. Encoding is parallel over each row of tiles.
+	bool AddMap(const char* name, const void* texels, uint32_t width, uint32_t height, TileFormat format, bool compress);
+
+	// Writes the tables and the header; the archive can be opened once this returns true.
+	bool Finish();
+
+	// Bytes of texels that went into the tiles, and bytes of tiles written.
+	uint64_t GetTileTexelBytes() const { return m_texelBytes; }
+	uint64_t GetTileBytes() const { return m_tileBytes; }
+
+private:
+	bool WriteAligned(const uint8_t* data, size_t bytes, TileCodec codec);
+
+	std::ofstream m_file;
+	std::vector<TileArchive::MapEntry> m_maps;
+	std::vector<TileArchive::TileEntry> m_tiles;
+	uint64_t m_offset;
+	uint64_t m_texelBytes;
+	uint64_t m_tileBytes;
+};
@@ -0,0 +1,230 @@
+#include "TilePyramid.h"
+#include "Parallel.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	int Wrap(int value, int size)
+	{
+		int wrapped = value % size;
+		return wrapped < 0 ? wrapped + size : wrapped;
+	}
+
+	// Next level of a tightly packed level: each texel averages its 2x2 children, with the
+	// children past the right edge wrapped around and the ones past the bottom clamped.
+	void Downsample(const std::vector<uint8_t>& source, uint32_t width, uint32_t height, TileFormat format,
+		std::vector<uint8_t>& target, uint32_t targetWidth, uint32_t targetHeight)
+	{
+		const size_t texelBytes = TilePyramid::TexelBytes(format);
+		target.resize((size_t)targetWidth * targetHeight * texelBytes);
+		ParallelFor(targetHeight, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t y = begin; y < end; ++y)
+			{
+				const uint32_t y0 = 2 * y;
+				const uint32_t y1 = std::min(2 * y + 1, height - 1);
+				for (uint32_t x = 0; x < targetWidth; ++x)
+				{
+					const uint32_t x0 = 2 * x;
+					const uint32_t x1 = (2 * x + 1) % width;
+					const size_t children[4] = { (size_t)y0 * width + x0, (size_t)y0 * width + x1, (size_t)y1 * width + x0, (size_t)y1 * width + x1 };
+					const size_t texel = (size_t)y * targetWidth + x;
+					if (format == TileFormat::R16_UNORM)
+					{
+						const uint16_t* in = reinterpret_cast<const uint16_t*>(source.data());
+						uint32_t sum = in[children[0]] + in[children[1]] + in[children[2]] + in[children[3]];
+						reinterpret_cast<uint16_t*>(target.data())[texel] = (uint16_t)((sum + 2) / 4);
+					}
+					else
+					{
+						for (size_t c = 0; c < 4; ++c)
+						{
+							uint32_t sum = source[children[0] * 4 + c] + source[children[1] * 4 + c] + source[children[2] * 4 + c] + source[children[3] * 4 + c];
+							target[texel * 4 + c] = (uint8_t)((sum + 2) / 4);
+						}
+					}
+				}
+			}
+		});
+	}
+
+	// Tile (x, y) of a tightly packed level with its border.
+	void CutTile(const uint8_t* level, uint32_t width, uint32_t height, size_t texelBytes, uint32_t x, uint32_t y, uint8_t* tile)
+	{
+		const int padded = (int)TilePyramid::PaddedSize();
+		const int left = (int)(x * TilePyramid::TILE_SIZE) - (int)TilePyramid::BORDER;
+		const int top = (int)(y * TilePyramid::TILE_SIZE) - (int)TilePyramid::BORDER;
+		for (int ty = 0; ty < padded; ++ty)
+		{
+			const int sy = std::min(std::max(top + ty, 0), (int)height - 1);
+			for (int tx = 0; tx < padded; ++tx)
+			{
+				const int sx = Wrap(left + tx, (int)width);
+				memcpy(tile + ((size_t)ty * padded + tx) * texelBytes, level + ((size_t)sy * width + sx) * texelBytes, texelBytes);
+			}
+		}
+	}
+}
+
+const uint32_t TilePyramid::TILE_SIZE;
+const uint32_t TilePyramid::BORDER;
+
+void TilePyramid::Layout(uint32_t width, uint32_t height, std::vector<Level>& levels)
+{
+	levels.clear();
+	uint64_t firstTile = 0;
+	for (uint32_t l = 0; ; ++l)
+	{
+		Level level;
+		level.width = (uint32_t)(((uint64_t)width + (1ull << l) - 1) >> l);
+		level.height = (uint32_t)(((uint64_t)height + (1ull << l) - 1) >> l);
+		level.tilesX = (level.width + TILE_SIZE - 1) / TILE_SIZE;
+		level.tilesY = (level.height + TILE_SIZE - 1) / TILE_SIZE;
+		level.firstTile = firstTile;
+		levels.push_back(level);
+		firstTile += (uint64_t)level.tilesX * level.tilesY;
+		if (level.tilesX == 1 && level.tilesY == 1)
+		{
+			break;
+		}
+	}
+}
+
+bool TilePyramid::Cut(const void* texels, uint32_t width, uint32_t height, TileFormat format, const TileRowSink& sink)
+{
+	std::vector<Level> levels;
+	Layout(width, height, levels);
+
+	const size_t texelBytes = TexelBytes(format);
+	const size_t tileBytes = TileBytes(format);
+	std::vector<uint8_t> level(static_cast<const uint8_t*>(texels), static_cast<const uint8_t*>(texels) + (size_t)width * height * texelBytes);
+	std::vector<uint8_t> next;
+	std::vector<uint8_t> tileRow;
+	for (size_t l = 0; l < levels.size(); ++l)
+	{
+		const Level& current = levels[l];
+		if (l > 0)
+		{
+			Downsample(level, levels[l - 1].width, levels[l - 1].height, format, next, current.width, current.height);
+			level.swap(next);
+		}
+
+		// One row of tiles at a time, cut in parallel and handed out in order.
+		tileRow.resize(current.tilesX * tileBytes);
+		for (uint32_t y = 0; y < current.tilesY; ++y)
+		{
+			ParallelFor(current.tilesX, [&](uint32_t begin, uint32_t end)
+			{
+				for (uint32_t x = begin; x < end; ++x)
+				{
+					CutTile(level.data(), current.width, current.height, texelBytes, x, y, &tileRow[x * tileBytes]);
+				}
+			});
+			if (!sink((uint32_t)l, y, tileRow.data()))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+bool TilePyramid::Validate()
+{
+	// Odd sizes so that levels round up and tiles hang over the right and bottom edges.
+	const uint32_t width = 3 * TILE_SIZE + 37;
+	const uint32_t height = TILE_SIZE + 21;
+	std::vector<uint16_t> heights((size_t)width * height);
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			heights[(size_t)y * width + x] = (uint16_t)((x * 131 + y * 977) * 2654435761u >> 16);
+		}
+	}
+
+	std::vector<Level> levels;
+	Layout(width, height, levels);
+	std::vector<uint16_t> tiles;
+	bool valid = levels.size() == 3 && Cut(heights.data(), width, height, TileFormat::R16_UNORM, [&](uint32_t level, uint32_t tileY, const uint8_t* row)
+	{
+		// Rows arrive in Level::firstTile order.
+		const Level& current = levels[level];
+		if ((current.firstTile + (uint64_t)tileY * current.tilesX) * PaddedSize() * PaddedSize() != tiles.size())
+		{
+			return false;
+		}
+		const uint16_t* texels = reinterpret_cast<const uint16_t*>(row);
+		tiles.insert(tiles.end(), texels, texels + (size_t)current.tilesX * PaddedSize() * PaddedSize());
+		return true;
+	});
+	valid = valid && tiles.size() == (levels.back().firstTile + 1) * PaddedSize() * PaddedSize();
+
+	// Every texel of every tile against the box filter recomputed from level 0.
+	for (uint32_t l = 0; valid && l < levels.size(); ++l)
+	{
+		const Level& level = levels[l];
+		for (uint32_t ty = 0; valid && ty < level.tilesY; ++ty)
+		{
+			for (uint32_t tx = 0; valid && tx < level.tilesX; ++tx)
+			{
+				const uint16_t* tile = &tiles[(level.firstTile + (uint64_t)ty * level.tilesX + tx) * PaddedSize() * PaddedSize()];
+				for (uint32_t i = 0; valid && i < PaddedSize() * PaddedSize(); i += 7)
+				{
+					int x = Wrap((int)(tx * TILE_SIZE + i % PaddedSize()) - (int)BORDER, (int)level.width);
+					int y = std::min(std::max((int)(ty * TILE_SIZE + i / PaddedSize()) - (int)BORDER, 0), (int)level.height - 1);
+
+					// Level l texel (x, y) by repeated 2x2 averaging of its level 0 footprint.
+					std::vector<uint32_t> xs(1, (uint32_t)x), ys(1, (uint32_t)y);
+					uint32_t size = 1;
+					for (uint32_t k = l; k > 0; --k)
+					{
+						const Level& finer = levels[k - 1];
+						std::vector<uint32_t> fx, fy;
+						for (uint32_t c : xs)
+						{
+							fx.push_back(2 * c);
+							fx.push_back((2 * c + 1) % finer.width);
+						}
+						for (uint32_t c : ys)
+						{
+							fy.push_back(2 * c);
+							fy.push_back(std::min(2 * c + 1, finer.height - 1));
+						}
+						xs.swap(fx);
+						ys.swap(fy);
+						size *= 2;
+					}
+					std::vector<uint32_t> values((size_t)size * size);
+					for (uint32_t j = 0; j < size; ++j)
+					{
+						for (uint32_t k = 0; k < size; ++k)
+						{
+							values[j * size + k] = heights[(size_t)ys[j] * width + xs[k]];
+						}
+					}
+					while (size > 1)
+					{
+						uint32_t half = size / 2;
+						std::vector<uint32_t> reduced((size_t)half * half);
+						for (uint32_t j = 0; j < half; ++j)
+						{
+							for (uint32_t k = 0; k < half; ++k)
+							{
+								// Children are ordered so that 2k, 2k + 1 are the pair of each parent.
+								uint32_t sum = values[(2 * j) * size + 2 * k] + values[(2 * j) * size + 2 * k + 1] +
+									values[(2 * j + 1) * size + 2 * k] + values[(2 * j + 1) * size + 2 * k + 1];
+								reduced[j * half + k] = (sum + 2) / 4;
+							}
+						}
+						values.swap(reduced);
+						size = half;
+					}
+					valid = tile[i] == values[0];
+				}
+			}
+		}
+	}
+	return valid;
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Texel formats of a tile pyramid, matching the physical cache texture they are copied into.
+enum class TileFormat : uint32_t
+{
+	R16_UNORM,		// heights
+	R8G8B8A8_UNORM,	// colors
+};
+
+// A mip chain of an equirectangular map cut into square tiles with a border; TileArchive
+// stores them. Texel i of level L covers texels i * 2^L .. (i + 1) * 2^L - 1 of level 0, so a
+// tile of level L covers exactly 2^L x 2^L tiles of level 0 whatever the map size. Borders wrap
+// in longitude and clamp at the poles. CPU only.
+class TilePyramid
+{
+public:
+	static const uint32_t TILE_SIZE = 128;	// texels per tile side without the border, as in DomainShader.hlsl
+	static const uint32_t BORDER = 1;		// texels repeated from the neighbours on each side, for bilinear filtering
+
+	struct Level
+	{
+		uint32_t width;		// texels, ceil(level 0 width / 2^level)
+		uint32_t height;
+		uint32_t tilesX;
+		uint32_t tilesY;
+		uint64_t firstTile;	// index of tile (0, 0) among the tiles of all levels
+	};
+
+	// One row of tiles of a level: tilesX tiles of PaddedSize()^2 tightly packed texels each.
+	// Returning false stops Cut.
+	typedef std::function<bool(uint32_t level, uint32_t tileY, const uint8_t* tiles)> TileRowSink;
+
+	// Levels of a width x height map, down to the one that fits a single tile.
+	static void Layout(uint32_t width, uint32_t height, std::vector<Level>& levels);
+
+	// Builds the mip chain of tightly packed level 0 texels with a 2x2 box filter and hands every
+	// row of tiles to the sink, finest level first and rows in order, so in Level::firstTile order.
+	// Parallel over the rows of each level; the sink is called on the calling thread.
+	static bool Cut(const void* texels, uint32_t width, uint32_t height, TileFormat format, const TileRowSink& sink);
+
+	static uint32_t PaddedSize() { return TILE_SIZE + 2 * BORDER; }
+	static size_t TexelBytes(TileFormat format) { return format == TileFormat::R16_UNORM ? 2 : 4; }
+	static size_t TileBytes(TileFormat format) { return (size_t)PaddedSize() * PaddedSize() * TexelBytes(format); }
+
+	// True if every tile of every level of an odd sized map, borders included, holds the box
+	// filtered texels with wrapping and clamping.
+	static bool Validate();
+};
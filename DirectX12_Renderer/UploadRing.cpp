@@ -0,0 +1,227 @@
+#include "UploadRing.h"
+#include "TextureFootprint.h"
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+	// Buffers are copied in rows of this many bytes, so that they share the ring and the budget
+	// of a frame like textures.
+	const uint64_t BUFFER_ROW_BYTES = 64 * 1024;
+
+	// Bytes of a texel, or of a 4x4 block, of the formats the maps are uploaded in; false for others.
+	bool FormatBytes(DXGI_FORMAT format, uint32_t& texelBytes, uint32_t& blockBytes)
+	{
+		texelBytes = 0;
+		blockBytes = 0;
+		switch (format)
+		{
+		case DXGI_FORMAT_R8_UNORM: texelBytes = 1; return true;
+		case DXGI_FORMAT_R16_UNORM: texelBytes = 2; return true;
+		case DXGI_FORMAT_R32_FLOAT:
+		case DXGI_FORMAT_R8G8B8A8_UNORM:
+		case DXGI_FORMAT_R8G8B8A8_UNORM_SRGB: texelBytes = 4; return true;
+		case DXGI_FORMAT_BC1_UNORM:
+		case DXGI_FORMAT_BC1_UNORM_SRGB:
+		case DXGI_FORMAT_BC4_UNORM: blockBytes = 8; return true;
+		case DXGI_FORMAT_BC5_UNORM:
+		case DXGI_FORMAT_BC7_UNORM:
+		case DXGI_FORMAT_BC7_UNORM_SRGB: blockBytes = 16; return true;
+		default: return false;
+		}
+	}
+}
+
+UploadRing::UploadRing(Graphics* renderer, uint64_t capacity, uint64_t frameBytes) :
+	m_ring(capacity),
+	m_device(renderer->GetDevice()),
+	m_buffer(nullptr),
+	m_mapped(nullptr),
+	m_frameBytes(frameBytes),
+	m_frameUsed(0),
+	m_bytesCopied(0),
+	m_pieces(0),
+	m_frames(0)
+{
+	renderer->CreateBuffer(m_buffer, &CD3DX12_RESOURCE_DESC::Buffer(capacity));
+	m_buffer->SetName(L"Staging ring");
+
+	// Mapped for good; the CPU only writes it.
+	CD3DX12_RANGE readRange(0, 0);
+	if (FAILED(m_buffer->Map(0, &readRange, reinterpret_cast<void**>(&m_mapped))))
+	{
+		throw (GFX_Exception("Failed to map the staging ring."));
+	}
+}
+
+UploadRing::~UploadRing()
+{
+	if (m_buffer)
+	{
+		m_buffer->Unmap(0, nullptr);
+		m_mapped = nullptr;
+		m_buffer->Release();
+		m_buffer = nullptr;
+	}
+}
+
+bool UploadRing::CopyTexture(ID3D12GraphicsCommandList* commandList, ID3D12Resource* texture, const D3D12_SUBRESOURCE_DATA* subresources,
+	UINT count, Cursor& cursor)
+{
+	return WriteTexture(commandList, texture, count,
+		[subresources](UINT subresource, UINT firstRow, UINT rowCount, uint8_t* destination, uint64_t rowPitch)
+		{
+			return CopyRows(subresources[subresource], firstRow, rowCount, destination, rowPitch);
+		}, cursor);
+}
+
+bool UploadRing::CopyRows(const D3D12_SUBRESOURCE_DATA& source, UINT firstRow, UINT rowCount, uint8_t* destination, uint64_t rowPitch)
+{
+	if (!source.pData)
+	{
+		return false;
+	}
+	const size_t rowBytes = (size_t)std::min<uint64_t>(rowPitch, (uint64_t)source.RowPitch);
+	for (UINT r = 0; r < rowCount; ++r)
+	{
+		memcpy(destination + r * rowPitch, (const uint8_t*)source.pData + (UINT64)(firstRow + r) * source.RowPitch, rowBytes);
+	}
+	return true;
+}
+
+bool UploadRing::WriteTexture(ID3D12GraphicsCommandList* commandList, ID3D12Resource* texture, UINT count, const RowWriter& write, Cursor& cursor,
+	uint64_t maxBytes)
+{
+	const D3D12_RESOURCE_DESC desc = texture->GetDesc();
+	const uint64_t startBytes = cursor.bytes;
+	while (cursor.subresource < count)
+	{
+		D3D12_PLACED_SUBRESOURCE_FOOTPRINT layout;
+		UINT numRows;
+		UINT64 rowSize, totalBytes;
+		m_device->GetCopyableFootprints(&desc, cursor.subresource, 1, 0, &layout, &numRows, &rowSize, &totalBytes);
+
+#ifdef _DEBUG
+		// The layout the rows are written in, as the CPU works it out.
+		uint32_t texelBytes, blockBytes;
+		std::vector<SubresourceFootprint> footprint;
+		if (cursor.row == 0 && FormatBytes(desc.Format, texelBytes, blockBytes))
+		{
+			TextureFootprint::Compute((uint32_t)desc.Width, desc.Height, texelBytes, blockBytes, cursor.subresource % desc.MipLevels, 1, footprint);
+			if (footprint[0].width != layout.Footprint.Width || footprint[0].height != layout.Footprint.Height ||
+				footprint[0].rowPitch != layout.Footprint.RowPitch || footprint[0].rows != numRows || footprint[0].rowBytes != rowSize)
+			{
+				throw (GFX_Exception("TextureFootprint does not lay out a subresource as the device does."));
+			}
+		}
+#endif
+
+		// At least one row per call, so a row larger than maxBytes still goes.
+		const uint64_t written = cursor.bytes - startBytes;
+		if (written > 0 && written + rowSize > maxBytes)
+		{
+			return false;
+		}
+		const UINT allowed = (UINT)std::min<uint64_t>(numRows - cursor.row, std::max<uint64_t>(1, (maxBytes - written) / rowSize));
+
+		uint64_t offset;
+		const UINT rows = AllocateRows(allowed, layout.Footprint.RowPitch, D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT, offset);
+		if (rows == 0)
+		{
+			return false;
+		}
+		if (!write(cursor.subresource, cursor.row, rows, m_mapped + offset, layout.Footprint.RowPitch))
+		{
+			throw (GFX_Exception("Failed to write the rows of a texture into the staging ring."));
+		}
+
+		// A row of the footprint is a row of texels, or of 4x4 blocks.
+		const UINT rowHeight = (layout.Footprint.Height + numRows - 1) / numRows;
+		D3D12_PLACED_SUBRESOURCE_FOOTPRINT piece = layout;
+		piece.Offset = offset;
+		piece.Footprint.Height = std::min(rows * rowHeight, layout.Footprint.Height - cursor.row * rowHeight);
+		CD3DX12_TEXTURE_COPY_LOCATION dst(texture, cursor.subresource);
+		CD3DX12_TEXTURE_COPY_LOCATION src(m_buffer, piece);
+		commandList->CopyTextureRegion(&dst, 0, cursor.row * rowHeight, 0, &src, nullptr);
+
+		cursor.bytes += rows * rowSize;
+		m_bytesCopied += rows * rowSize;
+		cursor.row += rows;
+		if (cursor.row == numRows)
+		{
+			++cursor.subresource;
+			cursor.row = 0;
+		}
+	}
+	return true;
+}
+
+bool UploadRing::CopyBuffer(ID3D12GraphicsCommandList* commandList, ID3D12Resource* buffer, const void* data, uint64_t size, Cursor& cursor)
+{
+	while (cursor.bytes < size)
+	{
+		const uint64_t left = size - cursor.bytes;
+		uint64_t offset;
+		const UINT rows = AllocateRows((UINT)((left + BUFFER_ROW_BYTES - 1) / BUFFER_ROW_BYTES), BUFFER_ROW_BYTES, 256, offset);
+		if (rows == 0)
+		{
+			return false;
+		}
+
+		const uint64_t bytes = std::min(rows * BUFFER_ROW_BYTES, left);
+		memcpy(m_mapped + offset, (const uint8_t*)data + cursor.bytes, (size_t)bytes);
+		commandList->CopyBufferRegion(buffer, cursor.bytes, m_buffer, offset, bytes);
+		cursor.bytes += bytes;
+		m_bytesCopied += bytes;
+	}
+	return true;
+}
+
+void UploadRing::Close(uint64_t fence)
+{
+	m_frames += m_ring.GetOpenBytes() != 0 ? 1 : 0;
+	m_ring.Close(fence);
+	m_frameUsed = 0;
+}
+
+void UploadRing::Retire(uint64_t completedFence)
+{
+	m_ring.Retire(completedFence);
+}
+
+void UploadRing::Report() const
+{
+	char report[256];
+	sprintf_s(report, "Staging ring: %.1f MB, %.1f MB a frame, peak %.1f MB; %.1f MB copied in %llu pieces over %llu frames\n",
+		m_ring.GetCapacity() / (1024.0 * 1024.0), m_frameBytes / (1024.0 * 1024.0), m_ring.GetPeakUsed() / (1024.0 * 1024.0),
+		m_bytesCopied / (1024.0 * 1024.0), (unsigned long long)m_pieces, (unsigned long long)m_frames);
+	OutputDebugStringA(report);
+}
+
+UINT UploadRing::AllocateRows(UINT rows, uint64_t rowPitch, uint64_t alignment, uint64_t& offset)
+{
+	// Within what is left of the frame's budget, though a row larger than the whole budget still
+	// goes on its own at the start of a frame.
+	const uint64_t budget = m_frameBytes > m_frameUsed ? m_frameBytes - m_frameUsed : 0;
+	rows = (UINT)std::min<uint64_t>(rows, budget / rowPitch);
+	if (rows == 0 && m_frameUsed == 0)
+	{
+		rows = 1;
+	}
+
+	const uint64_t usedBefore = m_ring.GetUsed();
+	for (; rows > 0; rows /= 2)
+	{
+		if (m_ring.Allocate(rows * rowPitch, alignment, offset))
+		{
+			m_frameUsed += m_ring.GetUsed() - usedBefore;
+			++m_pieces;
+			return rows;
+		}
+	}
+	if (usedBefore == 0)
+	{
+		throw (GFX_Exception("A row does not fit in the staging ring."));
+	}
+	return 0;
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "Renderer.h"
+#include "StagingRing.h"
+#include <functional>
+
+using namespace graphics;
+
+// One persistently mapped upload buffer that textures and buffers of any size are copied through
+// in pieces of whole rows, as many as fit in the ring and the budget of a frame, so the upload
+// memory stays the same however large the asset. Copies pick up where the last frame left off;
+// Close and Retire follow the frames, as for AssetLoader.
+class UploadRing
+{
+public:
+	// Where a copy has got to; zero before the first piece.
+	struct Cursor
+	{
+		UINT subresource;
+		UINT row;			// of texels, or of blocks when block compressed
+		uint64_t bytes;		// copied so far
+	};
+
+	// Writes rowCount rows from firstRow of a subresource into destination, rowPitch bytes apart, in
+	// the texture's format; rows of 4x4 blocks in block formats. False if they cannot be produced.
+	typedef std::function<bool(UINT subresource, UINT firstRow, UINT rowCount, uint8_t* destination, uint64_t rowPitch)> RowWriter;
+
+	UploadRing(Graphics* renderer, uint64_t capacity, uint64_t frameBytes);
+	~UploadRing();
+
+	UploadRing(const UploadRing&) = delete;
+	UploadRing& operator=(const UploadRing&) = delete;
+
+	// Records copies of the next rows of subresources 0 .. count - 1 of texture, which is in the
+	// copy destination state. True once the last row is recorded; false to continue next frame.
+	bool CopyTexture(ID3D12GraphicsCommandList* commandList, ID3D12Resource* texture, const D3D12_SUBRESOURCE_DATA* subresources,
+		UINT count, Cursor& cursor);
+
+	// The same with the rows written by write straight into the mapped ring, at the row pitch of
+	// the placed footprint, so they need not be decoded anywhere else first. Writers that decode
+	// on the calling thread pass maxBytes to write fewer rows per call than the frame's budget.
+	bool WriteTexture(ID3D12GraphicsCommandList* commandList, ID3D12Resource* texture, UINT count, const RowWriter& write, Cursor& cursor,
+		uint64_t maxBytes = UINT64_MAX);
+
+	// The writer CopyTexture uses, for writers that produce only some subresources themselves.
+	static bool CopyRows(const D3D12_SUBRESOURCE_DATA& source, UINT firstRow, UINT rowCount, uint8_t* destination, uint64_t rowPitch);
+
+	// The same for size bytes of data into a buffer.
+	bool CopyBuffer(ID3D12GraphicsCommandList* commandList, ID3D12Resource* buffer, const void* data, uint64_t size, Cursor& cursor);
+
+	// Ends the frame; its pieces are reused once fence has passed.
+	void Close(uint64_t fence);
+	void Retire(uint64_t completedFence);
+
+	// Capacity, peak use and what went through, to the debug output.
+	void Report() const;
+
+private:
+	// Space for up to rows rows of rowPitch bytes, fewer if they do not fit; 0 rows if none do.
+	UINT AllocateRows(UINT rows, uint64_t rowPitch, uint64_t alignment, uint64_t& offset);
+
+	StagingRing m_ring;
+	ID3D12Device* m_device;
+	ID3D12Resource* m_buffer;
+	uint8_t* m_mapped;
+	uint64_t m_frameBytes;		// budget of a frame
+	uint64_t m_frameUsed;
+	uint64_t m_bytesCopied;
+	uint64_t m_pieces;
+	uint64_t m_frames;			// closed with anything copied
+};
@@ -0,0 +1,210 @@
+#include "VertexPacking.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+	float SignNotZero(float v)
+	{
+		return v >= 0.0f ? 1.0f : -1.0f;
+	}
+
+	XMFLOAT3 Normalize(const XMFLOAT3& v)
+	{
+		float length = sqrtf(v.x * v.x + v.y * v.y + v.z * v.z);
+		return length > 0.0f ? XMFLOAT3(v.x / length, v.y / length, v.z / length) : v;
+	}
+
+	float AngleDegrees(const XMFLOAT3& a, const XMFLOAT3& b)
+	{
+		float d = a.x * b.x + a.y * b.y + a.z * b.z;
+		return acosf(std::max(-1.0f, std::min(1.0f, d))) * (180.0f / XM_PI);
+	}
+}
+
+int16_t VertexPacking::QuantizeSnorm16(float v)
+{
+	v = std::max(-1.0f, std::min(1.0f, v));
+	return (int16_t)lrintf(v * 32767.0f);
+}
+
+float VertexPacking::DequantizeSnorm16(int16_t v)
+{
+	// Same rule as the input assembler: -32768 and -32767 both map to -1.
+	return std::max((float)v / 32767.0f, -1.0f);
+}
+
+void VertexPacking::EncodeOctahedral(const XMFLOAT3& n, int16_t encoded[2])
+{
+	float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+	float x = n.x / l1;
+	float y = n.y / l1;
+
+	// Fold the lower hemisphere over the diagonals.
+	if (n.z < 0.0f)
+	{
+		float fx = (1.0f - fabsf(y)) * SignNotZero(x);
+		float fy = (1.0f - fabsf(x)) * SignNotZero(y);
+		x = fx;
+		y = fy;
+	}
+
+	encoded[0] = QuantizeSnorm16(x);
+	encoded[1] = QuantizeSnorm16(y);
+}
+
+XMFLOAT3 VertexPacking::DecodeOctahedral(const int16_t encoded[2])
+{
+	float x = DequantizeSnorm16(encoded[0]);
+	float y = DequantizeSnorm16(encoded[1]);
+	float z = 1.0f - fabsf(x) - fabsf(y);
+
+	if (z < 0.0f)
+	{
+		float fx = (1.0f - fabsf(y)) * SignNotZero(x);
+		float fy = (1.0f - fabsf(x)) * SignNotZero(y);
+		x = fx;
+		y = fy;
+	}
+
+	return Normalize(XMFLOAT3(x, y, z));
+}
+
+XMFLOAT3 VertexPacking::ReconstructTangent(const XMFLOAT3& n)
+{
+	// dP/dtheta with theta = atan2(z, x) is proportional to (-z, 0, x).
+	float length = sqrtf(n.x * n.x + n.z * n.z);
+	if (length < 1e-4f)
+	{
+		return XMFLOAT3(1.0f, 0.0f, 0.0f);
+	}
+	return XMFLOAT3(-n.z / length, 0.0f, n.x / length);
+}
+
+PackedVertex VertexPacking::Encode(const Vertex& v, const XMFLOAT3& origin, float scale)
+{
+	PackedVertex packed;
+	packed.Position[0] = QuantizeSnorm16((v.Position.x - origin.x) / scale);
+	packed.Position[1] = QuantizeSnorm16((v.Position.y - origin.y) / scale);
+	packed.Position[2] = QuantizeSnorm16((v.Position.z - origin.z) / scale);
+	packed.Position[3] = 0;
+	EncodeOctahedral(v.Normal, packed.Normal);
+	return packed;
+}
+
+Vertex VertexPacking::Decode(const PackedVertex& v, const XMFLOAT3& origin, float scale)
+{
+	Vertex decoded;
+	decoded.Position = XMFLOAT3(
+		origin.x + DequantizeSnorm16(v.Position[0]) * scale,
+		origin.y + DequantizeSnorm16(v.Position[1]) * scale,
+		origin.z + DequantizeSnorm16(v.Position[2]) * scale);
+	decoded.Normal = DecodeOctahedral(v.Normal);
+	decoded.TangentU = ReconstructTangent(decoded.Normal);
+	decoded.TexC = XMFLOAT2(0.0f, 0.0f);
+	return decoded;
+}
+
+void VertexPacking::PackVertices(const std::vector<Vertex>& vertices, std::vector<PackedVertex>& packed,
+	XMFLOAT3& origin, float& scale, PackingReport* report)
+{
+	XMFLOAT3 minimum(0.0f, 0.0f, 0.0f);
+	XMFLOAT3 maximum(0.0f, 0.0f, 0.0f);
+	if (!vertices.empty())
+	{
+		minimum = maximum = vertices[0].Position;
+	}
+
+	for (const Vertex& v : vertices)
+	{
+		minimum = XMFLOAT3(std::min(minimum.x, v.Position.x), std::min(minimum.y, v.Position.y), std::min(minimum.z, v.Position.z));
+		maximum = XMFLOAT3(std::max(maximum.x, v.Position.x), std::max(maximum.y, v.Position.y), std::max(maximum.z, v.Position.z));
+	}
+
+	origin = XMFLOAT3(0.5f * (minimum.x + maximum.x), 0.5f * (minimum.y + maximum.y), 0.5f * (minimum.z + maximum.z));
+	scale = 0.5f * std::max(maximum.x - minimum.x, std::max(maximum.y - minimum.y, maximum.z - minimum.z));
+	if (scale <= 0.0f)
+	{
+		scale = 1.0f;
+	}
+
+	packed.resize(vertices.size());
+	for (size_t i = 0; i < vertices.size(); ++i)
+	{
+		packed[i] = Encode(vertices[i], origin, scale);
+	}
+
+	if (report)
+	{
+		*report = {};
+		report->sourceBytes = vertices.size() * sizeof(Vertex);
+		report->packedBytes = packed.size() * sizeof(PackedVertex);
+
+		for (size_t i = 0; i < vertices.size(); ++i)
+		{
+			const Vertex& source = vertices[i];
+			Vertex decoded = Decode(packed[i], origin, scale);
+
+			float dx = decoded.Position.x - source.Position.x;
+			float dy = decoded.Position.y - source.Position.y;
+			float dz = decoded.Position.z - source.Position.z;
+
+			report->maxPositionError = std::max(report->maxPositionError, sqrtf(dx * dx + dy * dy + dz * dz));
+			report->maxNormalErrorDegrees = std::max(report->maxNormalErrorDegrees, AngleDegrees(decoded.Normal, Normalize(source.Normal)));
+
+			// At the poles dP/dtheta vanishes and either side just picks some axis, so
+			// there is nothing meaningful to compare.
+			if (sqrtf(source.Normal.x * source.Normal.x + source.Normal.z * source.Normal.z) >= 1e-3f)
+			{
+				report->maxTangentErrorDegrees = std::max(report->maxTangentErrorDegrees, AngleDegrees(decoded.TangentU, Normalize(source.TangentU)));
+			}
+		}
+	}
+}
+
+bool VertexPacking::Validate()
+{
+	if (QuantizeSnorm16(1.0f) != 32767 || QuantizeSnorm16(-1.0f) != -32767 || QuantizeSnorm16(0.0f) != 0 ||
+		QuantizeSnorm16(2.0f) != 32767 || QuantizeSnorm16(-2.0f) != -32767 ||
+		DequantizeSnorm16(32767) != 1.0f || DequantizeSnorm16(-32767) != -1.0f || DequantizeSnorm16(-32768) != -1.0f ||
+		DequantizeSnorm16(0) != 0.0f || DequantizeSnorm16(QuantizeSnorm16(0.5f)) != QuantizeSnorm16(0.5f) / 32767.0f)
+	{
+		return false;
+	}
+
+	// Rings from pole to pole; the ring at the equator passes through -z, where the fold meets.
+	const uint32_t rings = 64;
+	const uint32_t segments = 128;
+	for (uint32_t ring = 0; ring <= rings; ++ring)
+	{
+		for (uint32_t segment = 0; segment < segments; ++segment)
+		{
+			const float phi = XM_PI * ring / rings;
+			const float theta = XM_2PI * segment / segments;
+			const XMFLOAT3 n(sinf(phi) * cosf(theta), cosf(phi), sinf(phi) * sinf(theta));
+			int16_t encoded[2];
+			EncodeOctahedral(n, encoded);
+			if (AngleDegrees(DecodeOctahedral(encoded), n) > 0.05f)
+			{
+				return false;
+			}
+		}
+	}
+
+	for (uint32_t level : { 5u, 8u })
+	{
+		GeometryGenerator::MeshData mesh;
+		GeometryGenerator::CreateGeosphere(1737.0f, level, mesh);
+		std::vector<PackedVertex> packed;
+		XMFLOAT3 origin;
+		float scale;
+		PackingReport report;
+		PackVertices(mesh.Vertices, packed, origin, scale, &report);
+		if (report.packedBytes != mesh.Vertices.size() * sizeof(PackedVertex) || report.maxPositionError > scale / 32767.0f ||
+			report.maxNormalErrorDegrees > 0.05f || report.maxTangentErrorDegrees > 0.25f)
+		{
+			return false;
+		}
+	}
+	return true;
+}
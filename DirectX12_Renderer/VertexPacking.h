@@ -0,0 +1,50 @@
+#pragma once
+
+#include "GeometryGenerator.h"
+
+// 12 byte control point for the tessellated terrain (Vertex is 44).
+// Read by the input assembler as R16G16B16A16_SNORM + R16G16_SNORM.
+struct PackedVertex
+{
+	int16_t Position[4];	// (p - origin) / scale, w is padding
+	int16_t Normal[2];		// octahedral encoded unit normal
+};
+
+static_assert(sizeof(PackedVertex) == 12, "PackedVertex must match the packed input layout");
+
+// CPU encode/decode of PackedVertex. Decode mirrors VertexShaderTes.hlsl.
+class VertexPacking
+{
+public:
+	struct PackingReport
+	{
+		float maxPositionError;			// in mesh units
+		float maxNormalErrorDegrees;
+		float maxTangentErrorDegrees;
+		size_t sourceBytes;
+		size_t packedBytes;
+	};
+
+	static int16_t QuantizeSnorm16(float v);
+	static float DequantizeSnorm16(int16_t v);
+
+	static void EncodeOctahedral(const XMFLOAT3& n, int16_t encoded[2]);
+	static XMFLOAT3 DecodeOctahedral(const int16_t encoded[2]);
+
+	// The tangent is dP/dtheta of the sphere, which only depends on the normal.
+	static XMFLOAT3 ReconstructTangent(const XMFLOAT3& n);
+
+	static PackedVertex Encode(const Vertex& v, const XMFLOAT3& origin, float scale);
+	static Vertex Decode(const PackedVertex& v, const XMFLOAT3& origin, float scale);
+
+	// Picks origin and scale from the bounding box of the vertices and packs them all.
+	// If report is given, every vertex is decoded again and compared to its source.
+	static void PackVertices(const std::vector<Vertex>& vertices, std::vector<PackedVertex>& packed,
+		XMFLOAT3& origin, float& scale, PackingReport* report = nullptr);
+
+	// True if snorm16 keeps its endpoints as the input assembler reads them, normals swept over
+	// the sphere, poles and lower hemisphere included, decode within 0.05 degrees, and geospheres
+	// of levels 5 and 8 at the moon's radius round trip within a quantization step of position,
+	// 0.05 degrees of normal and 0.25 degrees of tangent away from the poles.
+	static bool Validate();
+};
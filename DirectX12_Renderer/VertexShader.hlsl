@@ -13,18 +13,35 @@ struct VS_INPUT
 	float3 norm : NORMAL;
 };
 
+struct LightData {
+	float4 pos;
+	float4 amb;
+	float4 dif;
+	float4 spec;
+	float3 att;
+	float rng;
+	float3 dir;
+	float sexp;
+};
+
+// Same layout as ConstantBuffer in Terrain.h, which Terrain and Sky both fill.
 cbuffer ConstantBuffer : register(b0)
 {
 	float4x4 viewproj;
 	float4 eye;
+	LightData light;
 	int height;
 	int width;
+	float heightOffset;
+	float heightScale;
+	float3 meshOrigin;
+	float meshScale;
 }
 
 VS_OUTPUT VS(VS_INPUT input) {
 	VS_OUTPUT output;
 
-	output.pos = float4(input.pos.x, input.pos.y, input.pos.z, 1.0f);
+	output.pos = float4(meshOrigin + input.pos * meshScale, 1.0f);
 	output.pos = mul(output.pos, viewproj);
 
 	output.norm = float4(input.norm, 1.0f);
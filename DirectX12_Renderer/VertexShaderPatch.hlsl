@@ -0,0 +1,83 @@
+struct VS_OUTPUT
+{
+	float3 pos : POSITION;
+	float3 norm : NORMAL;
+	float3 tan : TANGENT;
+};
+
+// Grid vertex plus the PatchInstance of TerrainQuadtree.h.
+struct VS_INPUT
+{
+	float2 grid : POSITION;
+	float4 patch : PATCH;
+	float2 morph : MORPH;
+};
+
+struct LightData {
+	float4 pos;
+	float4 amb;
+	float4 dif;
+	float4 spec;
+	float3 att;
+	float rng;
+	float3 dir;
+	float sexp;
+};
+
+cbuffer ConstantBuffer : register(b0)
+{
+	float4x4 viewproj;
+	float4 eye;
+	LightData light;
+	int height;
+	int width;
+	float heightOffset;
+	float heightScale;
+	float3 meshOrigin;
+	float meshScale;
+	float planetRadius;
+	int patchGridSize;
+}
+
+// Same as TerrainQuadtree::FaceToSphere.
+float3 FaceToSphere(uint face, float2 uv)
+{
+	static const float3 axes[18] =
+	{
+		float3(+1, 0, 0), float3(0, 1, 0), float3(0, 0, 1),
+		float3(-1, 0, 0), float3(0, 0, 1), float3(0, 1, 0),
+		float3(0, +1, 0), float3(0, 0, 1), float3(1, 0, 0),
+		float3(0, -1, 0), float3(1, 0, 0), float3(0, 0, 1),
+		float3(0, 0, +1), float3(1, 0, 0), float3(0, 1, 0),
+		float3(0, 0, -1), float3(0, 1, 0), float3(1, 0, 0),
+	};
+
+	float2 ab = uv * 2.0f - 1.0f;
+	float3 p = axes[face * 3] + ab.x * axes[face * 3 + 1] + ab.y * axes[face * 3 + 2];
+	float3 p2 = p * p;
+
+	return p * sqrt(max(0.0f, 1.0f - p2.yzx / 2.0f - p2.zxy / 2.0f + p2.yzx * p2.zxy / 3.0f));
+}
+
+VS_OUTPUT VSPatch(VS_INPUT input) {
+	VS_OUTPUT output;
+
+	uint face = (uint)input.patch.w;
+	float3 position = FaceToSphere(face, input.patch.xy + input.grid * input.patch.z) * planetRadius;
+
+	// CDLOD morph: odd grid vertices slide onto the parent's grid as the eye moves away.
+	float k = saturate((distance(eye.xyz, position) - input.morph.x) / (input.morph.y - input.morph.x));
+	float2 fracPart = frac(input.grid * patchGridSize * 0.5f) * 2.0f / patchGridSize;
+	float2 grid = input.grid - fracPart * k;
+
+	float3 n = FaceToSphere(face, input.patch.xy + grid * input.patch.z);
+
+	output.pos = n * planetRadius;
+	output.norm = n;
+
+	// dP/dtheta, as in VertexPacking::ReconstructTangent.
+	float len = length(n.xz);
+	output.tan = len < 1e-4f ? float3(1.0f, 0.0f, 0.0f) : float3(-n.z, 0.0f, n.x) / len;
+
+	return output;
+}
@@ -0,0 +1,18 @@
+struct VS_OUTPUT
+{
+	float4 pos : SV_POSITION;
+	float2 clip : TEXCOORD;
+};
+
+// One triangle that covers the screen, (-1, 1), (3, 1), (-1, -3), as SkyRay::FullscreenVertex.
+// It lies on the far plane, so the depth test keeps only the pixels nothing else was drawn to.
+VS_OUTPUT VSSky(uint id : SV_VERTEXID)
+{
+	VS_OUTPUT output;
+
+	float2 uv = float2((id << 1) & 2, id & 2);
+	output.clip = uv * float2(2.0f, -2.0f) + float2(-1.0f, 1.0f);
+	output.pos = float4(output.clip, 1.0f, 1.0f);
+
+	return output;
+}
@@ -0,0 +1,49 @@
+// SkyConstantBuffer in Sky.h.
+cbuffer SkyConstantBuffer : register(b0)
+{
+	float4x4 viewproj;
+	float4 eye;
+	int height;
+	int width;
+	float4x4 invViewproj;
+}
+
+// Star in StarCatalog.h, one per instance.
+struct VS_INPUT
+{
+	float3 direction : DIRECTION;
+	float magnitude : MAGNITUDE;
+	float4 color : COLOR;
+};
+
+struct VS_OUTPUT
+{
+	float4 pos : SV_POSITION;
+	float2 corner : TEXCOORD;
+	float3 color : COLOR;
+};
+
+// StarCatalog::SPRITE_RADIUS
+static const float SPRITE_RADIUS = 0.002f;
+
+// A strip of 4 vertices per star, a square of SpriteRadius around its direction at infinity,
+// on the far plane like the fullscreen sky. Same as StarCatalog::ProjectSprite.
+VS_OUTPUT VSStars(VS_INPUT input, uint id : SV_VERTEXID)
+{
+	VS_OUTPUT output;
+
+	float2 corner = float2((id & 1) ? 1.0f : -1.0f, (id & 2) ? 1.0f : -1.0f);
+	float3 reference = abs(input.direction.y) < 0.99f ? float3(0.0f, 1.0f, 0.0f) : float3(1.0f, 0.0f, 0.0f);
+	float3 right = normalize(cross(reference, input.direction));
+	float3 up = cross(input.direction, right);
+
+	float radius = SPRITE_RADIUS * clamp(1.0f - 0.1f * input.magnitude, 0.5f, 2.0f);
+	float3 p = input.direction + (right * corner.x + up * corner.y) * radius;
+
+	output.pos = mul(float4(p, 0.0f), viewproj);
+	output.pos.z = output.pos.w;
+	output.corner = corner;
+	output.color = input.color.rgb * min(pow(10.0f, -0.4f * input.magnitude), 1.0f);
+
+	return output;
+}
@@ -0,0 +1,49 @@
+struct VS_INPUT
+{
+	float3 pos : POSITION;
+	float3 norm : NORMAL;
+	float3 tan : TANGENT;
+	float2 tex : TEXCOORD;
+};
+
+// Same as DS_OUTPUT, so PSTes shades both paths.
+struct VS_OUTPUT
+{
+	float4 pos : SV_POSITION;
+	float4 norm : NORMAL;
+	float3 tan : TANGENT;
+	float2 tex : TEXCOORD;
+};
+
+struct LightData {
+	float4 pos;
+	float4 amb;
+	float4 dif;
+	float4 spec;
+	float3 att;
+	float rng;
+	float3 dir;
+	float sexp;
+};
+
+cbuffer ConstantBuffer : register(b0)
+{
+	float4x4 viewproj;
+	float4 eye;
+	LightData light;
+	int height;
+	int width;
+}
+
+// Vertices were displaced once on the CPU by TerrainDisplacement.
+VS_OUTPUT VSStatic(VS_INPUT input)
+{
+	VS_OUTPUT output;
+
+	output.pos = mul(float4(input.pos, 1.0f), viewproj);
+	output.norm = float4(input.norm, 1.0f);
+	output.tan = input.tan;
+	output.tex = input.tex;
+
+	return output;
+}
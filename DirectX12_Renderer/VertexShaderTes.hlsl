@@ -8,12 +8,21 @@ struct VS_OUTPUT
 	float3 tan : TANGENT;
 };
 
+#ifdef PACKED_VERTEX
+// PackedVertex in VertexPacking.h: R16G16B16A16_SNORM position, R16G16_SNORM octahedral normal.
+struct VS_INPUT
+{
+	float4 pos : POSITION;
+	float2 norm : NORMAL;
+};
+#else
 struct VS_INPUT
 {
 	float3 pos : POSITION;
 	float3 norm : NORMAL;
 	float3 tan : TANGENT;
 };
+#endif
 
 struct LightData {
 	float4 pos;
@@ -33,14 +42,44 @@ cbuffer ConstantBuffer : register(b0)
 	LightData light;
 	int height;
 	int width;
+	float heightOffset;
+	float heightScale;
+	float3 meshOrigin;
+	float meshScale;
+}
+
+#ifdef PACKED_VERTEX
+// Same as VertexPacking::DecodeOctahedral.
+float3 DecodeOctahedral(float2 e)
+{
+	float3 n = float3(e.x, e.y, 1.0f - abs(e.x) - abs(e.y));
+	if (n.z < 0.0f)
+	{
+		n.xy = (1.0f - abs(n.yx)) * (n.xy >= 0.0f ? 1.0f : -1.0f);
+	}
+	return normalize(n);
+}
+
+// Same as VertexPacking::ReconstructTangent: dP/dtheta of the sphere.
+float3 ReconstructTangent(float3 n)
+{
+	float len = length(n.xz);
+	return len < 1e-4f ? float3(1.0f, 0.0f, 0.0f) : float3(-n.z, 0.0f, n.x) / len;
 }
+#endif
 
 VS_OUTPUT VSTes(VS_INPUT input) {
 	VS_OUTPUT output;
 
-	output.pos = input.pos;
+#ifdef PACKED_VERTEX
+	output.pos = meshOrigin + input.pos.xyz * meshScale;
+	output.norm = DecodeOctahedral(input.norm);
+	output.tan = ReconstructTangent(output.norm);
+#else
+	output.pos = meshOrigin + input.pos * meshScale;
 	output.norm = input.norm;
 	output.tan = input.tan;
+#endif
 
 	return output;
 }
\ No newline at end of file
@@ -0,0 +1,549 @@
+#include "VirtualTexture.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+namespace
+{
+	const float PI = 3.14159265359f; // as in DomainShader
+
+	int64_t Wrap(int64_t value, int64_t size)
+	{
+		int64_t wrapped = value % size;
+		return wrapped < 0 ? wrapped + size : wrapped;
+	}
+}
+
+const uint16_t VirtualPageTable::NOT_RESIDENT;
+const uint16_t TileCache::NO_SLOT;
+const TileKey TileCache::NO_TILE;
+
+VirtualPageTable::VirtualPageTable()
+{
+}
+
+void VirtualPageTable::Init(const std::vector<TilePyramid::Level>& levels)
+{
+	m_levels = levels;
+	m_slots.resize(levels.size());
+	for (size_t l = 0; l < levels.size(); ++l)
+	{
+		m_slots[l].assign((size_t)levels[l].tilesX * levels[l].tilesY, NOT_RESIDENT);
+	}
+}
+
+uint16_t VirtualPageTable::GetSlot(TileKey key) const
+{
+	const uint32_t level = TileKeyLevel(key);
+	return m_slots[level][(size_t)TileKeyY(key) * m_levels[level].tilesX + TileKeyX(key)];
+}
+
+void VirtualPageTable::Map(TileKey key, uint16_t slot)
+{
+	const uint32_t level = TileKeyLevel(key);
+	m_slots[level][(size_t)TileKeyY(key) * m_levels[level].tilesX + TileKeyX(key)] = slot;
+}
+
+void VirtualPageTable::Unmap(TileKey key)
+{
+	Map(key, NOT_RESIDENT);
+}
+
+bool VirtualPageTable::Resolve(uint32_t level, uint32_t x, uint32_t y, uint16_t& slot, uint32_t& residentLevel) const
+{
+	for (uint32_t l = level; l < m_levels.size(); ++l)
+	{
+		const uint32_t shift = l - level;
+		slot = m_slots[l][(size_t)(y >> shift) * m_levels[l].tilesX + (x >> shift)];
+		if (slot != NOT_RESIDENT)
+		{
+			residentLevel = l;
+			return true;
+		}
+	}
+	return false;
+}
+
+void VirtualPageTable::WriteIndirection(uint32_t slotsPerRow, std::vector<uint32_t>& texels) const
+{
+	const uint32_t width = GetIndirectionWidth();
+	const uint32_t height = GetIndirectionHeight();
+	texels.resize((size_t)width * height);
+	for (uint32_t y = 0; y < height; ++y)
+	{
+		for (uint32_t x = 0; x < width; ++x)
+		{
+			uint16_t slot;
+			uint32_t level;
+			texels[(size_t)y * width + x] = Resolve(0, x, y, slot, level) ?
+				(slot % slotsPerRow) | (slot / slotsPerRow) << 8 | level << 16 | 0xFFu << 24 : 0;
+		}
+	}
+}
+
+TileCache::TileCache() :
+	m_head(NO_SLOT),
+	m_tail(NO_SLOT)
+{
+}
+
+TileCache::TileCache(uint32_t capacity) :
+	m_slots(capacity),
+	m_head(NO_SLOT),
+	m_tail(NO_SLOT)
+{
+	for (uint32_t s = capacity; s > 0; --s)
+	{
+		m_free.push_back((uint16_t)(s - 1));
+	}
+}
+
+uint16_t TileCache::Find(TileKey key) const
+{
+	auto found = m_lookup.find(key);
+	return found == m_lookup.end() ? NO_SLOT : found->second;
+}
+
+void TileCache::Touch(uint16_t slot, uint32_t frame)
+{
+	Slot& entry = m_slots[slot];
+	entry.lastUsed = frame;
+	if (!entry.pinned && slot != m_tail)
+	{
+		Unlink(slot);
+		PushBack(slot);
+	}
+}
+
+uint16_t TileCache::Insert(TileKey key, uint32_t frame, bool pinned, TileKey& evicted)
+{
+	evicted = NO_TILE;
+	uint16_t slot;
+	if (!m_free.empty())
+	{
+		slot = m_free.back();
+		m_free.pop_back();
+	}
+	else
+	{
+		// The list is in order of use, so if its head was used this frame all of them were.
+		if (m_head == NO_SLOT || m_slots[m_head].lastUsed == frame)
+		{
+			return NO_SLOT;
+		}
+		slot = m_head;
+		evicted = m_slots[slot].key;
+		m_lookup.erase(evicted);
+		Unlink(slot);
+	}
+
+	Slot& entry = m_slots[slot];
+	entry.key = key;
+	entry.lastUsed = frame;
+	entry.pinned = pinned;
+	m_lookup[key] = slot;
+	if (!pinned)
+	{
+		PushBack(slot);
+	}
+	return slot;
+}
+
+void TileCache::Unlink(uint16_t slot)
+{
+	Slot& entry = m_slots[slot];
+	(entry.prev == NO_SLOT ? m_head : m_slots[entry.prev].next) = entry.next;
+	(entry.next == NO_SLOT ? m_tail : m_slots[entry.next].prev) = entry.prev;
+}
+
+void TileCache::PushBack(uint16_t slot)
+{
+	Slot& entry = m_slots[slot];
+	entry.prev = m_tail;
+	entry.next = NO_SLOT;
+	(m_tail == NO_SLOT ? m_head : m_slots[m_tail].next) = slot;
+	m_tail = slot;
+}
+
+TileLoader::TileLoader(const ReadFunction& read) :
+	m_read(read),
+	m_reading(false),
+	m_stop(false)
+{
+	m_thread = std::thread(&TileLoader::Run, this);
+}
+
+TileLoader::~TileLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_wake.notify_one();
+	m_thread.join();
+}
+
+void TileLoader::Request(const std::vector<TileKey>& keys)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_queue.clear();
+		for (TileKey key : keys)
+		{
+			if (m_busy.find(key) == m_busy.end())
+			{
+				m_queue.push_back(key);
+			}
+		}
+		std::stable_sort(m_queue.begin(), m_queue.end(), [](TileKey a, TileKey b) { return TileKeyLevel(a) < TileKeyLevel(b); });
+	}
+	m_wake.notify_one();
+}
+
+void TileLoader::TakeLoaded(std::vector<LoadedTile>& tiles, size_t maxTiles)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	size_t count = std::min(maxTiles, m_loaded.size());
+	for (size_t i = 0; i < count; ++i)
+	{
+		m_busy.erase(m_loaded[i].key);
+		tiles.push_back(std::move(m_loaded[i]));
+	}
+	m_loaded.erase(m_loaded.begin(), m_loaded.begin() + count);
+}
+
+void TileLoader::WaitIdle()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_idle.wait(lock, [this] { return m_queue.empty() && !m_reading; });
+}
+
+void TileLoader::Run()
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	for (;;)
+	{
+		m_wake.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+		if (m_stop)
+		{
+			return;
+		}
+
+		LoadedTile tile;
+		tile.key = m_queue.back();
+		m_queue.pop_back();
+		m_busy.insert(tile.key);
+		m_reading = true;
+
+		lock.unlock();
+		bool read = m_read(tile.key, tile.texels);
+		lock.lock();
+
+		m_reading = false;
+		if (read)
+		{
+			m_loaded.push_back(std::move(tile));
+		}
+		else
+		{
+			m_busy.erase(tile.key);
+		}
+		if (m_queue.empty())
+		{
+			m_idle.notify_all();
+		}
+	}
+}
+
+VirtualTexture::VirtualTexture() :
+	m_format(TileFormat::R16_UNORM),
+	m_loader(nullptr),
+	m_slotsPerRow(0),
+	m_pinnedLevel(0),
+	m_frame(0),
+	m_statistics()
+{
+}
+
+VirtualTexture::~VirtualTexture()
+{
+	delete m_loader;
+}
+
+void VirtualTexture::Open(const TileArchive& archive, uint32_t map, uint32_t slotsPerRow)
+{
+	const TileFormat format = archive.GetMap(map).format;
+	Init(archive.GetLevels(map), format, slotsPerRow, [&archive, map, format](TileKey key, std::vector<uint8_t>& texels)
+	{
+		texels.resize(TilePyramid::TileBytes(format));
+		return archive.ReadTile(map, TileKeyLevel(key), TileKeyX(key), TileKeyY(key), texels.data());
+	});
+}
+
+void VirtualTexture::Init(const std::vector<TilePyramid::Level>& levels, TileFormat format, uint32_t slotsPerRow, const TileLoader::ReadFunction& read)
+{
+	delete m_loader;
+	m_levels = levels;
+	m_format = format;
+	m_pageTable.Init(levels);
+	m_cache = TileCache(slotsPerRow * slotsPerRow);
+	m_slotsPerRow = slotsPerRow;
+	m_frame = 0;
+	m_statistics = {};
+	m_pinnedUploads.clear();
+
+	const uint32_t coarsest = (uint32_t)levels.size() - 1;
+	uint32_t pinnedTiles = 0;
+	m_pinnedLevel = coarsest;
+	for (uint32_t l = coarsest + 1; l-- > 0;)
+	{
+		uint32_t tiles = levels[l].tilesX * levels[l].tilesY;
+		if (l != coarsest && pinnedTiles + tiles > m_cache.GetCapacity() / 8)
+		{
+			break;
+		}
+		pinnedTiles += tiles;
+		m_pinnedLevel = l;
+	}
+
+	for (uint32_t l = m_pinnedLevel; l <= coarsest; ++l)
+	{
+		for (uint32_t y = 0; y < levels[l].tilesY; ++y)
+		{
+			for (uint32_t x = 0; x < levels[l].tilesX; ++x)
+			{
+				Upload upload;
+				upload.key = MakeTileKey(l, x, y);
+				if (!read(upload.key, upload.texels))
+				{
+					continue;
+				}
+				TileKey evicted;
+				upload.slot = m_cache.Insert(upload.key, m_frame, true, evicted);
+				m_pageTable.Map(upload.key, upload.slot);
+				m_pinnedUploads.push_back(std::move(upload));
+			}
+		}
+	}
+
+	m_loader = new TileLoader(read);
+}
+
+uint32_t VirtualTexture::LevelForTexelAngle(float texelAngle) const
+{
+	// Level l texels are 2 pi 2^l / width wide.
+	float level = floorf(log2f(texelAngle * GetWidth() / (2.0f * PI)));
+	return (uint32_t)std::min(std::max(level, 0.0f), (float)(m_levels.size() - 1));
+}
+
+void VirtualTexture::AddFootprint(float thetaMin, float thetaMax, float phiMin, float phiMax, float texelAngle, std::vector<TileKey>& tiles) const
+{
+	const uint32_t level = LevelForTexelAngle(texelAngle);
+	const TilePyramid::Level& current = m_levels[level];
+	const int64_t width = current.width;
+	const int64_t height = current.height;
+
+	// Texels of the level, u = theta / 2 pi and v = phi / pi as in DomainShader.
+	int64_t x = (int64_t)floor(thetaMin / (2.0 * PI) * width);
+	int64_t xEnd = (int64_t)floor(thetaMax / (2.0 * PI) * width);
+	if (xEnd - x + 1 >= width)
+	{
+		x = 0;
+		xEnd = width - 1;
+	}
+	const int64_t yBegin = std::min(std::max((int64_t)floor(phiMin / PI * height), (int64_t)0), height - 1);
+	const int64_t yEnd = std::min(std::max((int64_t)floor(phiMax / PI * height), (int64_t)0), height - 1);
+
+	while (x <= xEnd)
+	{
+		const int64_t wrapped = Wrap(x, width);
+		const uint32_t tx = (uint32_t)(wrapped / TilePyramid::TILE_SIZE);
+		for (int64_t ty = yBegin / TilePyramid::TILE_SIZE; ty <= yEnd / TilePyramid::TILE_SIZE; ++ty)
+		{
+			tiles.push_back(MakeTileKey(level, tx, (uint32_t)ty));
+		}
+		x += std::min((int64_t)(tx + 1) * TilePyramid::TILE_SIZE, width) - wrapped;
+	}
+}
+
+bool VirtualTexture::Update(std::vector<TileKey>& wanted, uint32_t maxUploads, std::vector<Upload>& uploads)
+{
+	++m_frame;
+	uploads.clear();
+	bool changed = !m_pinnedUploads.empty();
+	uploads.swap(m_pinnedUploads);
+
+	std::sort(wanted.begin(), wanted.end());
+	wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+
+	// Missing tiles keep their resident fallback from being evicted while they load.
+	m_missing.clear();
+	for (TileKey key : wanted)
+	{
+		uint16_t slot = m_cache.Find(key);
+		if (slot == TileCache::NO_SLOT)
+		{
+			m_missing.push_back(key);
+			uint32_t level;
+			if (m_pageTable.Resolve(TileKeyLevel(key), TileKeyX(key), TileKeyY(key), slot, level))
+			{
+				m_cache.Touch(slot, m_frame);
+			}
+			continue;
+		}
+		m_cache.Touch(slot, m_frame);
+		++m_statistics.resident;
+	}
+	m_statistics.wanted += wanted.size();
+	m_loader->Request(m_missing);
+
+	m_loaded.clear();
+	m_loader->TakeLoaded(m_loaded, maxUploads);
+	for (TileLoader::LoadedTile& tile : m_loaded)
+	{
+		TileKey evicted;
+		uint16_t slot = m_cache.Find(tile.key) == TileCache::NO_SLOT ? m_cache.Insert(tile.key, m_frame, false, evicted) : TileCache::NO_SLOT;
+		if (slot == TileCache::NO_SLOT)
+		{
+			// Already resident, or every slot is in use this frame; a wanted tile is asked for again.
+			continue;
+		}
+		if (evicted != TileCache::NO_TILE)
+		{
+			m_pageTable.Unmap(evicted);
+			++m_statistics.evicted;
+		}
+		m_pageTable.Map(tile.key, slot);
+		++m_statistics.loaded;
+		changed = true;
+
+		Upload upload;
+		upload.key = tile.key;
+		upload.slot = slot;
+		upload.texels = std::move(tile.texels);
+		uploads.push_back(std::move(upload));
+	}
+	return changed;
+}
+
+void VirtualTexture::WaitForLoads()
+{
+	m_loader->WaitIdle();
+}
+
+bool VirtualTexture::Validate()
+{
+	// Page table: a level 2 tile and one of the level 0 tiles under it, over a map that is not a
+	// power of two.
+	std::vector<TilePyramid::Level> levels;
+	TilePyramid::Layout(40 * TilePyramid::TILE_SIZE + 5, 20 * TilePyramid::TILE_SIZE + 3, levels);
+	VirtualPageTable pageTable;
+	pageTable.Init(levels);
+	uint16_t slot;
+	uint32_t level;
+	if (pageTable.Resolve(0, 9, 5, slot, level))
+	{
+		return false;
+	}
+	pageTable.Map(MakeTileKey(2, 2, 1), 7);
+	pageTable.Map(MakeTileKey(0, 9, 5), 3);
+	if (!pageTable.Resolve(0, 9, 5, slot, level) || slot != 3 || level != 0 ||
+		!pageTable.Resolve(0, 8, 4, slot, level) || slot != 7 || level != 2 ||
+		!pageTable.Resolve(1, 5, 3, slot, level) || slot != 7 || level != 2 ||
+		pageTable.Resolve(0, 12, 4, slot, level))
+	{
+		return false;
+	}
+	std::vector<uint32_t> indirection;
+	pageTable.WriteIndirection(4, indirection);
+	const uint32_t indirectionWidth = pageTable.GetIndirectionWidth();
+	if (indirection.size() != (size_t)indirectionWidth * pageTable.GetIndirectionHeight() ||
+		indirection[5 * indirectionWidth + 9] != (3u | 0u << 8 | 0u << 16 | 0xFFu << 24) ||
+		indirection[4 * indirectionWidth + 11] != (3u | 1u << 8 | 2u << 16 | 0xFFu << 24) ||
+		indirection[4 * indirectionWidth + 12] != 0)
+	{
+		return false;
+	}
+
+	// Cache: least recently used first, never a pinned tile or one used this frame.
+	TileCache cache(4);
+	TileKey evicted;
+	uint16_t pinned = cache.Insert(100, 1, true, evicted);
+	uint16_t a = cache.Insert(101, 1, false, evicted);
+	uint16_t b = cache.Insert(102, 1, false, evicted);
+	uint16_t c = cache.Insert(103, 1, false, evicted);
+	cache.Touch(a, 2);
+	cache.Touch(pinned, 2);
+	if (cache.Insert(104, 2, false, evicted) != b || evicted != 102 || cache.Find(102) != TileCache::NO_SLOT ||
+		cache.Insert(105, 2, false, evicted) != c || evicted != 103 ||
+		cache.Insert(106, 2, false, evicted) != TileCache::NO_SLOT ||
+		cache.Insert(106, 3, false, evicted) != a || evicted != 101 ||
+		cache.Find(100) != pinned || cache.GetResidentCount() != 4)
+	{
+		return false;
+	}
+
+	// Streaming a synthetic pyramid whose tiles hold their own key: a patch of tiles and then
+	// one beside it, through a cache too small for both, with every tile read on the loader thread.
+	const uint32_t slotsPerRow = 4;
+	VirtualTexture texture;
+	texture.Init(levels, TileFormat::R16_UNORM, slotsPerRow, [](TileKey key, std::vector<uint8_t>& texels)
+	{
+		texels.assign(TilePyramid::TileBytes(TileFormat::R16_UNORM), 0);
+		memcpy(texels.data(), &key, sizeof(key));
+		return true;
+	});
+
+	std::vector<uint16_t> slotTiles(slotsPerRow * slotsPerRow, 0);
+	std::vector<TileKey> slotKeys(slotsPerRow * slotsPerRow, TileCache::NO_TILE);
+	std::vector<Upload> uploads;
+	for (int patch = 0; patch < 2; ++patch)
+	{
+		const float thetaMin = patch * 1.0f - 0.1f;
+		std::vector<TileKey> footprint;
+		texture.AddFootprint(thetaMin, thetaMin + 0.2f, 1.2f, 1.5f, 2.0f * PI / levels[0].width, footprint);
+		if (footprint.empty() || footprint.size() > slotsPerRow * slotsPerRow - 2)
+		{
+			return false;
+		}
+
+		for (int frame = 0; frame < 64; ++frame)
+		{
+			std::vector<TileKey> wanted = footprint;
+			texture.Update(wanted, 4, uploads);
+			for (const Upload& upload : uploads)
+			{
+				TileKey stored;
+				memcpy(&stored, upload.texels.data(), sizeof(stored));
+				if (stored != upload.key || upload.slot >= slotKeys.size())
+				{
+					return false;
+				}
+				slotKeys[upload.slot] = upload.key;
+			}
+			texture.WaitForLoads();
+		}
+
+		// Every wanted tile resident, and the page table agrees with what was copied where.
+		for (TileKey key : footprint)
+		{
+			uint16_t resident = texture.GetPageTable().GetSlot(key);
+			if (resident == VirtualPageTable::NOT_RESIDENT || slotKeys[resident] != key)
+			{
+				return false;
+			}
+		}
+		for (size_t s = 0; s < slotKeys.size(); ++s)
+		{
+			if (slotKeys[s] != TileCache::NO_TILE && texture.GetPageTable().GetSlot(slotKeys[s]) != s)
+			{
+				return false;
+			}
+		}
+	}
+
+	// The second patch evicted part of the first; the coarsest level stayed.
+	const uint32_t coarsest = (uint32_t)levels.size() - 1;
+	return texture.GetStatistics().evicted > 0 &&
+		texture.GetPageTable().GetSlot(MakeTileKey(coarsest, 0, 0)) != VirtualPageTable::NOT_RESIDENT;
+}
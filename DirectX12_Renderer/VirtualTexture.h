@@ -0,0 +1,217 @@
+#pragma once
+
+#include "TileArchive.h"
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Level in the top 4 bits, then the tile row and column with 14 bits each.
+typedef uint32_t TileKey;
+
+inline TileKey MakeTileKey(uint32_t level, uint32_t x, uint32_t y) { return level << 28 | y << 14 | x; }
+inline uint32_t TileKeyLevel(TileKey key) { return key >> 28; }
+inline uint32_t TileKeyX(TileKey key) { return key & 0x3FFF; }
+inline uint32_t TileKeyY(TileKey key) { return key >> 14 & 0x3FFF; }
+
+// Which cache slot holds each tile of a tile pyramid, and the indirection texture the shaders
+// read it through: one texel per level 0 tile naming the finest resident tile over it.
+class VirtualPageTable
+{
+public:
+	static const uint16_t NOT_RESIDENT = 0xFFFF;
+
+	VirtualPageTable();
+
+	void Init(const std::vector<TilePyramid::Level>& levels);
+
+	uint16_t GetSlot(TileKey key) const;
+	void Map(TileKey key, uint16_t slot);
+	void Unmap(TileKey key);
+
+	// Slot and level of the finest resident tile at or above tile (x, y) of level. False if
+	// not even the coarsest level is resident there.
+	bool Resolve(uint32_t level, uint32_t x, uint32_t y, uint16_t& slot, uint32_t& residentLevel) const;
+
+	uint32_t GetIndirectionWidth() const { return m_levels.empty() ? 0 : m_levels[0].tilesX; }
+	uint32_t GetIndirectionHeight() const { return m_levels.empty() ? 0 : m_levels[0].tilesY; }
+
+	// R8G8B8A8_UINT texels: slot column, slot row, resident level, and 255 where any level is
+	// resident, else all 0. Mirrors VirtualToPhysical in DomainShader.hlsl and PixelShaderTes.hlsl.
+	void WriteIndirection(uint32_t slotsPerRow, std::vector<uint32_t>& texels) const;
+
+private:
+	std::vector<TilePyramid::Level> m_levels;
+	std::vector<std::vector<uint16_t>> m_slots;	// per level, row major
+};
+
+// A fixed number of tile slots reused least recently used first. Pinned tiles are never evicted.
+class TileCache
+{
+public:
+	static const uint16_t NO_SLOT = 0xFFFF;
+	static const TileKey NO_TILE = 0xFFFFFFFF;
+
+	TileCache();
+	explicit TileCache(uint32_t capacity);
+
+	uint16_t Find(TileKey key) const;
+
+	// Marks a slot used in frame, so it is the last to be evicted.
+	void Touch(uint16_t slot, uint32_t frame);
+
+	// Slot for a new tile: a free one, else the least recently used one that was not used in
+	// frame, whose tile is returned in evicted. NO_SLOT if every slot is pinned or in use.
+	uint16_t Insert(TileKey key, uint32_t frame, bool pinned, TileKey& evicted);
+
+	uint32_t GetCapacity() const { return (uint32_t)m_slots.size(); }
+	uint32_t GetResidentCount() const { return (uint32_t)m_lookup.size(); }
+
+private:
+	struct Slot
+	{
+		TileKey key;
+		uint32_t lastUsed;
+		uint16_t prev;		// towards the least recently used end of the list
+		uint16_t next;
+		bool pinned;
+	};
+
+	void Unlink(uint16_t slot);
+	void PushBack(uint16_t slot);
+
+	std::vector<Slot> m_slots;
+	std::vector<uint16_t> m_free;
+	std::unordered_map<TileKey, uint16_t> m_lookup;
+	uint16_t m_head;	// least recently used unpinned slot
+	uint16_t m_tail;	// most recently used
+};
+
+// Reads tiles on a background thread, coarsest first so that fallbacks arrive early.
+class TileLoader
+{
+public:
+	typedef std::function<bool(TileKey key, std::vector<uint8_t>& texels)> ReadFunction;
+
+	struct LoadedTile
+	{
+		TileKey key;
+		std::vector<uint8_t> texels;
+	};
+
+	explicit TileLoader(const ReadFunction& read);
+	~TileLoader();
+
+	TileLoader(const TileLoader&) = delete;
+	TileLoader& operator=(const TileLoader&) = delete;
+
+	// Replaces the queue with the tiles of this frame that are neither being read nor waiting
+	// to be taken; tiles no longer wanted are dropped before they are read.
+	void Request(const std::vector<TileKey>& keys);
+
+	// Moves up to maxTiles loaded tiles out, in the order they were read.
+	void TakeLoaded(std::vector<LoadedTile>& tiles, size_t maxTiles);
+
+	// Blocks until the queue is empty and nothing is being read.
+	void WaitIdle();
+
+private:
+	void Run();
+
+	ReadFunction m_read;
+	std::mutex m_mutex;
+	std::condition_variable m_wake;
+	std::condition_variable m_idle;
+	std::vector<TileKey> m_queue;				// sorted finest first, popped from the back
+	std::unordered_set<TileKey> m_busy;			// being read or loaded and not taken yet
+	std::vector<LoadedTile> m_loaded;
+	bool m_reading;
+	bool m_stop;
+	std::thread m_thread;
+};
+
+// Streams a tile pyramid far larger than any one texture through a fixed physical cache: the
+// tiles a frame wants are requested from a loader thread, loaded tiles replace the least
+// recently used ones, and the page table sends every lookup to the finest resident tile.
+// CPU only; Terrain copies the uploads into the physical texture and the page table into the
+// indirection texture.
+class VirtualTexture
+{
+public:
+	struct Upload
+	{
+		TileKey key;
+		uint16_t slot;
+		std::vector<uint8_t> texels;
+	};
+
+	struct Statistics
+	{
+		uint64_t wanted;	// tiles wanted, summed over frames
+		uint64_t resident;	// of which already in the cache
+		uint64_t loaded;
+		uint64_t evicted;
+	};
+
+	VirtualTexture();
+	~VirtualTexture();
+
+	// Streams a map of an opened archive through slotsPerRow^2 slots. The archive must stay
+	// open while the texture is.
+	void Open(const TileArchive& archive, uint32_t map, uint32_t slotsPerRow);
+
+	// Streams from any tile source, e.g. a synthetic one for tests. The coarsest levels that
+	// fit in an eighth of the cache are read right away and pinned, so every lookup resolves.
+	void Init(const std::vector<TilePyramid::Level>& levels, TileFormat format, uint32_t slotsPerRow, const TileLoader::ReadFunction& read);
+
+	// Coarsest level whose texels are at most texelAngle radians wide along the equator.
+	uint32_t LevelForTexelAngle(float texelAngle) const;
+
+	// Adds the tiles of that level over an angular rectangle, with theta = atan2(z, x) and
+	// phi = acos(y) as in DomainShader; thetaMax may exceed pi when the rectangle wraps.
+	void AddFootprint(float thetaMin, float thetaMax, float phiMin, float phiMax, float texelAngle, std::vector<TileKey>& tiles) const;
+
+	// One frame: marks the wanted tiles that are resident as used, queues the missing ones,
+	// and moves up to maxUploads loaded tiles into cache slots. Uploads lists what to copy into
+	// the physical texture; true if the page table changed. Sorts and deduplicates wanted.
+	bool Update(std::vector<TileKey>& wanted, uint32_t maxUploads, std::vector<Upload>& uploads);
+
+	// Blocks until every requested tile is loaded, for benchmarks.
+	void WaitForLoads();
+
+	const VirtualPageTable& GetPageTable() const { return m_pageTable; }
+	const std::vector<TilePyramid::Level>& GetLevels() const { return m_levels; }
+	uint32_t GetWidth() const { return m_levels.empty() ? 0 : m_levels[0].width; }
+	uint32_t GetHeight() const { return m_levels.empty() ? 0 : m_levels[0].height; }
+	TileFormat GetFormat() const { return m_format; }
+	uint32_t GetSlotsPerRow() const { return m_slotsPerRow; }
+	bool IsOpen() const { return m_loader != nullptr; }
+
+	const Statistics& GetStatistics() const { return m_statistics; }
+	void ResetStatistics() { m_statistics = {}; }
+
+	// True if the page table resolves to the finest resident ancestor, the cache evicts least
+	// recently used tiles but never pinned ones or ones used this frame, and a streamed
+	// synthetic pyramid converges to the wanted tiles with a consistent page table.
+	static bool Validate();
+
+private:
+	std::vector<TilePyramid::Level> m_levels;
+	TileFormat m_format;
+	VirtualPageTable m_pageTable;
+	TileCache m_cache;
+	TileLoader* m_loader;
+	std::vector<Upload> m_pinnedUploads;	// read by Init, handed out by the first Update
+	std::vector<TileLoader::LoadedTile> m_loaded;
+	std::vector<TileKey> m_missing;
+	uint32_t m_slotsPerRow;
+	uint32_t m_pinnedLevel;		// this level and the coarser ones are pinned
+	uint32_t m_frame;
+	Statistics m_statistics;
+};
@@ -0,0 +1,1018 @@
+// Bakes the terrain and sky maps into the tile archive the renderer streams from.
+//
+//   TileBaker terrain.vtar --height height=ldem_64.tif --color color=lroc_color_poles.tif [--compress]
+//   TileBaker lroc_color_poles_4k.dds --color lroc_color_poles_4k.tif [--bc1]
+//   TileBaker --validate
+//   TileBaker --benchmark
+//
+// Portable; besides TileBaker.vcxproj it builds with DirectXMath on the include path and
+//   R=../DirectX12_Renderer; g++ -std=c++14 -O2 -pthread -I$R TileBaker.cpp $R/{AssetLoader,BlockCompressor,Camera,GeometryGenerator,
+//       Heightmap,HeightPyramid,HorizonMap,MeshCache,MeshChunker,MeshletBuilder,MeshOptimizer,MeshRegistry,MipChain,NormalMap,SkyRay,
+//       StagingRing,StarCatalog,TerrainCulling,TerrainDisplacement,TerrainHeightField,TerrainQuadtree,TextureFootprint,TiffCodec,
+//       TiffReader,TileArchive,TilePyramid,VertexPacking,VirtualTexture}.cpp
+
+#include "AssetLoader.h"
+#include "BlockCompressor.h"
+#include "Camera.h"
+#include "GeometryGenerator.h"
+#include "Heightmap.h"
+#include "HeightPyramid.h"
+#include "HorizonMap.h"
+#include "MeshCache.h"
+#include "MeshChunker.h"
+#include "MeshletBuilder.h"
+#include "MeshOptimizer.h"
+#include "MeshRegistry.h"
+#include "MipChain.h"
+#include "NormalMap.h"
+#include "Parallel.h"
+#include "SkyRay.h"
+#include "StagingRing.h"
+#include "StarCatalog.h"
+#include "TerrainDisplacement.h"
+#include "TerrainHeightField.h"
+#include "TerrainQuadtree.h"
+#include "TextureFootprint.h"
+#include "TiffCodec.h"
+#include "TiffReader.h"
+#include "TileArchive.h"
+#include "VertexPacking.h"
+#include "VirtualTexture.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+using namespace std::chrono;
+
+namespace
+{
+	struct MapSource
+	{
+		std::string name;
+		std::string path;
+		bool heights;
+	};
+
+	double Seconds(steady_clock::time_point start)
+	{
+		return duration<double>(steady_clock::now() - start).count();
+	}
+
+	double Megabytes(uint64_t bytes)
+	{
+		return bytes / (1024.0 * 1024.0);
+	}
+
+	// Heights become 0..65535 over their own range as in Terrain; any other map becomes RGBA8,
+	// gray spread over RGB and alpha filled in where the file has none.
+	bool ReadMap(const MapSource& source, std::vector<uint8_t>& texels, uint32_t& width, uint32_t& height)
+	{
+		TiffReader reader;
+		if (!reader.Open(source.path))
+		{
+			printf("%s: not a TIFF this baker reads\n", source.path.c_str());
+			return false;
+		}
+		const TiffInfo& info = reader.GetInfo();
+		std::vector<uint8_t> rows(reader.GetRowBytes() * info.height);
+		if (!reader.ReadRows(rows.data(), reader.GetRowBytes()))
+		{
+			printf("%s: truncated\n", source.path.c_str());
+			return false;
+		}
+		width = info.width;
+		height = info.height;
+
+		const size_t texelCount = (size_t)width * height;
+		if (source.heights)
+		{
+			// Signed heights keep their order as unsigned ones with the sign bit, in the last byte of
+			// a little endian sample, flipped.
+			if (info.signedSamples && info.samplesPerPixel == 1 && info.bitsPerSample <= 16)
+			{
+				const uint32_t sampleBytes = info.bitsPerSample / 8;
+				for (size_t i = sampleBytes - 1; i < rows.size(); i += sampleBytes)
+				{
+					rows[i] ^= 0x80;
+				}
+			}
+			HeightmapFormat format;
+			if (info.samplesPerPixel == 1 && info.bitsPerSample == 8)
+			{
+				format = HeightmapFormat::R8_UNORM;
+			}
+			else if (info.samplesPerPixel == 1 && info.bitsPerSample == 16)
+			{
+				format = HeightmapFormat::R16_UNORM;
+			}
+			else if (info.samplesPerPixel == 1 && info.floatSamples)
+			{
+				format = HeightmapFormat::R32_FLOAT;
+			}
+			else
+			{
+				printf("%s: heights must be one 8-bit, 16-bit or float sample per texel\n", source.path.c_str());
+				return false;
+			}
+
+			std::vector<uint16_t> heights;
+			Heightmap::Range range;
+			Heightmap::Decode(rows.data(), reader.GetRowBytes(), width, height, format, heights, range);
+			texels.resize(texelCount * sizeof(uint16_t));
+			memcpy(texels.data(), heights.data(), texels.size());
+			return true;
+		}
+
+		if (info.floatSamples || info.bitsPerSample == 32 || info.samplesPerPixel == 2)
+		{
+			printf("%s: colors must be gray, RGB or RGBA of 8 or 16 bits\n", source.path.c_str());
+			return false;
+		}
+		const uint32_t samples = info.samplesPerPixel;
+		const uint32_t sampleBytes = info.bitsPerSample / 8;
+		texels.resize(texelCount * 4);
+		ParallelFor(height, [&](uint32_t begin, uint32_t end)
+		{
+			for (size_t i = (size_t)begin * width; i < (size_t)end * width; ++i)
+			{
+				uint8_t rgba[4] = { 0, 0, 0, 255 };
+				for (uint32_t c = 0; c < samples; ++c)
+				{
+					// The high byte of 16-bit samples, which are in native order.
+					uint16_t sample = sampleBytes == 2 ? reinterpret_cast<const uint16_t*>(rows.data())[i * samples + c] : rows[i * samples + c];
+					rgba[c] = (uint8_t)(sampleBytes == 2 ? sample >> 8 : sample);
+				}
+				if (samples == 1)
+				{
+					rgba[1] = rgba[2] = rgba[0];
+				}
+				memcpy(&texels[i * 4], rgba, 4);
+			}
+		});
+		return true;
+	}
+
+	int Bake(const std::string& path, const std::vector<MapSource>& sources, bool compress)
+	{
+		auto start = steady_clock::now();
+		TileArchiveWriter writer;
+		if (!writer.Create(path))
+		{
+			printf("%s: cannot be written\n", path.c_str());
+			return 1;
+		}
+		for (const MapSource& source : sources)
+		{
+			auto mapStart = steady_clock::now();
+			std::vector<uint8_t> texels;
+			uint32_t width, height;
+			if (!ReadMap(source, texels, width, height))
+			{
+				return 1;
+			}
+			double readSeconds = Seconds(mapStart);
+
+			auto bakeStart = steady_clock::now();
+			uint64_t tileBytes = writer.GetTileBytes();
+			TileFormat format = source.heights ? TileFormat::R16_UNORM : TileFormat::R8G8B8A8_UNORM;
+			if (!writer.AddMap(source.name.c_str(), texels.data(), width, height, format, compress))
+			{
+				printf("%s: failed to write the tiles of %s\n", path.c_str(), source.name.c_str());
+				return 1;
+			}
+			double bakeSeconds = Seconds(bakeStart);
+			printf("%s: %ux%u from %s, read in %.2f s, %.1f MB of tiles baked in %.2f s (%.0f MB/s)\n",
+				source.name.c_str(), width, height, source.path.c_str(), readSeconds, Megabytes(writer.GetTileBytes() - tileBytes),
+				bakeSeconds, Megabytes(texels.size()) / bakeSeconds);
+		}
+		if (!writer.Finish())
+		{
+			printf("%s: failed to write the tables\n", path.c_str());
+			return 1;
+		}
+
+		TileArchive archive;
+		if (!archive.Open(path))
+		{
+			printf("%s: does not open after baking\n", path.c_str());
+			return 1;
+		}
+		printf("%s: %u maps, %.1f MB, tiles at %.1f%% of their texels, in %.2f s\n", path.c_str(), archive.GetMapCount(),
+			Megabytes(archive.GetFileBytes()), 100.0 * writer.GetTileBytes() / writer.GetTileTexelBytes(), Seconds(start));
+		return 0;
+	}
+
+	// A color map and its mip chain, filtered as Terrain filters them by default, block compressed
+	// into a DDS that Terrain uploads instead of encoding the map itself.
+	int BakeDds(const std::string& path, const MapSource& source, BlockFormat format)
+	{
+		auto start = steady_clock::now();
+		std::vector<uint8_t> texels;
+		uint32_t width, height;
+		if (!ReadMap(source, texels, width, height))
+		{
+			return 1;
+		}
+		if (width % 4 != 0 || height % 4 != 0)
+		{
+			printf("%s: %ux%u is not a whole number of 4x4 blocks\n", source.path.c_str(), width, height);
+			return 1;
+		}
+		double readSeconds = Seconds(start);
+
+		auto mipStart = steady_clock::now();
+		std::vector<MipChain::Level> mips;
+		MipChain::Generate(texels.data(), width * 4, width, height, MipFormat::R8G8B8A8_SRGB, MipFilter::KAISER, MipChain::LevelCount(width, height), mips);
+		double mipSeconds = Seconds(mipStart);
+
+		auto blockStart = steady_clock::now();
+		std::vector<std::vector<uint8_t>> levels(mips.size() + 1);
+		BlockCompressor::Encode(texels.data(), width * 4, width, height, MipFormat::R8G8B8A8_UNORM, format, levels[0]);
+		uint64_t blocks = levels[0].size() / BlockCompressor::BlockBytes(format);
+		for (size_t level = 0; level < mips.size(); ++level)
+		{
+			BlockCompressor::Encode(mips[level].texels.data(), mips[level].width * 4, mips[level].width, mips[level].height, MipFormat::R8G8B8A8_UNORM,
+				format, levels[level + 1]);
+			blocks += levels[level + 1].size() / BlockCompressor::BlockBytes(format);
+		}
+		double blockSeconds = Seconds(blockStart);
+
+		if (!BlockCompressor::WriteDds(path, format, width, height, levels))
+		{
+			printf("%s: cannot be written\n", path.c_str());
+			return 1;
+		}
+		printf("%s: %ux%u from %s in %s, read in %.2f s, %zu mips in %.2f s, %.0f blocks in %.2f s (%.2f Mblocks/s), %.1f dB PSNR\n",
+			path.c_str(), width, height, source.path.c_str(), format == BlockFormat::BC1 ? "BC1" : "BC7", readSeconds, mips.size(), mipSeconds,
+			(double)blocks, blockSeconds, blocks / blockSeconds / 1e6,
+			BlockCompressor::Psnr(texels.data(), width * 4, width, height, MipFormat::R8G8B8A8_UNORM, format, levels[0]));
+		return 0;
+	}
+
+	// Decodes every tile of every map, on this thread or split by tile over all cores. Returns
+	// the texel bytes read.
+	uint64_t ReadAll(const TileArchive& archive, bool parallel)
+	{
+		std::atomic<uint64_t> bytes(0);
+		for (uint32_t map = 0; map < archive.GetMapCount(); ++map)
+		{
+			const size_t tileBytes = TilePyramid::TileBytes(archive.GetMap(map).format);
+			for (uint32_t level = 0; level < archive.GetLevels(map).size(); ++level)
+			{
+				const TilePyramid::Level& layout = archive.GetLevels(map)[level];
+				auto read = [&](uint32_t begin, uint32_t end)
+				{
+					std::vector<uint8_t> texels(tileBytes);
+					uint64_t read = 0;
+					for (uint32_t tile = begin; tile < end; ++tile)
+					{
+						if (archive.ReadTile(map, level, tile % layout.tilesX, tile / layout.tilesX, texels.data()))
+						{
+							read += tileBytes;
+						}
+					}
+					bytes += read;
+				};
+				const uint32_t tiles = layout.tilesX * layout.tilesY;
+				if (parallel)
+				{
+					ParallelFor(tiles, read);
+				}
+				else
+				{
+					read(0, tiles);
+				}
+			}
+		}
+		return bytes;
+	}
+
+	// Tile traffic of the quadtree selection along three scripted flights of 300 frames over the
+	// height map of an archive, streamed as Terrain streams it with TERRAIN_VIRTUAL_TEXTURE: 16 x 16
+	// patches LOD ranged at twice their size, whose tiles go through a cache of 16 x 16 slots
+	// taking 16 uploads a frame. The quadtree is bounded by heights, which the map was baked from.
+	void FlyOver(const TileArchive& archive, uint32_t map, const HeightPyramid& heights, float radius, float heightScale)
+	{
+		const uint32_t patchGrid = 16;
+		const uint32_t frames = 300;
+
+		// Deepest level at which a tessellated leaf quad is still larger than a texel, as in
+		// Terrain::CreatePatchGrid.
+		const float texel = XM_2PI * radius / (float)archive.GetLevels(map)[0].width;
+		const float rootQuad = radius * XM_PIDIV2 / (float)patchGrid / 9.0f;
+		uint32_t maxLevel = 0;
+		while (maxLevel < 12 && rootQuad / (float)(1u << (maxLevel + 1)) >= texel)
+		{
+			++maxLevel;
+		}
+		TerrainQuadtree::Settings settings;
+		settings.radius = radius;
+		settings.maxDisplacement = heightScale * 65535.0f;
+		settings.maxLevel = maxLevel;
+		settings.gridSize = patchGrid;
+		settings.lodDistanceRatio = 2.0f;
+		settings.morphStartRatio = 0.66f;
+		TerrainQuadtree quadtree(settings);
+		quadtree.BuildBounds([&heights, heightScale](float thetaMin, float thetaMax, float phiMin, float phiMax, float& minHeight, float& maxHeight)
+		{
+			uint16_t lowest, highest;
+			heights.Query(thetaMin, thetaMax, phiMin, phiMax, lowest, highest);
+			minHeight = lowest * heightScale;
+			maxHeight = highest * heightScale;
+		});
+
+		// Same projection as Camera.
+		const XMMATRIX proj = XMMatrixPerspectiveFovLH(XMConvertToRadians(45.0f), 16.0f / 9.0f, 0.1f, 100000.0f);
+		const char* names[3] = { "descent", "low orbit", "polar pass" };
+		std::vector<SelectedPatch> selection;
+		std::vector<TileKey> wanted;
+		std::vector<VirtualTexture::Upload> uploads;
+		for (uint32_t flight = 0; flight < 3; ++flight)
+		{
+			VirtualTexture texture;
+			texture.Open(archive, map, 16);
+			auto start = steady_clock::now();
+			for (uint32_t frame = 0; frame < frames; ++frame)
+			{
+				const float t = (float)frame / (frames - 1);
+				XMVECTOR eye, look, up;
+				if (flight == 0)
+				{
+					// Straight down from 6000 above the surface to 20, slowing down exponentially.
+					eye = XMVectorSet(0.0f, 0.0f, radius + 6000.0f * powf(20.0f / 6000.0f, t), 0.0f);
+					look = XMVectorSet(0.0f, 0.0f, -1.0f, 0.0f);
+					up = XMVectorSet(0.0f, 1.0f, 0.0f, 0.0f);
+				}
+				else
+				{
+					// A quarter of an equatorial orbit 30 above the surface, or a meridian from 60 degrees
+					// south to 60 north 100 above it, looking ahead and down.
+					float angle = flight == 1 ? t * XM_PIDIV2 : XMConvertToRadians(-60.0f + 120.0f * t);
+					float tilt = flight == 1 ? 0.35f : XMConvertToRadians(20.0f);
+					XMVECTOR out = flight == 1 ? XMVectorSet(cosf(angle), 0.0f, sinf(angle), 0.0f) : XMVectorSet(cosf(angle), sinf(angle), 0.0f, 0.0f);
+					XMVECTOR ahead = flight == 1 ? XMVectorSet(-sinf(angle), 0.0f, cosf(angle), 0.0f) : XMVectorSet(-sinf(angle), cosf(angle), 0.0f, 0.0f);
+					eye = out * (radius + (flight == 1 ? 30.0f : 100.0f));
+					look = XMVector3Normalize(ahead * cosf(tilt) - out * sinf(tilt));
+					up = out;
+				}
+
+				XMFLOAT4X4 viewproj;
+				XMStoreFloat4x4(&viewproj, XMMatrixTranspose(XMMatrixLookToLH(eye, look, up) * proj));
+				XMFLOAT3 eyePosition;
+				XMStoreFloat3(&eyePosition, eye);
+				TerrainCulling::View view = TerrainCulling::MakeView(viewproj, eyePosition, quadtree.OccluderRadius());
+				quadtree.Select(eyePosition, selection, nullptr, &view);
+
+				// Each patch at the size of its tessellated quads, as Terrain's AddSelectionFootprint.
+				wanted.clear();
+				for (const SelectedPatch& patch : selection)
+				{
+					float thetaMin, thetaMax, phiMin, phiMax;
+					TerrainQuadtree::NodeAngularBounds(patch.face, patch.level, patch.x, patch.y, thetaMin, thetaMax, phiMin, phiMax);
+					texture.AddFootprint(thetaMin, thetaMax, phiMin, phiMax, XM_PIDIV2 / ((float)(1u << patch.level) * patchGrid * 9.0f), wanted);
+				}
+				texture.Update(wanted, 16, uploads);
+				texture.WaitForLoads();
+			}
+			const double frameMs = duration<double, std::milli>(steady_clock::now() - start).count() / frames;
+
+			const VirtualTexture::Statistics& stats = texture.GetStatistics();
+			printf("flight, %s: %u levels, %.1f tiles wanted per frame, %.1f%% resident, %.2f loads and %.2f evictions per frame, %.3f ms per frame\n",
+				names[flight], maxLevel + 1, (double)stats.wanted / frames, stats.wanted ? 100.0 * stats.resident / stats.wanted : 100.0,
+				(double)stats.loaded / frames, (double)stats.evicted / frames, frameMs);
+		}
+	}
+
+	// Meshlets of the level 5 geosphere the terrain and the sky draw, in chunks of 2048 vertices as
+	// GeometryCache makes them with TERRAIN_MESHLETS, culled from 12 scripted views 2000 from the
+	// center: as the moon, and as the sky seen from inside, which the moon hides.
+	void CullMeshlets()
+	{
+		const float radius = 1737.0f;
+		GeometryGenerator::MeshData mesh;
+		GeometryGenerator::CreateGeosphere(1.0f, 5, mesh);
+		std::vector<XMFLOAT3> positions(mesh.Vertices.size());
+		for (size_t i = 0; i < positions.size(); ++i)
+		{
+			positions[i] = mesh.Vertices[i].Position;
+		}
+		MeshChunker::ChunkedMesh chunked;
+		MeshChunker::Build(positions, mesh.Indices32, 2048, chunked);
+		positions = MeshChunker::GatherVertices(positions, chunked);
+		const std::vector<uint32_t> indices = MeshChunker::ExpandIndices(chunked);
+
+		auto buildStart = steady_clock::now();
+		MeshletBuilder::MeshletMesh meshlets;
+		MeshletBuilder::Build(positions, indices, meshlets);
+		double buildSeconds = Seconds(buildStart);
+		printf("meshlets: %zu of %.1f vertices and %.1f triangles on average, %.1f KB, built in %.1f ms\n", meshlets.Meshlets.size(),
+			(double)meshlets.VertexIndices.size() / meshlets.Meshlets.size(), (double)meshlets.Triangles.size() / meshlets.Meshlets.size(),
+			meshlets.Bytes() / 1024.0, buildSeconds * 1000.0);
+
+		// The flat triangles dip below the sphere by far less than 1% of the radius; seen from
+		// inside, no sky meshlet faces away.
+		struct CullCase
+		{
+			const char* name;
+			float scale;
+		};
+		const CullCase cases[2] = { { "terrain", radius }, { "sky", -20000.0f } };
+		const uint32_t views = 12;
+		for (const CullCase& cull : cases)
+		{
+			auto cullStart = steady_clock::now();
+			const MeshletBuilder::CullStatistics culled = MeshletBuilder::CullScriptedViews(meshlets, cull.scale, 2000.0f, radius * 0.99f, views);
+			double cullSeconds = Seconds(cullStart);
+			printf("meshlets, %s: %u views cull %.1f%% by frustum and horizon, %.1f%% by normal cone, %.3f ms per view\n", cull.name, views,
+				100.0 * culled.frustumCulled / culled.meshlets, 100.0 * culled.coneCulled / culled.meshlets, cullSeconds * 1000.0 / views);
+		}
+	}
+
+	// Meshlets of the packed geospheres up to the terrain's, read back as GeometryCache::BuildMeshlets
+	// reads them from the upload-ready mesh, and of a bumpy grid whose cones are far from one axis.
+	bool ValidateMeshlets()
+	{
+		GeometryGenerator::MeshData geosphere;
+		for (uint32_t level = 0; level <= 5; ++level)
+		{
+			GeometryGenerator::CreateGeosphere(1.0f, level, geosphere);
+			std::vector<XMFLOAT3> positions(geosphere.Vertices.size());
+			for (size_t i = 0; i < positions.size(); ++i)
+			{
+				positions[i] = geosphere.Vertices[i].Position;
+			}
+			MeshChunker::ChunkedMesh chunked;
+			MeshChunker::Build(positions, geosphere.Indices32, 2048, chunked);
+			std::vector<PackedVertex> packed;
+			XMFLOAT3 origin;
+			float scale;
+			VertexPacking::PackVertices(MeshChunker::GatherVertices(geosphere.Vertices, chunked), packed, origin, scale);
+			MeshBlob blob = MeshCache::MakeBlob(packed.data(), sizeof(PackedVertex), packed.size(), chunked);
+			blob.meshOrigin = origin;
+			blob.meshScale = scale;
+
+			std::vector<uint32_t> indices;
+			MeshletBuilder::GetGeometry(blob, positions, indices);
+			MeshletBuilder::MeshletMesh meshlets;
+			MeshletBuilder::Build(positions, indices, meshlets);
+			if (!MeshletBuilder::Validate(meshlets, positions, indices))
+			{
+				return false;
+			}
+		}
+
+		const uint32_t size = 64;
+		std::vector<XMFLOAT3> positions;
+		std::vector<uint32_t> indices;
+		for (uint32_t y = 0; y <= size; ++y)
+		{
+			for (uint32_t x = 0; x <= size; ++x)
+			{
+				positions.push_back(XMFLOAT3((float)x, 4.0f * sinf(x * 0.3f) * cosf(y * 0.2f), (float)y));
+				if (x < size && y < size)
+				{
+					const uint32_t v = y * (size + 1) + x;
+					const uint32_t quad[6] = { v, v + size + 1, v + 1, v + 1, v + size + 1, v + size + 2 };
+					indices.insert(indices.end(), quad, quad + 6);
+				}
+			}
+		}
+		MeshletBuilder::MeshletMesh meshlets;
+		MeshletBuilder::Build(positions, indices, meshlets);
+		return MeshletBuilder::Validate(meshlets, positions, indices);
+	}
+
+	// Bakes a synthetic 8192x4096 height map and color map with and without compression, reads
+	// every tile back, writes the heights as TIFF files and reads them back, generates the mip
+	// chains of both maps and block compresses them, generates the normal map of the heights, times
+	// height queries over them, streams the archived heights along flights of the quadtree, times
+	// the geosphere of every level and loading it from the mesh cache, and culls the meshlets of the
+	// one the terrain draws.
+	int Benchmark()
+	{
+		const uint32_t width = 8192;
+		const uint32_t height = 4096;
+		std::vector<uint16_t> heights((size_t)width * height);
+		std::vector<uint8_t> colors((size_t)width * height * 4);
+		ParallelFor(height, [&](uint32_t begin, uint32_t end)
+		{
+			for (uint32_t y = begin; y < end; ++y)
+			{
+				for (uint32_t x = 0; x < width; ++x)
+				{
+					// Rolling terrain with a little hashed noise, shaded gray as the lunar maps are.
+					const size_t i = (size_t)y * width + x;
+					uint32_t noise = (uint32_t)(i * 2654435761u) >> 28;
+					float terrain = 0.5f + 0.25f * sinf(x * 0.0031f) * cosf(y * 0.0047f) + 0.04f * sinf((x + 2 * y) * 0.011f);
+					heights[i] = (uint16_t)(20000.0f + terrain * 20000.0f + noise);
+					uint8_t gray = (uint8_t)(terrain * 200.0f + (noise >> 1));
+					colors[i * 4 + 0] = gray;
+					colors[i * 4 + 1] = gray;
+					colors[i * 4 + 2] = (uint8_t)(gray - (gray >> 4));
+					colors[i * 4 + 3] = 255;
+				}
+			}
+		});
+
+		const std::string path = "TileBakerBenchmark.vtar";
+		const uint64_t texelBytes = heights.size() * sizeof(uint16_t) + colors.size();
+		for (int compress = 0; compress < 2; ++compress)
+		{
+			auto bakeStart = steady_clock::now();
+			TileArchiveWriter writer;
+			bool baked = writer.Create(path) &&
+				writer.AddMap("height", heights.data(), width, height, TileFormat::R16_UNORM, compress != 0) &&
+				writer.AddMap("color", colors.data(), width, height, TileFormat::R8G8B8A8_UNORM, compress != 0) &&
+				writer.Finish();
+			double bakeSeconds = Seconds(bakeStart);
+
+			TileArchive archive;
+			if (!baked || !archive.Open(path))
+			{
+				printf("benchmark archive failed to bake\n");
+				return 1;
+			}
+
+			auto readStart = steady_clock::now();
+			uint64_t readBytes = ReadAll(archive, false);
+			double readSeconds = Seconds(readStart);
+			auto parallelStart = steady_clock::now();
+			uint64_t parallelBytes = ReadAll(archive, true);
+			double parallelSeconds = Seconds(parallelStart);
+
+			printf("%s: baked %.0f MB of texels at %.0f MB/s into %.1f MB (%.2f:1); read %.0f MB of tiles at %.0f MB/s, %.0f MB/s on %u threads\n",
+				compress ? "delta" : "raw", Megabytes(texelBytes), Megabytes(texelBytes) / bakeSeconds, Megabytes(archive.GetFileBytes()),
+				(double)writer.GetTileTexelBytes() / writer.GetTileBytes(), Megabytes(readBytes), Megabytes(readBytes) / readSeconds,
+				Megabytes(parallelBytes) / parallelSeconds, std::max(1u, std::thread::hardware_concurrency()));
+		}
+
+		// The height map as TIFF files the way elevation models come, read back on one thread and
+		// on every core.
+		struct TiffCase
+		{
+			const char* name;
+			TiffCompression compression;
+			uint32_t predictor;
+			uint32_t tileSize;		// 0 for strips of 16 rows
+		};
+		const TiffCase tiffCases[4] = {
+			{ "strips", TiffCompression::NONE, 1, 0 },
+			{ "LZW strips", TiffCompression::LZW, 2, 0 },
+			{ "Deflate strips", TiffCompression::DEFLATE, 2, 0 },
+			{ "Deflate tiles", TiffCompression::DEFLATE, 2, 256 } };
+		const std::string tiffPath = "TileBakerBenchmark.tif";
+		const uint64_t heightBytes = heights.size() * sizeof(uint16_t);
+		std::vector<uint8_t> rows(heightBytes);
+		for (const TiffCase& tiff : tiffCases)
+		{
+			TiffInfo info = {};
+			info.width = width;
+			info.height = height;
+			info.samplesPerPixel = 1;
+			info.bitsPerSample = 16;
+			info.compression = tiff.compression;
+			info.predictor = tiff.predictor;
+			info.tileWidth = tiff.tileSize;
+			info.tileHeight = tiff.tileSize != 0 ? tiff.tileSize : 16;
+			auto writeStart = steady_clock::now();
+			if (!TiffWriter::Write(tiffPath, info, reinterpret_cast<const uint8_t*>(heights.data()), false))
+			{
+				printf("benchmark TIFF failed to write\n");
+				return 1;
+			}
+			double writeSeconds = Seconds(writeStart);
+			const uint64_t fileBytes = (uint64_t)std::ifstream(tiffPath, std::ios::binary | std::ios::ate).tellg();
+
+			double readSeconds[2];
+			bool read = true;
+			for (int parallel = 0; parallel < 2; ++parallel)
+			{
+				std::fill(rows.begin(), rows.end(), (uint8_t)0);
+				auto readStart = steady_clock::now();
+				TiffReader reader;
+				reader.SetThreads(parallel ? 0 : 1);
+				read = read && reader.Open(tiffPath) && reader.ReadRows(rows.data(), width * sizeof(uint16_t)) &&
+					memcmp(rows.data(), heights.data(), rows.size()) == 0;
+				readSeconds[parallel] = Seconds(readStart);
+			}
+			if (!read)
+			{
+				printf("benchmark TIFF does not read back\n");
+				return 1;
+			}
+			printf("tiff, %s: %.0f MB written in %.2f s into %.1f MB (%.2f:1); decoded at %.0f MB/s, %.0f MB/s on %u threads\n", tiff.name,
+				Megabytes(heightBytes), writeSeconds, Megabytes(fileBytes), (double)heightBytes / fileBytes, Megabytes(heightBytes) / readSeconds[0],
+				Megabytes(heightBytes) / readSeconds[1], std::max(1u, std::thread::hardware_concurrency()));
+		}
+		std::remove(tiffPath.c_str());
+
+		// Full mip chains of the same maps, as Terrain uploads them.
+		struct MipCase
+		{
+			const char* name;
+			const void* texels;
+			MipFormat format;
+			MipFilter filter;
+		};
+		const MipCase cases[4] = {
+			{ "height box", heights.data(), MipFormat::R16_UNORM, MipFilter::BOX },
+			{ "height kaiser", heights.data(), MipFormat::R16_UNORM, MipFilter::KAISER },
+			{ "color box", colors.data(), MipFormat::R8G8B8A8_SRGB, MipFilter::BOX },
+			{ "color kaiser", colors.data(), MipFormat::R8G8B8A8_SRGB, MipFilter::KAISER } };
+		std::vector<MipChain::Level> levels;
+		for (const MipCase& mip : cases)
+		{
+			auto mipStart = steady_clock::now();
+			const size_t texelBytes = MipChain::TexelBytes(mip.format);
+			MipChain::Generate(mip.texels, width * texelBytes, width, height, mip.format, mip.filter, MipChain::LevelCount(width, height), levels);
+			double mipSeconds = Seconds(mipStart);
+			printf("mips, %s: %zu levels of %.0f MB in %.0f ms (%.0f MB/s)\n", mip.name, levels.size() + 1,
+				Megabytes((uint64_t)width * height * texelBytes), mipSeconds * 1000.0, Megabytes((uint64_t)width * height * texelBytes) / mipSeconds);
+		}
+
+		// Level 0 of the same maps block compressed; BC5 takes the red and green of the color map
+		// as it would a normal map's.
+		struct BlockCase
+		{
+			const char* name;
+			const void* texels;
+			MipFormat source;
+			BlockFormat format;
+		};
+		const BlockCase blockCases[4] = {
+			{ "height BC4", heights.data(), MipFormat::R16_UNORM, BlockFormat::BC4 },
+			{ "color BC5", colors.data(), MipFormat::R8G8B8A8_UNORM, BlockFormat::BC5 },
+			{ "color BC1", colors.data(), MipFormat::R8G8B8A8_UNORM, BlockFormat::BC1 },
+			{ "color BC7", colors.data(), MipFormat::R8G8B8A8_UNORM, BlockFormat::BC7 } };
+		std::vector<uint8_t> blocks;
+		for (const BlockCase& block : blockCases)
+		{
+			auto blockStart = steady_clock::now();
+			const size_t rowPitch = width * MipChain::TexelBytes(block.source);
+			BlockCompressor::Encode(block.texels, rowPitch, width, height, block.source, block.format, blocks);
+			double blockSeconds = Seconds(blockStart);
+			const double count = (double)blocks.size() / BlockCompressor::BlockBytes(block.format);
+			printf("blocks, %s: %.0f blocks in %.0f ms (%.2f Mblocks/s on %u threads), %.1f dB PSNR\n", block.name, count, blockSeconds * 1000.0,
+				count / blockSeconds / 1e6, std::max(1u, std::thread::hardware_concurrency()),
+				BlockCompressor::Psnr(block.texels, rowPitch, width, height, block.source, block.format, blocks));
+		}
+
+		// Normals of the heights on the moon's sphere at the scale Terrain gives them, one texel at
+		// a time and then across threads with SSE.
+		const float heightScale = TerrainHeightField::HeightScale(height);
+		std::vector<uint8_t> scalarNormals((size_t)width * height * 4);
+		std::vector<uint8_t> normals((size_t)width * height * 4);
+		auto normalStart = steady_clock::now();
+		NormalMap::GenerateScalar(heights.data(), width, height, 1737.0f, heightScale, scalarNormals.data());
+		double scalarSeconds = Seconds(normalStart);
+		normalStart = steady_clock::now();
+		NormalMap::Generate(heights.data(), width, height, 1737.0f, heightScale, normals.data());
+		double normalSeconds = Seconds(normalStart);
+		size_t differing = 0;
+		for (size_t i = 0; i < normals.size(); ++i)
+		{
+			differing += normals[i] != scalarNormals[i] ? 1 : 0;
+		}
+		printf("normals: scalar %.0f ms (%.0f Mtexels/s), SSE on %u threads %.0f ms (%.0f Mtexels/s), %zu bytes differ\n", scalarSeconds * 1000.0,
+			(double)width * height / scalarSeconds / 1e6, std::max(1u, std::thread::hardware_concurrency()), normalSeconds * 1000.0,
+			(double)width * height / normalSeconds / 1e6, differing);
+
+		// Heights under random points of the same map, as the camera queries them.
+		HeightPyramid pyramid;
+		pyramid.Build(heights, width, height);
+		TerrainHeightField field;
+		field.Bind(&pyramid, 1737.0f, heightScale);
+		const TerrainHeightField::Throughput throughput = field.Measure(1 << 20);
+		printf("height queries: %.1f M/s one at a time, %.1f M/s batched, %.1f M/s surface points\n",
+			throughput.scalar / 1e6, throughput.batched / 1e6, throughput.surface / 1e6);
+
+		// The static terrain's level 8 geosphere displaced over the same heights, one vertex at a
+		// time and then across threads with SSE.
+		GeometryGenerator::MeshData displaced;
+		GeometryGenerator::CreateGeosphere(1737.0f, 8, displaced);
+		std::vector<Vertex> scalarDisplaced = displaced.Vertices;
+		auto displaceStart = steady_clock::now();
+		TerrainDisplacement::DisplaceScalar(pyramid, 1737.0f, heightScale, scalarDisplaced);
+		double scalarDisplaceSeconds = Seconds(displaceStart);
+		displaceStart = steady_clock::now();
+		TerrainDisplacement::Displace(pyramid, 1737.0f, heightScale, displaced.Vertices);
+		double displaceSeconds = Seconds(displaceStart);
+		const TerrainDisplacement::Comparison comparison = TerrainDisplacement::Compare(displaced.Vertices, scalarDisplaced);
+		printf("displacement: %zu vertices, scalar %.0f ms, SSE on %u threads %.0f ms; max difference %.5f units, %.4f deg\n",
+			displaced.Vertices.size(), scalarDisplaceSeconds * 1000.0, std::max(1u, std::thread::hardware_concurrency()), displaceSeconds * 1000.0,
+			comparison.maxPositionError, comparison.maxNormalErrorDegrees);
+
+		// The quadtree flying over the height map of the compressed archive baked above.
+		TileArchive archive;
+		uint32_t map = 0;
+		if (!archive.Open(path) || !archive.FindMap("height", map))
+		{
+			printf("benchmark archive does not open\n");
+			return 1;
+		}
+		FlyOver(archive, map, pyramid, 1737.0f, heightScale);
+		archive.Close();
+		std::remove(path.c_str());
+
+		// Geospheres of every level up to the static terrain's, welded through the midpoint cache
+		// and expanded as they used to be, and the welded ones reordered for the vertex cache.
+		GeometryGenerator::MeshData geosphere;
+		for (uint32_t level = 0; level <= 8; ++level)
+		{
+			auto weldStart = steady_clock::now();
+			GeometryGenerator::CreateGeosphere(1.0f, level, geosphere);
+			double weldSeconds = Seconds(weldStart);
+			const size_t weldedVertices = geosphere.Vertices.size();
+
+			std::vector<uint32_t> reordered = geosphere.Indices32;
+			auto reorderStart = steady_clock::now();
+			MeshOptimizer::OptimizeVertexCache(reordered, weldedVertices);
+			double reorderSeconds = Seconds(reorderStart);
+			const MeshOptimizer::CacheStatistics before = MeshOptimizer::AnalyzeVertexCache(geosphere.Indices32, weldedVertices);
+			const MeshOptimizer::CacheStatistics after = MeshOptimizer::AnalyzeVertexCache(reordered, weldedVertices);
+			auto expandStart = steady_clock::now();
+			GeometryGenerator::CreateGeosphereExpanded(1.0f, level, geosphere);
+			double expandSeconds = Seconds(expandStart);
+			printf("geosphere %u: %zu triangles, %zu vertices in %.2f ms; expanded, %zu vertices in %.2f ms\n", level, geosphere.Indices32.size() / 3,
+				weldedVertices, weldSeconds * 1000.0, geosphere.Vertices.size(), expandSeconds * 1000.0);
+			printf("vertex cache %u: ACMR %.3f -> %.3f, ATVR %.3f -> %.3f, reordered in %.2f ms\n", level, before.acmr, after.acmr,
+				before.atvr, after.atvr, reorderSeconds * 1000.0);
+		}
+
+		// The terrain's control points packed at the moon's radius, as PACKED_TERRAIN_VERTEX uploads them.
+		for (uint32_t level : { 5u, 8u })
+		{
+			GeometryGenerator::CreateGeosphere(1737.0f, level, geosphere);
+			std::vector<PackedVertex> packed;
+			XMFLOAT3 origin;
+			float scale;
+			VertexPacking::PackingReport packing;
+			auto packStart = steady_clock::now();
+			VertexPacking::PackVertices(geosphere.Vertices, packed, origin, scale, &packing);
+			double packSeconds = Seconds(packStart);
+			printf("packed vertices %u: %zu -> %zu bytes per vertex, %.1f MB -> %.1f MB, max error position %.4f, normal %.4f deg, tangent %.4f deg; "
+				"packed and checked in %.1f ms\n", level, sizeof(Vertex), sizeof(PackedVertex), Megabytes(packing.sourceBytes), Megabytes(packing.packedBytes),
+				packing.maxPositionError, packing.maxNormalErrorDegrees, packing.maxTangentErrorDegrees, packSeconds * 1000.0);
+		}
+
+		// The packed geosphere as GeometryCache::AcquireGeosphere generates it on a cache miss, against
+		// opening its mesh cache and reading every byte once. The file is in the page cache, as it
+		// is from the second run of the renderer on.
+		for (uint32_t level : { 5u, 8u })
+		{
+			auto generateStart = steady_clock::now();
+			GeometryGenerator::CreateGeosphere(1.0f, level, geosphere);
+			std::vector<XMFLOAT3> positions(geosphere.Vertices.size());
+			for (size_t i = 0; i < positions.size(); ++i)
+			{
+				positions[i] = geosphere.Vertices[i].Position;
+			}
+			MeshChunker::ChunkedMesh chunked;
+			MeshChunker::Build(positions, geosphere.Indices32, MeshChunker::MAX_CHUNK_VERTICES, chunked);
+			std::vector<PackedVertex> packed;
+			XMFLOAT3 origin;
+			float scale;
+			VertexPacking::PackVertices(MeshChunker::GatherVertices(geosphere.Vertices, chunked), packed, origin, scale);
+			double generateSeconds = Seconds(generateStart);
+
+			MeshBlob blob = MeshCache::MakeBlob(packed.data(), sizeof(PackedVertex), packed.size(), chunked);
+			blob.meshOrigin = origin;
+			blob.meshScale = scale;
+			const MeshCache::Key key = { "Geosphere", 1.0f, level, MeshChunker::MAX_CHUNK_VERTICES, sizeof(PackedVertex), 0 };
+			const std::wstring cachePath = L"TileBakerBenchmark.meshcache";
+			MeshCache::Write(cachePath, key, blob);
+
+			auto loadStart = steady_clock::now();
+			MeshCache cache;
+			const bool loaded = cache.Open(cachePath, key);
+			const MeshBlob cached = cache.GetMesh();
+			uint32_t checksum = 0;
+			for (const uint8_t* byte = (const uint8_t*)cached.vertices; loaded && byte != (const uint8_t*)cached.vertices + cached.VertexBytes(); ++byte)
+			{
+				checksum = checksum * 31 + *byte;
+			}
+			for (size_t i = 0; loaded && i < cached.indexCount; ++i)
+			{
+				checksum = checksum * 31 + cached.indices[i];
+			}
+			double loadSeconds = Seconds(loadStart);
+			cache.Close();
+			std::remove("TileBakerBenchmark.meshcache");
+			printf("mesh cache %u: %zu chunks, %.1f MB; generated in %.1f ms, %s in %.2f ms (checksum %08x)\n", level, chunked.Chunks.size(),
+				Megabytes(blob.VertexBytes() + blob.IndexBytes()), generateSeconds * 1000.0, loaded ? "loaded" : "NOT loaded", loadSeconds * 1000.0, checksum);
+		}
+
+		CullMeshlets();
+		return 0;
+	}
+
+	// A pyramid over ramps with noise and a cliff, which must bound every run of its texels.
+	bool ValidateHeightPyramid()
+	{
+		const uint32_t width = 512;
+		const uint32_t height = 256;
+		std::vector<uint16_t> heights((size_t)width * height);
+		uint32_t seed = 1;
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				seed = seed * 1664525u + 1013904223u;
+				heights[(size_t)y * width + x] = (uint16_t)((x * 97 + y * 31) % 30000 + (seed >> 20) + (x > width / 3 ? 20000 : 0));
+			}
+		}
+		HeightPyramid pyramid;
+		pyramid.Build(heights, width, height);
+		return pyramid.Validate(1000);
+	}
+
+	// Chunks within their vertex limit drawing exactly the source triangles.
+	bool ValidateChunks(const std::vector<XMFLOAT3>& positions, const std::vector<uint32_t>& indices, uint32_t maxVertices)
+	{
+		MeshChunker::ChunkedMesh chunked;
+		MeshChunker::Build(positions, indices, maxVertices, chunked);
+		for (const MeshChunk& chunk : chunked.Chunks)
+		{
+			if (chunk.vertexCount > maxVertices)
+			{
+				return false;
+			}
+		}
+		return MeshChunker::Validate(chunked, indices, positions.size());
+	}
+
+	// Geospheres of every level in the terrain's chunks, the static terrain's in 16-bit ones, and
+	// a grid cut into hundreds of chunks of 64 vertices.
+	bool ValidateMeshChunker()
+	{
+		GeometryGenerator::MeshData geosphere;
+		std::vector<XMFLOAT3> positions;
+		for (uint32_t level = 0; level <= 8; ++level)
+		{
+			GeometryGenerator::CreateGeosphere(1.0f, level, geosphere);
+			positions.resize(geosphere.Vertices.size());
+			for (size_t i = 0; i < positions.size(); ++i)
+			{
+				positions[i] = geosphere.Vertices[i].Position;
+			}
+			if (!ValidateChunks(positions, geosphere.Indices32, 2048) ||
+				(level == 8 && !ValidateChunks(positions, geosphere.Indices32, MeshChunker::MAX_CHUNK_VERTICES)))
+			{
+				return false;
+			}
+		}
+
+		const uint32_t size = 128;
+		std::vector<uint32_t> indices;
+		positions.clear();
+		for (uint32_t y = 0; y <= size; ++y)
+		{
+			for (uint32_t x = 0; x <= size; ++x)
+			{
+				positions.push_back(XMFLOAT3((float)x, 0.0f, (float)y));
+				if (x < size && y < size)
+				{
+					const uint32_t v = y * (size + 1) + x;
+					const uint32_t quad[6] = { v, v + size + 1, v + 1, v + 1, v + size + 1, v + size + 2 };
+					indices.insert(indices.end(), quad, quad + 6);
+				}
+			}
+		}
+		return ValidateChunks(positions, indices, 64);
+	}
+
+	// The sky rays and star sprites of the renderer's starting camera, turned and moved a few times.
+	bool ValidateSkyViews()
+	{
+		Camera camera(540, 960);
+		for (int i = 0; i < 8; ++i)
+		{
+			const XMFLOAT4 eye = camera.GetEyePosition();
+			const XMFLOAT4X4 viewproj = camera.GetViewProjectionMatrixTransposed();
+			if (!SkyRay::Validate(viewproj, XMFLOAT3(eye.x, eye.y, eye.z)) ||
+				!StarCatalog::ValidateProjection(viewproj, XMFLOAT3(eye.x, eye.y, eye.z)))
+			{
+				return false;
+			}
+			camera.Yaw(50.0f);
+			camera.Pitch(35.0f);
+			camera.Roll(20.0f);
+			camera.Translate(XMFLOAT3(300.0f, -200.0f, 100.0f));
+		}
+		return true;
+	}
+
+	int Validate()
+	{
+		struct Suite
+		{
+			const char* name;
+			bool (*validate)();
+		};
+		const Suite suites[] = {
+			{ "TilePyramid", TilePyramid::Validate },
+			{ "TileArchive", TileArchive::Validate },
+			{ "TiffCodec", TiffCodec::Validate },
+			{ "TiffReader", TiffReader::Validate },
+			{ "Heightmap", Heightmap::Validate },
+			{ "HeightPyramid", ValidateHeightPyramid },
+			{ "MipChain", MipChain::Validate },
+			{ "BlockCompressor", BlockCompressor::Validate },
+			{ "TextureFootprint", TextureFootprint::Validate },
+			{ "NormalMap", NormalMap::Validate },
+			{ "HorizonMap", HorizonMap::Validate },
+			{ "TerrainHeightField", TerrainHeightField::Validate },
+			{ "TerrainDisplacement", TerrainDisplacement::Validate },
+			{ "VirtualTexture", VirtualTexture::Validate },
+			{ "AssetLoader", AssetLoader::Validate },
+			{ "StagingRing", StagingRing::Validate },
+			{ "StarCatalog", StarCatalog::Validate },
+			{ "SkyRay", ValidateSkyViews },
+			{ "GeometryGenerator", GeometryGenerator::Validate },
+			{ "MeshOptimizer", MeshOptimizer::Validate },
+			{ "MeshChunker", ValidateMeshChunker },
+			{ "MeshCache", MeshCache::Validate },
+			{ "MeshletBuilder", ValidateMeshlets },
+			{ "MeshRegistry", MeshRegistry::Validate },
+			{ "VertexPacking", VertexPacking::Validate },
+			{ "TerrainQuadtree", TerrainQuadtree::Validate } };
+		bool valid = true;
+		for (const Suite& suite : suites)
+		{
+			const bool passed = suite.validate();
+			printf("%s %s\n", suite.name, passed ? "passed" : "FAILED");
+			valid = valid && passed;
+		}
+		return valid ? 0 : 1;
+	}
+
+	int Usage()
+	{
+		printf("TileBaker out.vtar (--height name=file.tif | --color name=file.tif)... [--compress]\n"
+			"TileBaker out.dds --color file.tif [--bc1]\n"
+			"TileBaker --validate\n"
+			"TileBaker --benchmark\n");
+		return 1;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	if (argc == 2 && strcmp(argv[1], "--validate") == 0)
+	{
+		return Validate();
+	}
+	if (argc == 2 && strcmp(argv[1], "--benchmark") == 0)
+	{
+		return Benchmark();
+	}
+	if (argc < 2 || argv[1][0] == '-')
+	{
+		return Usage();
+	}
+
+	// One color map in BC7, or BC1.
+	const std::string out = argv[1];
+	if (out.size() > 4 && out.compare(out.size() - 4, 4, ".dds") == 0)
+	{
+		const bool bc1 = argc == 5 && strcmp(argv[4], "--bc1") == 0;
+		if ((argc != 4 && !bc1) || strcmp(argv[2], "--color") != 0)
+		{
+			return Usage();
+		}
+		const MapSource source = { "color", argv[3], false };
+		return BakeDds(out, source, bc1 ? BlockFormat::BC1 : BlockFormat::BC7);
+	}
+
+	std::vector<MapSource> sources;
+	bool compress = false;
+	for (int i = 2; i < argc; ++i)
+	{
+		const bool heights = strcmp(argv[i], "--height") == 0;
+		if (strcmp(argv[i], "--compress") == 0)
+		{
+			compress = true;
+		}
+		else if ((heights || strcmp(argv[i], "--color") == 0) && i + 1 < argc && strchr(argv[i + 1], '='))
+		{
+			// Names are stored in 16 bytes with their terminator.
+			const std::string map = argv[++i];
+			MapSource source = { map.substr(0, map.find('=')), map.substr(map.find('=') + 1), heights };
+			if (source.name.empty() || source.name.size() >= sizeof(TileArchive::MapEntry::name))
+			{
+				return Usage();
+			}
+			sources.push_back(source);
+		}
+		else
+		{
+			return Usage();
+		}
+	}
+	return sources.empty() ? Usage() : Bake(argv[1], sources, compress);
+}